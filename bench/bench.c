@@ -0,0 +1,638 @@
+/**
+ * Microbenchmarks of the core functions of PseudoAsm.
+ *
+ * Every benchmark runs batches of the same operation. The time of a batch
+ * divided by its number of operations is one sample, and a batch is made
+ * long enough to be timed reliably. The results are written to stdout as
+ * JSON: per benchmark the nanoseconds per operation as minimum, mean,
+ * percentiles and maximum of the samples. Runs with another memory backend
+ * or run loop can be compared benchmark by benchmark.
+ *
+ * Build it from the root of the repository with "make pseudoasm-bench".
+ * It uses all sources except the console interface, so it needs no GTK.
+ *
+ * Usage: pseudoasm-bench [--quick] [name...]
+ * Only the benchmarks whose name starts with one of the names are run,
+ * e.g. "memory/read" or "execute". --quick uses fewer batches and sizes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hardware.h"
+#include "errors.h"
+#include "util.h"
+#include "memory.h"
+#include "numberlist.h"
+#include "parser.h"
+#include "processor.h"
+#include "compiler.h"
+
+/** Samples per benchmark */
+#define BATCHES		31
+#define QUICK_BATCHES	11
+/** A batch takes at least this many seconds */
+#define BATCH_SECONDS	0.0005
+/** Random addresses and numbers are taken from a table of this size */
+#define RANDOM_COUNT	4096
+/** Cells of the sparse memory are this far apart on average */
+#define SPARSE_STRIDE	1024
+
+/** Runs count operations of a benchmark */
+typedef void (*BenchFunc)(void *context, unsigned long count);
+
+/** A memory list and the addresses a benchmark reads or writes */
+typedef struct MemBench
+{
+	Memory		*memory;
+	unsigned int	*addresses;
+	unsigned long	next;
+} MemBench;
+
+/** A list of numbers and the numbers a benchmark adds or looks up */
+typedef struct ListBench
+{
+	NumberList	*list;
+	int		*numbers;
+	unsigned long	next;
+	unsigned long	size;
+	unsigned long	added;
+} ListBench;
+
+/** A source file for compile() */
+typedef struct CompileBench
+{
+	FILE		*fp;
+} CompileBench;
+
+static int isQuick = 0;
+static int numBatches = BATCHES;
+static int isFirstResult = 1;
+static char **filters = NULL;
+static int numFilters = 0;
+
+/** Keeps the compiler from removing the benchmarked calls */
+static volatile int sink = 0;
+
+static void benchMemory(void);
+static void benchExecute(void);
+static void benchParse(void);
+static void benchCompile(void);
+static void benchNumberList(void);
+static int shouldRun(const char *name);
+static void measure(const char *name, unsigned long size, unsigned long unitsPerOp,
+	BenchFunc func, void *context);
+static int compareDouble(const void *a, const void *b);
+static unsigned int randomNumber(void);
+static void quiet(char *line);
+static int benchInput(void);
+static void benchOutput(int number);
+
+int main(int argc, char *argv[])
+{
+	int i = 0;
+
+	filters = (char**) malloc(argc * sizeof(char*));
+	if(filters == NULL)
+	{
+		return 1;
+	}
+
+	for(i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "--quick") == 0)
+		{
+			isQuick = 1;
+			numBatches = QUICK_BATCHES;
+		}
+		else
+		{
+			filters[numFilters++] = argv[i];
+		}
+	}
+
+	printf("{\n  \"batches\": %d,\n  \"benchmarks\": [", numBatches);
+
+	benchMemory();
+	benchExecute();
+	benchParse();
+	benchCompile();
+	benchNumberList();
+
+	printf("\n  ]\n}\n");
+	free(filters);
+
+	return 0;
+}
+
+/** Read the next address of a memory benchmark */
+static void readCells(void *context, unsigned long count)
+{
+	MemBench	*bench = (MemBench*) context;
+	unsigned long	i = 0;
+	int		sum = 0;
+
+	for(i = 0; i < count; i++)
+	{
+		sum += readMemCell(&bench->memory, bench->addresses[bench->next]).getal;
+		bench->next = (bench->next + 1) % RANDOM_COUNT;
+	}
+	sink += sum;
+}
+
+/** Write the next address of a memory benchmark */
+static void writeCells(void *context, unsigned long count)
+{
+	MemBench	*bench = (MemBench*) context;
+	unsigned long	i = 0;
+	MemCell		cell;
+
+	for(i = 0; i < count; i++)
+	{
+		cell.getal = (int)i;
+		writeMemCell(&bench->memory, bench->addresses[bench->next], cell);
+		bench->next = (bench->next + 1) % RANDOM_COUNT;
+	}
+}
+
+/** readMemCell and writeMemCell on memory with 'size' cells:
+ *  - sequential: cells 0 up to size, accessed in order,
+ *  - random: the same cells, accessed in random order,
+ *  - sparse: cells about SPARSE_STRIDE apart. Reads are of random
+ *    addresses, so most are uninitialized, writes update random cells. */
+static void benchMemory(void)
+{
+	static const char *patterns[3] = {"sequential", "random", "sparse"};
+	unsigned long	sizes[2] = {1000, 10000};
+	unsigned int	*cells = NULL;
+	MemBench	bench = {NULL, NULL, 0};
+	char		name[64];
+	int		s = 0,
+			p = 0,
+			write = 0;
+
+	if(!shouldRun("memory/"))
+	{
+		return;
+	}
+
+	bench.addresses = (unsigned int*) malloc(RANDOM_COUNT * sizeof(unsigned int));
+	cells = (unsigned int*) malloc(sizes[1] * sizeof(unsigned int));
+	if(bench.addresses == NULL || cells == NULL)
+	{
+		free(bench.addresses);
+		free(cells);
+		return;
+	}
+
+	for(s = 0; s < (isQuick ? 1 : 2); s++)
+	{
+		unsigned long size = sizes[s],
+			      i = 0;
+
+		for(p = 0; p < 3; p++)
+		{
+			MemCell cell = {0};
+
+			// Fill the memory with the cells of the pattern
+			for(i = 0; i < size; i++)
+			{
+				cells[i] = p < 2 ? (unsigned int)i
+					: (unsigned int)(i * SPARSE_STRIDE + randomNumber() % SPARSE_STRIDE);
+				cell.getal = (int)i;
+				writeMemCell(&bench.memory, cells[i], cell);
+			}
+
+			for(write = 0; write < 2; write++)
+			{
+				for(i = 0; i < RANDOM_COUNT; i++)
+				{
+					if(p == 0)
+					{
+						bench.addresses[i] = cells[i % size];
+					}
+					else if(p == 1 || write)
+					{
+						bench.addresses[i] = cells[randomNumber() % size];
+					}
+					else
+					{
+						bench.addresses[i] = randomNumber() % (size * SPARSE_STRIDE);
+					}
+				}
+				bench.next = 0;
+
+				sprintf(name, "memory/%s/%s", write ? "write" : "read", patterns[p]);
+				measure(name, size, 1, write ? writeCells : readCells, &bench);
+			}
+
+			freeMemList(bench.memory);
+			bench.memory = NULL;
+		}
+	}
+
+	free(bench.addresses);
+	free(cells);
+}
+
+/** Execute one instruction, without changing the program counter */
+static void executeOne(void *context, unsigned long count)
+{
+	Instruction	instr = *(Instruction*) context;
+	unsigned long	i = 0;
+
+	for(i = 0; i < count; i++)
+	{
+		sink += executeInstr(instr, 1);
+	}
+}
+
+/** Execute a JSB and the RTS back */
+static void executeCall(void *context, unsigned long count)
+{
+	Instruction	*instr = (Instruction*) context;
+	unsigned long	i = 0;
+
+	for(i = 0; i < count; i++)
+	{
+		sink += executeInstr(instr[0], 1);
+		sink += executeInstr(instr[1], 1);
+	}
+}
+
+/** executeInstr of every opcode and addressing method. Cell 100 holds a
+ *  value, cell 101 points to cell 100. */
+static void benchExecute(void)
+{
+	static const char *instructions[] =
+	{
+		"nop", "lda #7", "lda 100", "lda (101)", "ldb #3", "ldb 100",
+		"sta 102", "sta (101)", "stb 102", "inp", "out",
+		"add", "sub", "mul", "div",
+		"jmp 0", "jsp 0", "jsn 0", "jiz 0", "jof 0", "hlt"
+	};
+	Memory		*memory = NULL;
+	MemCell		cell;
+	Instruction	call[2];
+	ProcInfo	info;
+	char		name[64];
+	unsigned int	i = 0;
+
+	if(!shouldRun("execute/"))
+	{
+		return;
+	}
+
+	cell.getal = 5;
+	writeMemCell(&memory, 100, cell);
+	cell.getal = 100;
+	writeMemCell(&memory, 101, cell);
+	if(InitProcessor(memory, benchInput, benchOutput) != ERR_None)
+	{
+		return;
+	}
+
+	info = getStatus();
+	for(i = 0; i < sizeof(instructions) / sizeof(instructions[0]); i++)
+	{
+		char text[16];
+
+		// The registers stay small and B is never 0, so DIV does not fail
+		info.regA = 1000;
+		info.regB = 3;
+		setStatus(info);
+
+		strcpy(text, instructions[i]);
+		if(parseAsmInstr(text, &cell) != ERR_None)
+		{
+			continue;
+		}
+
+		sprintf(name, "execute/%s", instructions[i]);
+		measure(name, 1, 1, executeOne, &cell.instructie);
+	}
+
+	parseAsmInstr("jsb 0", &cell);
+	call[0] = cell.instructie;
+	parseAsmInstr("rts", &cell);
+	call[1] = cell.instructie;
+	measure("execute/jsb 0+rts", 1, 1, executeCall, call);
+
+	DeInitProcessor();
+}
+
+/** Instructions for the parse benchmarks */
+static const char *sourceLines[16] =
+{
+	"lda #12", "ldb 400", "sta (401)", "stb 402", "add", "sub", "mul", "div",
+	"jmp 10", "jsp 20", "jsn 30", "jiz 40", "jof 50", "jsb 60", "rts", "out"
+};
+
+/** Parse the next instruction of sourceLines */
+static void parseOne(void *context, unsigned long count)
+{
+	unsigned long	i = 0;
+	MemCell		cell;
+	char		text[16];
+
+	(void)context;
+	for(i = 0; i < count; i++)
+	{
+		strcpy(text, sourceLines[i % 16]);
+		sink += parseAsmInstr(text, &cell);
+		sink += cell.getal;
+	}
+}
+
+/** Disassemble the next cell */
+static void formatOne(void *context, unsigned long count)
+{
+	MemCell		*cells = (MemCell*) context;
+	unsigned long	i = 0;
+	char		text[MAXINSTRLEN + 1];
+
+	for(i = 0; i < count; i++)
+	{
+		sink += instToStr(cells[i % 16].instructie, text);
+		sink += text[0];
+	}
+}
+
+/** parseAsmInstr and instToStr of a mix of instructions */
+static void benchParse(void)
+{
+	MemCell		cells[16];
+	unsigned int	i = 0;
+	char		text[16];
+
+	if(shouldRun("parse/"))
+	{
+		measure("parse/parseAsmInstr", 16, 1, parseOne, NULL);
+	}
+
+	if(shouldRun("format/"))
+	{
+		for(i = 0; i < 16; i++)
+		{
+			strcpy(text, sourceLines[i]);
+			parseAsmInstr(text, &cells[i]);
+		}
+		measure("format/instToStr", 16, 1, formatOne, cells);
+	}
+}
+
+/** Compile the whole source file, and free the memory */
+static void compileOne(void *context, unsigned long count)
+{
+	CompileBench	*bench = (CompileBench*) context;
+	unsigned long	i = 0;
+	Memory		*memory = NULL;
+
+	for(i = 0; i < count; i++)
+	{
+		rewind(bench->fp);
+		sink += compile(bench->fp, &memory, quiet);
+		freeMemList(memory);
+		memory = NULL;
+	}
+}
+
+/** compile() of synthetic sources with more and more lines. The time is
+ *  per line, freeing the memory list included. */
+static void benchCompile(void)
+{
+	unsigned long	sizes[3] = {1000, 10000, 100000};
+	CompileBench	bench = {NULL};
+	unsigned long	i = 0;
+	int		s = 0;
+
+	if(!shouldRun("compile/"))
+	{
+		return;
+	}
+
+	for(s = 0; s < (isQuick ? 2 : 3); s++)
+	{
+		bench.fp = tmpfile();
+		if(bench.fp == NULL)
+		{
+			return;
+		}
+
+		for(i = 0; i < sizes[s]; i++)
+		{
+			fprintf(bench.fp, "%s\n", sourceLines[randomNumber() % 16]);
+		}
+
+		measure("compile/lines", sizes[s], sizes[s], compileOne, &bench);
+		fclose(bench.fp);
+	}
+}
+
+/** Add the next number. The list is emptied when it holds 'size' numbers,
+ *  so the time is the average over the lengths up to 'size'. */
+static void addNumbers(void *context, unsigned long count)
+{
+	ListBench	*bench = (ListBench*) context;
+	unsigned long	i = 0;
+
+	for(i = 0; i < count; i++)
+	{
+		sink += addNumber(&bench->list, bench->numbers[bench->next]);
+		bench->next = (bench->next + 1) % RANDOM_COUNT;
+
+		if(++bench->added == bench->size)
+		{
+			freeNumberList(&bench->list);
+			bench->added = 0;
+		}
+	}
+}
+
+/** Look up the next number */
+static void findNumbers(void *context, unsigned long count)
+{
+	ListBench	*bench = (ListBench*) context;
+	unsigned long	i = 0;
+
+	for(i = 0; i < count; i++)
+	{
+		sink += hasNumber(bench->list, bench->numbers[bench->next]);
+		bench->next = (bench->next + 1) % RANDOM_COUNT;
+	}
+}
+
+/** addNumber and hasNumber on long lists. The list of hasNumber holds the
+ *  even numbers, half of the lookups find their number. */
+static void benchNumberList(void)
+{
+	unsigned long	sizes[2] = {1000, 10000};
+	ListBench	bench = {NULL, NULL, 0, 0, 0};
+	unsigned long	i = 0;
+	int		s = 0;
+
+	if(!shouldRun("numberlist/"))
+	{
+		return;
+	}
+
+	bench.numbers = (int*) malloc(RANDOM_COUNT * sizeof(int));
+	if(bench.numbers == NULL)
+	{
+		return;
+	}
+
+	for(s = 0; s < (isQuick ? 1 : 2); s++)
+	{
+		bench.size = sizes[s];
+
+		for(i = 0; i < RANDOM_COUNT; i++)
+		{
+			bench.numbers[i] = (int)(randomNumber() % (2 * bench.size));
+		}
+
+		bench.next = 0;
+		bench.added = 0;
+		measure("numberlist/addNumber", bench.size, 1, addNumbers, &bench);
+		freeNumberList(&bench.list);
+
+		// Added from the end, so every addNumber is at the start of the list
+		for(i = bench.size; i > 0; i--)
+		{
+			addNumber(&bench.list, (int)(2 * (i - 1)));
+		}
+		bench.next = 0;
+		measure("numberlist/hasNumber", bench.size, 1, findNumbers, &bench);
+		freeNumberList(&bench.list);
+	}
+
+	free(bench.numbers);
+}
+
+/** Private function: does a benchmark match one of the names on the command
+ *  line? A group matches when a name starts with it, or it starts with a
+ *  name. */
+static int shouldRun(const char *name)
+{
+	int i = 0;
+
+	if(numFilters == 0)
+	{
+		return 1;
+	}
+
+	for(i = 0; i < numFilters; i++)
+	{
+		size_t length = strlen(filters[i]) < strlen(name) ? strlen(filters[i]) : strlen(name);
+
+		if(strncmp(filters[i], name, length) == 0)
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/** Private function: time the batches of a benchmark and print the result
+ *
+ * @param [in] name		Name of the benchmark
+ * @param [in] size		Number of cells, lines or numbers it works on
+ * @param [in] unitsPerOp	The time is divided by this, e.g. the lines
+ *				of one compile
+ * @param [in] func		Runs the operations
+ * @param [in] context		Passed to func
+ */
+static void measure(const char *name, unsigned long size, unsigned long unitsPerOp,
+	BenchFunc func, void *context)
+{
+	double		*samples = NULL,
+			start = 0,
+			elapsed = 0,
+			sum = 0;
+	unsigned long	count = 1;
+	int		i = 0;
+
+	if(!shouldRun(name))
+	{
+		return;
+	}
+
+	samples = (double*) malloc(numBatches * sizeof(double));
+	if(samples == NULL)
+	{
+		return;
+	}
+
+	// Double the batch until it is long enough, this also warms up
+	do
+	{
+		start = getWallTime();
+		func(context, count);
+		elapsed = getWallTime() - start;
+		if(elapsed < BATCH_SECONDS)
+		{
+			count *= 2;
+		}
+	} while(elapsed < BATCH_SECONDS);
+
+	for(i = 0; i < numBatches; i++)
+	{
+		start = getWallTime();
+		func(context, count);
+		samples[i] = (getWallTime() - start) * 1e9 / ((double)count * unitsPerOp);
+		sum += samples[i];
+	}
+
+	qsort(samples, numBatches, sizeof(double), compareDouble);
+
+	printf("%s\n    {\"name\": \"%s\", \"size\": %lu, \"ops_per_batch\": %lu, "
+		"\"ns_per_op\": {\"min\": %.2f, \"mean\": %.2f, \"p50\": %.2f, "
+		"\"p90\": %.2f, \"p99\": %.2f, \"max\": %.2f}}",
+		isFirstResult ? "" : ",", name, size, count * unitsPerOp,
+		samples[0], sum / numBatches, samples[numBatches / 2],
+		samples[(numBatches * 9) / 10], samples[(numBatches * 99) / 100],
+		samples[numBatches - 1]);
+	fflush(stdout);
+	isFirstResult = 0;
+
+	free(samples);
+}
+
+/** Private function: order samples */
+static int compareDouble(const void *a, const void *b)
+{
+	double	x = *(const double*) a,
+		y = *(const double*) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/** Private function: xorshift, so every run uses the same addresses */
+static unsigned int randomNumber(void)
+{
+	static unsigned int state = 2463534242u;
+
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+
+	return state;
+}
+
+/** Private function: drop the messages of the compiler */
+static void quiet(char *line)
+{
+	(void)line;
+}
+
+/** Private function: input of INP */
+static int benchInput(void)
+{
+	return 1;
+}
+
+/** Private function: output of OUT */
+static void benchOutput(int number)
+{
+	sink += number;
+}
@@ -0,0 +1,445 @@
+/**
+ * Workloads of realistic programs for PseudoAsm.
+ *
+ * Every workload is a program in bench/workloads, with the numbers it reads
+ * in a .in file next to it and the numbers it must write in a .out file.
+ * The harness loads each program as the console does, runs it without the
+ * console and without the trace of memory changes, checks what it wrote
+ * and reports the instructions per second of the fastest run.
+ *
+ * Build it from the root of the repository with "make pseudoasm-workload".
+ * It uses all sources except the console interface, so it needs no GTK.
+ *
+ * Usage: pseudoasm-workload [options] [workload...]
+ * A workload is the name of a program in bench/workloads, or the path of
+ * an .asm file. Without workloads all programs of bench/workloads are run.
+ *   --runs n		run every workload n times, 5 by default
+ *   --no-fast-forward	execute every iteration of counted loops
+ *   --memoize		replay subroutine calls with the same input
+ *   --optimize		optimize the programs when they are loaded
+ *   --trace file	write every executed instruction to a trace file, see
+ *			src/exectrace.c; each run overwrites it
+ *   --json		write the results as JSON
+ * Instructions skipped by fast-forwarding and memoization count as
+ * instructions of the program, "executed" are the ones really executed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hardware.h"
+#include "errors.h"
+#include "processor.h"
+#include "runtime.h"
+#include "exectrace.h"
+#include "util.h"
+
+/** Directory of the workloads, relative to the root of the repository */
+#define WORKLOAD_DIR	"bench/workloads"
+#define DEFAULT_RUNS	5
+#define MAXPATH		1024
+
+/** The workloads that are run when none are given */
+static const char *workloads[] =
+{
+	"bubblesort",
+	"insertionsort",
+	"fibonacci",
+	"ackermann",
+	"sieve",
+	"matmul",
+	"linkedlist"
+};
+
+/** A list of numbers read or written by a program */
+typedef struct Numbers
+{
+	int		*numbers;
+	size_t		count;
+	size_t		size;
+} Numbers;
+
+/** Result of the runs of a workload */
+typedef struct Result
+{
+	int		isCorrect;
+	const char	*problem;
+	unsigned long	instructions;
+	unsigned long	executed;
+	double		seconds;
+} Result;
+
+static Numbers input = {NULL, 0, 0};
+static Numbers output = {NULL, 0, 0};
+static size_t nextInput = 0;
+static int readTooMuch = 0;
+static int isOutOfMemory = 0;
+static int isJson = 0;
+static int isFirstResult = 1;
+static const char *traceFile = NULL;
+
+static int runWorkload(const char *workload, int runs);
+static Error runOnce(const char *source, Numbers *expected, Result *result);
+static void report(const char *name, Result *result);
+static int readNumbers(const char *filename, Numbers *list);
+static int appendNumber(Numbers *list, int number);
+static void workloadPaths(const char *workload, char *source, char *in, char *out);
+static int workloadInput(void);
+static void workloadOutput(int number);
+static void quiet(char *line);
+
+int main(int argc, char *argv[])
+{
+	int	runs = DEFAULT_RUNS,
+		numFailed = 0,
+		numGiven = 0,
+		i = 0;
+
+	// Options first, so they apply to every workload
+	for(i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+		{
+			runs = atoi(argv[++i]);
+			if(runs < 1)
+			{
+				runs = 1;
+			}
+		}
+		else if(strcmp(argv[i], "--no-fast-forward") == 0)
+		{
+			rntFastForward(0);
+		}
+		else if(strcmp(argv[i], "--memoize") == 0)
+		{
+			rntMemoize(1);
+		}
+		else if(strcmp(argv[i], "--optimize") == 0)
+		{
+			rntOptimize(1);
+		}
+		else if(strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+		{
+			traceFile = argv[++i];
+		}
+		else if(strcmp(argv[i], "--json") == 0)
+		{
+			isJson = 1;
+		}
+		else if(strncmp(argv[i], "--", 2) == 0)
+		{
+			fprintf(stderr, "Unknown option %s\n", argv[i]);
+			return 2;
+		}
+		else
+		{
+			numGiven++;
+		}
+	}
+
+	if(isJson)
+	{
+		printf("{\n  \"runs\": %d,\n  \"workloads\": [", runs);
+	}
+	else
+	{
+		printf("%-16s %-6s %14s %14s %10s %10s\n", "workload", "result",
+			"instructions", "executed", "seconds", "MIPS");
+	}
+
+	if(numGiven == 0)
+	{
+		for(i = 0; i < (int)(sizeof(workloads) / sizeof(workloads[0])); i++)
+		{
+			numFailed += runWorkload(workloads[i], runs);
+		}
+	}
+	for(i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "--runs") == 0 || strcmp(argv[i], "--trace") == 0)
+		{
+			i++;
+		}
+		else if(strncmp(argv[i], "--", 2) != 0)
+		{
+			numFailed += runWorkload(argv[i], runs);
+		}
+	}
+
+	if(isJson)
+	{
+		printf("\n  ]\n}\n");
+	}
+
+	free(input.numbers);
+	free(output.numbers);
+
+	return numFailed ? 1 : 0;
+}
+
+/** Run a workload a number of times and report the fastest run.
+ *  Returns 1 when the workload failed, 0 when it succeeded. */
+static int runWorkload(const char *workload, int runs)
+{
+	char		source[MAXPATH],
+			in[MAXPATH],
+			out[MAXPATH],
+			name[MAXPATH];
+	const char	*base = NULL;
+	Numbers		expected = {NULL, 0, 0};
+	Result		best,
+			result;
+	int		i = 0;
+
+	memset(&best, 0, sizeof(best));
+	best.isCorrect = 1;
+
+	workloadPaths(workload, source, in, out);
+	base = strrchr(source, '/');
+	strcpy(name, base ? base + 1 : source);
+	name[strlen(name) - 4] = '\0';
+	input.count = 0;
+	if(readNumbers(in, &input) != 0 || readNumbers(out, &expected) != 0)
+	{
+		best.isCorrect = 0;
+		best.problem = "cannot read the .in or .out file";
+	}
+
+	for(i = 0; i < runs && best.isCorrect; i++)
+	{
+		memset(&result, 0, sizeof(result));
+		result.isCorrect = 1;
+
+		if(runOnce(source, &expected, &result) != ERR_None || !result.isCorrect)
+		{
+			best = result;
+			best.isCorrect = 0;
+		}
+		else if(i == 0 || result.seconds < best.seconds)
+		{
+			best = result;
+		}
+	}
+
+	report(name, &best);
+	free(expected.numbers);
+
+	return best.isCorrect ? 0 : 1;
+}
+
+/**
+ * Load and run a program once, with the numbers of the input list.
+ *
+ * @param [in] source		Program to run
+ * @param [in] expected		Numbers the program must write
+ * @param [out] result		Instructions, time and correctness of the run
+ * @retval ERR_None		The program ran until HLT
+ * @retval ERR_InvalidState	The program could not be loaded
+ * @retval <other>		Error that stopped the program
+ */
+static Error runOnce(const char *source, Numbers *expected, Result *result)
+{
+	ProcStats	stats;
+	Error		rval = ERR_None;
+	char		filename[MAXPATH];
+	double		start = 0;
+
+	strcpy(filename, source);
+	nextInput = 0;
+	readTooMuch = 0;
+	isOutOfMemory = 0;
+	output.count = 0;
+
+	if(rntInit(filename, workloadInput, workloadOutput, quiet) != ERR_None)
+	{
+		result->problem = "cannot load the program";
+		return ERR_InvalidState;
+	}
+
+	if(traceFile != NULL && startExecTrace(traceFile) != ERR_None)
+	{
+		rntDeInit();
+		result->problem = "cannot write the trace file";
+		return ERR_InvalidState;
+	}
+
+	resetProcStats();
+	rval = runProgram();
+	getProcStats(&stats);
+
+	// The buffers the trace writes at the end count as time of the run
+	start = getWallTime();
+	if(traceFile != NULL && stopExecTrace(NULL) != ERR_None)
+	{
+		result->isCorrect = 0;
+		result->problem = "error writing the trace file";
+	}
+	stats.lastSeconds += getWallTime() - start;
+	rntDeInit();
+
+	result->executed = stats.executed;
+	result->instructions = stats.executed + stats.skipped;
+	result->seconds = stats.lastSeconds;
+
+	if(rval != ERR_EndOfProgram)
+	{
+		result->problem = "the program stopped with an error";
+		return rval;
+	}
+
+	if(isOutOfMemory)
+	{
+		result->isCorrect = 0;
+		result->problem = "out of memory for the numbers the program wrote";
+	}
+	else if(readTooMuch)
+	{
+		result->isCorrect = 0;
+		result->problem = "the program read more numbers than the .in file has";
+	}
+	else if(output.count != expected->count
+		|| memcmp(output.numbers, expected->numbers, output.count * sizeof(int)) != 0)
+	{
+		result->isCorrect = 0;
+		result->problem = "the program wrote other numbers than the .out file has";
+	}
+
+	return ERR_None;
+}
+
+/** Write the result of a workload as a line of the table, or as JSON */
+static void report(const char *name, Result *result)
+{
+	double	mips = 0;
+
+	if(result->seconds > 0)
+	{
+		mips = result->instructions / result->seconds / 1e6;
+	}
+
+	if(isJson)
+	{
+		printf("%s\n    {\"name\": \"%s\", \"correct\": %s", isFirstResult ? "" : ",",
+			name, result->isCorrect ? "true" : "false");
+		if(!result->isCorrect)
+		{
+			printf(", \"problem\": \"%s\"", result->problem);
+		}
+		printf(", \"instructions\": %lu, \"executed\": %lu, \"seconds\": %.6f, \"mips\": %.2f}",
+			result->instructions, result->executed, result->seconds, mips);
+		isFirstResult = 0;
+		return;
+	}
+
+	printf("%-16s %-6s %14lu %14lu %10.6f %10.2f\n", name,
+		result->isCorrect ? "ok" : "FAILED", result->instructions,
+		result->executed, result->seconds, mips);
+	if(!result->isCorrect)
+	{
+		printf("  %s\n", result->problem);
+	}
+}
+
+/** Read the whitespace separated numbers of a file into a list.
+ *  Returns 0 on success, -1 when the file cannot be read. */
+static int readNumbers(const char *filename, Numbers *list)
+{
+	FILE	*fp = NULL;
+	int	number = 0,
+		rval = 0;
+
+	fp = fopen(filename, "r");
+	if(fp == NULL)
+	{
+		return -1;
+	}
+
+	list->count = 0;
+	while(fscanf(fp, "%d", &number) == 1)
+	{
+		if(appendNumber(list, number) != 0)
+		{
+			rval = -1;
+			break;
+		}
+	}
+	if(!feof(fp))
+	{
+		rval = -1;
+	}
+
+	fclose(fp);
+	return rval;
+}
+
+/** Add a number to the end of a list, returns -1 when out of memory */
+static int appendNumber(Numbers *list, int number)
+{
+	if(list->count == list->size)
+	{
+		size_t	size = list->size ? list->size * 2 : 256;
+		int	*bigger = (int*) realloc(list->numbers, size * sizeof(int));
+
+		if(bigger == NULL)
+		{
+			return -1;
+		}
+		list->numbers = bigger;
+		list->size = size;
+	}
+
+	list->numbers[list->count++] = number;
+	return 0;
+}
+
+/** The source, input and output file of a workload. A workload ending in
+ *  .asm is a path, other workloads are names in WORKLOAD_DIR. */
+static void workloadPaths(const char *workload, char *source, char *in, char *out)
+{
+	size_t	length = strlen(workload);
+	int	base = 0;
+
+	if(length > 4 && strcmp(workload + length - 4, ".asm") == 0)
+	{
+		base = snprintf(source, MAXPATH, "%.*s", (int)(length - 4), workload);
+	}
+	else
+	{
+		base = snprintf(source, MAXPATH, "%s/%s", WORKLOAD_DIR, workload);
+	}
+	if(base > MAXPATH - 5)
+	{
+		base = MAXPATH - 5;
+	}
+
+	strcpy(in, source);
+	strcpy(out, source);
+	strcpy(source + base, ".asm");
+	strcpy(in + base, ".in");
+	strcpy(out + base, ".out");
+}
+
+/** Input of the program: the next number of the .in file */
+static int workloadInput(void)
+{
+	if(nextInput >= input.count)
+	{
+		readTooMuch = 1;
+		return 0;
+	}
+	return input.numbers[nextInput++];
+}
+
+/** Output of the program: kept to compare with the .out file */
+static void workloadOutput(int number)
+{
+	if(appendNumber(&output, number) != 0)
+	{
+		isOutOfMemory = 1;
+	}
+}
+
+/** Console messages of the runtime are not displayed */
+static void quiet(char *line)
+{
+	(void)line;
+}
@@ -0,0 +1,55 @@
+NOP		; Ackermann function: reads m and n until a negative m, writes A(m, n)
+NOP		; m is saved on a stack from 1000, the arguments are in m and n
+INP		; main: m
+JSN 12		; stop at a negative m
+STA 200
+INP		; n
+STA 201
+LDA #1000
+STA 202		; empty stack
+JSB 13
+OUT
+JMP 2
+HLT		; done
+LDA 200		; ack: A = A(m, n)
+JIZ 39
+LDA 201
+JIZ 43
+LDA 200		; push m
+STA (202)
+LDA 202
+LDB #1
+ADD
+STA 202
+LDA 201		; A(m, n - 1)
+LDB #1
+SUB
+STA 201
+JSB 13
+STA 201		; n = A(m, n - 1)
+LDA 202		; pop m
+LDB #1
+SUB
+STA 202
+LDA (202)
+LDB #1
+SUB
+STA 200
+JSB 13		; A(m - 1, A(m, n - 1))
+RTS
+LDA 201		; mzero: A(0, n) = n + 1
+LDB #1
+ADD
+RTS
+LDA 200		; nzero: A(m, 0) = A(m - 1, 1)
+LDB #1
+SUB
+STA 200
+LDA #1
+STA 201
+JSB 13
+RTS
+.org 200
+.word 0	; m
+.word 0	; n
+.word 0	; stack pointer
@@ -0,0 +1,83 @@
+NOP		; Bubble sort: reads n and n numbers and writes them sorted
+NOP		; The numbers are kept from address 1000, compared via pointers
+INP		; n
+STA 200
+LDA #1000
+STA 201		; p = a
+LDA 200		; read: numbers left?
+JIZ 19
+INP
+STA (201)	; *p = input
+LDA 201
+LDB #1
+ADD
+STA 201
+LDA 200
+LDB #1
+SUB
+STA 200
+JMP 6
+LDA 201		; sort: end = address of the last number
+LDB #1
+SUB
+STA 203
+STA 204		; last = end
+LDA #0		; pass: swapped = 0
+STA 205
+LDA #1000
+STA 201		; p = a
+LDA #1001
+STA 202		; q = a + 1
+LDA 201		; cmp: p < end?
+LDB 203
+SUB
+JSN 35
+JMP 54
+LDA (201)	; inner: *p > *q?
+LDB (202)
+SUB
+JSP 45
+LDA 202		; next: p = q, q = q + 1
+STA 201
+LDB #1
+ADD
+STA 202
+JMP 30
+LDA (201)	; swap: swap *p and *q
+STA 206
+LDA (202)
+STA (201)
+LDA 206
+STA (202)
+LDA #1
+STA 205		; swapped = 1
+JMP 39
+LDA 205		; passdone: sorted when nothing was swapped
+JIZ 61
+LDA 203		; the largest number is in place
+LDB #1
+SUB
+STA 203
+JMP 24
+LDA #1000	; write: write the numbers
+STA 201
+LDA 201		; wloop: p <= last?
+LDB 204
+SUB
+JSP 74
+LDA (201)
+OUT
+LDA 201
+LDB #1
+ADD
+STA 201
+JMP 63
+HLT		; done
+.org 200
+.word 0	; n, numbers left to read
+.word 0	; p
+.word 0	; q
+.word 0	; end of the unsorted part
+.word 0	; address of the last number
+.word 0	; swapped
+.word 0	; t
@@ -0,0 +1,58 @@
+NOP		; Recursive Fibonacci: reads n until a negative n, writes fib(n)
+NOP		; Locals are saved on a stack from 1000, the argument is in n
+INP		; main: n
+JSN 10		; stop at a negative n
+STA 200
+LDA #1000
+STA 201		; empty stack
+JSB 11
+OUT
+JMP 2
+HLT		; done
+LDA 200		; fib: A = fib(n)
+LDB #2
+SUB
+JSN 51		; fib(0) = 0, fib(1) = 1
+LDA 200		; push n
+STA (201)
+LDA 201
+LDB #1
+ADD
+STA 201
+LDA 200		; fib(n - 1)
+LDB #1
+SUB
+STA 200
+JSB 11
+STA (201)	; push fib(n - 1)
+LDA 201
+LDB #1
+ADD
+STA 201
+LDA 201		; n = saved n - 2
+LDB #2
+SUB
+STA 202
+LDA (202)
+SUB
+STA 200
+JSB 11		; fib(n - 2)
+STA 203
+LDA 201		; pop fib(n - 1) and n
+LDB #2
+SUB
+STA 201
+LDB #1
+ADD
+STA 202
+LDB (202)
+LDA 203
+ADD		; fib(n - 1) + fib(n - 2)
+RTS
+LDA 200		; small
+RTS
+.org 200
+.word 0	; n
+.word 0	; stack pointer
+.word 0	; t
+.word 0	; r
@@ -0,0 +1,81 @@
+NOP		; Insertion sort: reads n and n numbers and writes them sorted
+NOP		; The numbers are kept from address 1000, moved via pointers
+INP		; n
+STA 200
+LDA #1000
+STA 201		; p = a
+LDA 200		; read: numbers left?
+JIZ 19
+INP
+STA (201)	; *p = input
+LDA 201
+LDB #1
+ADD
+STA 201
+LDA 200
+LDB #1
+SUB
+STA 200
+JMP 6
+LDA 201		; sort: end = p
+STA 202
+LDA #1001
+STA 203		; i = a + 1
+LDA 203		; outer: i < end?
+LDB 202
+SUB
+JSN 28
+JMP 59
+LDA (203)	; take: key = *i
+STA 206
+LDA 203
+STA 205		; k = i
+LDB #1
+SUB
+STA 204		; j = i - 1
+LDA 204		; shift: j >= a?
+LDB #1000
+SUB
+JSN 52
+LDA (204)	; *j > key?
+LDB 206
+SUB
+JSP 44
+JMP 52
+LDA (204)	; move: *k = *j
+STA (205)
+LDA 204		; k = j, j = j - 1
+STA 205
+LDB #1
+SUB
+STA 204
+JMP 35
+LDA 206		; place: *k = key
+STA (205)
+LDA 203
+LDB #1
+ADD
+STA 203
+JMP 23
+LDA #1000	; write: write the numbers
+STA 201
+LDA 201		; wloop: p < end?
+LDB 202
+SUB
+JSN 66
+HLT
+LDA (201)	; wnext
+OUT
+LDA 201
+LDB #1
+ADD
+STA 201
+JMP 61
+.org 200
+.word 0	; n, numbers left to read
+.word 0	; p
+.word 0	; address after the last number
+.word 0	; i
+.word 0	; j
+.word 0	; k, the free place
+.word 0	; key
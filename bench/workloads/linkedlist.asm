@@ -0,0 +1,59 @@
+NOP		; Linked list: reads numbers until a negative number and inserts
+NOP		; each in a sorted list, nodes of value and next from 1000, writes the list
+LDA #0
+STA 200		; empty list
+LDA #1000
+STA 201
+INP		; main: v
+JSN 38		; stop at a negative number
+STA 202
+LDA #200
+STA 203		; link = &head
+LDA (203)	; walk: cur = *link
+STA 204
+JIZ 24		; end of the list
+LDA (204)	; cur->value < v?
+LDB 202
+SUB
+JSN 19
+JMP 24
+LDA 204		; skip: link = &cur->next
+LDB #1
+ADD
+STA 203
+JMP 11
+LDA 202		; insert: free->value = v
+STA (201)
+LDA 201
+STA (203)	; *link = free
+LDB #1
+ADD
+STA 205
+LDA 204		; free->next = cur
+STA (205)
+LDA 201		; next free node
+LDB #2
+ADD
+STA 201
+JMP 6
+LDA 200		; write: write the list
+STA 204
+LDA 204		; wloop
+JIZ 51
+LDA (204)
+OUT
+LDA 204		; cur = cur->next
+LDB #1
+ADD
+STA 205
+LDA (205)
+STA 204
+JMP 40
+HLT		; done
+.org 200
+.word 0	; first node
+.word 0	; next free node
+.word 0	; v
+.word 0	; address of the link to cur
+.word 0	; cur
+.word 0	; t
@@ -0,0 +1,126 @@
+NOP		; Matrix multiply: reads n, the n x n matrices A and B by rows and
+NOP		; writes C = A * B by rows, A is kept at 1000, B at 5000, C at 9000
+INP		; n
+STA 200
+LDB 200
+MUL
+STA 201		; size = n * n
+LDA #1000	; read A and B
+STA 202
+LDB 201
+ADD
+STA 203
+JSB 100
+LDA #5000
+STA 202
+LDB 201
+ADD
+STA 203
+JSB 100
+LDA #9000
+STA 211		; pc = C
+LDA #1000
+STA 204		; row = A
+LDB 201
+ADD
+STA 205
+LDA 204		; rows: for every row of A
+LDB 205
+SUB
+JIZ 83
+LDA #5000
+STA 206		; col = B
+LDB 200
+ADD
+STA 207
+LDA 206		; cols: for every column of B
+LDB 207
+SUB
+JIZ 78
+LDA #0
+STA 212		; sum = 0
+LDA 204
+STA 208		; pa = row
+LDB 200
+ADD
+STA 209
+LDA 206
+STA 210		; pb = col
+LDA 208		; dot: sum += *pa * *pb
+LDB 209
+SUB
+JIZ 67
+LDA (208)
+LDB (210)
+MUL
+LDB 212
+ADD
+STA 212
+LDA 208		; pa = pa + 1
+LDB #1
+ADD
+STA 208
+LDA 210		; pb = pb + n
+LDB 200
+ADD
+STA 210
+JMP 48
+LDA 212		; store: *pc = sum
+STA (211)
+LDA 211
+LDB #1
+ADD
+STA 211
+LDA 206		; next column
+LDB #1
+ADD
+STA 206
+JMP 35
+LDA 204		; nextrow: next row
+LDB 200
+ADD
+STA 204
+JMP 26
+LDA #9000	; write: write C
+STA 202
+LDB 201
+ADD
+STA 203
+LDA 202		; wloop
+LDB 203
+SUB
+JIZ 99
+LDA (202)
+OUT
+LDA 202
+LDB #1
+ADD
+STA 202
+JMP 88
+HLT		; done
+LDA 202		; read: read the numbers from p to end
+LDB 203
+SUB
+JIZ 111
+INP
+STA (202)
+LDA 202
+LDB #1
+ADD
+STA 202
+JMP 100
+RTS		; rdone
+.org 200
+.word 0	; n
+.word 0	; n * n
+.word 0	; p
+.word 0	; end
+.word 0	; row of A
+.word 0	; end of A
+.word 0	; column of B
+.word 0	; end of the first row of B
+.word 0	; pa
+.word 0	; end of the row of A
+.word 0	; pb
+.word 0	; pc
+.word 0	; sum
@@ -0,0 +1,97 @@
+NOP		; Sieve of Eratosthenes: reads n until a negative n, writes the
+NOP		; number of primes up to n and the largest, flags are kept from 1000
+INP		; main: n
+JSN 88		; stop at a negative n
+STA 200
+LDB #1000
+ADD
+STA 201		; end = flags + n
+LDA #1002
+STA 204
+LDA 204		; clear: clear the flags of 2 .. n
+LDB 201
+SUB
+JSP 21
+LDA #0
+STA (204)
+LDA 204
+LDB #1
+ADD
+STA 204
+JMP 10
+LDA #2		; cleared: i = 2
+STA 202
+LDA 202		; outer: i * i <= n?
+LDB 202
+MUL
+STA 203
+LDB 200
+SUB
+JSP 56
+LDA 202
+LDB #1000
+ADD
+STA 204
+LDA (204)	; i is a prime?
+JIZ 41
+LDA 202		; nexti
+LDB #1
+ADD
+STA 202
+JMP 23
+LDA 203		; strike: p = flags + i * i
+LDB #1000
+ADD
+STA 204
+LDA 204		; sloop: strike the multiples of i
+LDB 201
+SUB
+JSP 36
+LDA #1
+STA (204)
+LDA 204
+LDB 202
+ADD
+STA 204
+JMP 45
+LDA #0		; count: count the primes
+STA 205
+STA 206
+LDA #2
+STA 202
+LDA 202		; cloop
+LDB 200
+SUB
+JSP 83
+LDA 202
+LDB #1000
+ADD
+STA 204
+LDA (204)
+JIZ 76
+LDA 202		; cnext
+LDB #1
+ADD
+STA 202
+JMP 61
+LDA 202		; prime: largest prime so far
+STA 206
+LDA 205
+LDB #1
+ADD
+STA 205
+JMP 71
+LDA 205		; report
+OUT
+LDA 206
+OUT
+JMP 2
+HLT		; done
+.org 200
+.word 0	; n
+.word 0	; address of the flag of n
+.word 0	; i
+.word 0	; i * i
+.word 0	; p
+.word 0	; primes found
+.word 0	; largest prime found
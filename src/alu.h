@@ -0,0 +1,107 @@
+#ifndef _PSEUDOASM_INC_ALU_H_
+#define _PSEUDOASM_INC_ALU_H_
+
+/**
+ * Semantics of the instructions that only work on the registers and flags.
+ *
+ * The processor executes the program, and the prologue (see prologue.c)
+ * executes the start of it when it is assembled. Both must give exactly
+ * the same registers and flags, so both use these functions; they only
+ * differ in how memory is read and written. The fast-forwarding of loops
+ * (see fastforward.c) follows ADD, SUB and the conditional jumps
+ * symbolically and has to be kept in line with them by hand.
+ *
+ * The registers are 32 bit and wrap around. The overflow flag is set when
+ * the exact result differs from the register.
+ *
+ * The functions are inline, the processor calls them for every instruction
+ * and a call into another file made a run measurably slower.
+ */
+#include <assert.h>
+#include "hardware.h"
+#include "errors.h"
+
+/** Value of an immediate operand, the 24 bit operand sign extended */
+static inline int immediateValue(Instruction instr)
+{
+	return (int)(instr.operand & 0x800000 ? instr.operand | 0xFF000000 : instr.operand);
+}
+
+/** Set the flags after a value is loaded in register A (LDA, INP), the
+ *  overflow flag is cleared */
+static inline void setLoadFlags(int regA, int *flagN, int *flagZ, int *flagO)
+{
+	*flagN = regA < 0;
+	*flagZ = regA == 0;
+	*flagO = 0;
+}
+
+/** Execute ADD, SUB, MUL or DIV: register A becomes A op B and the flags
+ *  are set. When it fails the registers and flags do not change.
+ *
+ * @retval ERR_DivideZero	Attempt to divide by zero
+ * @retval ERR_InvalidInstr	Not an arithmetic instruction
+ */
+static inline Error computeMath(Instruction instr, int *regA, int regB,
+	int *flagN, int *flagZ, int *flagO)
+{
+	double	dvalA = *regA,
+		dvalB = regB;
+
+	switch(instr.operator)
+	{
+	case A_ADD:
+		*regA = (int)((unsigned int)*regA + (unsigned int)regB);
+		dvalA += dvalB;
+		break;
+	case A_SUB:
+		*regA = (int)((unsigned int)*regA - (unsigned int)regB);
+		dvalA -= dvalB;
+		break;
+	case A_MUL:
+		*regA = (int)((unsigned int)*regA * (unsigned int)regB);
+		dvalA *= dvalB;
+		break;
+	case A_DIV:
+		if(regB == 0)
+		{
+			return ERR_DivideZero;
+		}
+		// INT_MIN / -1 does not fit, it wraps like the other instructions
+		*regA = regB == -1 ? (int)(0u - (unsigned int)*regA) : *regA / regB;
+		dvalA /= dvalB;
+		break;
+	default:
+		assert(0); // Mistake in parse table
+		return ERR_InvalidInstr;
+	}
+
+	*flagN = *regA < 0;
+	*flagZ = *regA == 0;
+	*flagO = dvalA != (double)*regA;
+
+	return ERR_None;
+}
+
+/** Does a jump instruction jump with these flags? JMP always does, JSP,
+ *  JSN, JIZ and JOF test a flag, any other instruction does not jump. */
+static inline int isJumpTaken(Instruction instr, int flagN, int flagZ, int flagO)
+{
+	switch(instr.operator)
+	{
+	case A_JMP:
+		return 1;
+	case A_JSP:
+		return !flagZ && !flagN;
+	case A_JSN:
+		return flagN;
+	case A_JIZ:
+		return flagZ;
+	case A_JOF:
+		return flagO;
+	default:
+		return 0;
+	}
+}
+
+#endif // _PSEUDOASM_INC_ALU_H_
@@ -0,0 +1,558 @@
+/**
+ * Control flow graph of a program.
+ *
+ * The instructions that can be reached from the entry point are split in
+ * basic blocks. A block starts at the entry point, at the target of a jump
+ * or call, at the return address of a call, and after an instruction that
+ * does not fall through. It ends with a jump, JSB, RTS, HLT or an invalid
+ * instruction, or just before the next block.
+ *
+ * A JSB block has the called block as successor. The return address can
+ * not be known, so an RTS block has the blocks after every JSB of the
+ * program as successors, and can stop the program when the stack does not
+ * hold a return address. Both are conservative: every path the program
+ * can take is a path in the graph, but not the other way around.
+ *
+ * The program is read with a fetch function, so the graph can be built for
+ * an assembled image as well as for the memory of a running program.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "hardware.h"
+#include "memory.h"
+#include "cfg.h"
+
+/** Set of addresses, open addressing with linear probing */
+typedef struct AddrSet
+{
+	unsigned int	*keys;
+	unsigned char	*used;
+	size_t		size;
+	size_t		count;
+} AddrSet;
+
+/** Growing array of addresses */
+typedef struct AddrList
+{
+	unsigned int	*items;
+	size_t		count;
+	size_t		size;
+} AddrList;
+
+static int isValidInstr(Instruction instr);
+static int fallsThrough(Instruction instr);
+static int endsBlock(Instruction instr);
+static unsigned int blockSuccessors(Cfg *cfg, CfgBlock *block, AddrList *returns,
+	unsigned int *succ);
+static unsigned int findStart(Cfg *cfg, unsigned int address);
+static int addrSetAdd(AddrSet *set, unsigned int address);
+static Error addrListAdd(AddrList *list, unsigned int address);
+static size_t sortUnique(AddrList *list);
+static int compareAddr(const void *a, const void *b);
+
+/** Build the control flow graph of the instructions that can be reached from
+ *  the entry point. The graph is empty when the entry point is not part of
+ *  the program.
+ *
+ * @param [in] fetch		Reads the cells of the program
+ * @param [in] context		Passed to fetch
+ * @param [in] entry		Address of the first instruction
+ * @param [out] cfg		Free with freeCfg
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error buildCfg(CfgFetch fetch, void *context, unsigned int entry, Cfg *cfg)
+{
+	AddrSet		seen = {NULL, NULL, 0, 0};
+	AddrList	todo = {NULL, 0, 0},
+			reachable = {NULL, 0, 0},
+			leaders = {NULL, 0, 0},
+			returns = {NULL, 0, 0};
+	MemCell		cell;
+	size_t		i = 0,
+			leader = 0;
+	unsigned int	numSucc = 0,
+			j = 0;
+	Error		rval = ERR_None;
+
+	assert(fetch != NULL && cfg != NULL);
+
+	memset(cfg, 0, sizeof(Cfg));
+	cfg->entry = CFG_NONE;
+
+	if(!fetch(context, entry, &cell))
+	{
+		return ERR_None;
+	}
+
+	rval = addrSetAdd(&seen, entry) < 0 ? ERR_OutOfMemory : ERR_None;
+	rval = rval == ERR_None ? addrListAdd(&todo, entry) : rval;
+	rval = rval == ERR_None ? addrListAdd(&leaders, entry) : rval;
+
+	// Find the reachable instructions and where blocks have to start
+	while(todo.count > 0 && rval == ERR_None)
+	{
+		unsigned int	address = todo.items[--todo.count],
+				next[2];
+		int		numNext = 0,
+				k = 0;
+		Instruction	instr;
+
+		fetch(context, address, &cell);
+		instr = cell.instructie;
+		rval = addrListAdd(&reachable, address);
+
+		if(!isValidInstr(instr))
+		{
+			continue;
+		}
+
+		switch(instr.operator)
+		{
+		case A_JMP:
+		case A_JSP:
+		case A_JSN:
+		case A_JIZ:
+		case A_JOF:
+			next[numNext++] = instr.operand;
+			rval = rval == ERR_None ? addrListAdd(&leaders, instr.operand) : rval;
+			break;
+		case A_JSB:
+			next[numNext++] = instr.operand;
+			next[numNext++] = address + 1;
+			rval = rval == ERR_None ? addrListAdd(&leaders, instr.operand) : rval;
+			rval = rval == ERR_None ? addrListAdd(&leaders, address + 1) : rval;
+			rval = rval == ERR_None ? addrListAdd(&returns, address + 1) : rval;
+			break;
+		default:
+			break;
+		}
+
+		if(fallsThrough(instr))
+		{
+			next[numNext++] = address + 1;
+		}
+
+		for(k = 0; k < numNext && rval == ERR_None; k++)
+		{
+			int added = 0;
+
+			if(!fetch(context, next[k], &cell))
+			{
+				continue;
+			}
+
+			added = addrSetAdd(&seen, next[k]);
+			if(added < 0)
+			{
+				rval = ERR_OutOfMemory;
+			}
+			else if(added)
+			{
+				rval = addrListAdd(&todo, next[k]);
+			}
+		}
+	}
+
+	free(seen.keys);
+	free(seen.used);
+	free(todo.items);
+
+	if(rval == ERR_None)
+	{
+		sortUnique(&reachable);
+		sortUnique(&leaders);
+		sortUnique(&returns);
+
+		cfg->blocks = (CfgBlock*) malloc(reachable.count * sizeof(CfgBlock) + 1);
+		cfg->code = (MemCell*) malloc(reachable.count * sizeof(MemCell) + 1);
+		if(cfg->blocks == NULL || cfg->code == NULL)
+		{
+			rval = ERR_OutOfMemory;
+		}
+	}
+
+	// Split the instructions in blocks
+	for(i = 0; i < reachable.count && rval == ERR_None; i++)
+	{
+		unsigned int	address = reachable.items[i];
+		CfgBlock	*block = cfg->numBlocks > 0 ? &cfg->blocks[cfg->numBlocks - 1] : NULL;
+
+		while(leader < leaders.count && leaders.items[leader] < address)
+		{
+			leader++;
+		}
+
+		if(block == NULL || address != block->start + block->length
+			|| (leader < leaders.count && leaders.items[leader] == address)
+			|| endsBlock(cfg->code[i - 1].instructie))
+		{
+			block = &cfg->blocks[cfg->numBlocks++];
+			block->start = address;
+			block->length = 0;
+			block->first = (unsigned int)i;
+			block->exits = 0;
+			block->numSucc = 0;
+			block->firstSucc = 0;
+			block->callee = CFG_NONE;
+		}
+
+		fetch(context, address, &cfg->code[i]);
+		block->length++;
+	}
+	cfg->numCode = (unsigned int)reachable.count;
+
+	// Every RTS returns to the same blocks, find them once
+	for(i = 0, j = 0; i < returns.count && rval == ERR_None; i++)
+	{
+		unsigned int index = findStart(cfg, returns.items[i]);
+
+		if(index != CFG_NONE)
+		{
+			returns.items[j++] = index;
+		}
+	}
+	returns.count = j;
+
+	// Connect the blocks: count the edges first, then fill them in
+	for(j = 0; j < cfg->numBlocks && rval == ERR_None; j++)
+	{
+		numSucc += blockSuccessors(cfg, &cfg->blocks[j], &returns, NULL);
+	}
+
+	if(rval == ERR_None)
+	{
+		cfg->succ = (unsigned int*) malloc(numSucc * sizeof(unsigned int) + 1);
+		rval = cfg->succ == NULL ? ERR_OutOfMemory : ERR_None;
+	}
+
+	for(j = 0; j < cfg->numBlocks && rval == ERR_None; j++)
+	{
+		CfgBlock *block = &cfg->blocks[j];
+
+		block->firstSucc = cfg->numSucc;
+		block->numSucc = blockSuccessors(cfg, block, &returns, &cfg->succ[cfg->numSucc]);
+		cfg->numSucc += block->numSucc;
+	}
+
+	free(reachable.items);
+	free(leaders.items);
+	free(returns.items);
+
+	if(rval != ERR_None)
+	{
+		freeCfg(cfg);
+		return rval;
+	}
+
+	cfg->entry = findStart(cfg, entry);
+
+	return ERR_None;
+}
+
+/** Index of the block that contains an address, CFG_NONE if there is none */
+unsigned int cfgFindBlock(Cfg *cfg, unsigned int address)
+{
+	unsigned int	low = 0,
+			high = cfg->numBlocks,
+			mid = 0;
+
+	assert(cfg != NULL);
+
+	// First block that starts after the address
+	while(low < high)
+	{
+		mid = low + (high - low) / 2;
+		if(cfg->blocks[mid].start <= address)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+
+	if(low > 0 && address - cfg->blocks[low - 1].start < cfg->blocks[low - 1].length)
+	{
+		return low - 1;
+	}
+
+	return CFG_NONE;
+}
+
+/** Free a control flow graph */
+void freeCfg(Cfg *cfg)
+{
+	assert(cfg != NULL);
+
+	free(cfg->blocks);
+	free(cfg->succ);
+	free(cfg->code);
+	memset(cfg, 0, sizeof(Cfg));
+	cfg->entry = CFG_NONE;
+}
+
+/** Private function: can the processor execute the instruction? */
+static int isValidInstr(Instruction instr)
+{
+	switch(instr.operator)
+	{
+	case A_LDA:
+	case A_LDB:
+		return instr.adressering != GEINDEXEERD;
+	case A_STA:
+	case A_STB:
+		return instr.adressering == DIRECT || instr.adressering == INDIRECT;
+	case A_NOP:
+	case A_INP:
+	case A_OUT:
+	case A_ADD:
+	case A_SUB:
+	case A_MUL:
+	case A_DIV:
+	case A_JMP:
+	case A_JSP:
+	case A_JSN:
+	case A_JIZ:
+	case A_JOF:
+	case A_JSB:
+	case A_RTS:
+	case A_HLT:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/** Private function: can the next instruction be executed after this one,
+ *  without jumping? A JSB only gets there through an RTS. */
+static int fallsThrough(Instruction instr)
+{
+	if(!isValidInstr(instr))
+	{
+		return 0;
+	}
+
+	switch(instr.operator)
+	{
+	case A_JMP:
+	case A_JSB:
+	case A_RTS:
+	case A_HLT:
+		return 0;
+	default:
+		return 1;
+	}
+}
+
+/** Private function: is the instruction the last one of its block? */
+static int endsBlock(Instruction instr)
+{
+	switch(instr.operator)
+	{
+	case A_JSP:
+	case A_JSN:
+	case A_JIZ:
+	case A_JOF:
+		return 1;
+	default:
+		return !fallsThrough(instr);
+	}
+}
+
+/** Private function: find the successors of a block, and set how it ends.
+ *  Returns the number of successors, they are saved in succ unless it is
+ *  NULL. Returns holds the blocks after every JSB. */
+static unsigned int blockSuccessors(Cfg *cfg, CfgBlock *block, AddrList *returns,
+	unsigned int *succ)
+{
+	Instruction	instr = cfg->code[block->first + block->length - 1].instructie;
+	unsigned int	last = block->start + block->length - 1,
+			next[2],
+			numNext = 0,
+			count = 0,
+			i = 0;
+
+	block->exits = 0;
+	block->callee = CFG_NONE;
+
+	if(!isValidInstr(instr) || instr.operator == A_HLT)
+	{
+		block->end = CFG_STOP;
+		block->exits = 1;
+		return 0;
+	}
+
+	switch(instr.operator)
+	{
+	case A_JMP:
+		block->end = CFG_JUMP;
+		next[numNext++] = instr.operand;
+		break;
+	case A_JSP:
+	case A_JSN:
+	case A_JIZ:
+	case A_JOF:
+		block->end = CFG_BRANCH;
+		next[numNext++] = instr.operand;
+		next[numNext++] = last + 1;
+		break;
+	case A_JSB:
+		block->end = CFG_CALL;
+		next[numNext++] = instr.operand;
+		block->callee = findStart(cfg, instr.operand);
+		break;
+	case A_RTS:
+		block->end = CFG_RETURN;
+		if(succ != NULL)
+		{
+			memcpy(succ, returns->items, returns->count * sizeof(unsigned int));
+		}
+		// Without a JSB before it, RTS pops whatever the stack holds
+		block->exits = 1;
+		return (unsigned int)returns->count;
+	default:
+		block->end = CFG_FALL;
+		next[numNext++] = last + 1;
+		break;
+	}
+
+	for(i = 0; i < numNext; i++)
+	{
+		unsigned int target = findStart(cfg, next[i]);
+
+		if(target == CFG_NONE)
+		{
+			// Executing a cell outside the program fails
+			block->exits = 1;
+			continue;
+		}
+
+		if(succ != NULL)
+		{
+			succ[count] = target;
+		}
+		count++;
+	}
+
+	return count;
+}
+
+/** Private function: index of the block that starts at an address */
+static unsigned int findStart(Cfg *cfg, unsigned int address)
+{
+	unsigned int index = cfgFindBlock(cfg, address);
+
+	return index != CFG_NONE && cfg->blocks[index].start == address ? index : CFG_NONE;
+}
+
+/** Private function: add an address to a set. Returns 1 if it was added, 0
+ *  if it was already in the set and -1 if malloc failed. */
+static int addrSetAdd(AddrSet *set, unsigned int address)
+{
+	size_t i = 0;
+
+	if(2 * (set->count + 1) > set->size)
+	{
+		AddrSet bigger = {NULL, NULL, set->size ? 2 * set->size : 1024, 0};
+
+		bigger.keys = (unsigned int*) malloc(bigger.size * sizeof(unsigned int));
+		bigger.used = (unsigned char*) calloc(bigger.size, 1);
+		if(bigger.keys == NULL || bigger.used == NULL)
+		{
+			free(bigger.keys);
+			free(bigger.used);
+			return -1;
+		}
+
+		for(i = 0; i < set->size; i++)
+		{
+			if(set->used[i])
+			{
+				addrSetAdd(&bigger, set->keys[i]);
+			}
+		}
+
+		free(set->keys);
+		free(set->used);
+		*set = bigger;
+	}
+
+	i = (size_t)hashValue(address, 0) & (set->size - 1);
+	while(set->used[i])
+	{
+		if(set->keys[i] == address)
+		{
+			return 0;
+		}
+		i = (i + 1) & (set->size - 1);
+	}
+
+	set->keys[i] = address;
+	set->used[i] = 1;
+	set->count++;
+
+	return 1;
+}
+
+/** Private function: append an address to a list
+ *
+ * @retval ERR_OutOfMemory	Realloc failed
+ */
+static Error addrListAdd(AddrList *list, unsigned int address)
+{
+	if(list->count == list->size)
+	{
+		size_t		size = list->size ? 2 * list->size : 256;
+		unsigned int	*bigger = NULL;
+
+		bigger = (unsigned int*) realloc(list->items, size * sizeof(unsigned int));
+		if(bigger == NULL)
+		{
+			return ERR_OutOfMemory;
+		}
+		list->items = bigger;
+		list->size = size;
+	}
+
+	list->items[list->count++] = address;
+
+	return ERR_None;
+}
+
+/** Private function: sort a list and remove the duplicates. Returns the new
+ *  number of addresses. */
+static size_t sortUnique(AddrList *list)
+{
+	size_t	i = 0,
+		kept = 0;
+
+	// An empty list has no items array, and qsort needs one
+	if(list->count < 2)
+	{
+		return list->count;
+	}
+
+	qsort(list->items, list->count, sizeof(unsigned int), compareAddr);
+
+	for(i = 0; i < list->count; i++)
+	{
+		if(kept == 0 || list->items[kept - 1] != list->items[i])
+		{
+			list->items[kept++] = list->items[i];
+		}
+	}
+	list->count = kept;
+
+	return kept;
+}
+
+/** Private function: order addresses */
+static int compareAddr(const void *a, const void *b)
+{
+	unsigned int	x = *(const unsigned int*) a,
+			y = *(const unsigned int*) b;
+
+	return x < y ? -1 : x > y;
+}
@@ -0,0 +1,66 @@
+#ifndef _PSEUDOASM_INC_CFG_H_
+#define _PSEUDOASM_INC_CFG_H_
+
+#include "errors.h"
+#include "hardware.h"
+
+/** Block index of a missing block */
+#define CFG_NONE	0xFFFFFFFFu
+
+/** How a basic block ends */
+typedef enum CfgEnd
+{
+	CFG_FALL,	// Falls through in the next block, which is a jump target
+	CFG_JUMP,	// JMP
+	CFG_BRANCH,	// Conditional jump, the second successor is the next block
+	CFG_CALL,	// JSB, the successor is the called block
+	CFG_RETURN,	// RTS, the successors are the blocks after every JSB
+	CFG_STOP	// HLT or an invalid instruction
+} CfgEnd;
+
+/** Straight line code: only the first instruction is jumped to */
+typedef struct CfgBlock
+{
+	unsigned int start;
+	unsigned int length;
+	/** Index of the first instruction in Cfg.code */
+	unsigned int first;
+	CfgEnd end;
+	/** Can the program stop after this block? E.g. at HLT, at RTS, or
+	 *  because the next instruction is not in the program. */
+	int exits;
+	unsigned int numSucc;
+	/** Index of the first successor in Cfg.succ */
+	unsigned int firstSucc;
+	/** Block called by JSB, CFG_NONE for other blocks */
+	unsigned int callee;
+} CfgBlock;
+
+/** Control flow graph of the instructions reachable from the entry point */
+typedef struct Cfg
+{
+	unsigned int entry;
+	unsigned int numBlocks;
+	/** Sorted on address */
+	CfgBlock *blocks;
+	unsigned int numSucc;
+	unsigned int *succ;
+	/** Instructions of all blocks */
+	unsigned int numCode;
+	MemCell *code;
+} Cfg;
+
+/** Read the cell at an address of the program. Returns FALSE when the
+ *  address is not part of the program. */
+typedef int (*CfgFetch)(void *context, unsigned int address, MemCell *cell);
+
+/* Build the control flow graph of a program */
+Error buildCfg(CfgFetch fetch, void *context, unsigned int entry, Cfg *cfg);
+
+/* Index of the block that contains an address, CFG_NONE if there is none */
+unsigned int cfgFindBlock(Cfg *cfg, unsigned int address);
+
+/* Free a control flow graph */
+void freeCfg(Cfg *cfg);
+
+#endif // _PSEUDOASM_INC_CFG_H_
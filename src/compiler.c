@@ -1,14 +1,191 @@
+#define _POSIX_C_SOURCE 200112L
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "util.h"
 #include "hardware.h"
 #include "parser.h"
 #include "memory.h"
 #include "compiler.h"
 
-#define MAXLEN	151
+#define MAXLEN	COMPILER_MAXLEN
+
+/** Files are split in chunks of at least this size to assemble them in
+ *  parallel */
+#define CHUNK_MINSIZE	(256 * 1024)
+
+/** The address after the last cell of the memory, a line whose cells pass
+ *  it is left out */
+#define ADDRESS_END	((unsigned long long)UINT_MAX + 1)
+
+/** Most cells of a .fill or .zero, as many as an operand can address */
+#define MAX_FILL	0x1000000
+#define MAX_THREADS	16
+
+/** Destination of the messages of the assembler. Messages are passed to the
+ *  output function, or when it is NULL saved in the buffer (each message
+ *  is terminated by '\0') until the messages of the lines before it have
+ *  been displayed. */
+typedef struct Diagnostics
+{
+	OutputFunc	output;
+	char		*text;
+	size_t		length;
+	size_t		size;
+	Error		error;
+} Diagnostics;
+
+/** Assembler directives */
+typedef enum DirType
+{
+	DIR_Org,
+	DIR_Word,
+	DIR_Fill,
+	DIR_Zero
+} DirType;
+
+/** A parsed directive */
+typedef struct Directive
+{
+	DirType		type;
+	/** Address of .org, number of cells of the other directives */
+	unsigned int	count;
+	/** Value of .fill */
+	int		value;
+	/** Text of the values of .word */
+	const char	*values;
+} Directive;
+
+/** Cells that are placed at consecutive addresses. While assembling, the
+ *  cells are at an offset in the cell array of the assembler. */
+typedef struct Segment
+{
+	unsigned int	base;
+	unsigned int	count;
+	unsigned int	flags;
+	size_t		offset;
+} Segment;
+
+/** Segments in the order they were assembled */
+typedef struct SegmentList
+{
+	Segment		*segments;
+	unsigned int	count;
+	unsigned int	size;
+} SegmentList;
+
+/** Part of a source file that is assembled by one thread */
+typedef struct Chunk
+{
+	const char		*begin;
+	const char		*end;
+	/** Number of the first line and number of lines */
+	unsigned int		lineBase;
+	unsigned int		numLines;
+	/** Offset of the first cell in the cell array and number of cells */
+	size_t			cellBase;
+	size_t			numCells;
+	/** Address of the first line. When the chunk contains a .org, the
+	 *  address after the chunk is orgEnd instead of address + numCells. */
+	unsigned long long	address;
+	int			hasOrg;
+	unsigned long long	orgEnd;
+	MemCell			*cells;
+	/** Hashes of the lines by line number, NULL when they are not asked */
+	SourceLine		*lines;
+	SegmentList		segments;
+	Diagnostics		diag;
+	pthread_t		thread;
+} Chunk;
+
+/** Address and number of cells of a line of a source file */
+typedef struct LineRange
+{
+	unsigned int	address;
+	unsigned int	count;
+} LineRange;
+
+/** Instruction lines of a lazy program that are placed at consecutive
+ *  addresses */
+typedef struct LazyRun
+{
+	unsigned int	base;
+	unsigned int	count;
+	/** Number of the first line and index of its offset in LazyProgram.lines */
+	unsigned int	lineNr;
+	size_t		first;
+} LazyRun;
+
+/** A source file whose instruction lines are assembled the first time
+ *  their cell is used. The text is a copy, so the file can be changed. */
+typedef struct LazyProgram
+{
+	char		*text;
+	size_t		size;
+	/** Offset in the text of every instruction line */
+	size_t		*lines;
+	/** Is the line not assembled (or written over) yet? */
+	unsigned char	*pending;
+	size_t		numLines;
+	size_t		linesSize;
+	/** In order of their address, runs never overlap */
+	LazyRun		*runs;
+	unsigned int	numRuns;
+	unsigned int	runsSize;
+	Diagnostics	diag;
+} LazyProgram;
 
 static void prepareLine(char *line);
+static unsigned int assembleLine(char *line, unsigned int lineNr, MemCell *cells,
+	Diagnostics *diag);
+static unsigned int lineSize(const char *line, int *isOrg);
+static void reportPastEnd(char *line, unsigned int lineNr, Diagnostics *diag);
+static Error parseDirective(const char *line, Directive *dir);
+static int readNumber(const char **p, long long min, long long max, long long *value);
+static Error addCells(SegmentList *list, unsigned int address, unsigned int count,
+	unsigned int flags, size_t offset);
+static Error buildImage(SegmentList *list, MemCell *cells, Image *image);
+static void diagOutput(Diagnostics *diag, char *message);
+static void diagFlush(Diagnostics *diag, OutputFunc output);
+static void *mapFile(int fd, size_t *size);
+static Error compileText(const char *text, size_t size, Image *image, SourceHash *hash,
+	OutputFunc output);
+static const char *nextLine(const char *line, const char *end);
+static const char *repeatedLine(const char *text, size_t size);
+static unsigned long long hashLine(const char *line, const char *end);
+static Error hashText(const char *text, size_t size, SourceHash *hash);
+static void hashSourceLine(SourceLine *source, const char *line, const char *end,
+	unsigned long long address, unsigned int count);
+static const char *extraLine(const char *text, size_t size, const char **lastEnd);
+static Error patchLine(const char *line, const char *end, unsigned int lineNr,
+	SourceLine *newLine, Diagnostics *diag, PatchFunc patch);
+static Error clearRemoved(SourceLine *oldLine, LineRange *ranges, size_t numRanges,
+	PatchFunc patch);
+static int lineChanged(SourceHash *oldHash, SourceHash *newHash, size_t lineNr);
+static int hasOverlap(SourceHash *hash);
+static int compareRanges(const void *a, const void *b);
+static size_t mergeRanges(LineRange *ranges, size_t numRanges);
+static void runChunks(Chunk *chunks, int numChunks, void *(*work)(void *));
+static void *countChunk(void *arg);
+static void *assembleChunk(void *arg);
+static Error readText(int fd, size_t size, char **text);
+static Error indexLines(LazyProgram *program, SegmentList *list, MemCell **cells,
+	int *overlap);
+static Error addLazyLine(LazyProgram *program, size_t offset, unsigned int address,
+	unsigned int lineNr);
+static LazyRun *findRun(LazyProgram *program, unsigned int address);
+static int fetchLazy(void *context, unsigned int address, MemCell *cell);
+static int nextLazy(void *context, unsigned int from, unsigned int *address);
+static void freeLazyProgram(LazyProgram *program);
 
 /** Compile a file of assembly instructions. The first line will have number 0.
  *  Compiled instructions are saved in the memory. Error messages are displayed
@@ -21,78 +198,1839 @@ static void prepareLine(char *line);
  */
 Error compile(FILE *fp, Memory **memory, OutputFunc output)
 {
-	char line[MAXLEN];
-	char buff[MAXLEN + 16];
-	MemCell instr;
-	unsigned int instrCounter = 0;
+	Image	image;
+	Error	rval = ERR_None;
 
 	assert(memory != NULL);
 
-	while(!feof(fp))
+	rval = compileImage(fp, &image, output);
+	if(rval != ERR_None)
+	{
+		return rval;
+	}
+
+	// Hand the whole program to the memory at once
+	rval = loadImage(memory, &image);
+	freeImage(&image);
+
+	return rval;
+}
+
+/** Compile a file of assembly instructions into an image. Every line is
+ *  placed at the address after the previous line, starting at address 0,
+ *  unless a .org directive sets the address. Free the image with freeImage.
+ *
+ *  Directives:
+ *    .org address		the next line is placed at address
+ *    .word value, ...		data cells with these values
+ *    .fill count, value	count data cells with the same value
+ *    .zero count		count data cells with value 0
+ *  A line whose cells would pass the last address is left out, and .fill
+ *  and .zero place at most MAX_FILL cells.
+ *
+ * @param [in] fp		File to compile
+ * @param [out] image		Compiled program
+ * @retval ERR_ReadingFile	Error getting line from file
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error compileImage(FILE *fp, Image *image, OutputFunc output)
+{
+	char			line[MAXLEN];
+	MemCell			*cells = NULL;
+	size_t			numCells = 0,
+				size = 0;
+	unsigned long long	address = 0;
+	unsigned int		lineNr = 0,
+				count = 0,
+				flags = 0;
+	int			isOrg = 0,
+				repeated = 0;
+	SegmentList		list = {NULL, 0, 0};
+	Diagnostics		diag = {NULL, NULL, 0, 0, ERR_None};
+	Error			rval = ERR_None;
+
+	assert(image != NULL);
+
+	diag.output = output;
+	line[0] = '\0';
+
+	while(!feof(fp) && rval == ERR_None)
 	{
-		Error	rval = ERR_None;
+		// Get line from the file. At the end of the file, the last line
+		// is assembled again (but a directive is not repeated).
+		if(fgets(line, MAXLEN, fp) == NULL)
+		{
+			if(!feof(fp))
+			{
+				rval = ERR_ReadingFile;
+				break;
+			}
+			repeated = 1;
+		}
 
-		// Get line from the file
-		if(fgets(line, MAXLEN, fp) == NULL && !feof(fp))
+		if(repeated && line[0] == '.')
 		{
-			return ERR_ReadingFile;
+			break;
 		}
 
-		// Remove comments and newline
-		prepareLine(line);
+		count = lineSize(line, &isOrg);
+		if(isOrg)
+		{
+			address = count;
+			lineNr++;
+			continue;
+		}
 
-		// Handle empty lines
-		if(line[0] == '\0')
+		if(address + count > ADDRESS_END)
 		{
-			sprintf(buff,
-				"  WARNING: Empty line (%d), replaing with NOP instruction.\n",
-				instrCounter);
-			output(buff);
-			instr.getal = 0;
+			reportPastEnd(line, lineNr, &diag);
+			address += count;
+			lineNr++;
+			continue;
 		}
-		else
+
+		// Grow the cell array when it is full
+		if(numCells + count > size)
+		{
+			MemCell *bigger = NULL;
+
+			size = size ? size * 2 : 256;
+			while(size < numCells + count)
+			{
+				size *= 2;
+			}
+			bigger = (MemCell*) realloc(cells, size * sizeof(MemCell));
+			if(bigger == NULL)
+			{
+				rval = ERR_OutOfMemory;
+				break;
+			}
+			cells = bigger;
+		}
+
+		flags = assembleLine(line, lineNr, &cells[numCells], &diag);
+		rval = addCells(&list, (unsigned int)address, count, flags, numCells);
+
+		address += count;
+		numCells += count;
+		lineNr++;
+	}
+
+	if(rval == ERR_None)
+	{
+		rval = buildImage(&list, cells, image);
+	}
+
+	free(list.segments);
+	if(rval != ERR_None)
+	{
+		free(cells);
+		return rval;
+	}
+
+	output("  Compilation complete.\n");
+
+	return ERR_None;
+}
+
+/** Compile a source file like compile, but the file is mapped in memory and
+ *  large files are assembled on multiple threads. Messages are displayed in
+ *  the order of the lines, as compile does.
+ *
+ * @param [in] filename		File to compile
+ * @param [in,out] memory	Memory where the compiled program will be saved
+ * @retval ERR_OpeningFile	File could not be opened
+ * @retval ERR_ReadingFile	Error getting line from file
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error compileFile(const char *filename, Memory **memory, OutputFunc output)
+{
+	Image	image;
+	Error	rval = ERR_None;
+
+	assert(memory != NULL);
+
+	rval = compileFileImage(filename, &image, NULL, output);
+	if(rval != ERR_None)
+	{
+		return rval;
+	}
+
+	rval = loadImage(memory, &image);
+	freeImage(&image);
+
+	return rval;
+}
+
+/** Same as compileFile, but the program is saved in an image like
+ *  compileImage does. Files that cannot be mapped (empty files, pipes) are
+ *  read with compileImage.
+ *
+ * @param [out] hash		When not NULL, the hashes of the lines for
+ *				recompileFile, calculated while the lines are
+ *				assembled. Free with freeSourceHash.
+ * @retval ERR_OpeningFile	File could not be opened
+ * @retval ERR_ReadingFile	Error getting line from file
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error compileFileImage(const char *filename, Image *image, SourceHash *hash,
+	OutputFunc output)
+{
+	int		fd = -1;
+	size_t		size = 0;
+	void		*text = MAP_FAILED;
+	FILE		*fp = NULL;
+	Error		rval = ERR_None;
+
+	assert(image != NULL);
+
+	fd = open(filename, O_RDONLY);
+	if(fd < 0)
+	{
+		return ERR_OpeningFile;
+	}
+
+	text = mapFile(fd, &size);
+	if(text == MAP_FAILED)
+	{
+		fp = fdopen(fd, "r");
+		if(fp == NULL)
 		{
-			// Parse the line and handle errors if any
-			rval = parseAsmInstr(line, &instr); 
+			close(fd);
+			return ERR_OpeningFile;
+		}
+		rval = compileImage(fp, image, output);
+		fclose(fp);
+
+		// Like recompileFile, a file that cannot be mapped is empty
+		if(rval == ERR_None && hash != NULL)
+		{
+			rval = hashText(NULL, 0, hash);
 			if(rval != ERR_None)
 			{
-				switch(rval)
-				{
-				case ERR_UnknownInstr:
-					sprintf(buff, "  ERROR: Unknown instruction at line %d: %s\n",
-						instrCounter, line);
-					break;
-				case ERR_InvalidInstr:
-					sprintf(buff, "  ERROR: Invalid use of instruction at line %d: %s\n",
-						instrCounter, line);
-					break;
-				default:
-					sprintf(buff, "  ERROR: Line %d: %s\n",
-						instrCounter, line);
-					break;
-				}
-				output(buff);
-				output("  > WARNING: Replacing with NOP instruction!\n");
-				instr.getal = 0;
+				freeImage(image);
 			}
 		}
+		return rval;
+	}
+
+	close(fd);
+	posix_madvise(text, size, POSIX_MADV_SEQUENTIAL);
+
+	rval = compileText((const char*)text, size, image, hash, output);
+	munmap(text, size);
+
+	return rval;
+}
+
+/** Re-assemble the lines of a source file that changed since it was hashed.
+ *  The file is split in lines like compileFile does, and line N is compared
+ *  with line N of the previous version. For every line whose text or
+ *  address changed, patch is called with each of its new cells. When .org
+ *  makes lines write over each other's cells, in either version, a line that
+ *  did not change may still own cells of a changed line, so then all lines
+ *  are patched again in order. Cells of the previous version that no line
+ *  of the new version covers are cleared by calling patch with a NULL cell.
+ *  Afterwards hash describes the new version. When patch is NULL, only the
+ *  hashes are calculated.
+ *
+ * @param [in] filename		Source file
+ * @param [in,out] hash		Hashes of the lines of the previous version
+ * @param [in] patch		Called for every changed or removed cell
+ * @param [out] changed		Number of changed and removed lines
+ * @retval ERR_OpeningFile	File could not be opened
+ * @retval ERR_ReadingFile	File could not be mapped
+ * @retval ERR_OutOfMemory	Malloc failed
+ * @return Or the first error returned by patch
+ */
+Error recompileFile(const char *filename, SourceHash *hash, PatchFunc patch,
+	OutputFunc output, unsigned int *changed)
+{
+	int			fd = -1;
+	void			*mapping = MAP_FAILED;
+	const char		*text = NULL,
+				*line = NULL,
+				*end = NULL,
+				*last = NULL,
+				*lastEnd = NULL;
+	size_t			size = 0,
+				numRanges = 0,
+				i = 0;
+	unsigned int		count = 0,
+				lineNr = 0;
+	int			overlap = 0,
+				patchAll = 0;
+	SourceHash		newHash = {0, NULL};
+	SourceLine		*newLine = NULL;
+	LineRange		*ranges = NULL;
+	Diagnostics		diag = {NULL, NULL, 0, 0, ERR_None};
+	Error			rval = ERR_None;
+
+	assert(hash != NULL && changed != NULL);
+
+	*changed = 0;
+	diag.output = output;
+
+	fd = open(filename, O_RDONLY);
+	if(fd < 0)
+	{
+		return ERR_OpeningFile;
+	}
+
+	mapping = mapFile(fd, &size);
+	close(fd);
+	if(mapping == MAP_FAILED && size > 0)
+	{
+		return ERR_ReadingFile;
+	}
+	text = mapping != MAP_FAILED ? (const char*) mapping : NULL;
+	last = extraLine(text, size, &lastEnd);
+
+	// Hash the lines and calculate their addresses
+	rval = hashText(text, size, &newHash);
+	ranges = rval == ERR_None
+		? (LineRange*) malloc(newHash.count * sizeof(LineRange) + 1) : NULL;
+	if(ranges == NULL)
+	{
+		free(newHash.lines);
+		if(mapping != MAP_FAILED)
+		{
+			munmap(mapping, size);
+		}
+		return ERR_OutOfMemory;
+	}
 
-		// Write the parsed instruction to memory
-		rval = writeMemCell(memory, instrCounter, instr);
-		if(rval != ERR_None)
+	count = newHash.count - (last != NULL);
+	for(lineNr = 0; lineNr < newHash.count; lineNr++)
+	{
+		newLine = &newHash.lines[lineNr];
+		if(newLine->count > 0)
 		{
-			return rval;
+			ranges[numRanges].address = newLine->address;
+			ranges[numRanges].count = newLine->count;
+			numRanges++;
 		}
 
-		instrCounter++;
+		patchAll = patchAll || lineChanged(hash, &newHash, lineNr);
 	}
 
-	output("  Compilation complete.\n");
+	overlap = hasOverlap(hash) || hasOverlap(&newHash);
+	patchAll = overlap && (patchAll || hash->count != newHash.count);
+
+	// Only the lines that changed are assembled, unless cells overlap
+	for(line = text, lineNr = 0; lineNr < newHash.count && patch != NULL
+		&& rval == ERR_None; lineNr++)
+	{
+		line = lineNr < count ? line : last;
+		end = lineNr < count ? nextLine(line, text + size) : lastEnd;
+
+		if(lineChanged(hash, &newHash, lineNr))
+		{
+			(*changed)++;
+			rval = patchLine(line, end, lineNr, &newHash.lines[lineNr], &diag, patch);
+		}
+		else if(patchAll)
+		{
+			rval = patchLine(line, end, lineNr, &newHash.lines[lineNr], &diag, patch);
+		}
+
+		line = end;
+	}
+
+	// Clear the cells of changed and removed lines that are not used by
+	// the new version
+	if(patch != NULL && rval == ERR_None)
+	{
+		if(overlap)
+		{
+			qsort(ranges, numRanges, sizeof(LineRange), compareRanges);
+			numRanges = mergeRanges(ranges, numRanges);
+		}
+
+		for(i = 0; i < hash->count && rval == ERR_None; i++)
+		{
+			if(i < newHash.count && !lineChanged(hash, &newHash, i))
+			{
+				continue;
+			}
+
+			if(i >= newHash.count)
+			{
+				(*changed)++;
+			}
+			rval = clearRemoved(&hash->lines[i], ranges, numRanges, patch);
+		}
+	}
+
+	if(mapping != MAP_FAILED)
+	{
+		munmap(mapping, size);
+	}
+	free(ranges);
+
+	if(rval != ERR_None)
+	{
+		free(newHash.lines);
+		return rval;
+	}
+
+	freeSourceHash(hash);
+	*hash = newHash;
+
+	return ERR_None;
+}
+
+/** Free the hashes of a source file */
+void freeSourceHash(SourceHash *hash)
+{
+	assert(hash != NULL);
+
+	free(hash->lines);
+	hash->lines = NULL;
+	hash->count = 0;
+}
+
+/** Load a source file without assembling the instructions. Only the start
+ *  of every line is found, with one scan for newlines, and the directives
+ *  are assembled (they are data, and they decide the addresses). An
+ *  instruction line is assembled when the program reads its cell for the
+ *  first time, and its messages are displayed at that moment. Pass lazy to
+ *  setLazyCells to start using it.
+ *
+ *  A file whose lines write over each other's cells with .org is assembled
+ *  completely, like compileFile does, and so is a file that cannot be read
+ *  at once (an empty file or a pipe). Then lazy->context is NULL.
+ *
+ * @param [in] filename		File to load
+ * @param [in,out] memory	Memory where the directives are saved
+ * @param [out] lazy		Free with freeLazy
+ * @retval ERR_OpeningFile	File could not be opened
+ * @retval ERR_ReadingFile	Error reading the file
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error compileLazy(const char *filename, Memory **memory, LazyCells *lazy, OutputFunc output)
+{
+	int		fd = -1,
+			overlap = 0;
+	struct stat	info;
+	LazyProgram	*program = NULL;
+	SegmentList	list = {NULL, 0, 0};
+	MemCell		*cells = NULL;
+	Image		image;
+	char		buff[MAXLEN];
+	Error		rval = ERR_None;
+
+	assert(memory != NULL && lazy != NULL);
+
+	lazy->fetch = fetchLazy;
+	lazy->next = nextLazy;
+	lazy->context = NULL;
+
+	fd = open(filename, O_RDONLY);
+	if(fd < 0)
+	{
+		return ERR_OpeningFile;
+	}
+
+	if(fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0)
+	{
+		close(fd);
+		return compileFile(filename, memory, output);
+	}
+
+	program = (LazyProgram*) calloc(1, sizeof(LazyProgram));
+	if(program == NULL)
+	{
+		close(fd);
+		return ERR_OutOfMemory;
+	}
+
+	program->size = (size_t)info.st_size;
+	rval = readText(fd, program->size, &program->text);
+	close(fd);
+
+	rval = rval == ERR_None ? indexLines(program, &list, &cells, &overlap) : rval;
+	rval = rval == ERR_None ? program->diag.error : rval;
+	if(rval == ERR_None && overlap)
+	{
+		// Later lines would have to replace earlier ones
+		rval = compileText(program->text, program->size, &image, NULL, output);
+		if(rval == ERR_None)
+		{
+			rval = loadImage(memory, &image);
+			freeImage(&image);
+		}
+		free(cells);
+		cells = NULL;
+		freeLazyProgram(program);
+		program = NULL;
+	}
+	else if(rval == ERR_None)
+	{
+		rval = buildImage(&list, cells, &image);
+		if(rval == ERR_None)
+		{
+			cells = NULL;
+			rval = loadImage(memory, &image);
+			freeImage(&image);
+		}
+	}
+	free(list.segments);
+	free(cells);
+
+	if(program == NULL)
+	{
+		return rval;
+	}
+
+	if(rval != ERR_None)
+	{
+		freeLazyProgram(program);
+		return rval;
+	}
+
+	// The messages of the directives, from now on they are displayed
+	diagFlush(&program->diag, output);
+	free(program->diag.text);
+	memset(&program->diag, 0, sizeof(Diagnostics));
+	program->diag.output = output;
+	lazy->context = program;
+
+	sprintf(buff, "  Indexed %lu instructions, they are assembled when they are used.\n",
+		(unsigned long)program->numLines);
+	output(buff);
+
+	return ERR_None;
+}
+
+/** Hash the lines of the source of a lazy program, exactly like
+ *  recompileFile hashes a file, so the program can be reloaded after the
+ *  source file was changed.
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error hashLazySource(LazyCells *lazy, SourceHash *hash)
+{
+	LazyProgram *program = (LazyProgram*) lazy->context;
+
+	assert(program != NULL && hash != NULL);
+
+	return hashText(program->text, program->size, hash);
+}
+
+/** Free the source and the index of a lazy program. Its cells that were not
+ *  used are lost, call loadLazyCells first to keep them. */
+void freeLazy(LazyCells *lazy)
+{
+	assert(lazy != NULL);
+
+	freeLazyProgram((LazyProgram*) lazy->context);
+	lazy->context = NULL;
+}
+
+/** Private function: split a text in lines like compileFile does, and hash
+ *  the lines and calculate their addresses for recompileFile
+ *
+ * @param [in] text		Text of the source file, NULL when it is empty
+ * @param [out] hash		Free with freeSourceHash
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error hashText(const char *text, size_t size, SourceHash *hash)
+{
+	const char		*line = NULL,
+				*end = NULL,
+				*last = NULL,
+				*lastEnd = NULL;
+	char			buff[MAXLEN];
+	unsigned long long	address = 0;
+	unsigned int		count = 0,
+				lineNr = 0,
+				numCells = 0;
+	int			isOrg = 0;
+	SourceLine		*newLine = NULL;
+
+	last = extraLine(text, size, &lastEnd);
+
+	for(line = text; line < text + size; line = nextLine(line, text + size))
+	{
+		count++;
+	}
+
+	hash->count = count + (last != NULL);
+	hash->lines = (SourceLine*) malloc(hash->count * sizeof(SourceLine) + 1);
+	if(hash->lines == NULL)
+	{
+		hash->count = 0;
+		return ERR_OutOfMemory;
+	}
+
+	for(line = text; lineNr < hash->count; lineNr++)
+	{
+		line = lineNr < count ? line : last;
+		end = lineNr < count ? nextLine(line, text + size) : lastEnd;
+
+		memcpy(buff, line, end - line);
+		buff[end - line] = '\0';
+
+		newLine = &hash->lines[lineNr];
+		numCells = lineSize(buff, &isOrg);
+		hashSourceLine(newLine, line, end, address, isOrg ? 0 : numCells);
+		address = isOrg ? numCells : address + numCells;
+
+		line = end;
+	}
 
 	return ERR_None;
 }
 
-/** Prepares a line for parsing: removes comments and the newline */
+/** Private function: set the hash, address and number of cells of a line.
+ *  A .org has no cells, and a line that passes the last address has none
+ *  either, see patchLine. */
+static void hashSourceLine(SourceLine *source, const char *line, const char *end,
+	unsigned long long address, unsigned int count)
+{
+	source->hash = hashLine(line, end);
+	source->address = address + count <= ADDRESS_END ? (unsigned int)address : 0;
+	source->count = address + count <= ADDRESS_END ? count : 0;
+}
+
+/** Private function: the line that is assembled once more after the last
+ *  line of a text, see repeatedLine, or NULL. A repeated directive is left
+ *  out, and like compile reads it an empty text is one empty line. */
+static const char *extraLine(const char *text, size_t size, const char **lastEnd)
+{
+	static const char	emptyLine[] = "";
+	const char		*last = NULL;
+
+	if(size == 0)
+	{
+		*lastEnd = emptyLine;
+		return emptyLine;
+	}
+
+	last = repeatedLine(text, size);
+	*lastEnd = text + size;
+
+	return last != NULL && *last == '.' ? NULL : last;
+}
+
+/** Private function: assemble a changed line and patch its cells */
+static Error patchLine(const char *line, const char *end, unsigned int lineNr,
+	SourceLine *newLine, Diagnostics *diag, PatchFunc patch)
+{
+	char		buff[MAXLEN];
+	MemCell		cell,
+			*cells = &cell;
+	unsigned int	i = 0;
+	int		isOrg = 0;
+	Error		rval = ERR_None;
+
+	memcpy(buff, line, end - line);
+	buff[end - line] = '\0';
+
+	if(newLine->count == 0)
+	{
+		// Only a line that passes the last address loses its cells
+		if(lineSize(buff, &isOrg) > 0 && !isOrg)
+		{
+			reportPastEnd(buff, lineNr, diag);
+		}
+		return ERR_None;
+	}
+
+	if(newLine->count > 1)
+	{
+		cells = (MemCell*) malloc(newLine->count * sizeof(MemCell));
+		if(cells == NULL)
+		{
+			return ERR_OutOfMemory;
+		}
+	}
+
+	assembleLine(buff, lineNr, cells, diag);
+
+	for(i = 0; i < newLine->count && rval == ERR_None; i++)
+	{
+		rval = patch(newLine->address + i, &cells[i]);
+	}
+
+	if(cells != &cell)
+	{
+		free(cells);
+	}
+
+	return rval;
+}
+
+/** Private function: clear the cells of a line of the previous version
+ *  that are not in one of the (sorted) ranges of the new version */
+static Error clearRemoved(SourceLine *oldLine, LineRange *ranges, size_t numRanges,
+	PatchFunc patch)
+{
+	unsigned long long	address = oldLine->address,
+				end = (unsigned long long)oldLine->address + oldLine->count;
+	size_t			low = 0,
+				high = numRanges,
+				mid = 0;
+	Error			rval = ERR_None;
+
+	// First range that ends after the address
+	while(low < high)
+	{
+		mid = (low + high) / 2;
+		if((unsigned long long)ranges[mid].address + ranges[mid].count <= address)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+
+	while(address < end && rval == ERR_None)
+	{
+		if(low < numRanges && ranges[low].address <= address)
+		{
+			// Skip the cells the range covers
+			address = (unsigned long long)ranges[low].address + ranges[low].count;
+			low++;
+		}
+		else
+		{
+			rval = patch((unsigned int)address, NULL);
+			address++;
+		}
+	}
+
+	return rval;
+}
+
+/** Private function: did the text, address or size of a line change? A
+ *  line that is new is changed too. */
+static int lineChanged(SourceHash *oldHash, SourceHash *newHash, size_t lineNr)
+{
+	SourceLine	*oldLine = NULL,
+			*newLine = &newHash->lines[lineNr];
+
+	if(lineNr >= oldHash->count)
+	{
+		return 1;
+	}
+
+	oldLine = &oldHash->lines[lineNr];
+	return oldLine->hash != newLine->hash || oldLine->address != newLine->address
+		|| oldLine->count != newLine->count;
+}
+
+/** Private function: does a line write to the cells of an earlier line? If
+ *  not, the cells of the lines are in increasing order. */
+static int hasOverlap(SourceHash *hash)
+{
+	unsigned long long	end = 0;
+	unsigned int		i = 0;
+
+	for(i = 0; i < hash->count; i++)
+	{
+		if(hash->lines[i].count == 0)
+		{
+			continue;
+		}
+		if(hash->lines[i].address < end)
+		{
+			return 1;
+		}
+		end = (unsigned long long)hash->lines[i].address + hash->lines[i].count;
+	}
+
+	return 0;
+}
+
+/** Private function: order ranges by address */
+static int compareRanges(const void *a, const void *b)
+{
+	const LineRange	*ra = (const LineRange*) a,
+			*rb = (const LineRange*) b;
+
+	return ra->address < rb->address ? -1 : ra->address > rb->address;
+}
+
+/** Private function: merge the overlapping ranges of a sorted array.
+ *  Returns the new number of ranges. */
+static size_t mergeRanges(LineRange *ranges, size_t numRanges)
+{
+	size_t			i = 0,
+				merged = 0;
+	unsigned long long	end = 0;
+
+	for(i = 0; i < numRanges; i++)
+	{
+		if(merged > 0 && ranges[i].address <= end)
+		{
+			if((unsigned long long)ranges[i].address + ranges[i].count > end)
+			{
+				end = (unsigned long long)ranges[i].address + ranges[i].count;
+				ranges[merged - 1].count = (unsigned int)(end - ranges[merged - 1].address);
+			}
+			continue;
+		}
+
+		ranges[merged++] = ranges[i];
+		end = (unsigned long long)ranges[i].address + ranges[i].count;
+	}
+
+	return merged;
+}
+
+/** Private function: FNV-1a hash of a line */
+static unsigned long long hashLine(const char *line, const char *end)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+
+	for(; line < end; line++)
+	{
+		hash ^= (unsigned char)*line;
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+/** Private function: compile the text of a source file. The text is split
+ *  in lines exactly like compileImage reads them with fgets: lines longer
+ *  than MAXLEN - 1 characters are split, and when reading the last line did
+ *  not reach the end of the file, it is read twice.
+ *
+ *  The text is split in chunks at line boundaries. First the lines and cells
+ *  of every chunk are counted, which gives the number of its first line and
+ *  its first address, then the chunks are assembled. Both steps run a thread
+ *  per chunk. When hash is not NULL, the lines are hashed while they are
+ *  assembled, exactly like hashText does.
+ */
+static Error compileText(const char *text, size_t size, Image *image, SourceHash *hash,
+	OutputFunc output)
+{
+	Chunk			chunks[MAX_THREADS];
+	int			numChunks = 1,
+				i = 0;
+	long			numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned long long	address = 0;
+	unsigned int		lineNr = 0,
+				j = 0,
+				flags = 0;
+	size_t			numCells = 0;
+	const char		*split = NULL,
+				*last = NULL;
+	char			line[MAXLEN];
+	MemCell			*cells = NULL;
+	SegmentList		list = {NULL, 0, 0};
+	Error			rval = ERR_None;
+
+	if(numCpus > 1 && size >= 2 * CHUNK_MINSIZE)
+	{
+		numChunks = size / CHUNK_MINSIZE < (size_t)numCpus
+			? (int)(size / CHUNK_MINSIZE) : (int)numCpus;
+		numChunks = numChunks > MAX_THREADS ? MAX_THREADS : numChunks;
+	}
+
+	// Every chunk but the last one ends after a newline
+	for(i = 0; i < numChunks; i++)
+	{
+		memset(&chunks[i], 0, sizeof(Chunk));
+		chunks[i].begin = i == 0 ? text : chunks[i - 1].end;
+		chunks[i].end = text + size;
+
+		split = text + size / numChunks * (i + 1);
+		if(i < numChunks - 1 && split > chunks[i].begin)
+		{
+			split = memchr(split - 1, '\n', text + size - (split - 1));
+			chunks[i].end = split != NULL ? split + 1 : text + size;
+		}
+		else if(i < numChunks - 1)
+		{
+			chunks[i].end = chunks[i].begin;
+		}
+	}
+
+	runChunks(chunks, numChunks, countChunk);
+
+	for(i = 0; i < numChunks; i++)
+	{
+		chunks[i].lineBase = lineNr;
+		chunks[i].cellBase = numCells;
+		chunks[i].address = address;
+		lineNr += chunks[i].numLines;
+		numCells += chunks[i].numCells;
+		address = chunks[i].hasOrg ? chunks[i].orgEnd : address + chunks[i].numCells;
+	}
+
+	// A repeated directive would place its data twice
+	last = repeatedLine(text, size);
+	last = last != NULL && *last == '.' ? NULL : last;
+
+	cells = (MemCell*) malloc((numCells + 1) * sizeof(MemCell));
+	if(cells == NULL)
+	{
+		return ERR_OutOfMemory;
+	}
+
+	if(hash != NULL)
+	{
+		hash->count = lineNr + (last != NULL);
+		hash->lines = (SourceLine*) malloc(hash->count * sizeof(SourceLine) + 1);
+		if(hash->lines == NULL)
+		{
+			hash->count = 0;
+			free(cells);
+			return ERR_OutOfMemory;
+		}
+	}
+
+	// The first chunk is assembled by this thread and can display its
+	// messages directly, the others are displayed afterwards
+	for(i = 0; i < numChunks; i++)
+	{
+		chunks[i].cells = cells;
+		chunks[i].lines = hash != NULL ? hash->lines : NULL;
+		chunks[i].diag.output = i == 0 ? output : NULL;
+	}
+
+	runChunks(chunks, numChunks, assembleChunk);
+
+	for(i = 0; i < numChunks; i++)
+	{
+		if(chunks[i].diag.error != ERR_None)
+		{
+			rval = chunks[i].diag.error;
+		}
+		else if(rval == ERR_None)
+		{
+			diagFlush(&chunks[i].diag, output);
+		}
+
+		// Join the segments of the chunks
+		for(j = 0; j < chunks[i].segments.count && rval == ERR_None; j++)
+		{
+			Segment *segment = &chunks[i].segments.segments[j];
+
+			rval = addCells(&list, segment->base, segment->count, segment->flags,
+				segment->offset);
+		}
+
+		free(chunks[i].diag.text);
+		free(chunks[i].segments.segments);
+	}
+
+	if(last != NULL && rval == ERR_None)
+	{
+		memcpy(line, last, text + size - last);
+		line[text + size - last] = '\0';
+		if(hash != NULL)
+		{
+			hashSourceLine(&hash->lines[lineNr], last, text + size, address, 1);
+		}
+		if(address + 1 > ADDRESS_END)
+		{
+			reportPastEnd(line, lineNr, &chunks[0].diag);
+		}
+		else
+		{
+			flags = assembleLine(line, lineNr, &cells[numCells], &chunks[0].diag);
+			rval = addCells(&list, (unsigned int)address, 1, flags, numCells);
+		}
+	}
+
+	if(rval == ERR_None)
+	{
+		rval = buildImage(&list, cells, image);
+	}
+
+	free(list.segments);
+	if(rval != ERR_None)
+	{
+		free(cells);
+		if(hash != NULL)
+		{
+			freeSourceHash(hash);
+		}
+		return rval;
+	}
+
+	output("  Compilation complete.\n");
+
+	return ERR_None;
+}
+
+/** Private function: map a file in memory. Returns MAP_FAILED if the file
+ *  cannot be mapped, e.g. because it is empty or not a regular file. */
+static void *mapFile(int fd, size_t *size)
+{
+	struct stat info;
+
+	*size = 0;
+	if(fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0)
+	{
+		return MAP_FAILED;
+	}
+
+	*size = (size_t)info.st_size;
+	return mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+}
+
+/** Private function: end of the line that starts at 'line', as fgets would
+ *  read it: after the newline, after MAXLEN - 1 characters or at the end of
+ *  the text. */
+static const char *nextLine(const char *line, const char *end)
+{
+	const char *newline = NULL;
+
+	if(end - line > MAXLEN - 1)
+	{
+		end = line + MAXLEN - 1;
+	}
+
+	newline = memchr(line, '\n', end - line);
+	return newline != NULL ? newline + 1 : end;
+}
+
+/** Private function: start of the line that fgets reads again at the end
+ *  of the text, because reading it did not reach the end of the file.
+ *  Returns NULL when the last line is not repeated. */
+static const char *repeatedLine(const char *text, size_t size)
+{
+	const char *last = text + size - 1;
+
+	while(last > text && last[-1] != '\n')
+	{
+		last--;
+	}
+	last += (text + size - 1 - last) / (MAXLEN - 1) * (MAXLEN - 1);
+
+	if(text[size - 1] != '\n' && text + size - last < MAXLEN - 1)
+	{
+		return NULL;
+	}
+
+	return last;
+}
+
+/** Private function: run work for every chunk, on a thread per chunk. The
+ *  first chunk (and any chunk for which no thread can be created) runs on
+ *  the calling thread. */
+static void runChunks(Chunk *chunks, int numChunks, void *(*work)(void *))
+{
+	int	started[MAX_THREADS];
+	int	i = 0;
+
+	for(i = 1; i < numChunks; i++)
+	{
+		started[i] = pthread_create(&chunks[i].thread, NULL, work, &chunks[i]) == 0;
+		if(!started[i])
+		{
+			work(&chunks[i]);
+		}
+	}
+
+	work(&chunks[0]);
+
+	for(i = 1; i < numChunks; i++)
+	{
+		if(started[i])
+		{
+			pthread_join(chunks[i].thread, NULL);
+		}
+	}
+}
+
+/** Private function: count the lines and cells of a chunk */
+static void *countChunk(void *arg)
+{
+	Chunk		*chunk = (Chunk*) arg;
+	const char	*line = NULL,
+			*end = NULL;
+	char		buff[MAXLEN];
+	unsigned int	count = 0;
+	int		isOrg = 0;
+
+	for(line = chunk->begin; line < chunk->end; line = end)
+	{
+		end = nextLine(line, chunk->end);
+		chunk->numLines++;
+
+		// Only directives can have another size than one cell
+		count = 1;
+		if(*line == '.')
+		{
+			memcpy(buff, line, end - line);
+			buff[end - line] = '\0';
+			count = lineSize(buff, &isOrg);
+			if(isOrg)
+			{
+				chunk->hasOrg = 1;
+				chunk->orgEnd = count;
+				continue;
+			}
+		}
+
+		chunk->numCells += count;
+		chunk->orgEnd += count;
+	}
+
+	return NULL;
+}
+
+/** Private function: assemble the lines of a chunk */
+static void *assembleChunk(void *arg)
+{
+	Chunk			*chunk = (Chunk*) arg;
+	const char		*line = NULL,
+				*end = NULL;
+	char			buff[MAXLEN];
+	unsigned long long	address = chunk->address;
+	unsigned int		lineNr = chunk->lineBase,
+				count = 0,
+				flags = 0;
+	size_t			offset = chunk->cellBase;
+	int			isOrg = 0;
+	Error			rval = ERR_None;
+
+	for(line = chunk->begin; line < chunk->end; line = end)
+	{
+		end = nextLine(line, chunk->end);
+
+		// The line is copied, assembleLine needs a string it may change
+		memcpy(buff, line, end - line);
+		buff[end - line] = '\0';
+
+		count = lineSize(buff, &isOrg);
+		if(chunk->lines != NULL)
+		{
+			hashSourceLine(&chunk->lines[lineNr], line, end, address, isOrg ? 0 : count);
+		}
+		if(isOrg)
+		{
+			address = count;
+			lineNr++;
+			continue;
+		}
+
+		// The cells of a line that is left out stay unused
+		if(address + count > ADDRESS_END)
+		{
+			reportPastEnd(buff, lineNr, &chunk->diag);
+		}
+		else
+		{
+			flags = assembleLine(buff, lineNr, &chunk->cells[offset], &chunk->diag);
+			rval = addCells(&chunk->segments, (unsigned int)address, count, flags, offset);
+			if(rval != ERR_None)
+			{
+				chunk->diag.error = rval;
+				break;
+			}
+		}
+
+		address += count;
+		offset += count;
+		lineNr++;
+	}
+
+	return NULL;
+}
+
+/** Private function: read a whole file of a known size
+ *
+ * @param [out] text		Free with free()
+ * @retval ERR_ReadingFile	Error reading the file
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error readText(int fd, size_t size, char **text)
+{
+	size_t	done = 0;
+	ssize_t	got = 0;
+
+	*text = (char*) malloc(size + 1);
+	if(*text == NULL)
+	{
+		return ERR_OutOfMemory;
+	}
+
+	while(done < size)
+	{
+		got = read(fd, *text + done, size - done);
+		if(got < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if(got <= 0)
+		{
+			// The file became shorter or could not be read
+			free(*text);
+			*text = NULL;
+			return ERR_ReadingFile;
+		}
+		done += (size_t)got;
+	}
+
+	return ERR_None;
+}
+
+/** Private function: find the instruction lines of a lazy program and
+ *  assemble its directives into segments, in one pass over the text. When
+ *  a line is placed before the end of an earlier line, overlap is set and
+ *  the index is not complete.
+ *
+ * @param [out] cells		Cells of the directives, the segments point in it
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error indexLines(LazyProgram *program, SegmentList *list, MemCell **cells,
+	int *overlap)
+{
+	const char		*text = program->text,
+				*line = NULL,
+				*end = NULL,
+				*last = NULL;
+	char			buff[MAXLEN];
+	unsigned long long	address = 0,
+				used = 0;
+	unsigned int		lineNr = 0,
+				count = 0,
+				flags = 0;
+	size_t			numCells = 0,
+				size = 0;
+	int			isOrg = 0;
+	Error			rval = ERR_None;
+
+	*overlap = 0;
+	*cells = NULL;
+
+	for(line = text; line < text + program->size && rval == ERR_None; line = end, lineNr++)
+	{
+		end = nextLine(line, text + program->size);
+
+		if(*line != '.')
+		{
+			if(address < used || address > UINT_MAX)
+			{
+				*overlap = 1;
+				return ERR_None;
+			}
+
+			rval = addLazyLine(program, (size_t)(line - text), (unsigned int)address, lineNr);
+			used = ++address;
+			continue;
+		}
+
+		// Directives are assembled now, they are rare
+		memcpy(buff, line, end - line);
+		buff[end - line] = '\0';
+
+		count = lineSize(buff, &isOrg);
+		if(isOrg)
+		{
+			address = count;
+			continue;
+		}
+
+		if(address < used || address + count > (unsigned long long)UINT_MAX + 1)
+		{
+			*overlap = 1;
+			return ERR_None;
+		}
+
+		if(numCells + count > size)
+		{
+			MemCell *bigger = NULL;
+
+			size = size ? size * 2 : 256;
+			while(size < numCells + count)
+			{
+				size *= 2;
+			}
+			bigger = (MemCell*) realloc(*cells, size * sizeof(MemCell));
+			if(bigger == NULL)
+			{
+				return ERR_OutOfMemory;
+			}
+			*cells = bigger;
+		}
+
+		flags = assembleLine(buff, lineNr, &(*cells)[numCells], &program->diag);
+		rval = addCells(list, (unsigned int)address, count, flags, numCells);
+
+		numCells += count;
+		used = address += count;
+	}
+
+	// Like compileText, the last line is assembled again
+	last = repeatedLine(text, program->size);
+	if(rval == ERR_None && last != NULL && *last != '.')
+	{
+		if(address < used || address > UINT_MAX)
+		{
+			*overlap = 1;
+			return ERR_None;
+		}
+		rval = addLazyLine(program, (size_t)(last - text), (unsigned int)address, lineNr);
+	}
+
+	if(rval == ERR_None)
+	{
+		program->pending = (unsigned char*) malloc(program->numLines + 1);
+		rval = program->pending == NULL ? ERR_OutOfMemory : ERR_None;
+	}
+	if(rval == ERR_None)
+	{
+		memset(program->pending, 1, program->numLines);
+	}
+
+	return rval;
+}
+
+/** Private function: add an instruction line to the index of a lazy
+ *  program. It is added to the last run when it follows it, both in the
+ *  text and in the memory.
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error addLazyLine(LazyProgram *program, size_t offset, unsigned int address,
+	unsigned int lineNr)
+{
+	LazyRun *run = program->numRuns > 0 ? &program->runs[program->numRuns - 1] : NULL;
+
+	if(program->numLines == program->linesSize)
+	{
+		size_t	size = program->linesSize ? program->linesSize * 2 : 4096;
+		size_t	*bigger = (size_t*) realloc(program->lines, size * sizeof(size_t));
+
+		if(bigger == NULL)
+		{
+			return ERR_OutOfMemory;
+		}
+		program->lines = bigger;
+		program->linesSize = size;
+	}
+
+	if(run == NULL || run->base + run->count != address || run->lineNr + run->count != lineNr)
+	{
+		if(program->numRuns == program->runsSize)
+		{
+			unsigned int	size = program->runsSize ? program->runsSize * 2 : 16;
+			LazyRun		*bigger = (LazyRun*) realloc(program->runs, size * sizeof(LazyRun));
+
+			if(bigger == NULL)
+			{
+				return ERR_OutOfMemory;
+			}
+			program->runs = bigger;
+			program->runsSize = size;
+		}
+
+		run = &program->runs[program->numRuns++];
+		run->base = address;
+		run->count = 0;
+		run->lineNr = lineNr;
+		run->first = program->numLines;
+	}
+
+	program->lines[program->numLines++] = offset;
+	run->count++;
+
+	return ERR_None;
+}
+
+/** Private function: the run of a lazy program with the first address after
+ *  'address' as its last address, or NULL when all runs end before it */
+static LazyRun *findRun(LazyProgram *program, unsigned int address)
+{
+	unsigned int	low = 0,
+			high = program->numRuns,
+			mid = 0;
+
+	while(low < high)
+	{
+		mid = low + (high - low) / 2;
+		if(program->runs[mid].base + (program->runs[mid].count - 1) < address)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+
+	return low < program->numRuns ? &program->runs[low] : NULL;
+}
+
+/** Private function: assemble the line of a lazy cell, or drop it when cell
+ *  is NULL. Every line is assembled at most once, see LazyCells. */
+static int fetchLazy(void *context, unsigned int address, MemCell *cell)
+{
+	LazyProgram	*program = (LazyProgram*) context;
+	LazyRun		*run = findRun(program, address);
+	const char	*line = NULL,
+			*end = NULL;
+	char		buff[MAXLEN];
+	size_t		index = 0;
+
+	if(run == NULL || run->base > address)
+	{
+		return 0;
+	}
+
+	index = run->first + (address - run->base);
+	if(!program->pending[index])
+	{
+		return 0;
+	}
+	program->pending[index] = 0;
+
+	if(cell == NULL)
+	{
+		return 1;
+	}
+
+	line = program->text + program->lines[index];
+	end = nextLine(line, program->text + program->size);
+	memcpy(buff, line, end - line);
+	buff[end - line] = '\0';
+	assembleLine(buff, run->lineNr + (address - run->base), cell, &program->diag);
+
+	return 1;
+}
+
+/** Private function: first address from 'from' of a line of a lazy
+ *  program that was not assembled or dropped yet */
+static int nextLazy(void *context, unsigned int from, unsigned int *address)
+{
+	LazyProgram	*program = (LazyProgram*) context;
+	LazyRun		*run = findRun(program, from),
+			*runsEnd = program->runs + program->numRuns;
+	size_t		index = 0,
+			last = 0;
+
+	for(; run != NULL && run < runsEnd; run++)
+	{
+		index = run->first + (from > run->base ? from - run->base : 0);
+		last = run->first + run->count;
+
+		while(index < last && !program->pending[index])
+		{
+			index++;
+		}
+
+		if(index < last)
+		{
+			*address = run->base + (unsigned int)(index - run->first);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/** Private function: free a lazy program */
+static void freeLazyProgram(LazyProgram *program)
+{
+	if(program == NULL)
+	{
+		return;
+	}
+
+	free(program->text);
+	free(program->lines);
+	free(program->pending);
+	free(program->runs);
+	free(program->diag.text);
+	free(program);
+}
+
+/** Private function: add cells to the list of segments. Cells that follow
+ *  the last segment, both in the cell array and in the memory, and that have
+ *  the same flags are added to it.
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error addCells(SegmentList *list, unsigned int address, unsigned int count,
+	unsigned int flags, size_t offset)
+{
+	Segment *segment = list->count > 0 ? &list->segments[list->count - 1] : NULL;
+
+	if(count == 0)
+	{
+		return ERR_None;
+	}
+
+	if(segment != NULL && segment->flags == flags
+		&& segment->base + segment->count == address
+		&& segment->offset + segment->count == offset)
+	{
+		segment->count += count;
+		return ERR_None;
+	}
+
+	if(list->count == list->size)
+	{
+		Segment		*bigger = NULL;
+		unsigned int	size = list->size ? list->size * 2 : 16;
+
+		bigger = (Segment*) realloc(list->segments, size * sizeof(Segment));
+		if(bigger == NULL)
+		{
+			return ERR_OutOfMemory;
+		}
+		list->segments = bigger;
+		list->size = size;
+	}
+
+	segment = &list->segments[list->count++];
+	segment->base = address;
+	segment->count = count;
+	segment->flags = flags;
+	segment->offset = offset;
+
+	return ERR_None;
+}
+
+/** Private function: fill in an image with the assembled segments. The
+ *  image owns the cell array afterwards.
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error buildImage(SegmentList *list, MemCell *cells, Image *image)
+{
+	unsigned int i = 0;
+
+	image->segments = (ImageSegment*) malloc(list->count * sizeof(ImageSegment) + 1);
+	if(image->segments == NULL)
+	{
+		return ERR_OutOfMemory;
+	}
+
+	for(i = 0; i < list->count; i++)
+	{
+		image->segments[i].base = list->segments[i].base;
+		image->segments[i].count = list->segments[i].count;
+		image->segments[i].flags = list->segments[i].flags;
+		image->segments[i].cells = cells + list->segments[i].offset;
+	}
+
+	image->entry = 0;
+	image->stackPointer = STACK_START;
+	image->regA = 0;
+	image->regB = 0;
+	image->flags = 0;
+	image->numSegments = list->count;
+	image->cells = cells;
+	image->mapping = NULL;
+	image->mapSize = 0;
+
+	return ERR_None;
+}
+
+/** Private function: display a message, or save it when there is no output
+ *  function. When saving fails the error is set. */
+static void diagOutput(Diagnostics *diag, char *message)
+{
+	size_t length = strlen(message) + 1;
+
+	if(diag->output != NULL)
+	{
+		diag->output(message);
+		return;
+	}
+
+	if(diag->length + length > diag->size)
+	{
+		size_t	size = diag->size ? diag->size * 2 : 4096;
+		char	*bigger = NULL;
+
+		while(size < diag->length + length)
+		{
+			size *= 2;
+		}
+
+		bigger = (char*) realloc(diag->text, size);
+		if(bigger == NULL)
+		{
+			diag->error = ERR_OutOfMemory;
+			return;
+		}
+		diag->text = bigger;
+		diag->size = size;
+	}
+
+	memcpy(diag->text + diag->length, message, length);
+	diag->length += length;
+}
+
+/** Private function: display the saved messages */
+static void diagFlush(Diagnostics *diag, OutputFunc output)
+{
+	size_t pos = 0;
+
+	while(pos < diag->length)
+	{
+		output(diag->text + pos);
+		pos += strlen(diag->text + pos) + 1;
+	}
+}
+
+/** Assemble one line of the source into the cells, lineSize gives the
+ *  number of cells. Empty and invalid lines become a NOP instruction, a
+ *  warning or error is displayed.
+ *
+ * @return The segment flags of the cells: code or data
+ */
+static unsigned int assembleLine(char *line, unsigned int lineNr, MemCell *cells,
+	Diagnostics *diag)
+{
+	char		buff[MAXLEN + 64];
+	Directive	dir;
+	const char	*p = NULL;
+	long long	value = 0;
+	unsigned int	i = 0;
+	Error		rval = ERR_None;
+
+	// Handle empty lines (nothing before the comment or newline)
+	if(line[0] == '\0' || line[0] == ';' || line[0] == '\n')
+	{
+		sprintf(buff,
+			"  WARNING: Empty line (%d), replaing with NOP instruction.\n",
+			lineNr);
+		diagOutput(diag, buff);
+		cells->getal = 0;
+		return IMAGE_SEG_CODE;
+	}
+
+	// Directives place data
+	if(line[0] == '.')
+	{
+		rval = parseDirective(line, &dir);
+		if(rval == ERR_None)
+		{
+			for(i = 0, p = dir.values; dir.type == DIR_Word && i < dir.count; i++)
+			{
+				readNumber(&p, INT_MIN, UINT_MAX, &value);
+				cells[i].getal = (int)(unsigned int)value;
+				p += *p == ',';
+			}
+			for(i = 0; dir.type != DIR_Word && dir.type != DIR_Org && i < dir.count; i++)
+			{
+				cells[i].getal = dir.type == DIR_Fill ? dir.value : 0;
+			}
+			return IMAGE_SEG_DATA;
+		}
+
+		prepareLine(line);
+		strtolower(line);
+		sprintf(buff, "  ERROR: Invalid directive at line %d: %s\n", lineNr, line);
+		diagOutput(diag, buff);
+		diagOutput(diag, "  > WARNING: Replacing with NOP instruction!\n");
+		cells->getal = 0;
+		return IMAGE_SEG_CODE;
+	}
+
+	// Parse the line and handle errors if any. The parser stops at the
+	// comment, so the line only has to be prepared for the error message.
+	rval = parseAsmLine(line, cells);
+	if(rval != ERR_None)
+	{
+		prepareLine(line);
+		strtolower(line);
+		switch(rval)
+		{
+		case ERR_UnknownInstr:
+			sprintf(buff, "  ERROR: Unknown instruction at line %d: %s\n",
+				lineNr, line);
+			break;
+		case ERR_InvalidInstr:
+			sprintf(buff, "  ERROR: Invalid use of instruction at line %d: %s\n",
+				lineNr, line);
+			break;
+		default:
+			sprintf(buff, "  ERROR: Line %d: %s\n",
+				lineNr, line);
+			break;
+		}
+		diagOutput(diag, buff);
+		diagOutput(diag, "  > WARNING: Replacing with NOP instruction!\n");
+		cells->getal = 0;
+	}
+
+	return IMAGE_SEG_CODE;
+}
+
+/** Private function: number of cells that a line is assembled to. For a
+ *  .org directive isOrg is set and the address is returned instead. Lines
+ *  that are not a (valid) directive are one cell. */
+static unsigned int lineSize(const char *line, int *isOrg)
+{
+	Directive dir;
+
+	*isOrg = 0;
+	if(line[0] != '.' || parseDirective(line, &dir) != ERR_None)
+	{
+		return 1;
+	}
+
+	*isOrg = dir.type == DIR_Org;
+	return dir.count;
+}
+
+/** Private function: display the error for a line that is left out, because
+ *  its cells would pass the last address */
+static void reportPastEnd(char *line, unsigned int lineNr, Diagnostics *diag)
+{
+	char buff[MAXLEN + 64];
+
+	prepareLine(line);
+	strtolower(line);
+	sprintf(buff, "  ERROR: Line %d passes the last address: %s\n", lineNr, line);
+	diagOutput(diag, buff);
+	diagOutput(diag, "  > WARNING: Leaving the line out!\n");
+}
+
+/** Private function: parse a directive. The directive name is not case
+ *  sensitive, numbers are decimal.
+ *
+ * @retval ERR_InvalidInstr	Unknown directive or invalid arguments
+ */
+static Error parseDirective(const char *line, Directive *dir)
+{
+	static const struct
+	{
+		const char	*name;
+		DirType		type;
+	} directives[] =
+	{
+		{".org", DIR_Org},
+		{".word", DIR_Word},
+		{".fill", DIR_Fill},
+		{".zero", DIR_Zero}
+	};
+	const char	*p = line;
+	long long	value = 0;
+	size_t		length = 0;
+	int		i = 0;
+
+	while(p[length] != '\0' && !isspace((unsigned char)p[length]) && p[length] != ';')
+	{
+		length++;
+	}
+
+	for(i = 0; i < (int)(sizeof(directives) / sizeof(directives[0])); i++)
+	{
+		if(strlen(directives[i].name) == length)
+		{
+			size_t j = 0;
+
+			while(j < length && tolower((unsigned char)p[j]) == directives[i].name[j])
+			{
+				j++;
+			}
+			if(j == length)
+			{
+				break;
+			}
+		}
+	}
+
+	if(i == (int)(sizeof(directives) / sizeof(directives[0])))
+	{
+		return ERR_InvalidInstr;
+	}
+
+	dir->type = directives[i].type;
+	dir->count = 0;
+	dir->value = 0;
+	dir->values = NULL;
+	p += length;
+
+	switch(dir->type)
+	{
+	case DIR_Org:
+	case DIR_Zero:
+		if(!readNumber(&p, 0, dir->type == DIR_Org ? UINT_MAX : MAX_FILL, &value))
+		{
+			return ERR_InvalidInstr;
+		}
+		dir->count = (unsigned int)value;
+		break;
+	case DIR_Fill:
+		if(!readNumber(&p, 0, MAX_FILL, &value))
+		{
+			return ERR_InvalidInstr;
+		}
+		dir->count = (unsigned int)value;
+		if(*p++ != ',' || !readNumber(&p, INT_MIN, UINT_MAX, &value))
+		{
+			return ERR_InvalidInstr;
+		}
+		dir->value = (int)(unsigned int)value;
+		break;
+	case DIR_Word:
+		dir->values = p;
+		do
+		{
+			if(!readNumber(&p, INT_MIN, UINT_MAX, &value) || dir->count == UINT_MAX)
+			{
+				return ERR_InvalidInstr;
+			}
+			dir->count++;
+		} while(*p++ == ',');
+		p--;
+		break;
+	}
+
+	// Only whitespace and a comment may follow
+	while(*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+	{
+		p++;
+	}
+
+	return *p == '\0' || *p == ';' ? ERR_None : ERR_InvalidInstr;
+}
+
+/** Private function: read a decimal number between min and max, whitespace
+ *  before and after it is skipped.
+ *
+ * @return FALSE if there is no valid number
+ */
+static int readNumber(const char **p, long long min, long long max, long long *value)
+{
+	const char	*s = *p;
+	char		*end = NULL;
+
+	while(*s == ' ' || *s == '\t')
+	{
+		s++;
+	}
+
+	if(!isdigit((unsigned char)*s) && !((*s == '-' || *s == '+')
+		&& isdigit((unsigned char)s[1])))
+	{
+		return 0;
+	}
+
+	errno = 0;
+	*value = strtoll(s, &end, 10);
+	if(errno == ERANGE || *value < min || *value > max)
+	{
+		return 0;
+	}
+
+	while(*end == ' ' || *end == '\t')
+	{
+		end++;
+	}
+
+	*p = end;
+	return 1;
+}
+
+/** Prepares a line for an error message: removes comments and the newline */
 static void prepareLine(char *line)
 {
 	int	i, length;
@@ -5,6 +5,26 @@
 #include "errors.h"   // Return value
 #include "memory.h"   // Memory typedef
 #include "hardware.h" // OutputFunc decleration
+#include "image.h"    // Image typedef
+
+/** Longest line the compiler reads at once, with the newline. A longer line
+ *  is split, the parts are assembled as separate lines. */
+#define COMPILER_MAXLEN	151
+
+/** Hash, address and number of cells of a line of a source file */
+typedef struct SourceLine
+{
+	unsigned long long hash;
+	unsigned int address;
+	unsigned int count;
+} SourceLine;
+
+/** The lines of a source file, to find the lines that changed */
+typedef struct SourceHash
+{
+	unsigned int count;
+	SourceLine *lines;
+} SourceHash;
 
 /** Reads a file and converts each assembler instruction to it's
  *  binary representation. 'Compiled' program is saved in the linked
@@ -12,5 +32,40 @@
  *  to print error messages */
 Error compile(FILE *fp, Memory **memory, OutputFunc output);
 
+/** Same as compile, but the program is saved in an image instead of in the
+ *  memory list. Free it with freeImage. */
+Error compileImage(FILE *fp, Image *image, OutputFunc output);
+
+/** Same as compile, but the file is mapped in memory and large files are
+ *  assembled on multiple threads */
+Error compileFile(const char *filename, Memory **memory, OutputFunc output);
+
+/* Same as compileFile, the program is saved in an image. When hash is not
+   NULL the lines are hashed too, as recompileFile would. */
+Error compileFileImage(const char *filename, Image *image, SourceHash *hash,
+	OutputFunc output);
+
+/** Called by recompileFile for every changed cell. Cell is NULL when the
+ *  cell is no longer used by the program. */
+typedef Error (*PatchFunc)(unsigned int address, MemCell *cell);
+
+/* Assemble only the lines that changed since the file was hashed */
+Error recompileFile(const char *filename, SourceHash *hash, PatchFunc patch,
+	OutputFunc output, unsigned int *changed);
+
+/* Free the hashes of a source file */
+void freeSourceHash(SourceHash *hash);
+
+/* Index the lines of a source file, they are assembled the first time the
+   program uses their cell. lazy->context is NULL when the whole file was
+   assembled anyway. */
+Error compileLazy(const char *filename, Memory **memory, LazyCells *lazy, OutputFunc output);
+
+/* Hash the lines of the source of a lazy program, as recompileFile would */
+Error hashLazySource(LazyCells *lazy, SourceHash *hash);
+
+/* Free the source and index of a lazy program */
+void freeLazy(LazyCells *lazy);
+
 #endif // _PSEUDOASM_INC_COMPILER_H_
 
@@ -0,0 +1,276 @@
+/**
+ * Coverage of the executed instructions.
+ *
+ * The bitmap has a bit for every address an operand can hold, the run loop
+ * sets the bit of every instruction it executes. Bitmaps of several runs,
+ * threads or processes are merged with an atomic OR, so workers can merge
+ * into a shared bitmap without a lock.
+ *
+ * Layout of a coverage file, all numbers are 32 bit in the byte order of
+ * the host:
+ *   magic		"PCOV"
+ *   version		COVERAGE_VERSION
+ *   words		number of words that follow
+ * followed by the words of the bitmap that have a bit set, as the index of
+ * the word and the word.
+ *
+ * The report maps the bitmap back to the lines of the source file, with the
+ * addresses the compiler gave to the lines. Only lines with an instruction
+ * are counted, not the directives, empty lines and comments.
+ */
+#define _XOPEN_SOURCE 500
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include "errors.h"
+#include "compiler.h"
+#include "coverage.h"
+
+#define COVERAGE_MAGIC		"PCOV"
+#define COVERAGE_VERSION	1
+
+typedef struct CoverageHeader
+{
+	char		magic[4];
+	uint32_t	version;
+	uint32_t	numWords;
+} CoverageHeader;
+
+static int isInstrLine(const char *line);
+
+/** Allocate a bitmap without executed addresses.
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error initCoverage(Coverage *coverage)
+{
+	coverage->bits = (uint32_t*) calloc(COVERAGE_WORDS, sizeof(uint32_t));
+
+	return coverage->bits == NULL ? ERR_OutOfMemory : ERR_None;
+}
+
+/** Free a bitmap */
+void freeCoverage(Coverage *coverage)
+{
+	free(coverage->bits);
+	coverage->bits = NULL;
+}
+
+/** Forget all executed addresses */
+void clearCoverage(Coverage *coverage)
+{
+	memset(coverage->bits, 0, COVERAGE_WORDS * sizeof(uint32_t));
+}
+
+/** Was the instruction at the address executed? */
+int isCovered(Coverage *coverage, unsigned int address)
+{
+	return address < COVERAGE_ADDRESSES
+		&& (coverage->bits[address >> 5] >> (address & 31)) & 1;
+}
+
+/** Add the executed addresses of one bitmap to another. Every word is
+ *  merged with an atomic OR, so several threads can merge into the same
+ *  bitmap at the same time. */
+void mergeCoverage(Coverage *into, Coverage *from)
+{
+	unsigned int i = 0;
+
+	for(i = 0; i < COVERAGE_WORDS; i++)
+	{
+		if(from->bits[i] != 0)
+		{
+			__sync_fetch_and_or(&into->bits[i], from->bits[i]);
+		}
+	}
+}
+
+/** Write the executed addresses to a file, that can be merged later
+ *
+ * @retval ERR_OpeningFile	File could not be created
+ * @retval ERR_WritingFile	Error writing the file
+ */
+Error writeCoverage(const char *filename, Coverage *coverage)
+{
+	CoverageHeader	header;
+	FILE		*fp = NULL;
+	uint32_t	word[2];
+	unsigned int	i = 0;
+	int		failed = 0;
+
+	memcpy(header.magic, COVERAGE_MAGIC, 4);
+	header.version = COVERAGE_VERSION;
+	header.numWords = 0;
+	for(i = 0; i < COVERAGE_WORDS; i++)
+	{
+		header.numWords += coverage->bits[i] != 0;
+	}
+
+	fp = fopen(filename, "wb");
+	if(fp == NULL)
+	{
+		return ERR_OpeningFile;
+	}
+
+	failed = fwrite(&header, sizeof(header), 1, fp) != 1;
+	for(i = 0; i < COVERAGE_WORDS && !failed; i++)
+	{
+		if(coverage->bits[i] != 0)
+		{
+			word[0] = i;
+			word[1] = coverage->bits[i];
+			failed = fwrite(word, sizeof(word), 1, fp) != 1;
+		}
+	}
+
+	if(fclose(fp) != 0)
+	{
+		failed = 1;
+	}
+
+	return failed ? ERR_WritingFile : ERR_None;
+}
+
+/** Add the executed addresses of a file written by writeCoverage to a
+ *  bitmap, with an atomic OR like mergeCoverage
+ *
+ * @retval ERR_OpeningFile	File could not be opened
+ * @retval ERR_ReadingFile	Error reading the file
+ * @retval ERR_InvalidImage	The file is not a coverage file of this host
+ */
+Error mergeCoverageFile(const char *filename, Coverage *into)
+{
+	CoverageHeader	header;
+	FILE		*fp = NULL;
+	uint32_t	word[2];
+	unsigned int	i = 0;
+	Error		rval = ERR_None;
+
+	fp = fopen(filename, "rb");
+	if(fp == NULL)
+	{
+		return ERR_OpeningFile;
+	}
+
+	if(fread(&header, sizeof(header), 1, fp) != 1)
+	{
+		rval = ERR_ReadingFile;
+	}
+	else if(memcmp(header.magic, COVERAGE_MAGIC, 4) != 0
+		|| header.version != COVERAGE_VERSION)
+	{
+		rval = ERR_InvalidImage;
+	}
+
+	for(i = 0; i < header.numWords && rval == ERR_None; i++)
+	{
+		if(fread(word, sizeof(word), 1, fp) != 1)
+		{
+			rval = ERR_ReadingFile;
+		}
+		else if(word[0] >= COVERAGE_WORDS)
+		{
+			rval = ERR_InvalidImage;
+		}
+		else
+		{
+			__sync_fetch_and_or(&into->bits[word[0]], word[1]);
+		}
+	}
+
+	fclose(fp);
+	return rval;
+}
+
+/**
+ * Count the lines of a source file with an instruction, and those of which
+ * the instruction was executed. When fp is not NULL they are written in the
+ * lcov tracefile format, a DA record per instruction line with 1 when it was
+ * executed and 0 when not.
+ *
+ * @param [in] fp		File to write to, or NULL to only count
+ * @param [in] source		The source file of the program
+ * @param [in] lines		Addresses of the lines, see recompileFile
+ * @param [in] coverage		Executed addresses
+ * @param [out] result		Instruction lines and executed lines
+ * @retval ERR_OpeningFile	The source file could not be opened
+ * @retval ERR_WritingFile	Error writing the file
+ */
+Error writeLcov(FILE *fp, const char *source, SourceHash *lines,
+	Coverage *coverage, LineCoverage *result)
+{
+	char		line[COMPILER_MAXLEN],
+			path[PATH_MAX];
+	FILE		*src = NULL;
+	unsigned int	lineNr = 0,
+			fileLine = 1;
+	int		hit = 0,
+			isWhole = 1,
+			failed = 0;
+
+	result->found = 0;
+	result->hit = 0;
+
+	src = fopen(source, "r");
+	if(src == NULL)
+	{
+		return ERR_OpeningFile;
+	}
+
+	if(fp != NULL)
+	{
+		fprintf(fp, "TN:\nSF:%s\n", realpath(source, path) != NULL ? path : source);
+	}
+
+	// The lines are read like compile reads them, so a long line has more
+	// than one address. lcov numbers the lines of the file from 1.
+	for(lineNr = 0; lineNr < lines->count
+		&& fgets(line, COMPILER_MAXLEN, src) != NULL; lineNr++)
+	{
+		int isFirst = isWhole;
+
+		isWhole = strchr(line, '\n') != NULL;
+		fileLine += isFirst && lineNr > 0;
+		if(!isFirst || lines->lines[lineNr].count != 1 || !isInstrLine(line))
+		{
+			continue;
+		}
+
+		hit = isCovered(coverage, lines->lines[lineNr].address);
+		result->found++;
+		result->hit += hit;
+		if(fp != NULL)
+		{
+			fprintf(fp, "DA:%u,%d\n", fileLine, hit);
+		}
+	}
+	fclose(src);
+
+	if(fp != NULL && fprintf(fp, "LF:%u\nLH:%u\nend_of_record\n",
+		result->found, result->hit) < 0)
+	{
+		failed = 1;
+	}
+
+	return failed ? ERR_WritingFile : ERR_None;
+}
+
+/** Private function: does the line have an instruction? Directives start
+ *  with a dot, empty lines and comments are assembled to a NOP but are
+ *  not counted. */
+static int isInstrLine(const char *line)
+{
+	if(line[0] == '.')
+	{
+		return 0;
+	}
+
+	while(*line == ' ' || *line == '\t')
+	{
+		line++;
+	}
+
+	return *line != '\0' && *line != '\n' && *line != '\r' && *line != ';';
+}
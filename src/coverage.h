@@ -0,0 +1,52 @@
+#ifndef _PSEUDOASM_INC_COVERAGE_H_
+#define _PSEUDOASM_INC_COVERAGE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "errors.h"
+#include "compiler.h"
+
+/** Addresses the bitmap has a bit for, operands have 24 bits */
+#define COVERAGE_ADDRESSES	0x1000000
+#define COVERAGE_WORDS		(COVERAGE_ADDRESSES / 32)
+
+/** Executed addresses, one bit per address */
+typedef struct Coverage
+{
+	uint32_t *bits;
+} Coverage;
+
+/** Source lines with an instruction, and those that were executed */
+typedef struct LineCoverage
+{
+	unsigned int found;
+	unsigned int hit;
+} LineCoverage;
+
+/* Allocate a bitmap without executed addresses */
+Error initCoverage(Coverage *coverage);
+
+/* Free a bitmap */
+void freeCoverage(Coverage *coverage);
+
+/* Forget all executed addresses */
+void clearCoverage(Coverage *coverage);
+
+/* Was the address executed? */
+int isCovered(Coverage *coverage, unsigned int address);
+
+/* Add the executed addresses of one bitmap to another, with atomic OR */
+void mergeCoverage(Coverage *into, Coverage *from);
+
+/* Write the executed addresses to a file */
+Error writeCoverage(const char *filename, Coverage *coverage);
+
+/* Add the executed addresses of a file to a bitmap */
+Error mergeCoverageFile(const char *filename, Coverage *into);
+
+/* Count the executed instruction lines of a source file, and write them in
+   the lcov format when fp is not NULL */
+Error writeLcov(FILE *fp, const char *source, SourceHash *lines,
+	Coverage *coverage, LineCoverage *result);
+
+#endif // _PSEUDOASM_INC_COVERAGE_H_
@@ -0,0 +1,843 @@
+/**
+ * Data flow analysis over a control flow graph.
+ *
+ * The variables are register A, register B, the flags and every cell that
+ * an instruction addresses directly (for an indirect access, the pointer).
+ *
+ * Constant propagation finds for every block which variables always hold
+ * the same value at its start. At the entry point the cells hold the value
+ * they have in the program and the registers are unknown. An indirect store
+ * through a constant pointer only changes the cell it points to, through
+ * another pointer it makes all cells unknown.
+ *
+ * Reaching definitions finds for every use of a variable the instructions
+ * whose value it can see. An instruction none of whose definitions reaches
+ * a use is unused. When the program can stop (HLT, an invalid instruction,
+ * a DIV that divides by zero, or running out of the program) all variables
+ * are used, they are the result of the program. An indirect load uses all
+ * cells, an indirect store does not define a variable: that is always
+ * conservative.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include "hardware.h"
+#include "cfg.h"
+#include "dataflow.h"
+
+/** Largest number of values kept by the constant propagation */
+#define DF_MAX_VALUES	(1 << 21)
+/** Largest number of bits in each set of definitions of the blocks */
+#define DF_MAX_BITS	(1 << 24)
+
+#define DF_NODEF	0xFFFFFFFFu
+
+typedef unsigned long long DfWord;
+#define DF_WORDBITS	64
+
+/** Definitions of the reaching definitions analysis */
+typedef struct DfDefs
+{
+	unsigned int	count;
+	/** Variable and instruction of every definition */
+	unsigned int	*var;
+	unsigned int	*instr;
+	/** Definitions of variable v are byVar[start[v]] up to byVar[start[v + 1]] */
+	unsigned int	*start;
+	unsigned int	*byVar;
+	/** First definition of every instruction */
+	unsigned int	*first;
+	size_t		words;
+} DfDefs;
+
+static Error findVariables(DataFlow *flow);
+static Error propagateConstants(DataFlow *flow, CfgFetch fetch, void *context);
+static int meetValues(DfValue *into, DfValue *from, unsigned int count);
+static Error findUnused(DataFlow *flow);
+static Error collectDefs(DataFlow *flow, DfDefs *defs);
+static int instrDefs(DataFlow *flow, Instruction instr, unsigned int vars[2]);
+static void blockDefs(DataFlow *flow, DfDefs *defs, CfgBlock *block, DfWord *gen, DfWord *kill);
+static void markUses(DataFlow *flow, DfDefs *defs, CfgBlock *block, DfWord *in,
+	unsigned int *lastDef, unsigned char *exposed, unsigned char *used);
+static void useVar(DfDefs *defs, unsigned int var, DfWord *in, unsigned int *lastDef,
+	unsigned char *exposed, unsigned char *used);
+
+/** Analyze the instructions of a control flow graph. The graph must not be
+ *  freed before the results.
+ *
+ * @param [in] cfg		Control flow graph
+ * @param [in] fetch		Reads the initial value of the cells
+ * @param [in] context		Passed to fetch
+ * @param [out] flow		Free with dfFree
+ * @retval ERR_MemoryLimit	The program is too large to analyze
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error dfAnalyze(Cfg *cfg, CfgFetch fetch, void *context, DataFlow *flow)
+{
+	Error rval = ERR_None;
+
+	assert(cfg != NULL && fetch != NULL && flow != NULL);
+
+	memset(flow, 0, sizeof(DataFlow));
+	flow->cfg = cfg;
+
+	rval = findVariables(flow);
+	if(rval == ERR_None && (size_t)cfg->numBlocks * flow->numVars > DF_MAX_VALUES)
+	{
+		rval = ERR_MemoryLimit;
+	}
+
+	if(rval == ERR_None)
+	{
+		rval = propagateConstants(flow, fetch, context);
+	}
+
+	if(rval == ERR_None)
+	{
+		rval = findUnused(flow);
+	}
+
+	if(rval != ERR_None)
+	{
+		dfFree(flow);
+	}
+
+	return rval;
+}
+
+/** Variable of a directly addressed cell, -1 if the cell is not a variable */
+int dfVariable(DataFlow *flow, unsigned int address)
+{
+	unsigned int	low = 0,
+			high = flow->numVars - DF_CELLS,
+			mid = 0;
+
+	while(low < high)
+	{
+		mid = low + (high - low) / 2;
+		if(flow->cells[mid] < address)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+
+	if(low < flow->numVars - DF_CELLS && flow->cells[low] == address)
+	{
+		return (int)(DF_CELLS + low);
+	}
+
+	return -1;
+}
+
+/** Update the constants with the effect of an instruction. State holds a
+ *  value for every variable. */
+void dfStep(DataFlow *flow, Instruction instr, DfValue *state)
+{
+	DfValue		*reg = NULL,
+			value = {DF_VARYING, 0};
+	int		var = -1;
+	unsigned int	i = 0;
+
+	switch(instr.operator)
+	{
+	case A_LDA:
+	case A_LDB:
+		reg = &state[instr.operator == A_LDA ? DF_REGA : DF_REGB];
+		if(instr.adressering == ONMIDDELIJK)
+		{
+			value.state = DF_CONST;
+			value.value = (int)(instr.operand & 0x800000
+				? instr.operand | 0xFF000000 : instr.operand);
+		}
+		else if(instr.adressering == DIRECT)
+		{
+			value = state[dfVariable(flow, instr.operand)];
+		}
+		else if(instr.adressering == INDIRECT)
+		{
+			DfValue pointer = state[dfVariable(flow, instr.operand)];
+
+			var = pointer.state == DF_CONST ? dfVariable(flow, (unsigned int)pointer.value) : -1;
+			if(var >= 0)
+			{
+				value = state[var];
+			}
+		}
+		*reg = value.state == DF_CONST ? value : (DfValue){DF_VARYING, 0};
+		break;
+	case A_STA:
+	case A_STB:
+		value = state[instr.operator == A_STA ? DF_REGA : DF_REGB];
+		if(instr.adressering == DIRECT)
+		{
+			state[dfVariable(flow, instr.operand)] = value;
+		}
+		else if(instr.adressering == INDIRECT)
+		{
+			DfValue pointer = state[dfVariable(flow, instr.operand)];
+
+			if(pointer.state == DF_CONST)
+			{
+				var = dfVariable(flow, (unsigned int)pointer.value);
+				if(var >= 0)
+				{
+					state[var] = value;
+				}
+			}
+			else
+			{
+				for(i = DF_CELLS; i < flow->numVars; i++)
+				{
+					state[i].state = DF_VARYING;
+				}
+			}
+		}
+		break;
+	case A_ADD:
+	case A_SUB:
+	case A_MUL:
+	case A_DIV:
+		if(state[DF_REGA].state == DF_CONST && state[DF_REGB].state == DF_CONST)
+		{
+			// Wraps around like the processor
+			unsigned int	a = (unsigned int)state[DF_REGA].value,
+					b = (unsigned int)state[DF_REGB].value;
+
+			value.state = DF_CONST;
+			switch(instr.operator)
+			{
+			case A_ADD:
+				value.value = (int)(a + b);
+				break;
+			case A_SUB:
+				value.value = (int)(a - b);
+				break;
+			case A_MUL:
+				value.value = (int)(a * b);
+				break;
+			default:
+				if(b == 0 || ((int)a == INT_MIN && (int)b == -1))
+				{
+					value.state = DF_VARYING;
+				}
+				else
+				{
+					value.value = (int)a / (int)b;
+				}
+				break;
+			}
+		}
+		state[DF_REGA] = value;
+		break;
+	case A_INP:
+		state[DF_REGA] = value;
+		break;
+	default:
+		break;
+	}
+}
+
+/** Free the results */
+void dfFree(DataFlow *flow)
+{
+	assert(flow != NULL);
+
+	free(flow->cells);
+	free(flow->constIn);
+	free(flow->unused);
+	memset(flow, 0, sizeof(DataFlow));
+}
+
+/** Private function: make a variable of every directly addressed cell
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error findVariables(DataFlow *flow)
+{
+	Cfg		*cfg = flow->cfg;
+	unsigned int	i = 0,
+			count = 0;
+
+	flow->cells = (unsigned int*) malloc(cfg->numCode * sizeof(unsigned int) + 1);
+	if(flow->cells == NULL)
+	{
+		return ERR_OutOfMemory;
+	}
+
+	for(i = 0; i < cfg->numCode; i++)
+	{
+		Instruction instr = cfg->code[i].instructie;
+
+		if((instr.operator == A_LDA || instr.operator == A_LDB
+			|| instr.operator == A_STA || instr.operator == A_STB)
+			&& (instr.adressering == DIRECT || instr.adressering == INDIRECT))
+		{
+			flow->cells[count++] = instr.operand;
+		}
+	}
+
+	// Sort, and remove duplicates
+	for(i = 1; i < count; i++)
+	{
+		unsigned int	address = flow->cells[i],
+				j = i;
+
+		if(address >= flow->cells[i - 1])
+		{
+			continue;
+		}
+
+		// Most programs use few cells, in about increasing order
+		while(j > 0 && flow->cells[j - 1] > address)
+		{
+			flow->cells[j] = flow->cells[j - 1];
+			j--;
+		}
+		flow->cells[j] = address;
+	}
+
+	flow->numVars = 0;
+	for(i = 0; i < count; i++)
+	{
+		if(flow->numVars == 0 || flow->cells[flow->numVars - 1] != flow->cells[i])
+		{
+			flow->cells[flow->numVars++] = flow->cells[i];
+		}
+	}
+	flow->numVars += DF_CELLS;
+
+	return ERR_None;
+}
+
+/** Private function: find the constants at the start of every block
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error propagateConstants(DataFlow *flow, CfgFetch fetch, void *context)
+{
+	Cfg		*cfg = flow->cfg;
+	unsigned int	*todo = NULL,
+			numTodo = 0,
+			i = 0;
+	unsigned char	*queued = NULL;
+	DfValue		*state = NULL;
+	MemCell		cell;
+
+	flow->constIn = (DfValue*) malloc((size_t)cfg->numBlocks * flow->numVars * sizeof(DfValue) + 1);
+	state = (DfValue*) malloc(flow->numVars * sizeof(DfValue));
+	todo = (unsigned int*) malloc(cfg->numBlocks * sizeof(unsigned int) + 1);
+	queued = (unsigned char*) calloc(cfg->numBlocks + 1, 1);
+	if(flow->constIn == NULL || state == NULL || todo == NULL || queued == NULL)
+	{
+		free(state);
+		free(todo);
+		free(queued);
+		return ERR_OutOfMemory;
+	}
+
+	for(i = 0; i < cfg->numBlocks * flow->numVars; i++)
+	{
+		flow->constIn[i].state = DF_UNDEF;
+		flow->constIn[i].value = 0;
+	}
+
+	if(cfg->entry != CFG_NONE)
+	{
+		DfValue *in = &flow->constIn[(size_t)cfg->entry * flow->numVars];
+
+		in[DF_REGA].state = DF_VARYING;
+		in[DF_REGB].state = DF_VARYING;
+		in[DF_FLAGS].state = DF_VARYING;
+		for(i = DF_CELLS; i < flow->numVars; i++)
+		{
+			in[i].state = fetch(context, flow->cells[i - DF_CELLS], &cell) ? DF_CONST : DF_VARYING;
+			in[i].value = cell.getal;
+		}
+
+		todo[numTodo++] = cfg->entry;
+		queued[cfg->entry] = 1;
+	}
+
+	while(numTodo > 0)
+	{
+		CfgBlock	*block = &cfg->blocks[todo[--numTodo]];
+		unsigned int	j = 0;
+
+		queued[block - cfg->blocks] = 0;
+		memcpy(state, &flow->constIn[(size_t)(block - cfg->blocks) * flow->numVars],
+			flow->numVars * sizeof(DfValue));
+
+		for(j = 0; j < block->length; j++)
+		{
+			dfStep(flow, cfg->code[block->first + j].instructie, state);
+		}
+
+		for(j = 0; j < block->numSucc; j++)
+		{
+			unsigned int succ = cfg->succ[block->firstSucc + j];
+
+			if(meetValues(&flow->constIn[(size_t)succ * flow->numVars], state, flow->numVars)
+				&& !queued[succ])
+			{
+				todo[numTodo++] = succ;
+				queued[succ] = 1;
+			}
+		}
+	}
+
+	free(state);
+	free(todo);
+	free(queued);
+
+	return ERR_None;
+}
+
+/** Private function: meet the values of another path into a block. Returns
+ *  TRUE if a value changed. */
+static int meetValues(DfValue *into, DfValue *from, unsigned int count)
+{
+	unsigned int	i = 0;
+	int		changed = 0;
+
+	for(i = 0; i < count; i++)
+	{
+		if(from[i].state == DF_UNDEF || into[i].state == DF_VARYING)
+		{
+			continue;
+		}
+
+		if(into[i].state == DF_UNDEF)
+		{
+			into[i] = from[i];
+			changed = 1;
+		}
+		else if(from[i].state == DF_VARYING || from[i].value != into[i].value)
+		{
+			into[i].state = DF_VARYING;
+			changed = 1;
+		}
+	}
+
+	return changed;
+}
+
+/** Private function: find the instructions whose definitions are never used,
+ *  with reaching definitions
+ *
+ * @retval ERR_MemoryLimit	Too many blocks and definitions
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error findUnused(DataFlow *flow)
+{
+	Cfg		*cfg = flow->cfg;
+	DfDefs		defs;
+	DfWord		*gen = NULL,
+			*kill = NULL,
+			*in = NULL,
+			*out = NULL;
+	unsigned int	*todo = NULL,
+			*lastDef = NULL,
+			numTodo = 0,
+			i = 0,
+			d = 0;
+	unsigned char	*queued = NULL,
+			*exposed = NULL,
+			*used = NULL;
+	size_t		w = 0,
+			size = 0;
+	Error		rval = ERR_None;
+
+	rval = collectDefs(flow, &defs);
+	if(rval != ERR_None)
+	{
+		return rval;
+	}
+
+	if(defs.words * DF_WORDBITS * cfg->numBlocks > DF_MAX_BITS)
+	{
+		rval = ERR_MemoryLimit;
+	}
+
+	size = defs.words * cfg->numBlocks * sizeof(DfWord) + 1;
+	if(rval == ERR_None)
+	{
+		gen = (DfWord*) calloc(size, 1);
+		kill = (DfWord*) calloc(size, 1);
+		in = (DfWord*) calloc(size, 1);
+		out = (DfWord*) calloc(size, 1);
+		todo = (unsigned int*) malloc(cfg->numBlocks * sizeof(unsigned int) + 1);
+		queued = (unsigned char*) malloc(cfg->numBlocks + 1);
+		lastDef = (unsigned int*) malloc(flow->numVars * sizeof(unsigned int));
+		exposed = (unsigned char*) malloc(flow->numVars);
+		used = (unsigned char*) calloc(defs.count + 1, 1);
+		flow->unused = (unsigned char*) calloc(cfg->numCode + 1, 1);
+		if(gen == NULL || kill == NULL || in == NULL || out == NULL || todo == NULL
+			|| queued == NULL || lastDef == NULL || exposed == NULL || used == NULL
+			|| flow->unused == NULL)
+		{
+			rval = ERR_OutOfMemory;
+		}
+	}
+
+	if(rval == ERR_None)
+	{
+		// OUT = GEN + (IN - KILL), pushed to the IN of the successors
+		for(i = 0; i < cfg->numBlocks; i++)
+		{
+			blockDefs(flow, &defs, &cfg->blocks[i], &gen[i * defs.words], &kill[i * defs.words]);
+			todo[numTodo++] = cfg->numBlocks - 1 - i;
+			queued[i] = 1;
+		}
+
+		while(numTodo > 0)
+		{
+			unsigned int	b = todo[--numTodo],
+					j = 0;
+			DfWord		*bOut = &out[b * defs.words];
+			int		changed = 0;
+
+			queued[b] = 0;
+			for(w = 0; w < defs.words; w++)
+			{
+				DfWord word = gen[b * defs.words + w]
+					| (in[b * defs.words + w] & ~kill[b * defs.words + w]);
+
+				changed |= word != bOut[w];
+				bOut[w] = word;
+			}
+
+			for(j = 0; j < cfg->blocks[b].numSucc && changed; j++)
+			{
+				unsigned int	succ = cfg->succ[cfg->blocks[b].firstSucc + j];
+				DfWord		*sIn = &in[succ * defs.words];
+				int		grown = 0;
+
+				for(w = 0; w < defs.words; w++)
+				{
+					grown |= (bOut[w] & ~sIn[w]) != 0;
+					sIn[w] |= bOut[w];
+				}
+
+				if(grown && !queued[succ])
+				{
+					todo[numTodo++] = succ;
+					queued[succ] = 1;
+				}
+			}
+		}
+
+		for(i = 0; i < cfg->numBlocks; i++)
+		{
+			markUses(flow, &defs, &cfg->blocks[i], &in[i * defs.words], lastDef, exposed, used);
+		}
+
+		// An instruction is unused when it defines something, and none of
+		// its definitions is used
+		for(i = 0; i < cfg->numCode; i++)
+		{
+			flow->unused[i] = 1;
+		}
+		for(d = 0; d < defs.count; d++)
+		{
+			flow->unused[defs.instr[d]] &= !used[d];
+		}
+		for(i = 0; i < cfg->numCode; i++)
+		{
+			unsigned int vars[2];
+
+			if(instrDefs(flow, cfg->code[i].instructie, vars) == 0)
+			{
+				flow->unused[i] = 0;
+			}
+		}
+	}
+
+	free(gen);
+	free(kill);
+	free(in);
+	free(out);
+	free(todo);
+	free(queued);
+	free(lastDef);
+	free(exposed);
+	free(used);
+	free(defs.var);
+	free(defs.instr);
+	free(defs.start);
+	free(defs.byVar);
+	free(defs.first);
+
+	return rval;
+}
+
+/** Private function: list the definitions of all instructions, and of every
+ *  variable
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error collectDefs(DataFlow *flow, DfDefs *defs)
+{
+	Cfg		*cfg = flow->cfg;
+	unsigned int	i = 0,
+			v = 0,
+			vars[2];
+	int		n = 0,
+			k = 0;
+
+	memset(defs, 0, sizeof(DfDefs));
+
+	for(i = 0; i < cfg->numCode; i++)
+	{
+		defs->count += instrDefs(flow, cfg->code[i].instructie, vars);
+	}
+
+	defs->var = (unsigned int*) malloc(defs->count * sizeof(unsigned int) + 1);
+	defs->instr = (unsigned int*) malloc(defs->count * sizeof(unsigned int) + 1);
+	defs->byVar = (unsigned int*) malloc(defs->count * sizeof(unsigned int) + 1);
+	defs->start = (unsigned int*) calloc(flow->numVars + 1, sizeof(unsigned int));
+	defs->first = (unsigned int*) malloc(cfg->numCode * sizeof(unsigned int) + 1);
+	if(defs->var == NULL || defs->instr == NULL || defs->byVar == NULL || defs->start == NULL
+		|| defs->first == NULL)
+	{
+		free(defs->var);
+		free(defs->instr);
+		free(defs->byVar);
+		free(defs->start);
+		free(defs->first);
+		memset(defs, 0, sizeof(DfDefs));
+		return ERR_OutOfMemory;
+	}
+
+	defs->count = 0;
+	for(i = 0; i < cfg->numCode; i++)
+	{
+		n = instrDefs(flow, cfg->code[i].instructie, vars);
+		defs->first[i] = defs->count;
+		for(k = 0; k < n; k++)
+		{
+			defs->var[defs->count] = vars[k];
+			defs->instr[defs->count] = i;
+			defs->start[vars[k] + 1]++;
+			defs->count++;
+		}
+	}
+	defs->words = (defs->count + DF_WORDBITS - 1) / DF_WORDBITS;
+
+	// Group the definitions on variable, start[v + 1] is used as write position
+	for(v = 0; v < flow->numVars; v++)
+	{
+		defs->start[v + 1] += defs->start[v];
+	}
+	for(i = 0; i < defs->count; i++)
+	{
+		defs->byVar[defs->start[defs->var[i]]++] = i;
+	}
+	for(v = flow->numVars; v > 0; v--)
+	{
+		defs->start[v] = defs->start[v - 1];
+	}
+	defs->start[0] = 0;
+
+	return ERR_None;
+}
+
+/** Private function: the variables an instruction always defines. Returns
+ *  how many there are. */
+static int instrDefs(DataFlow *flow, Instruction instr, unsigned int vars[2])
+{
+	switch(instr.operator)
+	{
+	case A_LDA:
+		if(instr.adressering == GEINDEXEERD)
+		{
+			return 0;
+		}
+		vars[0] = DF_REGA;
+		vars[1] = DF_FLAGS;
+		return 2;
+	case A_LDB:
+		if(instr.adressering == GEINDEXEERD)
+		{
+			return 0;
+		}
+		vars[0] = DF_REGB;
+		return 1;
+	case A_STA:
+	case A_STB:
+		if(instr.adressering != DIRECT)
+		{
+			return 0;
+		}
+		vars[0] = (unsigned int)dfVariable(flow, instr.operand);
+		return 1;
+	case A_INP:
+	case A_ADD:
+	case A_SUB:
+	case A_MUL:
+	case A_DIV:
+		vars[0] = DF_REGA;
+		vars[1] = DF_FLAGS;
+		return 2;
+	default:
+		return 0;
+	}
+}
+
+/** Private function: the last definition of every variable in a block
+ *  (GEN) and all definitions of the variables it defines (KILL) */
+static void blockDefs(DataFlow *flow, DfDefs *defs, CfgBlock *block, DfWord *gen, DfWord *kill)
+{
+	unsigned int	i = 0,
+			d = 0,
+			vars[2];
+	int		n = 0,
+			k = 0;
+
+	d = defs->first[block->first];
+	for(i = 0; i < block->length; i++)
+	{
+		n = instrDefs(flow, flow->cfg->code[block->first + i].instructie, vars);
+		for(k = 0; k < n; k++, d++)
+		{
+			unsigned int j = 0;
+
+			for(j = defs->start[vars[k]]; j < defs->start[vars[k] + 1]; j++)
+			{
+				unsigned int other = defs->byVar[j];
+
+				kill[other / DF_WORDBITS] |= (DfWord)1 << (other % DF_WORDBITS);
+				gen[other / DF_WORDBITS] &= ~((DfWord)1 << (other % DF_WORDBITS));
+			}
+			gen[d / DF_WORDBITS] |= (DfWord)1 << (d % DF_WORDBITS);
+		}
+	}
+}
+
+/** Private function: mark the definitions that the uses in a block see. A
+ *  use sees the last definition in the block before it, or else the
+ *  definitions that reach the start of the block. */
+static void markUses(DataFlow *flow, DfDefs *defs, CfgBlock *block, DfWord *in,
+	unsigned int *lastDef, unsigned char *exposed, unsigned char *used)
+{
+	Cfg		*cfg = flow->cfg;
+	unsigned int	i = 0,
+			v = 0,
+			d = 0,
+			vars[2];
+	int		n = 0,
+			k = 0;
+
+	for(v = 0; v < flow->numVars; v++)
+	{
+		lastDef[v] = DF_NODEF;
+		exposed[v] = 0;
+	}
+
+	d = defs->first[block->first];
+
+	for(i = 0; i < block->length; i++)
+	{
+		Instruction instr = cfg->code[block->first + i].instructie;
+
+		switch(instr.operator)
+		{
+		case A_LDA:
+		case A_LDB:
+			if(instr.adressering == DIRECT || instr.adressering == INDIRECT)
+			{
+				useVar(defs, (unsigned int)dfVariable(flow, instr.operand),
+					in, lastDef, exposed, used);
+			}
+			if(instr.adressering == INDIRECT)
+			{
+				for(v = DF_CELLS; v < flow->numVars; v++)
+				{
+					useVar(defs, v, in, lastDef, exposed, used);
+				}
+			}
+			break;
+		case A_STA:
+		case A_STB:
+			useVar(defs, instr.operator == A_STA ? DF_REGA : DF_REGB,
+				in, lastDef, exposed, used);
+			if(instr.adressering == INDIRECT)
+			{
+				useVar(defs, (unsigned int)dfVariable(flow, instr.operand),
+					in, lastDef, exposed, used);
+			}
+			break;
+		case A_DIV:
+			// Dividing by zero stops the program
+			for(v = 0; v < flow->numVars; v++)
+			{
+				useVar(defs, v, in, lastDef, exposed, used);
+			}
+			break;
+		case A_ADD:
+		case A_SUB:
+		case A_MUL:
+			useVar(defs, DF_REGA, in, lastDef, exposed, used);
+			useVar(defs, DF_REGB, in, lastDef, exposed, used);
+			break;
+		case A_OUT:
+			useVar(defs, DF_REGA, in, lastDef, exposed, used);
+			break;
+		case A_JSP:
+		case A_JSN:
+		case A_JIZ:
+		case A_JOF:
+			useVar(defs, DF_FLAGS, in, lastDef, exposed, used);
+			break;
+		default:
+			break;
+		}
+
+		n = instrDefs(flow, instr, vars);
+		for(k = 0; k < n; k++, d++)
+		{
+			lastDef[vars[k]] = d;
+		}
+	}
+
+	if(block->exits)
+	{
+		for(v = 0; v < flow->numVars; v++)
+		{
+			useVar(defs, v, in, lastDef, exposed, used);
+		}
+	}
+}
+
+/** Private function: mark the definitions of a variable that a use sees */
+static void useVar(DfDefs *defs, unsigned int var, DfWord *in, unsigned int *lastDef,
+	unsigned char *exposed, unsigned char *used)
+{
+	unsigned int j = 0;
+
+	if(lastDef[var] != DF_NODEF)
+	{
+		used[lastDef[var]] = 1;
+		return;
+	}
+
+	if(exposed[var])
+	{
+		return;
+	}
+	exposed[var] = 1;
+
+	for(j = defs->start[var]; j < defs->start[var + 1]; j++)
+	{
+		unsigned int d = defs->byVar[j];
+
+		if(in[d / DF_WORDBITS] & ((DfWord)1 << (d % DF_WORDBITS)))
+		{
+			used[d] = 1;
+		}
+	}
+}
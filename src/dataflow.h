@@ -0,0 +1,56 @@
+#ifndef _PSEUDOASM_INC_DATAFLOW_H_
+#define _PSEUDOASM_INC_DATAFLOW_H_
+
+#include "errors.h"
+#include "hardware.h"
+#include "cfg.h"
+
+/* Variables of the analysis: the registers, the flags, and then every cell
+ * that is addressed directly */
+#define DF_REGA		0
+#define DF_REGB		1
+#define DF_FLAGS	2
+#define DF_CELLS	3
+
+/** State of a variable in the constant propagation */
+typedef enum DfState
+{
+	DF_UNDEF,	// No path gets here (yet)
+	DF_CONST,	// Always the same value
+	DF_VARYING	// Unknown
+} DfState;
+
+typedef struct DfValue
+{
+	DfState state;
+	int value;
+} DfValue;
+
+/** Results of the data flow analysis of a control flow graph */
+typedef struct DataFlow
+{
+	Cfg *cfg;
+	unsigned int numVars;
+	/** Address of variable DF_CELLS + i, sorted */
+	unsigned int *cells;
+	/** Constants at the start of each block, numVars values per block. The
+	 *  flags are not followed. */
+	DfValue *constIn;
+	/** For every instruction of the graph: nothing it defines is ever used
+	 *  by a later instruction, or seen when the program stops */
+	unsigned char *unused;
+} DataFlow;
+
+/* Run constant propagation and reaching definitions over a graph */
+Error dfAnalyze(Cfg *cfg, CfgFetch fetch, void *context, DataFlow *flow);
+
+/* Variable of a directly addressed cell, -1 if the cell is not a variable */
+int dfVariable(DataFlow *flow, unsigned int address);
+
+/* Update the constants with the effect of an instruction */
+void dfStep(DataFlow *flow, Instruction instr, DfValue *state);
+
+/* Free the results */
+void dfFree(DataFlow *flow);
+
+#endif // _PSEUDOASM_INC_DATAFLOW_H_
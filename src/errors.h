@@ -25,7 +25,23 @@ typedef enum Error
 
 	ERR_InvalidState,
 
-	ERR_Breakpoint
+	ERR_Breakpoint,
+
+	ERR_InstrLimit,
+
+	ERR_TimeLimit,
+
+	ERR_MemoryLimit,
+
+	ERR_NonTerminating,
+
+	ERR_WritingFile,
+
+	ERR_InvalidImage,
+
+	ERR_UndefinedSymbol,
+
+	ERR_DuplicateSymbol
 } Error;
 
 #endif // _PSEUDOASM_INC_ERROR_H_
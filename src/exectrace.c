@@ -0,0 +1,808 @@
+/**
+ * Trace of every executed instruction.
+ *
+ * The trace is recorded with the hooks of the processor. The records are
+ * packed into a ring of TRACE_BUFFERS buffers, a full buffer is handed to
+ * a writer thread that writes it to the file while the run fills the next
+ * one. The run only waits when all buffers are still waiting to be written.
+ *
+ * Layout of a trace file, the numbers of the headers are 32 bit in the
+ * byte order of the host:
+ *   magic		"PTRC"
+ *   version		TRACE_VERSION
+ * followed by a block for every buffer:
+ *   size		bytes of data
+ *   records		instructions in the block
+ *   data
+ * The data starts with the state before the first instruction: the address
+ * of the instruction before it, the last memory address, register A,
+ * register B and the flags. Every block can be decoded on its own.
+ *
+ * A record starts with a byte with the bits of the fields that follow, in
+ * this order:
+ *   TRACE_Jump		address of the instruction, relative to the one after
+ *			the previous instruction
+ *   TRACE_Cell		the instruction, when it is not the one last seen at
+ *			its address in the block
+ *   TRACE_Address	memory address, relative to the previous one
+ *   TRACE_Write	value written, relative to register A
+ *   TRACE_RegA		change of register A
+ *   TRACE_RegB		change of register B
+ *   TRACE_Flags	the flags, Z | O << 1 | N << 2
+ * All numbers are varints of 7 bits per byte, the low bits first. Signed
+ * numbers are zigzag encoded, so small changes take one byte. A sequential
+ * instruction that changes one register takes two or three bytes.
+ *
+ * Changes of the registers between runs are recorded as changes of the
+ * last instruction before them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "errors.h"
+#include "hardware.h"
+#include "processor.h"
+#include "exectrace.h"
+
+#define TRUE 1
+#define FALSE 0
+
+#define TRACE_MAGIC	"PTRC"
+#define TRACE_VERSION	1
+
+#define TRACE_BUFFERS	8
+#define TRACE_BUFSIZE	(1 << 20)
+/** Most bytes of a record, and of the state at the start of a block */
+#define TRACE_MAXRECORD	32
+/** Largest block a reader accepts */
+#define TRACE_MAXBLOCK	(1 << 26)
+/** Instructions remembered by address, a power of 2 */
+#define TRACE_CACHE	4096
+
+#define TRACE_Jump	0x01
+#define TRACE_Cell	0x02
+#define TRACE_Address	0x04
+#define TRACE_Write	0x08
+
+typedef struct TraceHeader
+{
+	char		magic[4];
+	uint32_t	version;
+} TraceHeader;
+
+typedef struct BlockHeader
+{
+	uint32_t	size;
+	uint32_t	records;
+} BlockHeader;
+
+/** State the records are relative to, kept the same way when writing and
+ *  when reading */
+typedef struct TraceState
+{
+	unsigned int	progCounter;
+	unsigned int	address;
+	int		regA;
+	int		regB;
+	unsigned int	flags;
+	/** Instruction last seen at an address, by the low bits of it */
+	unsigned int	cacheAddr[TRACE_CACHE];
+	int		cacheCell[TRACE_CACHE];
+} TraceState;
+
+typedef struct TraceBuffer
+{
+	unsigned char	*data;
+	unsigned int	size;
+	unsigned int	records;
+} TraceBuffer;
+
+struct TraceReader
+{
+	FILE		*fp;
+	unsigned char	*data;
+	unsigned int	size;
+	unsigned int	pos;
+	/** Records left in the block */
+	unsigned int	left;
+	TraceState	state;
+};
+
+// The buffers from firstFull are waiting to be written, the run fills the
+// current one. numFull and writeFailed are shared with the writer thread.
+static FILE *traceFile = NULL;
+static TraceBuffer buffers[TRACE_BUFFERS];
+static TraceBuffer *current = NULL;
+static unsigned int firstFull = 0;
+static unsigned int numFull = 0;
+static int stopWriter = 0;
+static int writeFailed = 0;
+static pthread_t writer;
+static pthread_mutex_t bufferLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bufferFilled = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t bufferEmptied = PTHREAD_COND_INITIALIZER;
+
+// The record of an instruction is finished when the next one starts, when
+// its memory accesses and the registers after it are known.
+static TraceState state;
+static TraceRecord pending;
+static int isPending = 0;
+static TraceStats stats = {0, 0};
+
+static Error traceInstr(void *context, const HookInfo *info);
+static Error traceRead(void *context, const HookInfo *info);
+static Error traceWrite(void *context, const HookInfo *info);
+static Error finishRecord(void);
+static void startBlock(TraceBuffer *buffer);
+static Error queueBuffer(int takeNext);
+static void *writeBuffers(void *arg);
+static Error closeTrace(void);
+static void freeBuffers(void);
+static void resetCache(TraceState *cache);
+static unsigned char *putVarint(unsigned char *p, uint32_t n);
+static Error getVarint(TraceReader *reader, uint32_t *n);
+static Error readBlock(TraceReader *reader);
+static uint32_t zigzag(int n);
+static int unzigzag(uint32_t n);
+
+/** Write every executed instruction to a trace file, until stopExecTrace.
+ *  Loops are not fast-forwarded and calls not replayed while tracing,
+ *  because the trace is made with the hooks of the processor.
+ *
+ * @retval ERR_InvalidState	A trace is being written already
+ * @retval ERR_OpeningFile	File could not be created
+ * @retval ERR_WritingFile	Error writing the file
+ * @retval ERR_OutOfMemory	Malloc failed, or no thread or hook left
+ */
+Error startExecTrace(const char *filename)
+{
+	TraceHeader	header;
+	ProcInfo	info = getStatus();
+	unsigned int	i = 0;
+
+	if(traceFile != NULL)
+	{
+		return ERR_InvalidState;
+	}
+
+	for(i = 0; i < TRACE_BUFFERS; i++)
+	{
+		buffers[i].data = (unsigned char*) malloc(TRACE_BUFSIZE);
+		if(buffers[i].data == NULL)
+		{
+			freeBuffers();
+			return ERR_OutOfMemory;
+		}
+	}
+
+	traceFile = fopen(filename, "wb");
+	if(traceFile == NULL)
+	{
+		freeBuffers();
+		return ERR_OpeningFile;
+	}
+
+	memcpy(header.magic, TRACE_MAGIC, 4);
+	header.version = TRACE_VERSION;
+	if(fwrite(&header, sizeof(header), 1, traceFile) != 1)
+	{
+		fclose(traceFile);
+		traceFile = NULL;
+		freeBuffers();
+		return ERR_WritingFile;
+	}
+
+	state.progCounter = info.progCounter - 1;
+	state.address = 0;
+	state.regA = info.regA;
+	state.regB = info.regB;
+	state.flags = info.flagZ | info.flagO << 1 | info.flagN << 2;
+	stats.records = 0;
+	stats.bytes = sizeof(header);
+	isPending = 0;
+	firstFull = 0;
+	numFull = 0;
+	stopWriter = 0;
+	writeFailed = 0;
+	current = &buffers[0];
+	startBlock(current);
+
+	if(pthread_create(&writer, NULL, writeBuffers, NULL) != 0)
+	{
+		fclose(traceFile);
+		traceFile = NULL;
+		freeBuffers();
+		return ERR_OutOfMemory;
+	}
+
+	if(addHook(HOOK_Instr, traceInstr, NULL) != ERR_None
+		|| addHook(HOOK_Read, traceRead, NULL) != ERR_None
+		|| addHook(HOOK_Write, traceWrite, NULL) != ERR_None)
+	{
+		removeHook(HOOK_Instr, traceInstr, NULL);
+		removeHook(HOOK_Read, traceRead, NULL);
+		removeHook(HOOK_Write, traceWrite, NULL);
+		closeTrace();
+		return ERR_OutOfMemory;
+	}
+
+	return ERR_None;
+}
+
+/** Write the last instruction and the buffers, and close the trace file
+ *
+ * @param [out] result		Size of the trace, or NULL
+ * @retval ERR_InvalidState	No trace is being written
+ * @retval ERR_WritingFile	Error writing the file, the trace is incomplete
+ */
+Error stopExecTrace(TraceStats *result)
+{
+	Error rval = ERR_None;
+
+	if(traceFile == NULL)
+	{
+		return ERR_InvalidState;
+	}
+
+	removeHook(HOOK_Instr, traceInstr, NULL);
+	removeHook(HOOK_Read, traceRead, NULL);
+	removeHook(HOOK_Write, traceWrite, NULL);
+
+	if(isPending)
+	{
+		finishRecord();
+		isPending = 0;
+	}
+	if(current->records > 0)
+	{
+		queueBuffer(FALSE);
+	}
+
+	rval = closeTrace();
+	if(result != NULL)
+	{
+		*result = stats;
+	}
+
+	return rval;
+}
+
+/** Is a trace being written? */
+int isExecTracing(void)
+{
+	return traceFile != NULL;
+}
+
+/** Open a trace file written by startExecTrace
+ *
+ * @retval ERR_OpeningFile	File could not be opened
+ * @retval ERR_ReadingFile	Error reading the file
+ * @retval ERR_InvalidImage	The file is not a trace of this host
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error openTraceReader(const char *filename, TraceReader **reader)
+{
+	TraceHeader	header;
+	TraceReader	*r = NULL;
+
+	r = (TraceReader*) calloc(1, sizeof(TraceReader));
+	if(r == NULL)
+	{
+		return ERR_OutOfMemory;
+	}
+
+	r->fp = fopen(filename, "rb");
+	if(r->fp == NULL)
+	{
+		free(r);
+		return ERR_OpeningFile;
+	}
+
+	if(fread(&header, sizeof(header), 1, r->fp) != 1)
+	{
+		closeTraceReader(r);
+		return ERR_ReadingFile;
+	}
+	if(memcmp(header.magic, TRACE_MAGIC, 4) != 0 || header.version != TRACE_VERSION)
+	{
+		closeTraceReader(r);
+		return ERR_InvalidImage;
+	}
+
+	*reader = r;
+	return ERR_None;
+}
+
+/** Read the next instruction of a trace
+ *
+ * @retval ERR_EndOfProgram	No instructions left
+ * @retval ERR_ReadingFile	Error reading the file, or it was cut off
+ * @retval ERR_InvalidImage	Corrupt trace
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error readTraceRecord(TraceReader *reader, TraceRecord *record)
+{
+	TraceState	*s = &reader->state;
+	unsigned int	bits = 0,
+			slot = 0;
+	uint32_t	n = 0;
+	MemCell		cell;
+	Error		rval = ERR_None;
+
+	while(reader->left == 0)
+	{
+		rval = readBlock(reader);
+		if(rval != ERR_None)
+		{
+			return rval;
+		}
+	}
+
+	if(reader->pos >= reader->size)
+	{
+		return ERR_InvalidImage;
+	}
+	bits = reader->data[reader->pos++];
+
+	record->progCounter = s->progCounter + 1;
+	if(bits & TRACE_Jump)
+	{
+		rval = getVarint(reader, &n);
+		record->progCounter += unzigzag(n);
+	}
+
+	slot = record->progCounter & (TRACE_CACHE - 1);
+	if((bits & TRACE_Cell) && rval == ERR_None)
+	{
+		rval = getVarint(reader, &n);
+		s->cacheAddr[slot] = record->progCounter;
+		s->cacheCell[slot] = (int) n;
+	}
+	else if(s->cacheAddr[slot] != record->progCounter && rval == ERR_None)
+	{
+		rval = ERR_InvalidImage;
+	}
+	cell.getal = s->cacheCell[slot];
+	record->instr = cell.instructie;
+
+	record->hasAddress = (bits & TRACE_Address) != 0;
+	if(record->hasAddress && rval == ERR_None)
+	{
+		rval = getVarint(reader, &n);
+		s->address += unzigzag(n);
+	}
+	record->address = s->address;
+
+	record->hasWrite = (bits & TRACE_Write) != 0;
+	record->value = 0;
+	if(record->hasWrite && rval == ERR_None)
+	{
+		rval = getVarint(reader, &n);
+		record->value = unzigzag(n);
+	}
+
+	if((bits & TRACE_RegA) && rval == ERR_None)
+	{
+		rval = getVarint(reader, &n);
+		s->regA = (int)((unsigned int) s->regA + unzigzag(n));
+	}
+	if((bits & TRACE_RegB) && rval == ERR_None)
+	{
+		rval = getVarint(reader, &n);
+		s->regB = (int)((unsigned int) s->regB + unzigzag(n));
+	}
+	if((bits & TRACE_Flags) && rval == ERR_None)
+	{
+		rval = reader->pos < reader->size ? ERR_None : ERR_InvalidImage;
+		s->flags = rval == ERR_None ? reader->data[reader->pos++] : 0;
+	}
+
+	if(rval != ERR_None)
+	{
+		return rval;
+	}
+
+	// The value written is relative to register A after the instruction
+	record->value = (int)((unsigned int) record->value + s->regA);
+	record->regA = s->regA;
+	record->regB = s->regB;
+	record->flagZ = s->flags & 1;
+	record->flagO = (s->flags >> 1) & 1;
+	record->flagN = (s->flags >> 2) & 1;
+	record->changed = bits & (TRACE_RegA | TRACE_RegB | TRACE_Flags);
+	s->progCounter = record->progCounter;
+	reader->left--;
+
+	return ERR_None;
+}
+
+/** Close a trace file opened with openTraceReader */
+void closeTraceReader(TraceReader *reader)
+{
+	if(reader != NULL)
+	{
+		fclose(reader->fp);
+		free(reader->data);
+		free(reader);
+	}
+}
+
+/** Private function: hook before an instruction, it finishes the record
+ *  of the previous instruction and starts the next */
+static Error traceInstr(void *context, const HookInfo *info)
+{
+	Error	rval = ERR_None;
+	MemCell	cell;
+
+	(void)context;
+
+	if(isPending)
+	{
+		rval = finishRecord();
+	}
+
+	cell.getal = info->value;
+	pending.progCounter = info->progCounter;
+	pending.instr = cell.instructie;
+	pending.hasAddress = 0;
+	pending.hasWrite = 0;
+	isPending = 1;
+
+	return rval;
+}
+
+/** Private function: hook of a memory read. A written cell is the address
+ *  of the record, else the last cell read. Accesses of instructions that
+ *  are executed outside the run, see executeInstr, are left out. */
+static Error traceRead(void *context, const HookInfo *info)
+{
+	(void)context;
+
+	if(isPending && !pending.hasWrite && info->progCounter == pending.progCounter)
+	{
+		pending.hasAddress = 1;
+		pending.address = info->address;
+	}
+
+	return ERR_None;
+}
+
+/** Private function: hook of a memory write */
+static Error traceWrite(void *context, const HookInfo *info)
+{
+	(void)context;
+
+	if(isPending && info->progCounter == pending.progCounter)
+	{
+		pending.hasAddress = 1;
+		pending.address = info->address;
+		pending.hasWrite = 1;
+		pending.value = info->value;
+	}
+
+	return ERR_None;
+}
+
+/** Private function: encode the pending record, with the registers after
+ *  the instruction, and queue the buffer when it is full
+ *
+ * @retval ERR_WritingFile	The writer thread could not write the file
+ */
+static Error finishRecord(void)
+{
+	ProcInfo	info = getStatus();
+	unsigned char	*start = current->data + current->size,
+			*p = start + 1;
+	unsigned int	bits = 0,
+			flags = info.flagZ | info.flagO << 1 | info.flagN << 2,
+			slot = pending.progCounter & (TRACE_CACHE - 1);
+	MemCell		cell;
+
+	if(pending.progCounter != state.progCounter + 1)
+	{
+		bits |= TRACE_Jump;
+		p = putVarint(p, zigzag((int)(pending.progCounter - (state.progCounter + 1))));
+	}
+
+	cell.instructie = pending.instr;
+	if(state.cacheAddr[slot] != pending.progCounter || state.cacheCell[slot] != cell.getal)
+	{
+		bits |= TRACE_Cell;
+		p = putVarint(p, (uint32_t) cell.getal);
+		state.cacheAddr[slot] = pending.progCounter;
+		state.cacheCell[slot] = cell.getal;
+	}
+
+	if(pending.hasAddress)
+	{
+		bits |= TRACE_Address;
+		p = putVarint(p, zigzag((int)(pending.address - state.address)));
+		state.address = pending.address;
+	}
+
+	if(pending.hasWrite)
+	{
+		bits |= TRACE_Write;
+		p = putVarint(p, zigzag((int)((unsigned int) pending.value - info.regA)));
+	}
+
+	if(info.regA != state.regA)
+	{
+		bits |= TRACE_RegA;
+		p = putVarint(p, zigzag((int)((unsigned int) info.regA - state.regA)));
+		state.regA = info.regA;
+	}
+
+	if(info.regB != state.regB)
+	{
+		bits |= TRACE_RegB;
+		p = putVarint(p, zigzag((int)((unsigned int) info.regB - state.regB)));
+		state.regB = info.regB;
+	}
+
+	if(flags != state.flags)
+	{
+		bits |= TRACE_Flags;
+		*p++ = (unsigned char) flags;
+		state.flags = flags;
+	}
+
+	*start = (unsigned char) bits;
+	state.progCounter = pending.progCounter;
+	current->size = p - current->data;
+	current->records++;
+	stats.records++;
+
+	if(current->size > TRACE_BUFSIZE - TRACE_MAXRECORD)
+	{
+		return queueBuffer(TRUE);
+	}
+
+	return ERR_None;
+}
+
+/** Private function: start a block with the state of the trace */
+static void startBlock(TraceBuffer *buffer)
+{
+	unsigned char *p = buffer->data;
+
+	p = putVarint(p, state.progCounter);
+	p = putVarint(p, state.address);
+	p = putVarint(p, zigzag(state.regA));
+	p = putVarint(p, zigzag(state.regB));
+	p = putVarint(p, state.flags);
+	buffer->size = p - buffer->data;
+	buffer->records = 0;
+	resetCache(&state);
+}
+
+/** Private function: hand the current buffer to the writer thread, and
+ *  take the next one when takeNext is set. Waits when there is none.
+ *
+ * @retval ERR_WritingFile	The writer thread could not write the file
+ */
+static Error queueBuffer(int takeNext)
+{
+	Error rval = ERR_None;
+
+	stats.bytes += sizeof(BlockHeader) + current->size;
+
+	pthread_mutex_lock(&bufferLock);
+	numFull++;
+	pthread_cond_signal(&bufferFilled);
+	while(takeNext && numFull == TRACE_BUFFERS)
+	{
+		pthread_cond_wait(&bufferEmptied, &bufferLock);
+	}
+	current = &buffers[(firstFull + numFull) % TRACE_BUFFERS];
+	rval = writeFailed ? ERR_WritingFile : ERR_None;
+	pthread_mutex_unlock(&bufferLock);
+
+	if(takeNext)
+	{
+		startBlock(current);
+	}
+
+	return rval;
+}
+
+/** Private function: writer thread, writes the full buffers in order until
+ *  stopWriter is set and none are left. After an error the buffers are
+ *  dropped, so the run does not wait for them. */
+static void *writeBuffers(void *arg)
+{
+	TraceBuffer	*buffer = NULL;
+	BlockHeader	header;
+	int		failed = 0;
+
+	(void)arg;
+
+	pthread_mutex_lock(&bufferLock);
+	for(;;)
+	{
+		while(numFull == 0 && !stopWriter)
+		{
+			pthread_cond_wait(&bufferFilled, &bufferLock);
+		}
+		if(numFull == 0)
+		{
+			break;
+		}
+		buffer = &buffers[firstFull];
+		failed = writeFailed;
+		pthread_mutex_unlock(&bufferLock);
+
+		if(!failed)
+		{
+			header.size = buffer->size;
+			header.records = buffer->records;
+			failed = fwrite(&header, sizeof(header), 1, traceFile) != 1
+				|| fwrite(buffer->data, buffer->size, 1, traceFile) != 1;
+		}
+
+		pthread_mutex_lock(&bufferLock);
+		writeFailed = failed;
+		firstFull = (firstFull + 1) % TRACE_BUFFERS;
+		numFull--;
+		pthread_cond_signal(&bufferEmptied);
+	}
+	pthread_mutex_unlock(&bufferLock);
+
+	return NULL;
+}
+
+/** Private function: wait for the writer thread to write the queued
+ *  buffers, close the file and free the buffers
+ *
+ * @retval ERR_WritingFile	Error writing the file
+ */
+static Error closeTrace(void)
+{
+	int failed = 0;
+
+	pthread_mutex_lock(&bufferLock);
+	stopWriter = 1;
+	pthread_cond_signal(&bufferFilled);
+	pthread_mutex_unlock(&bufferLock);
+	pthread_join(writer, NULL);
+
+	failed = writeFailed;
+	if(fclose(traceFile) != 0)
+	{
+		failed = 1;
+	}
+	traceFile = NULL;
+	freeBuffers();
+
+	return failed ? ERR_WritingFile : ERR_None;
+}
+
+/** Private function: free the buffers of the ring */
+static void freeBuffers(void)
+{
+	unsigned int i = 0;
+
+	for(i = 0; i < TRACE_BUFFERS; i++)
+	{
+		free(buffers[i].data);
+		buffers[i].data = NULL;
+	}
+	current = NULL;
+}
+
+/** Private function: forget the instructions seen, at the start of a block */
+static void resetCache(TraceState *cache)
+{
+	memset(cache->cacheAddr, 0xFF, sizeof(cache->cacheAddr));
+	memset(cache->cacheCell, 0, sizeof(cache->cacheCell));
+}
+
+/** Private function: read the header and the state of the next block */
+static Error readBlock(TraceReader *reader)
+{
+	BlockHeader	header;
+	unsigned char	*data = NULL;
+	uint32_t	n[5];
+	unsigned int	i = 0;
+	size_t		got = 0;
+	Error		rval = ERR_None;
+
+	got = fread(&header, 1, sizeof(header), reader->fp);
+	if(got == 0 && feof(reader->fp))
+	{
+		return ERR_EndOfProgram;
+	}
+	if(got != sizeof(header))
+	{
+		return ERR_ReadingFile;
+	}
+	if(header.size > TRACE_MAXBLOCK)
+	{
+		return ERR_InvalidImage;
+	}
+
+	data = (unsigned char*) realloc(reader->data, header.size);
+	if(data == NULL && header.size > 0)
+	{
+		return ERR_OutOfMemory;
+	}
+	reader->data = data;
+	reader->size = header.size;
+	reader->pos = 0;
+	reader->left = 0;
+	if(header.size > 0 && fread(reader->data, header.size, 1, reader->fp) != 1)
+	{
+		return ERR_ReadingFile;
+	}
+
+	for(i = 0; i < 5 && rval == ERR_None; i++)
+	{
+		rval = getVarint(reader, &n[i]);
+	}
+	if(rval != ERR_None)
+	{
+		return rval;
+	}
+
+	reader->state.progCounter = n[0];
+	reader->state.address = n[1];
+	reader->state.regA = unzigzag(n[2]);
+	reader->state.regB = unzigzag(n[3]);
+	reader->state.flags = n[4];
+	resetCache(&reader->state);
+	reader->left = header.records;
+
+	return ERR_None;
+}
+
+/** Private function: append a varint, at most 5 bytes */
+static unsigned char *putVarint(unsigned char *p, uint32_t n)
+{
+	while(n >= 0x80)
+	{
+		*p++ = (unsigned char)(n | 0x80);
+		n >>= 7;
+	}
+	*p++ = (unsigned char) n;
+
+	return p;
+}
+
+/** Private function: read a varint of the block
+ *
+ * @retval ERR_InvalidImage	The block ends in the number, or it is too long
+ */
+static Error getVarint(TraceReader *reader, uint32_t *n)
+{
+	unsigned int	shift = 0;
+	unsigned char	byte = 0x80;
+
+	*n = 0;
+	while(byte & 0x80)
+	{
+		if(reader->pos >= reader->size || shift > 28)
+		{
+			return ERR_InvalidImage;
+		}
+		byte = reader->data[reader->pos++];
+		*n |= (uint32_t)(byte & 0x7F) << shift;
+		shift += 7;
+	}
+
+	return ERR_None;
+}
+
+/** Private function: map small negative and positive numbers to small
+ *  unsigned ones: 0, -1, 1, -2 to 0, 1, 2, 3 */
+static uint32_t zigzag(int n)
+{
+	return ((uint32_t) n << 1) ^ (uint32_t)(n >> 31);
+}
+
+/** Private function: undo zigzag */
+static int unzigzag(uint32_t n)
+{
+	return (int)(n >> 1) ^ -(int)(n & 1);
+}
@@ -0,0 +1,61 @@
+#ifndef _PSEUDOASM_INC_EXECTRACE_H_
+#define _PSEUDOASM_INC_EXECTRACE_H_
+
+#include "hardware.h"
+#include "errors.h"
+
+/** Bits of TraceRecord.changed */
+#define TRACE_RegA	0x10
+#define TRACE_RegB	0x20
+#define TRACE_Flags	0x40
+
+/** One executed instruction of a trace */
+typedef struct TraceRecord
+{
+	unsigned int progCounter;
+	Instruction instr;
+	/** Memory cell written by the instruction, else the last one read */
+	int hasAddress;
+	unsigned int address;
+	/** Value written to the address */
+	int hasWrite;
+	int value;
+	/** Registers and flags after the instruction */
+	int regA;
+	int regB;
+	int flagZ;
+	int flagO;
+	int flagN;
+	/** Registers and flags changed by the instruction, TRACE_ bits */
+	unsigned int changed;
+} TraceRecord;
+
+/** Size of a trace */
+typedef struct TraceStats
+{
+	unsigned long records;
+	unsigned long bytes;
+} TraceStats;
+
+/** Reader of a trace file, see openTraceReader */
+typedef struct TraceReader TraceReader;
+
+/* Write every executed instruction to a trace file */
+Error startExecTrace(const char *filename);
+
+/* Write the buffered instructions and close the trace file */
+Error stopExecTrace(TraceStats *stats);
+
+/* Is a trace being written? */
+int isExecTracing(void);
+
+/* Open a trace file written by startExecTrace */
+Error openTraceReader(const char *filename, TraceReader **reader);
+
+/* Read the next instruction, ERR_EndOfProgram at the end of the trace */
+Error readTraceRecord(TraceReader *reader, TraceRecord *record);
+
+/* Close a trace file */
+void closeTraceReader(TraceReader *reader);
+
+#endif // _PSEUDOASM_INC_EXECTRACE_H_
@@ -0,0 +1,421 @@
+/**
+ * Fast-forwarding of counted loops.
+ *
+ * A loop is a backward jump to a straight line body. When every variable
+ * (register A and B, and the directly addressed cells) is, at the end of an
+ * iteration, a constant or another variable plus a constant, the value of
+ * all variables after n iterations has a closed form. If the exit test also
+ * looks at such a value, the number of iterations until the loop exits can
+ * be calculated, and the machine can jump directly to the start of the last
+ * iteration. That iteration is executed normally, so the flags and program
+ * counter after the loop are exactly the same.
+ *
+ * Supported body instructions: NOP, LDA/LDB immediate or direct, STA/STB
+ * direct, ADD, SUB (B must not be a variable), and one conditional jump out
+ * of the loop when the backward jump is a JMP. Everything else (I/O, calls,
+ * indirect addressing, MUL, DIV, JOF, stores into the loop itself) is not
+ * fast-forwarded.
+ */
+#include <stdlib.h>
+#include <assert.h>
+#include "hardware.h"
+#include "memory.h"
+#include "alu.h"
+#include "fastforward.h"
+
+#define FF_MAX_LENGTH	32
+#define FF_MAX_ITER	0x7FFFFFFFUL
+#define FF_MAX_SLOPE	0x100000000LL
+
+/** When does the loop exit, in function of the tested value */
+enum ExitWhen
+{
+	EXIT_GT0,
+	EXIT_GE0,
+	EXIT_LT0,
+	EXIT_LE0,
+	EXIT_EQ0,
+	EXIT_NE0
+};
+
+static int cellVar(FFLoop *loop, unsigned int address);
+static int exits(int exitWhen, long long value);
+static int firstExit(int exitWhen, long long p, long long q, unsigned long *first);
+static int inRange(long long value);
+
+/** Analyze a loop. jumpAddr is the address of the backward jump that ends
+ *  the loop body.
+ *
+ * @return TRUE if the loop can be fast-forwarded, the summary of one
+ *  iteration is then saved in loop.
+ */
+int ffAnalyze(Memory **mem, unsigned int jumpAddr, FFLoop *loop)
+{
+	FFExpr		cur[FF_NUMVARS],
+			flags,
+			a, b;
+	int		flagsSet = 0,
+			hasTest = 0,
+			v = 0;
+	unsigned int	addr;
+	Instruction	jump,
+			instr;
+
+	assert(mem != NULL);
+
+	jump = readMemCell(mem, jumpAddr).instructie;
+	if(jump.operator < A_JMP || jump.operator > A_JIZ || jump.adressering != DIRECT
+		|| jump.operand > jumpAddr || jumpAddr - jump.operand >= FF_MAX_LENGTH)
+	{
+		return 0;
+	}
+
+	loop->target = jump.operand;
+	loop->length = jumpAddr - jump.operand + 1;
+	loop->numCells = 0;
+	loop->numChecks = 0;
+
+	for(v = 0; v < FF_NUMVARS; v++)
+	{
+		cur[v].var = v;
+		cur[v].c = 0;
+	}
+	flags = cur[FF_REGA];
+
+	// Execute the body symbolically, like processor.c and alu.h do for real
+	for(addr = loop->target; addr < jumpAddr; addr++)
+	{
+		instr = readMemCell(mem, addr).instructie;
+
+		switch(instr.operator)
+		{
+		case A_NOP:
+			break;
+		case A_LDA:
+		case A_LDB:
+			if(instr.adressering == ONMIDDELIJK)
+			{
+				a.var = -1;
+				a.c = immediateValue(instr);
+			}
+			else if(instr.adressering == DIRECT
+				&& (v = cellVar(loop, instr.operand)) >= 0)
+			{
+				a = cur[v];
+			}
+			else
+			{
+				return 0;
+			}
+
+			if(instr.operator == A_LDA)
+			{
+				cur[FF_REGA] = a;
+				flags = a;
+				flagsSet = 1;
+			}
+			else
+			{
+				cur[FF_REGB] = a;
+			}
+			break;
+		case A_STA:
+		case A_STB:
+			if(instr.adressering != DIRECT
+				|| (instr.operand >= loop->target && instr.operand <= jumpAddr)
+				|| (v = cellVar(loop, instr.operand)) < 0)
+			{
+				return 0;
+			}
+			cur[v] = cur[instr.operator == A_STA ? FF_REGA : FF_REGB];
+			break;
+		case A_ADD:
+		case A_SUB:
+			a = cur[FF_REGA];
+			b = cur[FF_REGB];
+			if(b.var >= 0 && (instr.operator == A_SUB || a.var >= 0))
+			{
+				return 0;
+			}
+			if(loop->numChecks == FF_MAX_CHECKS)
+			{
+				return 0;
+			}
+
+			a.var = a.var >= 0 ? a.var : b.var;
+			a.c = instr.operator == A_ADD ? a.c + b.c : a.c - b.c;
+			loop->checks[loop->numChecks++] = a;
+
+			cur[FF_REGA] = a;
+			flags = a;
+			flagsSet = 1;
+			break;
+		case A_JSP:
+		case A_JSN:
+		case A_JIZ:
+			// Exit test: a single jump out of the loop
+			if(hasTest || !flagsSet || instr.adressering != DIRECT
+				|| (instr.operand >= loop->target && instr.operand <= jumpAddr))
+			{
+				return 0;
+			}
+			loop->test = flags;
+			loop->exitWhen = instr.operator == A_JSP ? EXIT_GT0
+				: instr.operator == A_JSN ? EXIT_LT0 : EXIT_EQ0;
+			hasTest = 1;
+			break;
+		default:
+			return 0;
+		}
+	}
+
+	if(jump.operator == A_JMP)
+	{
+		if(!hasTest)
+		{
+			return 0;
+		}
+	}
+	else
+	{
+		// The backward jump is the test, the loop exits when it is not taken
+		if(hasTest || !flagsSet)
+		{
+			return 0;
+		}
+		loop->test = flags;
+		loop->exitWhen = jump.operator == A_JSP ? EXIT_LE0
+			: jump.operator == A_JSN ? EXIT_GE0 : EXIT_NE0;
+	}
+
+	for(v = 0; v < FF_NUMVARS; v++)
+	{
+		loop->update[v] = cur[v];
+	}
+
+	return 1;
+}
+
+/** Skip iterations of an analyzed loop. The machine must be at the start
+ *  of the loop body. Iterations are only skipped when none of the skipped
+ *  additions or subtractions overflows, and the last iteration is never
+ *  skipped.
+ *
+ * @param [in] loop		Analyzed loop
+ * @param [in,out] values	Value of every variable (A, B, cells). Set to the
+ *				values after the skipped iterations.
+ * @param [in] maxIter		Skip at most this many iterations
+ * @param [out] iterations	Number of skipped iterations
+ * @return TRUE if at least two iterations were skipped
+ */
+int ffSolve(FFLoop *loop, long long values[], unsigned long maxIter,
+	unsigned long *iterations)
+{
+	long long	base[FF_NUMVARS],
+			slope[FF_NUMVARS],
+			p, q, value;
+	unsigned long	n = 0;
+	int		numVars = 2 + loop->numCells,
+			v = 0,
+			k = 0;
+	FFExpr		e;
+
+	// Closed form of every variable: base + i * slope, valid for i >= 1
+	for(v = 0; v < numVars; v++)
+	{
+		e = loop->update[v];
+		if(e.var < 0)
+		{
+			base[v] = e.c;
+			slope[v] = 0;
+		}
+		else if(e.var == v)
+		{
+			base[v] = values[v];
+			slope[v] = e.c;
+		}
+		else if(loop->update[e.var].var == e.var)
+		{
+			base[v] = values[e.var] - loop->update[e.var].c + e.c;
+			slope[v] = loop->update[e.var].c;
+		}
+		else
+		{
+			return 0;
+		}
+
+		if(slope[v] >= FF_MAX_SLOPE || slope[v] <= -FF_MAX_SLOPE)
+		{
+			return 0;
+		}
+	}
+
+	// Does the loop exit in the current iteration?
+	e = loop->test;
+	value = e.var < 0 ? e.c : values[e.var] + e.c;
+	if(exits(loop->exitWhen, value))
+	{
+		return 0;
+	}
+
+	// First iteration in which the loop exits
+	p = e.var < 0 ? e.c : base[e.var] + e.c;
+	q = e.var < 0 ? 0 : slope[e.var];
+	if(!firstExit(loop->exitWhen, p, q, &n))
+	{
+		return 0;
+	}
+
+	if(maxIter > FF_MAX_ITER)
+	{
+		maxIter = FF_MAX_ITER;
+	}
+	if(n > maxIter)
+	{
+		n = maxIter;
+	}
+	if(n < 2)
+	{
+		return 0;
+	}
+
+	// Nothing may overflow in the skipped iterations 0 .. n - 1. All values
+	// are linear in i (for i >= 1), so checking the bounds is enough.
+	for(k = 0; k < loop->numChecks; k++)
+	{
+		e = loop->checks[k];
+		if(e.var < 0)
+		{
+			if(!inRange(e.c))
+			{
+				return 0;
+			}
+			continue;
+		}
+
+		if(!inRange(values[e.var] + e.c)
+			|| !inRange(base[e.var] + slope[e.var] + e.c)
+			|| !inRange(base[e.var] + (long long)(n - 1) * slope[e.var] + e.c))
+		{
+			return 0;
+		}
+	}
+
+	for(v = 0; v < numVars; v++)
+	{
+		value = base[v] + (long long)n * slope[v];
+		if(!inRange(value))
+		{
+			return 0;
+		}
+		values[v] = value;
+	}
+
+	*iterations = n;
+	return 1;
+}
+
+/** Private function: variable number of a cell, added if it is new.
+ *  Returns -1 if there are too many cells. */
+static int cellVar(FFLoop *loop, unsigned int address)
+{
+	int i = 0;
+
+	for(i = 0; i < loop->numCells; i++)
+	{
+		if(loop->cells[i] == address)
+		{
+			return 2 + i;
+		}
+	}
+
+	if(loop->numCells == FF_MAX_CELLS)
+	{
+		return -1;
+	}
+
+	loop->cells[loop->numCells] = address;
+	return 2 + loop->numCells++;
+}
+
+/** Private function: does the loop exit for this tested value? */
+static int exits(int exitWhen, long long value)
+{
+	switch(exitWhen)
+	{
+	case EXIT_GT0:
+		return value > 0;
+	case EXIT_GE0:
+		return value >= 0;
+	case EXIT_LT0:
+		return value < 0;
+	case EXIT_LE0:
+		return value <= 0;
+	case EXIT_EQ0:
+		return value == 0;
+	default:
+		return value != 0;
+	}
+}
+
+/** Private function: smallest i >= 1 for which the loop exits when the
+ *  tested value is p + i * q.
+ *
+ * @return FALSE if the loop never exits
+ */
+static int firstExit(int exitWhen, long long p, long long q, unsigned long *first)
+{
+	// Exiting when the value is smaller is exiting on the negated value
+	if(exitWhen == EXIT_LT0 || exitWhen == EXIT_LE0)
+	{
+		p = -p;
+		q = -q;
+		exitWhen = exitWhen == EXIT_LT0 ? EXIT_GT0 : EXIT_GE0;
+	}
+
+	if(exits(exitWhen, p + q))
+	{
+		*first = 1;
+		return 1;
+	}
+
+	switch(exitWhen)
+	{
+	case EXIT_GT0:
+		// p + q <= 0, so -p >= q
+		if(q <= 0)
+		{
+			return 0;
+		}
+		*first = (unsigned long)(-p / q + 1);
+		return 1;
+	case EXIT_GE0:
+		if(q <= 0)
+		{
+			return 0;
+		}
+		*first = (unsigned long)((-p + q - 1) / q);
+		return 1;
+	case EXIT_EQ0:
+		if(q == 0 || -p % q != 0 || -p / q < 1)
+		{
+			return 0;
+		}
+		*first = (unsigned long)(-p / q);
+		return 1;
+	default:
+		// Zero after one iteration, so not zero after the second one
+		if(q == 0)
+		{
+			return 0;
+		}
+		*first = 2;
+		return 1;
+	}
+}
+
+/** Private function: does the value fit in a register? */
+static int inRange(long long value)
+{
+	return value >= -2147483647LL - 1 && value <= 2147483647LL;
+}
@@ -0,0 +1,46 @@
+#ifndef _PSEUDOASM_INC_FASTFORWARD_H_
+#define _PSEUDOASM_INC_FASTFORWARD_H_
+
+#include "memory.h"
+
+#define FF_MAX_CELLS	8
+#define FF_NUMVARS	(2 + FF_MAX_CELLS)
+#define FF_MAX_CHECKS	32
+
+/* Variables of a loop: both registers and the directly addressed cells */
+#define FF_REGA		0
+#define FF_REGB		1
+
+/** A value in the loop body: variable 'var' at the start of the iteration
+ *  plus 'c'. When var is -1 the value is the constant c. */
+typedef struct FFExpr
+{
+	int var;
+	long long c;
+} FFExpr;
+
+/** Summary of one iteration of a counted loop */
+typedef struct FFLoop
+{
+	unsigned int target;
+	unsigned int length;
+	int numCells;
+	unsigned int cells[FF_MAX_CELLS];
+	/** Value of every variable at the end of an iteration */
+	FFExpr update[FF_NUMVARS];
+	/** Value that the exit test looks at, and when the loop exits */
+	FFExpr test;
+	int exitWhen;
+	/** Results of ADD and SUB, these may not overflow */
+	int numChecks;
+	FFExpr checks[FF_MAX_CHECKS];
+} FFLoop;
+
+/* Analyze the loop that ends with the backward jump at jumpAddr */
+int ffAnalyze(Memory **mem, unsigned int jumpAddr, FFLoop *loop);
+
+/* Calculate the state after skipping as many iterations as possible */
+int ffSolve(FFLoop *loop, long long values[], unsigned long maxIter,
+	unsigned long *iterations);
+
+#endif // _PSEUDOASM_INC_FASTFORWARD_H_
@@ -66,6 +66,9 @@ enum Adressering
 //    MEMORY
 // -------------
 
+/** Initial value of the stack pointer, the stack grows down */
+#define STACK_START	900000
+
 /** A memory cell */
 typedef union geheugenCell
 {
@@ -0,0 +1,432 @@
+/**
+ * Binary images of compiled programs (.pbin files).
+ *
+ * Layout of the file, all numbers are 32 bit in the byte order of the host:
+ *   magic		"PBIN"
+ *   version		IMAGE_VERSION
+ *   entry		initial program counter
+ *   stack pointer	initial stack pointer
+ *   registers		initial A, B and flags (IMAGE_FLAG_*)
+ *   segments		number of segments
+ *   checksum		FNV-1a over the words after the header
+ * followed by a table with for every segment its base address, number of
+ * cells, flags and the offset of its cells in the file, and by the cells.
+ *
+ * A file written on a host with another byte order fails the version check.
+ */
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "image.h"
+
+#define IMAGE_MAGIC	"PBIN"
+
+typedef struct ImageHeader
+{
+	char		magic[4];
+	uint32_t	version;
+	uint32_t	entry;
+	uint32_t	stackPointer;
+	uint32_t	regA;
+	uint32_t	regB;
+	uint32_t	flags;
+	uint32_t	numSegments;
+	uint32_t	checksum;
+} ImageHeader;
+
+typedef struct ImageSegEntry
+{
+	uint32_t	base;
+	uint32_t	count;
+	uint32_t	flags;
+	uint32_t	offset;
+} ImageSegEntry;
+
+#define CHECKSUM_INIT	2166136261u
+
+static uint32_t checksum(uint32_t hash, const void *data, size_t numWords);
+static int compareCells(const void *a, const void *b);
+
+/** Write an image to a file
+ *
+ * @retval ERR_OpeningFile	File could not be created
+ * @retval ERR_WritingFile	Error writing the file
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error writeImage(const char *filename, Image *image)
+{
+	ImageHeader	header;
+	ImageSegEntry	*table = NULL;
+	FILE		*fp = NULL;
+	uint32_t	offset = 0;
+	unsigned int	i = 0;
+	int		failed = 0;
+
+	assert(image != NULL);
+
+	table = (ImageSegEntry*) malloc(image->numSegments * sizeof(ImageSegEntry) + 1);
+	if(table == NULL)
+	{
+		return ERR_OutOfMemory;
+	}
+
+	memcpy(header.magic, IMAGE_MAGIC, 4);
+	header.version = IMAGE_VERSION;
+	header.entry = image->entry;
+	header.stackPointer = image->stackPointer;
+	header.regA = (uint32_t)image->regA;
+	header.regB = (uint32_t)image->regB;
+	header.flags = image->flags;
+	header.numSegments = image->numSegments;
+
+	offset = sizeof(ImageHeader) + image->numSegments * sizeof(ImageSegEntry);
+	for(i = 0; i < image->numSegments; i++)
+	{
+		table[i].base = image->segments[i].base;
+		table[i].count = image->segments[i].count;
+		table[i].flags = image->segments[i].flags;
+		table[i].offset = offset;
+		offset += image->segments[i].count * sizeof(MemCell);
+	}
+
+	header.checksum = checksum(CHECKSUM_INIT, table,
+		image->numSegments * sizeof(ImageSegEntry) / 4);
+	for(i = 0; i < image->numSegments; i++)
+	{
+		header.checksum = checksum(header.checksum, image->segments[i].cells,
+			image->segments[i].count);
+	}
+
+	fp = fopen(filename, "wb");
+	if(fp == NULL)
+	{
+		free(table);
+		return ERR_OpeningFile;
+	}
+
+	failed = fwrite(&header, sizeof(header), 1, fp) != 1;
+	if(!failed && image->numSegments > 0)
+	{
+		failed = fwrite(table, sizeof(ImageSegEntry), image->numSegments, fp)
+			!= image->numSegments;
+	}
+	for(i = 0; i < image->numSegments && !failed; i++)
+	{
+		failed = fwrite(image->segments[i].cells, sizeof(MemCell),
+			image->segments[i].count, fp) != image->segments[i].count;
+	}
+
+	failed = fclose(fp) != 0 || failed;
+	free(table);
+
+	return failed ? ERR_WritingFile : ERR_None;
+}
+
+/** Map an image file in memory. Nothing is parsed or copied: the cells of
+ *  the segments point in the mapping. Free it with freeImage.
+ *
+ * @retval ERR_OpeningFile	File could not be opened
+ * @retval ERR_ReadingFile	File could not be mapped
+ * @retval ERR_InvalidImage	Not an image, another version or a bad checksum
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error mapImage(const char *filename, Image *image)
+{
+	int		fd = -1;
+	struct stat	info;
+	void		*mapping = MAP_FAILED;
+	ImageHeader	*header = NULL;
+	ImageSegEntry	*table = NULL;
+	size_t		size = 0,
+			tableEnd = 0;
+	uint32_t	hash = 0;
+	unsigned int	i = 0;
+
+	assert(image != NULL);
+
+	fd = open(filename, O_RDONLY);
+	if(fd < 0)
+	{
+		return ERR_OpeningFile;
+	}
+
+	if(fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+	{
+		close(fd);
+		return ERR_ReadingFile;
+	}
+
+	size = (size_t)info.st_size;
+	if(size < sizeof(ImageHeader) || size % 4 != 0)
+	{
+		close(fd);
+		return ERR_InvalidImage;
+	}
+
+	mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(mapping == MAP_FAILED)
+	{
+		return ERR_ReadingFile;
+	}
+
+	// Check the header, the segment table and the checksum
+	header = (ImageHeader*) mapping;
+	table = (ImageSegEntry*) (header + 1);
+	tableEnd = sizeof(ImageHeader) + (size_t)header->numSegments * sizeof(ImageSegEntry);
+	if(memcmp(header->magic, IMAGE_MAGIC, 4) != 0 || header->version != IMAGE_VERSION
+		|| header->numSegments > size / sizeof(ImageSegEntry) || tableEnd > size)
+	{
+		munmap(mapping, size);
+		return ERR_InvalidImage;
+	}
+
+	for(i = 0; i < header->numSegments; i++)
+	{
+		if(table[i].offset < tableEnd || table[i].offset % 4 != 0
+			|| table[i].offset > size
+			|| table[i].count > (size - table[i].offset) / sizeof(MemCell)
+			|| (unsigned long long)table[i].base + table[i].count
+				> (unsigned long long)UINT_MAX + 1)
+		{
+			munmap(mapping, size);
+			return ERR_InvalidImage;
+		}
+	}
+
+	hash = checksum(CHECKSUM_INIT, header + 1, (size - sizeof(ImageHeader)) / 4);
+	if(hash != header->checksum)
+	{
+		munmap(mapping, size);
+		return ERR_InvalidImage;
+	}
+
+	image->segments = (ImageSegment*) malloc(header->numSegments * sizeof(ImageSegment) + 1);
+	if(image->segments == NULL)
+	{
+		munmap(mapping, size);
+		return ERR_OutOfMemory;
+	}
+
+	for(i = 0; i < header->numSegments; i++)
+	{
+		image->segments[i].base = table[i].base;
+		image->segments[i].count = table[i].count;
+		image->segments[i].flags = table[i].flags;
+		image->segments[i].cells = (MemCell*) ((char*)mapping + table[i].offset);
+	}
+
+	image->entry = header->entry;
+	image->stackPointer = header->stackPointer;
+	image->regA = (int)header->regA;
+	image->regB = (int)header->regB;
+	image->flags = header->flags;
+	image->numSegments = header->numSegments;
+	image->cells = NULL;
+	image->mapping = mapping;
+	image->mapSize = size;
+
+	return ERR_None;
+}
+
+/** Free an assembled image, or unmap an image that was loaded with mapImage */
+void freeImage(Image *image)
+{
+	assert(image != NULL);
+
+	if(image->mapping != NULL)
+	{
+		munmap(image->mapping, image->mapSize);
+	}
+	free(image->cells);
+	free(image->segments);
+
+	image->mapping = NULL;
+	image->cells = NULL;
+	image->segments = NULL;
+	image->numSegments = 0;
+}
+
+/** Does the file start with the magic number of an image? Returns FALSE
+ *  if it can not be read. */
+int isImageFile(const char *filename)
+{
+	FILE	*fp = NULL;
+	char	magic[4];
+	int	isImage = 0;
+
+	fp = fopen(filename, "rb");
+	if(fp == NULL)
+	{
+		return 0;
+	}
+
+	isImage = fread(magic, 1, 4, fp) == 4 && memcmp(magic, IMAGE_MAGIC, 4) == 0;
+	fclose(fp);
+
+	return isImage;
+}
+
+/** Copy all segments of an image to the memory. Segments in ascending
+ *  order, as the compiler writes them, are loaded in one walk over the
+ *  memory; the walk only starts over at a segment below the previous one.
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error loadImage(Memory **memory, Image *image)
+{
+	Error			rval = ERR_None;
+	Memory			**cursor = NULL;
+	unsigned long long	end = 0;
+	unsigned int		i = 0;
+
+	assert(memory != NULL && image != NULL);
+
+	for(i = 0; i < image->numSegments && rval == ERR_None; i++)
+	{
+		ImageSegment *segment = &image->segments[i];
+
+		if(i > 0 && segment->base < end)
+		{
+			cursor = NULL;
+		}
+		rval = loadMemImage(memory, &cursor, segment->base,
+			segment->cells, segment->count);
+		end = (unsigned long long)segment->base + segment->count;
+	}
+
+	return rval;
+}
+
+/** List the cells of all segments sorted on address, for the analyses of a
+ *  program. When segments overlap, the cell of the last segment is kept,
+ *  like loadImage.
+ *
+ * @param [in] image		Assembled or mapped image
+ * @param [out] cells		The cells, free them with free
+ * @param [out] count		Number of cells
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error flattenImage(Image *image, ImageCell **cells, size_t *count)
+{
+	ImageCell	*list = NULL;
+	size_t		total = 0,
+			i = 0,
+			kept = 0;
+	unsigned int	j = 0,
+			k = 0;
+
+	assert(image != NULL && cells != NULL && count != NULL);
+
+	for(j = 0; j < image->numSegments; j++)
+	{
+		total += image->segments[j].count;
+	}
+
+	list = (ImageCell*) malloc(total * sizeof(ImageCell) + 1);
+	if(list == NULL)
+	{
+		return ERR_OutOfMemory;
+	}
+
+	for(j = 0; j < image->numSegments; j++)
+	{
+		ImageSegment *segment = &image->segments[j];
+
+		for(k = 0; k < segment->count; k++, i++)
+		{
+			list[i].address = segment->base + k;
+			list[i].order = (unsigned int)i;
+			list[i].flags = segment->flags;
+			list[i].cell = &segment->cells[k];
+			list[i].value = segment->cells[k];
+			list[i].marks = 0;
+		}
+	}
+
+	qsort(list, total, sizeof(ImageCell), compareCells);
+
+	for(i = 0; i < total; i++)
+	{
+		if(i + 1 < total && list[i + 1].address == list[i].address)
+		{
+			continue;
+		}
+		list[kept++] = list[i];
+	}
+
+	*cells = list;
+	*count = kept;
+
+	return ERR_None;
+}
+
+/** Index of the first cell at or above an address in the cells of
+ *  flattenImage, count if there is none */
+size_t firstImageCell(ImageCell *cells, size_t count, unsigned int address)
+{
+	size_t	low = 0,
+		high = count,
+		mid = 0;
+
+	while(low < high)
+	{
+		mid = (low + high) / 2;
+		if(cells[mid].address < address)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+
+	return low;
+}
+
+/** Find the cell of an address in the cells of flattenImage, NULL if it is
+ *  not in the image */
+ImageCell *findImageCell(ImageCell *cells, size_t count, unsigned int address)
+{
+	size_t i = firstImageCell(cells, count, address);
+
+	return i < count && cells[i].address == address ? &cells[i] : NULL;
+}
+
+/** Private function: order cells on address, and in the order of the segments */
+static int compareCells(const void *a, const void *b)
+{
+	const ImageCell	*ca = (const ImageCell*) a,
+			*cb = (const ImageCell*) b;
+
+	if(ca->address != cb->address)
+	{
+		return ca->address < cb->address ? -1 : 1;
+	}
+
+	return ca->order < cb->order ? -1 : ca->order > cb->order;
+}
+
+/** Private function: FNV-1a over 32 bit words */
+static uint32_t checksum(uint32_t hash, const void *data, size_t numWords)
+{
+	const uint32_t	*words = (const uint32_t*) data;
+	size_t		i = 0;
+
+	for(i = 0; i < numWords; i++)
+	{
+		hash ^= words[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
@@ -0,0 +1,88 @@
+#ifndef _PSEUDOASM_INC_IMAGE_H_
+#define _PSEUDOASM_INC_IMAGE_H_
+
+#include <stddef.h>
+#include "errors.h"
+#include "hardware.h"
+#include "memory.h"
+
+#define IMAGE_VERSION	2
+
+/* Flags of a segment: code (instructions) or data */
+#define IMAGE_SEG_CODE	0x0
+#define IMAGE_SEG_DATA	0x1
+
+/* Flags of the processor when the program starts */
+#define IMAGE_FLAG_Z	0x1
+#define IMAGE_FLAG_O	0x2
+#define IMAGE_FLAG_N	0x4
+
+/** Contiguous cells of a program, starting at address base */
+typedef struct ImageSegment
+{
+	unsigned int base;
+	unsigned int count;
+	unsigned int flags;
+	MemCell *cells;
+} ImageSegment;
+
+/** A compiled program: the segments and the initial state of the processor */
+typedef struct Image
+{
+	unsigned int entry;
+	unsigned int stackPointer;
+	/** Registers and IMAGE_FLAG_* when the program starts, 0 unless the
+	 *  prologue was executed, see runPrologue */
+	int regA;
+	int regB;
+	unsigned int flags;
+	unsigned int numSegments;
+	ImageSegment *segments;
+	/** Cells of all segments of an assembled image, NULL if it was loaded */
+	MemCell *cells;
+	/** File mapping of a loaded image, NULL if it was not loaded */
+	void *mapping;
+	size_t mapSize;
+} Image;
+
+/** A cell of an image after overlapping segments were resolved, see
+ *  flattenImage */
+typedef struct ImageCell
+{
+	unsigned int address;
+	/** Position in the segments, the last segment wins an address */
+	unsigned int order;
+	/** Flags of the segment, IMAGE_SEG_* */
+	unsigned int flags;
+	/** The cell in its segment, and a copy to work on */
+	MemCell *cell;
+	MemCell value;
+	/** Free for the user of the cells, 0 at first */
+	unsigned int marks;
+} ImageCell;
+
+/* Write an image to a file */
+Error writeImage(const char *filename, Image *image);
+
+/* Map an image file in memory, the cells of the segments point in the file */
+Error mapImage(const char *filename, Image *image);
+
+/* Free an assembled image, or unmap an image loaded with mapImage */
+void freeImage(Image *image);
+
+/* Does the file start with the magic number of an image? */
+int isImageFile(const char *filename);
+
+/* Copy all segments of an image to the memory */
+Error loadImage(Memory **memory, Image *image);
+
+/* List the cells of all segments sorted on address, free them with free */
+Error flattenImage(Image *image, ImageCell **cells, size_t *count);
+
+/* Index of the first cell at or above an address, count if there is none */
+size_t firstImageCell(ImageCell *cells, size_t count, unsigned int address);
+
+/* Find the cell of an address, NULL if it is not in the image */
+ImageCell *findImageCell(ImageCell *cells, size_t count, unsigned int address);
+
+#endif // _PSEUDOASM_INC_IMAGE_H_
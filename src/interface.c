@@ -21,8 +21,19 @@ Error cmdSetBp(char *cmd);
 Error cmdListBp(char *cmd);
 Error cmdDelBp(char *cmd);
 Error cmdAsm(char *cmd);
+Error cmdList(char *cmd);
+Error cmdExport(char *cmd);
 Error cmdStatus(char *cmd);
 Error cmdStack(char *cmd);
+Error cmdLimit(char *cmd);
+Error cmdLoop(char *cmd);
+Error cmdMemo(char *cmd);
+Error cmdStats(char *cmd);
+Error cmdProfile(char *cmd);
+Error cmdCoverage(char *cmd);
+Error cmdTrace(char *cmd);
+Error cmdReload(char *cmd);
+Error cmdFastForward(char *cmd);
 Error cmdHelp(char *cmd);
 
 //
@@ -59,7 +70,19 @@ UICommand commandList[] =
 	{"bpd", cmdDelBp, "Delete a breakpoint: bpd address"},
 	{"a", cmdAsm, "Assemble an instruction and save it to memory: a address instruction"},
 	{"asm", cmdAsm, NULL},
+	{"list", cmdList, "Disassemble memory: list from to"},
+	{"l", cmdList, NULL},
+	{"export", cmdExport, "Write memory as source: export file, export file from to"},
 	{"stack", cmdStack, "Manipulate the stack: stack, stack address, stack trace on/off"},
+	{"limit", cmdLimit, "Limit a run: limit, limit instr/time/mem number, limit off"},
+	{"loop", cmdLoop, "Stop a run that repeats the same state: loop on/off"},
+	{"ffwd", cmdFastForward, "Skip the iterations of counted loops: ffwd on/off"},
+	{"memo", cmdMemo, "Replay subroutine calls with the same input: memo, memo on/off"},
+	{"stats", cmdStats, "Display the work done by the processor: stats, stats reset"},
+	{"profile", cmdProfile, "Count executions per address and subroutine: profile on/off, profile [count], profile save file"},
+	{"coverage", cmdCoverage, "Record the executed addresses: coverage on/off/reset, coverage, coverage save/merge/lcov file"},
+	{"trace", cmdTrace, "Write every executed instruction to a file: trace file, trace off"},
+	{"reload", cmdReload, "Assemble the changed lines of the source file into the program"},
 	{"exit", cmdExit, "Exit the assembler program"},
 	{"quit", cmdExit, NULL},
 	{"help", cmdHelp, "Display all commands"},
@@ -345,6 +368,48 @@ Error cmdAsm(char *cmd)
 	return ERR_None;
 }
 
+Error cmdList(char *cmd)
+{
+	unsigned int from, to;
+	char end[2];
+
+	if(sscanf(cmd, "list %u %u %1s", &from, &to, end) == 2
+		|| sscanf(cmd, "l %u %u %1s", &from, &to, end) == 2)
+	{
+		rntList(from, to);
+	}
+	else
+	{
+		printf("Usage: list from to\n");
+	}
+
+	return ERR_None;
+}
+
+Error cmdExport(char *cmd)
+{
+	unsigned int from, to;
+	char filename[256];
+	char end[2];
+	int count;
+
+	count = sscanf(cmd, "export %255s %u %u %1s", filename, &from, &to, end);
+	if(count == 1)
+	{
+		rntExport(filename, 0, 0xFFFFFFFF);
+	}
+	else if(count == 3)
+	{
+		rntExport(filename, from, to);
+	}
+	else
+	{
+		printf("Usage: export file, export file from to\n");
+	}
+
+	return ERR_None;
+}
+
 void menuNieuwProg(void)
 {
 	printf("Opening edit window, close edit window to return to console ...\n");
@@ -387,6 +452,270 @@ Error cmdStack(char *cmd)
 	return ERR_None;
 }
 
+/* Resource limits of a run. Time is in milliseconds. */
+Error cmdLimit(char *cmd)
+{
+	static unsigned long maxInstr = 0, maxMillis = 0;
+	static unsigned int maxCells = 0;
+	unsigned long value;
+	char end[2];
+
+	if(sscanf(cmd, "limit %1s", end) == EOF)
+	{
+		rntListLimits();
+		return ERR_None;
+	}
+	else if(sscanf(cmd, "limit instr %lu %1s", &value, end) == 1)
+	{
+		maxInstr = value;
+	}
+	else if(sscanf(cmd, "limit time %lu %1s", &value, end) == 1)
+	{
+		maxMillis = value;
+	}
+	else if(sscanf(cmd, "limit mem %lu %1s", &value, end) == 1)
+	{
+		maxCells = (unsigned int)value;
+	}
+	else if(sscanf(cmd, "limit off %1s", end) == EOF)
+	{
+		maxInstr = maxMillis = maxCells = 0;
+	}
+	else if(sscanf(cmd, "limit %1s", end) != EOF)
+	{
+		printf("Usage: limit, limit instr/time/mem number, limit off\n");
+		return ERR_None;
+	}
+
+	rntSetLimits(maxInstr, maxMillis, maxCells);
+	rntListLimits();
+
+	return ERR_None;
+}
+
+Error cmdLoop(char *cmd)
+{
+	char end[2];
+
+	if(sscanf(cmd, "loop %1s", end) == EOF)
+	{
+		printf("Usage: loop on/off\n");
+	}
+	else if(sscanf(cmd, "loop on %1s", end) == EOF)
+	{
+		rntDetectLoops(1);
+		printf("Infinite loop detection enabled\n");
+	}
+	else if(sscanf(cmd, "loop off %1s", end) == EOF)
+	{
+		rntDetectLoops(0);
+		printf("Infinite loop detection disabled\n");
+	}
+	else
+	{
+		printf("Usage: loop on/off\n");
+	}
+
+	return ERR_None;
+}
+
+Error cmdFastForward(char *cmd)
+{
+	char end[2];
+
+	if(sscanf(cmd, "ffwd %1s", end) == EOF)
+	{
+		printf("Usage: ffwd on/off\n");
+	}
+	else if(sscanf(cmd, "ffwd on %1s", end) == EOF)
+	{
+		rntFastForward(1);
+		printf("Counted loops are fast-forwarded\n");
+	}
+	else if(sscanf(cmd, "ffwd off %1s", end) == EOF)
+	{
+		rntFastForward(0);
+		printf("Counted loops are executed normally\n");
+	}
+	else
+	{
+		printf("Usage: ffwd on/off\n");
+	}
+
+	return ERR_None;
+}
+
+Error cmdMemo(char *cmd)
+{
+	char end[2];
+
+	if(sscanf(cmd, "memo %1s", end) == EOF)
+	{
+		rntMemoStats();
+	}
+	else if(sscanf(cmd, "memo on %1s", end) == EOF)
+	{
+		rntMemoize(1);
+		printf("Subroutine memoization enabled\n");
+	}
+	else if(sscanf(cmd, "memo off %1s", end) == EOF)
+	{
+		rntMemoize(0);
+		printf("Subroutine memoization disabled\n");
+	}
+	else
+	{
+		printf("Usage: memo, memo on/off\n");
+	}
+
+	return ERR_None;
+}
+
+Error cmdStats(char *cmd)
+{
+	char end[2];
+
+	if(sscanf(cmd, "stats %1s", end) == EOF)
+	{
+		rntStats();
+	}
+	else if(sscanf(cmd, "stats reset %1s", end) == EOF)
+	{
+		rntResetStats();
+		printf("Statistics reset\n");
+	}
+	else
+	{
+		printf("Usage: stats, stats reset\n");
+	}
+
+	return ERR_None;
+}
+
+Error cmdProfile(char *cmd)
+{
+	char filename[256];
+	char end[2];
+	unsigned int count;
+
+	if(sscanf(cmd, "profile %1s", end) == EOF)
+	{
+		rntProfileReport(20);
+	}
+	else if(sscanf(cmd, "profile on %1s", end) == EOF)
+	{
+		rntProfile(1);
+		printf("Profiling enabled, loops are not fast-forwarded and calls not replayed\n");
+	}
+	else if(sscanf(cmd, "profile off %1s", end) == EOF)
+	{
+		rntProfile(0);
+		printf("Profiling disabled\n");
+	}
+	else if(sscanf(cmd, "profile save %255s %1s", filename, end) == 1)
+	{
+		rntProfileSave(filename);
+	}
+	else if(sscanf(cmd, "profile %u %1s", &count, end) == 1 && count <= 0x1000000)
+	{
+		rntProfileReport(count);
+	}
+	else
+	{
+		printf("Usage: profile on/off, profile [count], profile save file\n");
+	}
+
+	return ERR_None;
+}
+
+Error cmdCoverage(char *cmd)
+{
+	char filename[256];
+	char end[2];
+
+	if(sscanf(cmd, "coverage %1s", end) == EOF)
+	{
+		rntCoverageReport();
+	}
+	else if(sscanf(cmd, "coverage on %1s", end) == EOF)
+	{
+		rntCoverage(1);
+		printf("Coverage enabled, calls are not replayed\n");
+	}
+	else if(sscanf(cmd, "coverage off %1s", end) == EOF)
+	{
+		rntCoverage(0);
+		printf("Coverage disabled\n");
+	}
+	else if(sscanf(cmd, "coverage reset %1s", end) == EOF)
+	{
+		rntCoverageReset();
+		printf("Coverage reset\n");
+	}
+	else if(sscanf(cmd, "coverage save %255s %1s", filename, end) == 1)
+	{
+		rntCoverageSave(filename);
+	}
+	else if(sscanf(cmd, "coverage merge %255s %1s", filename, end) == 1)
+	{
+		rntCoverageMerge(filename);
+	}
+	else if(sscanf(cmd, "coverage lcov %255s %1s", filename, end) == 1)
+	{
+		rntCoverageLcov(filename);
+	}
+	else
+	{
+		printf("Usage: coverage on/off/reset, coverage, coverage save/merge/lcov file\n");
+	}
+
+	return ERR_None;
+}
+
+Error cmdTrace(char *cmd)
+{
+	char filename[256];
+	char end[2];
+
+	if(sscanf(cmd, "trace %1s", end) == EOF)
+	{
+		printf("Usage: trace file, trace off\n");
+	}
+	else if(sscanf(cmd, "trace off %1s", end) == EOF)
+	{
+		rntTraceStop();
+	}
+	else if(sscanf(cmd, "trace %255s %1s", filename, end) == 1)
+	{
+		if(rntTrace(filename) == ERR_None)
+		{
+			printf("Loops are not fast-forwarded and calls not replayed while tracing\n");
+		}
+	}
+	else
+	{
+		printf("Usage: trace file, trace off\n");
+	}
+
+	return ERR_None;
+}
+
+Error cmdReload(char *cmd)
+{
+	char end[2];
+
+	if(sscanf(cmd, "reload %1s", end) == EOF)
+	{
+		rntReload();
+	}
+	else
+	{
+		printf("Usage: reload\n");
+	}
+
+	return ERR_None;
+}
+
 /* Display a _very_ simple help: list all the commands */
 Error cmdHelp(char *cmd)
 {
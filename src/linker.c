@@ -0,0 +1,476 @@
+/**
+ * Linker for relocatable modules.
+ *
+ * Every module is assembled to an object file next to its source, with the
+ * extension .pobj. The object file keeps the hash of the source, so when
+ * the source did not change the module is read instead of assembled, and
+ * relinking after editing one module only assembles that module.
+ *
+ * The modules are placed one after the other from address 0, in the order
+ * they are given. A label a module uses but does not define is looked up
+ * in the .global labels of all modules. The program starts at the global
+ * label LINK_ENTRY when there is one.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "hardware.h"
+#include "image.h"
+#include "object.h"
+#include "linker.h"
+
+/** Largest address of a linked program, addresses must fit in an operand */
+#define LINK_MAXCELLS	0x1000000
+
+/** Global labels of all modules, open addressing on the names */
+typedef struct GlobalTable
+{
+	/** Module index + 1 and symbol index for every slot, module 0 is empty */
+	unsigned int	*modules;
+	unsigned int	*symbols;
+	unsigned int	size;
+} GlobalTable;
+
+static Error loadModule(const char *source, ObjModule *module, OutputFunc output);
+static Error readSource(const char *filename, char **text, size_t *size);
+static Error collectGlobals(ObjModule *modules, char *sources[], unsigned int count,
+	GlobalTable *table, OutputFunc output);
+static unsigned int *findGlobal(GlobalTable *table, ObjModule *modules, const char *name);
+static Error relocate(ObjModule *modules, char *sources[], unsigned int count,
+	unsigned int *bases, GlobalTable *table, MemCell *cells, OutputFunc output);
+static Error buildSegments(ObjModule *modules, unsigned int count, MemCell *cells,
+	Image *image);
+
+/** Link modules into an image. Modules whose source changed since their
+ *  object file was written are assembled, and the object file is updated.
+ *  Free the image with freeImage.
+ *
+ * @param [in] sources		Source files of the modules
+ * @param [out] image		Linked program
+ * @retval ERR_OpeningFile	A source file could not be opened
+ * @retval ERR_ReadingFile	Error reading a source file
+ * @retval ERR_InvalidInstr	A module has an error
+ * @retval ERR_UndefinedSymbol	A label is not defined, or the program is too large
+ * @retval ERR_DuplicateSymbol	Two modules define the same global label
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error linkModules(char *sources[], unsigned int count, Image *image, OutputFunc output)
+{
+	ObjModule	*modules = NULL;
+	GlobalTable	table = {NULL, NULL, 0};
+	unsigned int	*bases = NULL,
+			*entry = NULL,
+			total = 0,
+			i = 0;
+	MemCell		*cells = NULL;
+	char		buff[128];
+	Error		rval = ERR_None;
+
+	assert(sources != NULL && image != NULL);
+
+	modules = (ObjModule*) calloc(count + 1, sizeof(ObjModule));
+	bases = (unsigned int*) malloc((count + 1) * sizeof(unsigned int));
+	if(modules == NULL || bases == NULL)
+	{
+		free(modules);
+		free(bases);
+		return ERR_OutOfMemory;
+	}
+
+	for(i = 0; i < count && rval == ERR_None; i++)
+	{
+		rval = loadModule(sources[i], &modules[i], output);
+
+		bases[i] = total;
+		if(rval == ERR_None && modules[i].numCells > LINK_MAXCELLS - total)
+		{
+			output("  ERROR: The program does not fit in the address space\n");
+			rval = ERR_UndefinedSymbol;
+		}
+		total += modules[i].numCells;
+	}
+
+	if(rval == ERR_None)
+	{
+		rval = collectGlobals(modules, sources, count, &table, output);
+	}
+
+	if(rval == ERR_None)
+	{
+		cells = (MemCell*) malloc(total * sizeof(MemCell) + 1);
+		rval = cells == NULL ? ERR_OutOfMemory : ERR_None;
+	}
+
+	if(rval == ERR_None)
+	{
+		rval = relocate(modules, sources, count, bases, &table, cells, output);
+	}
+
+	if(rval == ERR_None)
+	{
+		rval = buildSegments(modules, count, cells, image);
+	}
+
+	if(rval == ERR_None)
+	{
+		entry = findGlobal(&table, modules, LINK_ENTRY);
+		image->entry = *entry != 0 ? bases[*entry - 1]
+			+ modules[*entry - 1].symbols[table.symbols[entry - table.modules]].value : 0;
+
+		sprintf(buff, "  Linked %u modules, %u cells.\n", count, total);
+		output(buff);
+	}
+	else
+	{
+		free(cells);
+	}
+
+	for(i = 0; i < count; i++)
+	{
+		freeObject(&modules[i]);
+	}
+	free(modules);
+	free(bases);
+	free(table.modules);
+	free(table.symbols);
+
+	return rval;
+}
+
+/** Name of the object file that caches a module: the source file with the
+ *  extension .pobj instead of .asm, or with .pobj added */
+void objectFileName(const char *source, char *filename, size_t size)
+{
+	size_t length = strlen(source);
+
+	if(length >= 4 && strcmp(source + length - 4, ".asm") == 0)
+	{
+		length -= 4;
+	}
+
+	snprintf(filename, size, "%.*s.pobj", (int)length, source);
+}
+
+/** Private function: read the object file of a module when it was made
+ *  from the current source, or else assemble the source and write it
+ *
+ * @retval ERR_OpeningFile	The source file could not be opened
+ * @retval ERR_ReadingFile	Error reading the source file
+ * @retval ERR_InvalidInstr	The module has an error
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error loadModule(const char *source, ObjModule *module, OutputFunc output)
+{
+	char			objName[FILENAME_MAX],
+				buff[FILENAME_MAX + 64],
+				*text = NULL;
+	size_t			size = 0;
+	unsigned long long	hash = 0;
+	Error			rval = ERR_None;
+
+	rval = readSource(source, &text, &size);
+	if(rval != ERR_None)
+	{
+		sprintf(buff, "  ERROR: Could not read %s\n", source);
+		output(buff);
+		return rval;
+	}
+
+	hash = hashSource(text, size);
+	objectFileName(source, objName, sizeof(objName));
+
+	if(readObject(objName, module) == ERR_None)
+	{
+		if(module->sourceHash == hash)
+		{
+			free(text);
+			return ERR_None;
+		}
+		freeObject(module);
+	}
+
+	sprintf(buff, "  Assembling %s\n", source);
+	output(buff);
+
+	rval = assembleModule(text, size, module, output);
+	free(text);
+	if(rval != ERR_None)
+	{
+		return rval;
+	}
+
+	// Without the cache the link still works, only slower the next time
+	if(writeObject(objName, module) != ERR_None)
+	{
+		sprintf(buff, "  WARNING: Could not write %s\n", objName);
+		output(buff);
+	}
+
+	return ERR_None;
+}
+
+/** Private function: read a whole source file
+ *
+ * @retval ERR_OpeningFile	The file could not be opened
+ * @retval ERR_ReadingFile	Error reading the file
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error readSource(const char *filename, char **text, size_t *size)
+{
+	FILE	*fp = NULL;
+	char	*buffer = NULL,
+		*bigger = NULL;
+	size_t	length = 0,
+		alloc = 0,
+		got = 0;
+	Error	rval = ERR_None;
+
+	fp = fopen(filename, "rb");
+	if(fp == NULL)
+	{
+		return ERR_OpeningFile;
+	}
+
+	do
+	{
+		if(length == alloc)
+		{
+			alloc = alloc ? alloc * 2 : 65536;
+			bigger = (char*) realloc(buffer, alloc);
+			if(bigger == NULL)
+			{
+				rval = ERR_OutOfMemory;
+				break;
+			}
+			buffer = bigger;
+		}
+
+		got = fread(buffer + length, 1, alloc - length, fp);
+		length += got;
+	} while(got > 0);
+
+	if(rval == ERR_None && ferror(fp))
+	{
+		rval = ERR_ReadingFile;
+	}
+	fclose(fp);
+
+	if(rval != ERR_None)
+	{
+		free(buffer);
+		return rval;
+	}
+
+	*text = buffer;
+	*size = length;
+
+	return ERR_None;
+}
+
+/** Private function: put the global labels of all modules in a table
+ *
+ * @retval ERR_DuplicateSymbol	Two modules define the same global label
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error collectGlobals(ObjModule *modules, char *sources[], unsigned int count,
+	GlobalTable *table, OutputFunc output)
+{
+	unsigned int	numGlobals = 0,
+			i = 0,
+			j = 0,
+			*slot = NULL;
+	char		buff[2 * FILENAME_MAX + 128];
+	Error		rval = ERR_None;
+
+	for(i = 0; i < count; i++)
+	{
+		for(j = 0; j < modules[i].numSymbols; j++)
+		{
+			numGlobals += (modules[i].symbols[j].flags & OBJ_SYM_GLOBAL) != 0;
+		}
+	}
+
+	for(table->size = 64; table->size < 2 * numGlobals; table->size *= 2)
+	{
+	}
+
+	table->modules = (unsigned int*) calloc(table->size, sizeof(unsigned int));
+	table->symbols = (unsigned int*) calloc(table->size, sizeof(unsigned int));
+	if(table->modules == NULL || table->symbols == NULL)
+	{
+		return ERR_OutOfMemory;
+	}
+
+	for(i = 0; i < count; i++)
+	{
+		for(j = 0; j < modules[i].numSymbols; j++)
+		{
+			ObjSymbol *symbol = &modules[i].symbols[j];
+
+			if(!(symbol->flags & OBJ_SYM_GLOBAL))
+			{
+				continue;
+			}
+
+			slot = findGlobal(table, modules, modules[i].names + symbol->name);
+			if(*slot != 0)
+			{
+				sprintf(buff, "  ERROR: %.64s is defined in %s and in %s\n",
+					modules[i].names + symbol->name, sources[*slot - 1], sources[i]);
+				output(buff);
+				rval = ERR_DuplicateSymbol;
+				continue;
+			}
+
+			*slot = i + 1;
+			table->symbols[slot - table->modules] = j;
+		}
+	}
+
+	return rval;
+}
+
+/** Private function: slot of a global label in the table. The module of the
+ *  slot is 0 when the label is not in the table. */
+static unsigned int *findGlobal(GlobalTable *table, ObjModule *modules, const char *name)
+{
+	unsigned int i = (unsigned int)hashSource(name, strlen(name)) & (table->size - 1);
+
+	while(table->modules[i] != 0)
+	{
+		ObjModule *module = &modules[table->modules[i] - 1];
+
+		if(strcmp(module->names + module->symbols[table->symbols[i]].name, name) == 0)
+		{
+			break;
+		}
+		i = (i + 1) & (table->size - 1);
+	}
+
+	return &table->modules[i];
+}
+
+/** Private function: copy the cells of the modules to their place and add
+ *  the address of the labels they use. All undefined labels are displayed.
+ *
+ * @retval ERR_UndefinedSymbol	A label is not defined
+ */
+static Error relocate(ObjModule *modules, char *sources[], unsigned int count,
+	unsigned int *bases, GlobalTable *table, MemCell *cells, OutputFunc output)
+{
+	unsigned int	i = 0,
+			j = 0,
+			address = 0,
+			*slot = NULL;
+	char		buff[FILENAME_MAX + 128];
+	Error		rval = ERR_None;
+
+	for(i = 0; i < count; i++)
+	{
+		ObjModule *module = &modules[i];
+
+		memcpy(cells + bases[i], module->cells, module->numCells * sizeof(MemCell));
+
+		for(j = 0; j < module->numRelocs; j++)
+		{
+			ObjReloc	*reloc = &module->relocs[j];
+			ObjSymbol	*symbol = &module->symbols[reloc->symbol];
+			MemCell		*cell = &cells[bases[i] + reloc->offset];
+
+			if(symbol->flags & OBJ_SYM_DEFINED)
+			{
+				address = bases[i] + symbol->value;
+			}
+			else
+			{
+				slot = findGlobal(table, modules, module->names + symbol->name);
+				if(*slot == 0)
+				{
+					sprintf(buff, "  ERROR: %s uses %.64s, which is not defined\n",
+						sources[i], module->names + symbol->name);
+					output(buff);
+					rval = ERR_UndefinedSymbol;
+					continue;
+				}
+				address = bases[*slot - 1]
+					+ modules[*slot - 1].symbols[table->symbols[slot - table->modules]].value;
+			}
+
+			if(reloc->kind == OBJ_RELOC_WORD)
+			{
+				cell->getal = (int)((unsigned int)cell->getal + address);
+			}
+			else
+			{
+				cell->instructie.operand = (cell->instructie.operand + address) & 0xFFFFFF;
+			}
+		}
+	}
+
+	return rval;
+}
+
+/** Private function: fill in the image with a segment for every run of
+ *  cells with the same flags. The image owns the cells afterwards.
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error buildSegments(ObjModule *modules, unsigned int count, MemCell *cells,
+	Image *image)
+{
+	unsigned int	numSegments = 0,
+			address = 0,
+			i = 0,
+			j = 0,
+			flags = 0;
+	ImageSegment	*segment = NULL;
+
+	// Count first, then fill in
+	for(i = 0; i < count; i++)
+	{
+		for(j = 0; j < modules[i].numCells; j++, address++)
+		{
+			if(address == 0 || modules[i].cellFlags[j] != flags)
+			{
+				numSegments++;
+			}
+			flags = modules[i].cellFlags[j];
+		}
+	}
+
+	image->segments = (ImageSegment*) malloc(numSegments * sizeof(ImageSegment) + 1);
+	if(image->segments == NULL)
+	{
+		return ERR_OutOfMemory;
+	}
+
+	for(i = 0, address = 0; i < count; i++)
+	{
+		for(j = 0; j < modules[i].numCells; j++, address++)
+		{
+			if(address == 0 || modules[i].cellFlags[j] != flags)
+			{
+				segment = segment == NULL ? image->segments : segment + 1;
+				segment->base = address;
+				segment->count = 0;
+				segment->flags = modules[i].cellFlags[j];
+				segment->cells = cells + address;
+			}
+			segment->count++;
+			flags = modules[i].cellFlags[j];
+		}
+	}
+
+	image->entry = 0;
+	image->stackPointer = STACK_START;
+	image->regA = 0;
+	image->regB = 0;
+	image->flags = 0;
+	image->numSegments = numSegments;
+	image->cells = cells;
+	image->mapping = NULL;
+	image->mapSize = 0;
+
+	return ERR_None;
+}
@@ -0,0 +1,17 @@
+#ifndef _PSEUDOASM_INC_LINKER_H_
+#define _PSEUDOASM_INC_LINKER_H_
+
+#include "errors.h"
+#include "hardware.h"
+#include "image.h"
+
+/** Global label where a linked program starts, else it starts at address 0 */
+#define LINK_ENTRY	"main"
+
+/* Assemble the modules that changed and link all modules into an image */
+Error linkModules(char *sources[], unsigned int count, Image *image, OutputFunc output);
+
+/* Name of the object file that caches a module */
+void objectFileName(const char *source, char *filename, size_t size);
+
+#endif // _PSEUDOASM_INC_LINKER_H_
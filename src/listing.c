@@ -0,0 +1,232 @@
+/**
+ * Disassembler for ranges of memory.
+ *
+ * The memory list is walked once, and every line is written straight into
+ * a growing buffer with the table of the parser, no sprintf. A cell that
+ * is not exactly what its mnemonic assembles to, e.g. data that decodes to
+ * a NOP, is shown as .word. An export is a listing without addresses,
+ * where .org starts every run of contiguous cells.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "hardware.h"
+#include "memory.h"
+#include "parser.h"
+#include "util.h"
+#include "listing.h"
+
+/** Longest line: "  " address ":\t" ".word " number "\n" */
+#define MAXLINELEN	40
+/** Bytes written to an export file at once */
+#define EXPORT_CHUNK	(1 << 16)
+
+static Error reserveText(Listing *listing, size_t length);
+static char *appendAddress(char *line, unsigned int address);
+static char *appendCell(char *line, MemCell cell);
+static Memory *skipTo(Memory *memory, unsigned int from);
+
+/** Disassemble the cells from one address up to and including another, in
+ *  lines like "  0000000100:\tlda #5". Uninitialized cells are left out.
+ *
+ * @param [in] memory		Memory list
+ * @param [out] listing		Free with freeListing
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error listMemory(Memory *memory, unsigned int from, unsigned int to, Listing *listing)
+{
+	Memory	*cell = NULL;
+	char	*line = NULL;
+	Error	rval = ERR_None;
+
+	assert(listing != NULL);
+
+	listing->text = NULL;
+	listing->length = 0;
+	listing->size = 0;
+
+	rval = reserveText(listing, 0);
+	for(cell = skipTo(memory, from); cell != NULL && cell->address <= to
+		&& rval == ERR_None; cell = cell->next)
+	{
+		rval = reserveText(listing, MAXLINELEN);
+		if(rval != ERR_None)
+		{
+			break;
+		}
+
+		line = appendAddress(listing->text + listing->length, cell->address);
+		line = appendCell(line, cell->cell);
+		line[0] = '\n';
+		line[1] = '\0';
+		listing->length = (size_t)(line + 1 - listing->text);
+	}
+
+	if(rval != ERR_None)
+	{
+		freeListing(listing);
+	}
+
+	return rval;
+}
+
+/** Write the cells in a range as source that assembles to the same memory.
+ *  Every run of contiguous cells starts with .org.
+ *
+ * @retval ERR_OpeningFile	The file could not be created
+ * @retval ERR_WritingFile	The file could not be written
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error exportMemory(Memory *memory, unsigned int from, unsigned int to, const char *filename)
+{
+	FILE		*file = NULL;
+	Memory		*cell = NULL;
+	char		*buffer = NULL,
+			*line = NULL;
+	unsigned int	next = 0;
+	int		first = 1;
+	Error		rval = ERR_None;
+
+	buffer = (char*) malloc(EXPORT_CHUNK + MAXLINELEN);
+	if(buffer == NULL)
+	{
+		return ERR_OutOfMemory;
+	}
+
+	file = fopen(filename, "w");
+	if(file == NULL)
+	{
+		free(buffer);
+		return ERR_OpeningFile;
+	}
+
+	line = buffer;
+	for(cell = skipTo(memory, from); cell != NULL && cell->address <= to
+		&& rval == ERR_None; cell = cell->next)
+	{
+		if(line - buffer >= EXPORT_CHUNK)
+		{
+			if(fwrite(buffer, 1, (size_t)(line - buffer), file) != (size_t)(line - buffer))
+			{
+				rval = ERR_WritingFile;
+			}
+			line = buffer;
+		}
+
+		if(first || cell->address != next)
+		{
+			memcpy(line, ".org ", 5);
+			line = formatUnsigned(line + 5, cell->address);
+			*line++ = '\n';
+			first = 0;
+		}
+		next = cell->address + 1;
+
+		line = appendCell(line, cell->cell);
+		*line++ = '\n';
+	}
+
+	// The assembler repeats the last line when the file ends with a newline
+	if(rval == ERR_None && line > buffer
+		&& fwrite(buffer, 1, (size_t)(line - 1 - buffer), file) != (size_t)(line - 1 - buffer))
+	{
+		rval = ERR_WritingFile;
+	}
+
+	if(fclose(file) != 0 && rval == ERR_None)
+	{
+		rval = ERR_WritingFile;
+	}
+	free(buffer);
+
+	return rval;
+}
+
+/** Free the text of a listing */
+void freeListing(Listing *listing)
+{
+	assert(listing != NULL);
+
+	free(listing->text);
+	listing->text = NULL;
+	listing->length = 0;
+	listing->size = 0;
+}
+
+/** Private function: make room for a line after the text, including its
+ *  terminating 0
+ *
+ * @retval ERR_OutOfMemory	Realloc failed, the text is kept
+ */
+static Error reserveText(Listing *listing, size_t length)
+{
+	char	*text = NULL;
+	size_t	size = listing->size;
+
+	if(listing->length + length + 1 <= listing->size)
+	{
+		return ERR_None;
+	}
+
+	while(size < listing->length + length + 1)
+	{
+		size = size == 0 ? 4096 : size * 2;
+	}
+
+	text = (char*) realloc(listing->text, size);
+	if(text == NULL)
+	{
+		return ERR_OutOfMemory;
+	}
+
+	listing->text = text;
+	listing->size = size;
+	if(listing->length == 0)
+	{
+		text[0] = '\0';
+	}
+
+	return ERR_None;
+}
+
+/** Private function: write the address of a line with leading zeros, like
+ *  the memory changes of the runtime */
+static char *appendAddress(char *line, unsigned int address)
+{
+	char	number[11];
+	size_t	digits = (size_t)(formatUnsigned(number, address) - number);
+
+	line[0] = ' ';
+	line[1] = ' ';
+	memset(line + 2, '0', 10 - digits);
+	memcpy(line + 12 - digits, number, digits);
+	line[12] = ':';
+	line[13] = '\t';
+
+	return line + 14;
+}
+
+/** Private function: write the mnemonic of a cell, or .word when the cell
+ *  would not assemble back from its mnemonic */
+static char *appendCell(char *line, MemCell cell)
+{
+	if(isCanonicalInstr(cell))
+	{
+		return appendInstr(line, cell.instructie);
+	}
+
+	memcpy(line, ".word ", 6);
+	return formatInt(line + 6, cell.getal);
+}
+
+/** Private function: the first cell of the list at or after an address */
+static Memory *skipTo(Memory *memory, unsigned int from)
+{
+	while(memory != NULL && memory->address < from)
+	{
+		memory = memory->next;
+	}
+
+	return memory;
+}
@@ -0,0 +1,25 @@
+#ifndef _PSEUDOASM_INC_LISTING_H_
+#define _PSEUDOASM_INC_LISTING_H_
+
+#include <stddef.h>
+#include "errors.h"
+#include "memory.h"
+
+/** Text of disassembled memory, one line per cell */
+typedef struct Listing
+{
+	char *text;
+	size_t length;
+	size_t size;
+} Listing;
+
+/* Disassemble the cells from one address up to and including another */
+Error listMemory(Memory *memory, unsigned int from, unsigned int to, Listing *listing);
+
+/* Write the cells in a range as source that assembles to the same memory */
+Error exportMemory(Memory *memory, unsigned int from, unsigned int to, const char *filename);
+
+/* Free the text of a listing */
+void freeListing(Listing *listing);
+
+#endif // _PSEUDOASM_INC_LISTING_H_
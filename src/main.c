@@ -1,14 +1,128 @@
+#include <stdio.h>
+#include <string.h>
 #include <gtk/gtk.h>
 #include "interface.h"
+#include "runtime.h"
 #include "util.h"
 
 // TODO: Is the actual output function always used ?!?!?
 
+static void printOutput(char *line);
+static int assembleProgram(char source[], char target[]);
+static int linkProgram(char *sources[], unsigned int count, char target[]);
+
 int main(int argc, char *argv[])
 {
+	int i = 0,
+	    kept = 1;
+
+	// Optimize the programs that are opened or assembled and display the
+	// changes: --opt anywhere on the command line. Assemble the instructions
+	// of the program that is opened when they are used: --lazy. Execute the
+	// start of the program until its first input or output: --prologue
+	for(i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "--opt") == 0)
+		{
+			rntOptimize(1);
+		}
+		else if(strcmp(argv[i], "--lazy") == 0)
+		{
+			rntLazy(1);
+		}
+		else if(strcmp(argv[i], "--prologue") == 0)
+		{
+			rntPrologue(1);
+		}
+		else
+		{
+			argv[kept++] = argv[i];
+		}
+	}
+	argc = kept;
+	argv[argc] = NULL;
+
+	// Compile to an image without starting the interface:
+	//   pseudoasm assemble <source> -o <image> [--opt] [--prologue]
+	if(argc == 5 && strcmp(argv[1], "assemble") == 0 && strcmp(argv[3], "-o") == 0)
+	{
+		return assembleProgram(argv[2], argv[4]);
+	}
+
+	// Link modules with labels to an image:
+	//   pseudoasm link <module>... -o <image> [--opt] [--prologue]
+	if(argc >= 5 && strcmp(argv[1], "link") == 0 && strcmp(argv[argc - 2], "-o") == 0)
+	{
+		return linkProgram(argv + 2, (unsigned int)(argc - 4), argv[argc - 1]);
+	}
+
 	gtk_init(&argc, &argv);
 
 	menuMain();
 
 	return 0;
 }
+
+static void printOutput(char *line)
+{
+	printf("%s", line);
+}
+
+/** Write the image of a source file, returns the exit code */
+static int assembleProgram(char source[], char target[])
+{
+	Error rval = rntAssemble(source, target, printOutput);
+
+	switch(rval)
+	{
+	case ERR_None:
+		printf("Image written to %s\n", target);
+		return 0;
+	case ERR_OpeningFile:
+		printf("Error opening %s or %s\n", source, target);
+		break;
+	case ERR_ReadingFile:
+		printf("Error reading %s\n", source);
+		break;
+	case ERR_WritingFile:
+		printf("Error writing %s\n", target);
+		break;
+	default:
+		printf("Error assembling %s (%d)\n", source, rval);
+		break;
+	}
+
+	return 1;
+}
+
+/** Link modules to an image, returns the exit code */
+static int linkProgram(char *sources[], unsigned int count, char target[])
+{
+	Error rval = rntLink(sources, count, target, printOutput);
+
+	switch(rval)
+	{
+	case ERR_None:
+		printf("Image written to %s\n", target);
+		return 0;
+	case ERR_OpeningFile:
+		printf("Error opening a module or %s\n", target);
+		break;
+	case ERR_ReadingFile:
+		printf("Error reading a module\n");
+		break;
+	case ERR_WritingFile:
+		printf("Error writing %s\n", target);
+		break;
+	case ERR_UndefinedSymbol:
+	case ERR_DuplicateSymbol:
+	case ERR_InvalidInstr:
+		printf("Error linking %s\n", target);
+		break;
+	default:
+		printf("Error linking %s (%d)\n", target, rval);
+		break;
+	}
+
+	return 1;
+}
@@ -0,0 +1,441 @@
+/**
+ * Memoization of subroutine calls.
+ *
+ * While a JSB ... RTS activation runs, every memory cell it reads before
+ * writing it (including the instructions it fetches) is saved in its read
+ * set, and the last value of every cell it writes in its write set. When
+ * the activation returns without doing I/O, it is stored together with the
+ * state at the call and the state after the return. A later call from the
+ * same address with the same registers, flags and stack pointer, and with
+ * all cells of the read set still holding the same values, will always
+ * behave the same. So it is replayed: the write set is written and the
+ * registers are restored, without executing the subroutine.
+ *
+ * Nested calls are recorded on a stack of activations. When a call returns,
+ * its read and write sets are merged into those of its caller.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "memory.h"
+#include "memo.h"
+
+#define MEMO_MAX_DEPTH		64
+#define MEMO_MAX_READS		128
+#define MEMO_MAX_WRITES		64
+#define MEMO_BUCKETS		1024
+#define MEMO_MAX_ENTRIES	4096
+
+typedef struct MemoRead
+{
+	unsigned int address;
+	int value;
+} MemoRead;
+
+typedef struct MemoWrite
+{
+	unsigned int address;
+	int value;
+	int isStack;
+} MemoWrite;
+
+/** An activation that is being recorded */
+typedef struct MemoCall
+{
+	unsigned int	target;
+	MemoState	state;
+	unsigned long	startInstr;
+	int		impure;
+	int		numReads;
+	int		numWrites;
+	MemoRead	reads[MEMO_MAX_READS];
+	MemoWrite	writes[MEMO_MAX_WRITES];
+} MemoCall;
+
+/** A recorded activation that can be replayed */
+typedef struct MemoEntry
+{
+	unsigned int	target;
+	MemoState	state;
+	MemoState	result;
+	unsigned long	instrCount;
+	int		numReads;
+	int		numWrites;
+	MemoRead	*reads;
+	MemoWrite	*writes;
+	struct MemoEntry *next;
+} MemoEntry;
+
+static MemoCall calls[MEMO_MAX_DEPTH];
+static int depth = 0;
+
+static MemoEntry *table[MEMO_BUCKETS];
+static unsigned long numEntries = 0;
+
+static MemoStats stats = {0, 0, 0, 0};
+
+static unsigned int hashKey(unsigned int target, MemoState *state);
+static int sameKey(MemoEntry *entry, unsigned int target, MemoState *state);
+static void storeCall(MemoCall *call, MemoState *result, unsigned long instrCount);
+static void mergeCall(MemoCall *parent, MemoCall *child);
+static void freeEntries(void);
+
+/** Replay a recorded call, if there is one for this target and state whose
+ *  read set still matches the memory. On a hit the write set is written,
+ *  the state is set to the state after the return and instrCount is set
+ *  to the number of instructions the call executed. A call that executed
+ *  more than maxCount instructions is not replayed.
+ *
+ * @param [in] mem		Memory
+ * @param [in] target		Address of the subroutine
+ * @param [in,out] state	State before the JSB instruction
+ * @param [in] traceStack	Should writes to the stack be traced?
+ * @param [in] maxCount		Most instructions the replay may save
+ * @param [out] instrCount	Instructions saved by the replay
+ * @param [out] hit		Was a recorded call replayed?
+ * @retval ERR_OutOfMemory	Malloc failed while replaying a write
+ * @retval ERR_MemoryLimit	Memory cell quota reached while replaying
+ */
+Error memoReplay(Memory **mem, unsigned int target, MemoState *state,
+	int traceStack, unsigned long maxCount, unsigned long *instrCount, int *hit)
+{
+	MemoEntry	*entry = NULL;
+	Error		rval = ERR_None;
+	int		i = 0;
+
+	assert(mem != NULL);
+
+	*hit = 0;
+	stats.calls++;
+
+	for(entry = table[hashKey(target, state)]; entry != NULL; entry = entry->next)
+	{
+		if(!sameKey(entry, target, state) || entry->instrCount > maxCount)
+		{
+			continue;
+		}
+
+		for(i = 0; i < entry->numReads; i++)
+		{
+			if(readMemCell(mem, entry->reads[i].address).getal != entry->reads[i].value)
+			{
+				break;
+			}
+		}
+
+		if(i == entry->numReads)
+		{
+			break;
+		}
+	}
+
+	if(entry == NULL)
+	{
+		return ERR_None;
+	}
+
+	// The caller (if it is being recorded) depends on the same cells
+	for(i = 0; i < entry->numReads; i++)
+	{
+		memoRead(entry->reads[i].address, entry->reads[i].value);
+	}
+
+	for(i = 0; i < entry->numWrites; i++)
+	{
+		MemCell cell;
+
+		cell.getal = entry->writes[i].value;
+		if(entry->writes[i].isStack && !traceStack)
+		{
+			ignoreNextWriteInTrace();
+		}
+
+		rval = writeMemCell(mem, entry->writes[i].address, cell);
+		if(rval != ERR_None)
+		{
+			return rval;
+		}
+		memoWrite(entry->writes[i].address, entry->writes[i].value, entry->writes[i].isStack);
+	}
+
+	*state = entry->result;
+	*instrCount = entry->instrCount;
+	*hit = 1;
+
+	stats.hits++;
+	stats.instrSaved += entry->instrCount;
+
+	return ERR_None;
+}
+
+/** Start recording a new activation. Calls nested deeper than
+ *  MEMO_MAX_DEPTH are recorded as part of their caller. */
+void memoBegin(unsigned int target, MemoState *state, unsigned long instrCount)
+{
+	MemoCall *call = NULL;
+
+	if(depth == MEMO_MAX_DEPTH)
+	{
+		return;
+	}
+
+	call = &calls[depth++];
+	call->target = target;
+	call->state = *state;
+	call->startInstr = instrCount;
+	call->impure = 0;
+	call->numReads = 0;
+	call->numWrites = 0;
+}
+
+/** Record a read of the innermost activation. Only the first read of a cell
+ *  that was not yet written by the activation itself is saved. */
+void memoRead(unsigned int address, int value)
+{
+	MemoCall	*call = NULL;
+	int		i = 0;
+
+	if(depth == 0 || calls[depth - 1].impure)
+	{
+		return;
+	}
+
+	call = &calls[depth - 1];
+	for(i = 0; i < call->numWrites; i++)
+	{
+		if(call->writes[i].address == address)
+		{
+			return;
+		}
+	}
+	for(i = 0; i < call->numReads; i++)
+	{
+		if(call->reads[i].address == address)
+		{
+			return;
+		}
+	}
+
+	if(call->numReads == MEMO_MAX_READS)
+	{
+		call->impure = 1;
+		return;
+	}
+
+	call->reads[call->numReads].address = address;
+	call->reads[call->numReads].value = value;
+	call->numReads++;
+}
+
+/** Record a write of the innermost activation */
+void memoWrite(unsigned int address, int value, int isStack)
+{
+	MemoCall	*call = NULL;
+	int		i = 0;
+
+	if(depth == 0 || calls[depth - 1].impure)
+	{
+		return;
+	}
+
+	call = &calls[depth - 1];
+	for(i = 0; i < call->numWrites; i++)
+	{
+		if(call->writes[i].address == address)
+		{
+			call->writes[i].value = value;
+			call->writes[i].isStack = isStack;
+			return;
+		}
+	}
+
+	if(call->numWrites == MEMO_MAX_WRITES)
+	{
+		call->impure = 1;
+		return;
+	}
+
+	call->writes[call->numWrites].address = address;
+	call->writes[call->numWrites].value = value;
+	call->writes[call->numWrites].isStack = isStack;
+	call->numWrites++;
+}
+
+/** Must be called after every RTS with the new state. When the stack pointer
+ *  is back at its value before the JSB, the innermost activation returned.
+ *  Activations that were left without a matching return are dropped. */
+void memoReturn(MemoState *state, unsigned long instrCount)
+{
+	MemoCall *call = NULL;
+
+	while(depth > 0 && state->stackPointer > calls[depth - 1].state.stackPointer)
+	{
+		depth--;
+		if(depth > 0)
+		{
+			calls[depth - 1].impure = 1;
+		}
+	}
+
+	if(depth == 0 || state->stackPointer != calls[depth - 1].state.stackPointer)
+	{
+		return;
+	}
+
+	call = &calls[--depth];
+	if(!call->impure)
+	{
+		storeCall(call, state, instrCount);
+	}
+
+	if(depth > 0)
+	{
+		mergeCall(&calls[depth - 1], call);
+	}
+}
+
+/** Mark all active calls as impure (they did I/O) */
+void memoImpure(void)
+{
+	int i = 0;
+
+	for(i = 0; i < depth; i++)
+	{
+		calls[i].impure = 1;
+	}
+}
+
+/** Stop recording the active calls, e.g. at the start of a new run */
+void memoClearCalls(void)
+{
+	depth = 0;
+}
+
+/** Free all recorded calls and reset the statistics */
+void memoFree(void)
+{
+	freeEntries();
+	depth = 0;
+	memset(&stats, 0, sizeof(stats));
+}
+
+MemoStats memoGetStats(void)
+{
+	return stats;
+}
+
+/** Private function: bucket of a target and state */
+static unsigned int hashKey(unsigned int target, MemoState *state)
+{
+	unsigned long long hash = hashValue(target, state->progCounter);
+
+	hash ^= hashValue(1, state->regA);
+	hash ^= hashValue(2, state->regB);
+	hash ^= hashValue(3, state->flags);
+	hash ^= hashValue(4, state->stackPointer);
+
+	return (unsigned int)hash & (MEMO_BUCKETS - 1);
+}
+
+/** Private function: was the entry recorded from the same call? */
+static int sameKey(MemoEntry *entry, unsigned int target, MemoState *state)
+{
+	return entry->target == target
+		&& entry->state.progCounter == state->progCounter
+		&& entry->state.regA == state->regA
+		&& entry->state.regB == state->regB
+		&& entry->state.flags == state->flags
+		&& entry->state.stackPointer == state->stackPointer;
+}
+
+/** Private function: save a returned activation in the table. When the table
+ *  is full, all entries are dropped. If malloc fails the call is not saved. */
+static void storeCall(MemoCall *call, MemoState *result, unsigned long instrCount)
+{
+	MemoEntry	*entry = NULL;
+	unsigned int	bucket;
+
+	if(numEntries >= MEMO_MAX_ENTRIES)
+	{
+		freeEntries();
+	}
+
+	entry = (MemoEntry*) malloc(sizeof(MemoEntry));
+	if(entry == NULL)
+	{
+		return;
+	}
+	entry->reads = (MemoRead*) malloc(call->numReads * sizeof(MemoRead) + 1);
+	entry->writes = (MemoWrite*) malloc(call->numWrites * sizeof(MemoWrite) + 1);
+	if(entry->reads == NULL || entry->writes == NULL)
+	{
+		free(entry->reads);
+		free(entry->writes);
+		free(entry);
+		return;
+	}
+
+	entry->target = call->target;
+	entry->state = call->state;
+	entry->result = *result;
+	entry->instrCount = instrCount - call->startInstr;
+	entry->numReads = call->numReads;
+	entry->numWrites = call->numWrites;
+	memcpy(entry->reads, call->reads, call->numReads * sizeof(MemoRead));
+	memcpy(entry->writes, call->writes, call->numWrites * sizeof(MemoWrite));
+
+	bucket = hashKey(entry->target, &entry->state);
+	entry->next = table[bucket];
+	table[bucket] = entry;
+
+	numEntries++;
+	stats.stored++;
+}
+
+/** Private function: the caller read and wrote everything its callee did */
+static void mergeCall(MemoCall *parent, MemoCall *child)
+{
+	int i = 0;
+
+	if(child->impure)
+	{
+		parent->impure = 1;
+		return;
+	}
+
+	// memoRead and memoWrite work on the innermost call, which is parent
+	assert(parent == &calls[depth - 1]);
+
+	for(i = 0; i < child->numReads; i++)
+	{
+		memoRead(child->reads[i].address, child->reads[i].value);
+	}
+	for(i = 0; i < child->numWrites; i++)
+	{
+		memoWrite(child->writes[i].address, child->writes[i].value, child->writes[i].isStack);
+	}
+}
+
+/** Private function: free all entries of the table */
+static void freeEntries(void)
+{
+	MemoEntry	*entry = NULL,
+			*toDel = NULL;
+	int		i = 0;
+
+	for(i = 0; i < MEMO_BUCKETS; i++)
+	{
+		entry = table[i];
+		while(entry != NULL)
+		{
+			toDel = entry;
+			entry = entry->next;
+			free(toDel->reads);
+			free(toDel->writes);
+			free(toDel);
+		}
+		table[i] = NULL;
+	}
+
+	numEntries = 0;
+}
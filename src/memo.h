@@ -0,0 +1,55 @@
+#ifndef _PSEUDOASM_INC_MEMO_H_
+#define _PSEUDOASM_INC_MEMO_H_
+
+#include "errors.h"
+#include "memory.h"
+
+/** State of the processor at a call (JSB) or after the matching return */
+typedef struct MemoState
+{
+	int regA;
+	int regB;
+	int flags;
+	unsigned int progCounter;
+	unsigned int stackPointer;
+} MemoState;
+
+/** Statistics of the subroutine memoization */
+typedef struct MemoStats
+{
+	unsigned long calls;
+	unsigned long hits;
+	unsigned long stored;
+	unsigned long instrSaved;
+} MemoStats;
+
+/* Replay a recorded call with the same state and an unchanged read set,
+ * that executed at most maxCount instructions */
+Error memoReplay(Memory **mem, unsigned int target, MemoState *state,
+	int traceStack, unsigned long maxCount, unsigned long *instrCount, int *hit);
+
+/* Start recording a call. State is the state before JSB is executed. */
+void memoBegin(unsigned int target, MemoState *state, unsigned long instrCount);
+
+/* Record a memory read of the active call */
+void memoRead(unsigned int address, int value);
+
+/* Record a memory write of the active call */
+void memoWrite(unsigned int address, int value, int isStack);
+
+/* Called after each RTS, stores the call when it has returned */
+void memoReturn(MemoState *state, unsigned long instrCount);
+
+/* The active calls did I/O and can never be memoized */
+void memoImpure(void);
+
+/* Stop recording all active calls */
+void memoClearCalls(void);
+
+/* Free all recorded calls and reset the statistics */
+void memoFree(void);
+
+/* Get the statistics */
+MemoStats memoGetStats(void);
+
+#endif // _PSEUDOASM_INC_MEMO_H_
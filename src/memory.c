@@ -1,14 +1,13 @@
 #include <stdlib.h>
+#include <limits.h>
 #include <assert.h>
 #include "errors.h"
 #include "memory.h"
 #include "numberlist.h"
 
-/** Value of uninitialized memory */
-#define UNINIT 0xCCCCCCCC
-
 static Memory * findMemCell(Memory *l, unsigned int address);
 static Error addMemCell(Memory **l, unsigned int address, MemCell data);
+static void addLazyHash(unsigned int address, MemCell data);
 
 /** WARNING: When using trace, make sure you are only working on ONE linked
  *  memory list! If you have multiple lists, you cannot write to them at the
@@ -19,6 +18,21 @@ static int lastWrittenAddr = 0;		// If so, this was the address that changed!
 static int ignoreNextTrace = 0;		// Used so stack access can be ignored
 static NumberList *memtrace = NULL;	// Complete memory trace
 
+static unsigned int memCellCount = 0;	// Number of allocated memory cells
+static unsigned int memCellQuota = 0;	// Maximum allowed, 0 is no limit
+static MemStats memStats = {0, 0, 0};	// Reads, writes and longest walk
+
+/** Zobrist style hash of the memory: the XOR over all cells of
+ *  hashValue(address, value) ^ hashValue(address, UNINIT), so a cell that
+ *  holds UNINIT is the same as a cell that was never written. Each write
+ *  removes the old value and adds the new one in constant time. */
+static int shouldHash = 0;
+static unsigned long long memHash = 0;
+
+/** Cells that are added to the list the first time they are read. Like the
+ *  trace, this is meant for the one list of the processor. */
+static LazyCells lazyCells = {NULL, NULL, NULL};
+
 /** Read the memory.
  *
  * @param [in] l	Memory
@@ -31,6 +45,8 @@ MemCell readMemCell(Memory ** l, unsigned int address)
 
 	assert(l != NULL);
 
+	memStats.reads++;
+
 	// Return the MemCell if the address is already in the linked list.
 	// If not yet in the list it is 'uninitialized' memory!
 
@@ -39,6 +55,15 @@ MemCell readMemCell(Memory ** l, unsigned int address)
 	{
 		MemCell emptyMemCell = {UNINIT};
 
+		// A lazy cell is decoded once and kept in the list. If adding it
+		// fails, it is only returned this time.
+		if(lazyCells.fetch != NULL
+			&& lazyCells.fetch(lazyCells.context, address, &emptyMemCell)
+			&& addMemCell(l, address, emptyMemCell) == ERR_None)
+		{
+			addLazyHash(address, emptyMemCell);
+		}
+
 		return emptyMemCell;
 	}
 	else
@@ -53,6 +78,7 @@ MemCell readMemCell(Memory ** l, unsigned int address)
  * @param [in] address		Address of where the save the memory cell
  * @param [in] data		Data to be safed
  * @retval ERR_OutOfMemory	Malloc Failed
+ * @retval ERR_MemoryLimit	Memory cell quota reached, see setMemCellQuota
  */
 Error writeMemCell(Memory ** l, unsigned int address, MemCell data)
 {
@@ -61,20 +87,45 @@ Error writeMemCell(Memory ** l, unsigned int address, MemCell data)
 
 	assert(l != NULL);
 
+	memStats.writes++;
+
 	// If the memory cell is not yet in the linked list, add it to the list.
 	// If already in the list, update the value.
 
 	mem = findMemCell(*l, address);
 	if(mem == NULL)
 	{
+		// A write that fails is not ignored in place of the next one
+		if(memCellQuota != 0 && memCellCount >= memCellQuota)
+		{
+			ignoreNextTrace = 0;
+			return ERR_MemoryLimit;
+		}
+
 		rval = addMemCell(l, address, data);
 		if(rval != ERR_None)
 		{
+			ignoreNextTrace = 0;
 			return rval;
 		}
+
+		// The write replaces a lazy cell that was never used
+		if(lazyCells.fetch != NULL)
+		{
+			lazyCells.fetch(lazyCells.context, address, NULL);
+		}
+
+		if(shouldHash)
+		{
+			memHash ^= hashValue(address, UNINIT) ^ hashValue(address, data.getal);
+		}
 	}
 	else
 	{
+		if(shouldHash)
+		{
+			memHash ^= hashValue(address, mem->cell.getal) ^ hashValue(address, data.getal);
+		}
 		mem->cell = data;
 	}
 
@@ -97,6 +148,189 @@ Error writeMemCell(Memory ** l, unsigned int address, MemCell data)
 	return ERR_None;
 }
 
+/** Remove a cell from the memory, it becomes uninitialized again. Removing
+ *  a cell that is not in the memory does nothing. The change is not traced.
+ *
+ * @param [in,out] l		Memory
+ * @param [in] address		Address of the memory cell
+ */
+void clearMemCell(Memory ** l, unsigned int address)
+{
+	Memory	**p = l,
+		*toDel = NULL;
+
+	assert(l != NULL);
+
+	while(*p != NULL && (*p)->address < address)
+	{
+		p = &(*p)->next;
+	}
+
+	if(*p == NULL || (*p)->address != address)
+	{
+		if(lazyCells.fetch != NULL)
+		{
+			lazyCells.fetch(lazyCells.context, address, NULL);
+		}
+		return;
+	}
+
+	toDel = *p;
+	*p = toDel->next;
+
+	if(shouldHash)
+	{
+		memHash ^= hashValue(address, toDel->cell.getal) ^ hashValue(address, UNINIT);
+	}
+
+	free(toDel);
+	memCellCount--;
+}
+
+/** Write count cells to the addresses base, base + 1, ... at once. Because
+ *  the list is sorted this takes one walk over the list, instead of one walk
+ *  per cell. The cells are not traced.
+ *
+ * Several ranges in ascending order are written in one walk by passing the
+ * cursor of the previous call: the walk continues where that one stopped.
+ *
+ * @param [in,out] l		Memory
+ * @param [in,out] cursor	Where to start the walk, NULL or a NULL
+ *				link for the start of the list. Set to where
+ *				the walk stopped. All cells before it must be
+ *				below base.
+ * @param [in] base		Address of the first cell
+ * @param [in] cells		Cells to write
+ * @param [in] count		Number of cells
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error loadMemImage(Memory ** l, Memory ***cursor, unsigned int base, MemCell *cells, unsigned int count)
+{
+	Memory		**p = l,
+			*toAdd = NULL;
+	unsigned int	i = 0;
+	Error		rval = ERR_None;
+
+	assert(l != NULL);
+
+	if(cursor != NULL && *cursor != NULL)
+	{
+		p = *cursor;
+	}
+
+	for(i = 0; i < count; i++)
+	{
+		unsigned int address = base + i;
+
+		while(*p != NULL && (*p)->address < address)
+		{
+			p = &(*p)->next;
+		}
+
+		if(*p != NULL && (*p)->address == address)
+		{
+			(*p)->cell = cells[i];
+		}
+		else
+		{
+			toAdd = (Memory*) malloc(sizeof(Memory));
+			if(toAdd == NULL)
+			{
+				rval = ERR_OutOfMemory;
+				break;
+			}
+			toAdd->address = address;
+			toAdd->cell = cells[i];
+			toAdd->next = *p;
+			*p = toAdd;
+			memCellCount++;
+		}
+
+		p = &(*p)->next;
+	}
+
+	if(cursor != NULL)
+	{
+		*cursor = p;
+	}
+
+	return rval;
+}
+
+/** Add cells to the list the first time they are read, instead of when the
+ *  program is loaded. Writing or clearing a lazy cell drops it. The cells
+ *  are copied in the list, so the lazy cells are only used by readMemCell,
+ *  writeMemCell, clearMemCell and loadLazyCells. Code that walks the list
+ *  itself must call loadLazyCells first.
+ *
+ * @param [in] lazy	Functions that decode the cells, NULL to stop
+ */
+void setLazyCells(const LazyCells *lazy)
+{
+	if(lazy == NULL)
+	{
+		lazyCells.fetch = NULL;
+		lazyCells.next = NULL;
+		lazyCells.context = NULL;
+		return;
+	}
+
+	lazyCells = *lazy;
+}
+
+/** Decode the lazy cells from one address up to and including another and
+ *  add them to the list, in one walk over the list.
+ *
+ * @param [in,out] l		Memory
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error loadLazyCells(Memory ** l, unsigned int from, unsigned int to)
+{
+	Memory		**p = l,
+			*toAdd = NULL;
+	unsigned int	address = 0;
+	MemCell		cell;
+
+	assert(l != NULL);
+
+	if(lazyCells.fetch == NULL)
+	{
+		return ERR_None;
+	}
+
+	while(from <= to && lazyCells.next(lazyCells.context, from, &address) && address <= to)
+	{
+		while(*p != NULL && (*p)->address < address)
+		{
+			p = &(*p)->next;
+		}
+
+		toAdd = (Memory*) malloc(sizeof(Memory));
+		if(toAdd == NULL)
+		{
+			return ERR_OutOfMemory;
+		}
+
+		// A cell in the list is never lazy, so the address is free
+		lazyCells.fetch(lazyCells.context, address, &cell);
+		toAdd->address = address;
+		toAdd->cell = cell;
+		toAdd->next = *p;
+		*p = toAdd;
+		p = &toAdd->next;
+		memCellCount++;
+		addLazyHash(address, cell);
+
+		if(address == UINT_MAX)
+		{
+			break;
+		}
+		from = address + 1;
+	}
+
+	return ERR_None;
+}
+
 /** Free the complete memory list */
 void freeMemList(Memory *l)
 {
@@ -107,9 +341,38 @@ void freeMemList(Memory *l)
 		toDel = l;
 		l = l->next;
 		free(toDel);
+		memCellCount--;
 	}
 }
 
+/** Number of memory cells that are currently allocated */
+unsigned int getMemCellCount(void)
+{
+	return memCellCount;
+}
+
+/** Number of reads and writes since the last resetMemStats, and the most
+ *  cells that were walked over to find one cell */
+MemStats getMemStats(void)
+{
+	return memStats;
+}
+
+/** Reset the counters of getMemStats */
+void resetMemStats(void)
+{
+	memStats.reads = 0;
+	memStats.writes = 0;
+	memStats.longestWalk = 0;
+}
+
+/** Limit the number of allocated memory cells. When the limit is reached,
+ *  writing to a new address fails with ERR_MemoryLimit. 0 disables the limit. */
+void setMemCellQuota(unsigned int quota)
+{
+	memCellQuota = quota;
+}
+
 /** TRUE if a memory address was changed.
  *  See getLastWrittenAddr to get the address. */
 int wasAddrWritten(void)
@@ -125,6 +388,44 @@ int getLastWrittenAddr(void)
 	return lastWrittenAddr;
 }
 
+/** Hash a value together with a key (e.g. the address of the value).
+ *  This is the finalizer of splitmix64, so every bit of the input changes
+ *  about half of the bits of the result. */
+unsigned long long hashValue(unsigned int key, int value)
+{
+	unsigned long long x = ((unsigned long long)key << 32) | (unsigned int)value;
+
+	x += 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+
+	return x ^ (x >> 31);
+}
+
+/** Start keeping a hash of the memory. The hash of the current contents is
+ *  calculated once, after that every writeMemCell updates it. */
+void enableMemHash(Memory *l)
+{
+	memHash = 0;
+	for(; l != NULL; l = l->next)
+	{
+		memHash ^= hashValue(l->address, UNINIT) ^ hashValue(l->address, l->cell.getal);
+	}
+
+	shouldHash = 1;
+}
+
+void disableMemHash(void)
+{
+	shouldHash = 0;
+}
+
+/** Hash of the memory contents, only valid after enableMemHash */
+unsigned long long getMemHash(void)
+{
+	return memHash;
+}
+
 /** Enable memory access trace (only writes are saved) */
 void enableTrace(void)
 {
@@ -159,11 +460,19 @@ NumberList ** getTrace(void)
  */
 static Memory * findMemCell(Memory *l, unsigned int address)
 {
+	unsigned int walk = 0;
+
 	// Find the address. This is a sorted list! Return NULL if address not found.
 
 	while(l != NULL && l->address < address)
 	{
 		l = l->next;
+		walk++;
+	}
+
+	if(walk > memStats.longestWalk)
+	{
+		memStats.longestWalk = walk;
 	}
 
 	if(l != NULL && l->address == address)
@@ -176,6 +485,16 @@ static Memory * findMemCell(Memory *l, unsigned int address)
 	}
 }
 
+/** Private function: a lazy cell was added to the list. For the hash it is
+ *  written over an uninitialized cell, see memHash. */
+static void addLazyHash(unsigned int address, MemCell data)
+{
+	if(shouldHash)
+	{
+		memHash ^= hashValue(address, UNINIT) ^ hashValue(address, data.getal);
+	}
+}
+
 /** Private function: add a memory cell to the linked list.
  *  Does nothing if a memory cell with this address already exists.
  *
@@ -198,6 +517,7 @@ static Error addMemCell(Memory **l, unsigned int address, MemCell data)
 		toAdd->cell = data;
 		toAdd->next = *l;
 		*l = toAdd;
+		memCellCount++;
 	}
 	else
 	{	// Add new MemCell in the middle or at the end of the list
@@ -223,6 +543,7 @@ static Error addMemCell(Memory **l, unsigned int address, MemCell data)
 			toAdd->cell = data;
 			toAdd->next = p;
 			q->next = toAdd;
+			memCellCount++;
 		}
 	}
 
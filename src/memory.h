@@ -5,6 +5,9 @@
 #include "errors.h"
 #include "numberlist.h"
 
+/** Value of uninitialized memory */
+#define UNINIT 0xCCCCCCCC
+
 typedef struct Memory
 {
 	unsigned int address;
@@ -12,15 +15,61 @@ typedef struct Memory
 	struct Memory *next;
 } Memory;
 
+/** Cells that are not in the memory list yet, but are decoded the first
+ *  time they are used, see setLazyCells */
+typedef struct LazyCells
+{
+	/** Decode the cell at an address. Returns FALSE when there is no cell
+	 *  to decode. With cell NULL the cell is dropped without decoding it. */
+	int (*fetch)(void *context, unsigned int address, MemCell *cell);
+	/** First address from 'from' with a cell that was not fetched yet.
+	 *  Returns FALSE when there is none. */
+	int (*next)(void *context, unsigned int from, unsigned int *address);
+	void *context;
+} LazyCells;
+
 /* Read data from an address */
 MemCell readMemCell(Memory ** l, unsigned int address);
 
 /* Write data to an address */
 Error writeMemCell(Memory ** l, unsigned int address, MemCell data);
 
+/* Remove a cell, so it is uninitialized again */
+void clearMemCell(Memory ** l, unsigned int address);
+
+/* Write a contiguous array of cells starting at base, in one pass */
+Error loadMemImage(Memory ** l, Memory ***cursor, unsigned int base, MemCell *cells, unsigned int count);
+
+/* Decode the cells of the memory list on first use, NULL to stop */
+void setLazyCells(const LazyCells *lazy);
+
+/* Add all lazy cells in a range to the memory list */
+Error loadLazyCells(Memory ** l, unsigned int from, unsigned int to);
+
 /* Free the memory list */
 void freeMemList(Memory *l);
 
+/** Accesses of the memory since the last resetMemStats */
+typedef struct MemStats
+{
+	unsigned long reads;
+	unsigned long writes;
+	/** Most cells findMemCell walked over to find one cell */
+	unsigned int longestWalk;
+} MemStats;
+
+/* Get the number of reads and writes, and the longest walk over the list */
+MemStats getMemStats(void);
+
+/* Reset the counters of getMemStats */
+void resetMemStats(void);
+
+/* Number of memory cells that are in use */
+unsigned int getMemCellCount(void);
+
+/* Maximum number of memory cells that may be in use, 0 means no limit */
+void setMemCellQuota(unsigned int quota);
+
 /* Get the last address that was written to.
    Resets "address was written", see wasAddrWritten. */
 int getLastWrittenAddr(void);
@@ -28,6 +77,18 @@ int getLastWrittenAddr(void);
 /* Did we write to an address. */
 int wasAddrWritten(void);
 
+/* Keep a hash of the complete memory, updated on every write */
+void enableMemHash(Memory *l);
+
+/* Stop updating the memory hash */
+void disableMemHash(void);
+
+/* Get the hash of the memory, see enableMemHash */
+unsigned long long getMemHash(void);
+
+/* Hash a number together with a key, used to build state hashes */
+unsigned long long hashValue(unsigned int key, int value);
+
 /* Saves a list of all the address where we wrote some data to */
 void enableTrace(void);
 
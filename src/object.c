@@ -0,0 +1,965 @@
+/**
+ * Relocatable modules and object files (.pobj files).
+ *
+ * A module is assembled like a program, but its cells start at offset 0
+ * and are placed by the linker. A line can start with a label, "name:",
+ * and an instruction or .word can use a label instead of a number:
+ *   loop:	lda count	; direct
+ *		lda #table	; the address of table
+ *		lda (ptr)	; indirect
+ *		jmp loop
+ *   ptr:	.word table
+ * Every use of a label is a relocation, the linker adds the address of the
+ * label to the cell. A label that the module does not define must be
+ * exported with .global by another module. Empty lines and comments take
+ * no cells, .org is not allowed.
+ *
+ * Layout of an object file, all numbers are 32 bit in the byte order of the
+ * host:
+ *   magic		"POBJ"
+ *   version		OBJECT_VERSION
+ *   source hash	2 words, low word first
+ *   counts		cells, symbols, relocations, size of the names
+ *   checksum		2 words, hashSource of everything after the header
+ * followed by the cells, the flags of the cells (a byte per cell), the
+ * symbols, the relocations and the names. The flags and the names are
+ * padded to a multiple of 4 bytes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <assert.h>
+#include <stdint.h>
+#include "hardware.h"
+#include "parser.h"
+#include "image.h"
+#include "object.h"
+
+#define OBJECT_MAGIC	"POBJ"
+
+/** Longest line of a module, without the newline */
+#define MODULE_MAXLEN	1023
+
+typedef struct ObjHeader
+{
+	char		magic[4];
+	uint32_t	version;
+	uint32_t	hashLow;
+	uint32_t	hashHigh;
+	uint32_t	numCells;
+	uint32_t	numSymbols;
+	uint32_t	numRelocs;
+	uint32_t	namesSize;
+	uint32_t	checkLow;
+	uint32_t	checkHigh;
+} ObjHeader;
+
+/** A module while it is assembled */
+typedef struct ModuleBuilder
+{
+	ObjModule	*module;
+	unsigned int	cellsSize;
+	unsigned int	symbolsSize;
+	unsigned int	relocsSize;
+	unsigned int	namesAlloc;
+	/** Open addressing on the symbol names, holds symbol index + 1 */
+	unsigned int	*index;
+	unsigned int	indexSize;
+	OutputFunc	output;
+	unsigned int	numErrors;
+} ModuleBuilder;
+
+static Error assembleModLine(ModuleBuilder *builder, char *line, unsigned int lineNr);
+static Error assembleWords(ModuleBuilder *builder, const char *p, unsigned int lineNr,
+	const char *line);
+static Error assembleInstr(ModuleBuilder *builder, char *p, unsigned int lineNr);
+static Error markGlobals(ModuleBuilder *builder, const char *p, unsigned int lineNr,
+	const char *line);
+static void lineError(ModuleBuilder *builder, const char *message, unsigned int lineNr,
+	const char *line);
+static size_t identLength(const char *p);
+static int readValue(const char **p, long long min, long long max, long long *value);
+static Error addCells(ModuleBuilder *builder, unsigned int count, unsigned char flags,
+	MemCell **cells);
+static Error findSymbol(ModuleBuilder *builder, const char *name, size_t length,
+	unsigned int *symbol);
+static Error growIndex(ModuleBuilder *builder);
+static Error addReloc(ModuleBuilder *builder, unsigned int offset, unsigned int symbol,
+	unsigned int kind);
+static int isDirective(const char *p, size_t length, const char *name);
+static void *growArray(void *array, unsigned int *size, unsigned int needed, size_t itemSize);
+static size_t padded(size_t size);
+
+/** Assemble the source text of a module. Lines with an error are displayed
+ *  and become a NOP, like compile does, but the module then fails.
+ *
+ * @param [out] module		Free with freeObject
+ * @retval ERR_InvalidInstr	A line has an error
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error assembleModule(const char *text, size_t size, ObjModule *module, OutputFunc output)
+{
+	ModuleBuilder	builder;
+	const char	*line = text,
+			*end = NULL;
+	char		buff[MODULE_MAXLEN + 1];
+	unsigned int	lineNr = 0,
+			i = 0;
+	Error		rval = ERR_None;
+
+	assert(module != NULL);
+
+	memset(module, 0, sizeof(ObjModule));
+	memset(&builder, 0, sizeof(ModuleBuilder));
+	builder.module = module;
+	builder.output = output;
+	module->sourceHash = hashSource(text, size);
+
+	for(line = text; line < text + size && rval == ERR_None; line = end + 1, lineNr++)
+	{
+		end = memchr(line, '\n', text + size - line);
+		end = end != NULL ? end : text + size;
+
+		if(end - line > MODULE_MAXLEN)
+		{
+			lineError(&builder, "Line too long", lineNr, "");
+			continue;
+		}
+
+		memcpy(buff, line, end - line);
+		buff[end - line] = '\0';
+		if(end > line && buff[end - line - 1] == '\r')
+		{
+			buff[end - line - 1] = '\0';
+		}
+
+		rval = assembleModLine(&builder, buff, lineNr);
+	}
+
+	// A global that is not defined here is only a use of the symbol
+	for(i = 0; i < module->numSymbols && rval == ERR_None; i++)
+	{
+		ObjSymbol *symbol = &module->symbols[i];
+
+		if((symbol->flags & OBJ_SYM_GLOBAL) && !(symbol->flags & OBJ_SYM_DEFINED))
+		{
+			lineError(&builder, ".global of a label that is not defined",
+				lineNr, module->names + symbol->name);
+		}
+	}
+
+	free(builder.index);
+
+	if(rval == ERR_None && builder.numErrors > 0)
+	{
+		rval = ERR_InvalidInstr;
+	}
+
+	if(rval != ERR_None)
+	{
+		freeObject(module);
+	}
+
+	return rval;
+}
+
+/** Write a module to an object file
+ *
+ * @retval ERR_OpeningFile	File could not be created
+ * @retval ERR_WritingFile	Error writing the file
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error writeObject(const char *filename, ObjModule *module)
+{
+	ObjHeader		header;
+	FILE			*fp = NULL;
+	char			*body = NULL,
+				*p = NULL;
+	size_t			size = 0;
+	unsigned long long	check = 0;
+	int			failed = 0;
+
+	assert(module != NULL);
+
+	size = module->numCells * sizeof(MemCell) + padded(module->numCells)
+		+ module->numSymbols * sizeof(ObjSymbol) + module->numRelocs * sizeof(ObjReloc)
+		+ padded(module->namesSize);
+
+	body = (char*) calloc(size + 1, 1);
+	if(body == NULL)
+	{
+		return ERR_OutOfMemory;
+	}
+
+	p = body;
+	memcpy(p, module->cells, module->numCells * sizeof(MemCell));
+	p += module->numCells * sizeof(MemCell);
+	memcpy(p, module->cellFlags, module->numCells);
+	p += padded(module->numCells);
+	memcpy(p, module->symbols, module->numSymbols * sizeof(ObjSymbol));
+	p += module->numSymbols * sizeof(ObjSymbol);
+	memcpy(p, module->relocs, module->numRelocs * sizeof(ObjReloc));
+	p += module->numRelocs * sizeof(ObjReloc);
+	memcpy(p, module->names, module->namesSize);
+
+	check = hashSource(body, size);
+	memcpy(header.magic, OBJECT_MAGIC, 4);
+	header.version = OBJECT_VERSION;
+	header.hashLow = (uint32_t)module->sourceHash;
+	header.hashHigh = (uint32_t)(module->sourceHash >> 32);
+	header.numCells = module->numCells;
+	header.numSymbols = module->numSymbols;
+	header.numRelocs = module->numRelocs;
+	header.namesSize = module->namesSize;
+	header.checkLow = (uint32_t)check;
+	header.checkHigh = (uint32_t)(check >> 32);
+
+	fp = fopen(filename, "wb");
+	if(fp == NULL)
+	{
+		free(body);
+		return ERR_OpeningFile;
+	}
+
+	failed = fwrite(&header, sizeof(header), 1, fp) != 1;
+	failed = failed || (size > 0 && fwrite(body, size, 1, fp) != 1);
+	failed = fclose(fp) != 0 || failed;
+	free(body);
+
+	return failed ? ERR_WritingFile : ERR_None;
+}
+
+/** Read an object file. Free the module with freeObject.
+ *
+ * @retval ERR_OpeningFile	File could not be opened
+ * @retval ERR_ReadingFile	Error reading the file
+ * @retval ERR_InvalidImage	Not an object file, another version or corrupt
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error readObject(const char *filename, ObjModule *module)
+{
+	ObjHeader		header;
+	FILE			*fp = NULL;
+	char			*body = NULL,
+				*p = NULL;
+	size_t			size = 0;
+	unsigned long long	check = 0;
+	unsigned int		i = 0;
+	Error			rval = ERR_None;
+
+	assert(module != NULL);
+
+	memset(module, 0, sizeof(ObjModule));
+
+	fp = fopen(filename, "rb");
+	if(fp == NULL)
+	{
+		return ERR_OpeningFile;
+	}
+
+	if(fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, OBJECT_MAGIC, 4) != 0
+		|| header.version != OBJECT_VERSION || header.numCells > INT_MAX / 8
+		|| header.numSymbols > INT_MAX / 16 || header.numRelocs > INT_MAX / 16
+		|| header.namesSize > INT_MAX / 2)
+	{
+		fclose(fp);
+		return ERR_InvalidImage;
+	}
+
+	size = header.numCells * sizeof(MemCell) + padded(header.numCells)
+		+ header.numSymbols * sizeof(ObjSymbol) + header.numRelocs * sizeof(ObjReloc)
+		+ padded(header.namesSize);
+	body = (char*) malloc(size + 1);
+	if(body == NULL)
+	{
+		fclose(fp);
+		return ERR_OutOfMemory;
+	}
+
+	if(size > 0 && fread(body, size, 1, fp) != 1)
+	{
+		rval = ERR_ReadingFile;
+	}
+	fclose(fp);
+
+	check = hashSource(body, size);
+	if(rval == ERR_None && ((uint32_t)check != header.checkLow
+		|| (uint32_t)(check >> 32) != header.checkHigh))
+	{
+		rval = ERR_InvalidImage;
+	}
+
+	if(rval == ERR_None)
+	{
+		module->sourceHash = header.hashLow | (unsigned long long)header.hashHigh << 32;
+		module->numCells = header.numCells;
+		module->numSymbols = header.numSymbols;
+		module->numRelocs = header.numRelocs;
+		module->namesSize = header.namesSize;
+		module->cells = (MemCell*) malloc(module->numCells * sizeof(MemCell) + 1);
+		module->cellFlags = (unsigned char*) malloc(module->numCells + 1);
+		module->symbols = (ObjSymbol*) malloc(module->numSymbols * sizeof(ObjSymbol) + 1);
+		module->relocs = (ObjReloc*) malloc(module->numRelocs * sizeof(ObjReloc) + 1);
+		module->names = (char*) malloc(module->namesSize + 1);
+		if(module->cells == NULL || module->cellFlags == NULL || module->symbols == NULL
+			|| module->relocs == NULL || module->names == NULL)
+		{
+			rval = ERR_OutOfMemory;
+		}
+	}
+
+	if(rval == ERR_None)
+	{
+		p = body;
+		memcpy(module->cells, p, module->numCells * sizeof(MemCell));
+		p += module->numCells * sizeof(MemCell);
+		memcpy(module->cellFlags, p, module->numCells);
+		p += padded(module->numCells);
+		memcpy(module->symbols, p, module->numSymbols * sizeof(ObjSymbol));
+		p += module->numSymbols * sizeof(ObjSymbol);
+		memcpy(module->relocs, p, module->numRelocs * sizeof(ObjReloc));
+		p += module->numRelocs * sizeof(ObjReloc);
+		memcpy(module->names, p, module->namesSize);
+
+		// Everything that the linker uses as an index must be valid
+		if(module->namesSize > 0 && module->names[module->namesSize - 1] != '\0')
+		{
+			rval = ERR_InvalidImage;
+		}
+		for(i = 0; i < module->numCells && rval == ERR_None; i++)
+		{
+			rval = module->cellFlags[i] > IMAGE_SEG_DATA ? ERR_InvalidImage : ERR_None;
+		}
+		for(i = 0; i < module->numSymbols && rval == ERR_None; i++)
+		{
+			rval = module->symbols[i].name >= module->namesSize
+				|| ((module->symbols[i].flags & OBJ_SYM_DEFINED)
+				&& module->symbols[i].value >= module->numCells)
+				? ERR_InvalidImage : ERR_None;
+		}
+		for(i = 0; i < module->numRelocs && rval == ERR_None; i++)
+		{
+			rval = module->relocs[i].offset >= module->numCells
+				|| module->relocs[i].symbol >= module->numSymbols
+				|| module->relocs[i].kind > OBJ_RELOC_WORD ? ERR_InvalidImage : ERR_None;
+		}
+	}
+
+	free(body);
+	if(rval != ERR_None)
+	{
+		freeObject(module);
+	}
+
+	return rval;
+}
+
+/** FNV-1a hash of a source text. A module whose source has the same hash
+ *  does not have to be assembled again. */
+unsigned long long hashSource(const char *text, size_t size)
+{
+	unsigned long long	hash = 14695981039346656037ULL;
+	size_t			i = 0;
+
+	for(i = 0; i < size; i++)
+	{
+		hash ^= (unsigned char)text[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+/** Free a module */
+void freeObject(ObjModule *module)
+{
+	assert(module != NULL);
+
+	free(module->cells);
+	free(module->cellFlags);
+	free(module->symbols);
+	free(module->relocs);
+	free(module->names);
+	memset(module, 0, sizeof(ObjModule));
+}
+
+/** Private function: assemble a line of a module: an optional label, then
+ *  a directive or an instruction
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error assembleModLine(ModuleBuilder *builder, char *line, unsigned int lineNr)
+{
+	ObjModule	*module = builder->module;
+	char		*p = line;
+	size_t		length = 0;
+	unsigned int	symbol = 0;
+	long long	count = 0,
+			value = 0;
+	MemCell		*cells = NULL;
+	Error		rval = ERR_None;
+
+	while(*p == ' ' || *p == '\t')
+	{
+		p++;
+	}
+
+	// Label
+	length = identLength(p);
+	if(length > 0 && p[length] == ':')
+	{
+		rval = findSymbol(builder, p, length, &symbol);
+		if(rval != ERR_None)
+		{
+			return rval;
+		}
+
+		if(module->symbols[symbol].flags & OBJ_SYM_DEFINED)
+		{
+			lineError(builder, "Label defined twice", lineNr, line);
+		}
+		module->symbols[symbol].flags |= OBJ_SYM_DEFINED;
+		module->symbols[symbol].value = module->numCells;
+
+		p += length + 1;
+		while(*p == ' ' || *p == '\t')
+		{
+			p++;
+		}
+	}
+
+	if(*p == '\0' || *p == ';')
+	{
+		return ERR_None;
+	}
+
+	if(*p != '.')
+	{
+		return assembleInstr(builder, p, lineNr);
+	}
+
+	length = 1 + identLength(p + 1);
+	if(isDirective(p, length, ".global"))
+	{
+		return markGlobals(builder, p + length, lineNr, line);
+	}
+	else if(isDirective(p, length, ".word"))
+	{
+		return assembleWords(builder, p + length, lineNr, line);
+	}
+	else if(isDirective(p, length, ".fill") || isDirective(p, length, ".zero"))
+	{
+		const char *arg = p + length;
+
+		if(!readValue(&arg, 0, UINT_MAX, &count) || (tolower((unsigned char)p[1]) == 'f'
+			&& (*arg++ != ',' || !readValue(&arg, INT_MIN, UINT_MAX, &value)))
+			|| (*arg != '\0' && *arg != ';'))
+		{
+			lineError(builder, "Invalid directive", lineNr, line);
+			return ERR_None;
+		}
+
+		rval = addCells(builder, (unsigned int)count, IMAGE_SEG_DATA, &cells);
+		while(rval == ERR_None && count-- > 0)
+		{
+			cells[count].getal = (int)(unsigned int)value;
+		}
+		return rval;
+	}
+	else if(isDirective(p, length, ".org"))
+	{
+		lineError(builder, ".org is not allowed in a module", lineNr, line);
+		return ERR_None;
+	}
+
+	lineError(builder, "Invalid directive", lineNr, line);
+	return ERR_None;
+}
+
+/** Private function: assemble the values of .word, numbers or labels
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error assembleWords(ModuleBuilder *builder, const char *p, unsigned int lineNr,
+	const char *line)
+{
+	const char	*arg = p;
+	unsigned int	count = 0,
+			i = 0,
+			symbol = 0;
+	long long	value = 0;
+	size_t		length = 0;
+	MemCell		*cells = NULL;
+	Error		rval = ERR_None;
+
+	// Check and count the values first
+	do
+	{
+		while(*arg == ' ' || *arg == '\t')
+		{
+			arg++;
+		}
+
+		length = identLength(arg);
+		if(length > 0)
+		{
+			arg += length;
+			while(*arg == ' ' || *arg == '\t')
+			{
+				arg++;
+			}
+		}
+		else if(!readValue(&arg, INT_MIN, UINT_MAX, &value))
+		{
+			lineError(builder, "Invalid directive", lineNr, line);
+			return ERR_None;
+		}
+		count++;
+	} while(*arg++ == ',');
+
+	if(arg[-1] != '\0' && arg[-1] != ';')
+	{
+		lineError(builder, "Invalid directive", lineNr, line);
+		return ERR_None;
+	}
+
+	rval = addCells(builder, count, IMAGE_SEG_DATA, &cells);
+	for(i = 0, arg = p; i < count && rval == ERR_None; i++)
+	{
+		while(*arg == ' ' || *arg == '\t')
+		{
+			arg++;
+		}
+
+		length = identLength(arg);
+		if(length > 0)
+		{
+			cells[i].getal = 0;
+			rval = findSymbol(builder, arg, length, &symbol);
+			if(rval == ERR_None)
+			{
+				rval = addReloc(builder, builder->module->numCells - count + i,
+					symbol, OBJ_RELOC_WORD);
+			}
+			arg += length;
+			while(*arg == ' ' || *arg == '\t')
+			{
+				arg++;
+			}
+		}
+		else
+		{
+			readValue(&arg, INT_MIN, UINT_MAX, &value);
+			cells[i].getal = (int)(unsigned int)value;
+		}
+		arg++;
+	}
+
+	return rval;
+}
+
+/** Private function: assemble an instruction. A label as operand is
+ *  replaced by 0 before parsing, and relocated.
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error assembleInstr(ModuleBuilder *builder, char *p, unsigned int lineNr)
+{
+	char		buff[MODULE_MAXLEN + 2],
+			*arg = NULL;
+	size_t		length = 0;
+	unsigned int	symbol = 0;
+	int		hasSymbol = 0;
+	MemCell		*cell = NULL,
+			parsed;
+	Error		rval = ERR_None;
+
+	strcpy(buff, p);
+	arg = buff + identLength(buff);
+	while(*arg == ' ' || *arg == '\t')
+	{
+		arg++;
+	}
+	if(*arg == '#' || *arg == '(')
+	{
+		arg++;
+		while(*arg == ' ' || *arg == '\t')
+		{
+			arg++;
+		}
+	}
+
+	length = identLength(arg);
+	if(length > 0 && arg > buff + 3)
+	{
+		rval = findSymbol(builder, arg, length, &symbol);
+		if(rval != ERR_None)
+		{
+			return rval;
+		}
+		arg[0] = '0';
+		memmove(arg + 1, arg + length, strlen(arg + length) + 1);
+		hasSymbol = 1;
+	}
+
+	rval = addCells(builder, 1, IMAGE_SEG_CODE, &cell);
+	if(rval != ERR_None)
+	{
+		return rval;
+	}
+
+	switch(parseAsmLine(buff, &parsed))
+	{
+	case ERR_None:
+		*cell = parsed;
+		return hasSymbol ? addReloc(builder, builder->module->numCells - 1, symbol,
+			OBJ_RELOC_OPERAND) : ERR_None;
+	case ERR_UnknownInstr:
+		lineError(builder, "Unknown instruction", lineNr, p);
+		break;
+	default:
+		lineError(builder, "Invalid use of instruction", lineNr, p);
+		break;
+	}
+
+	cell->getal = 0;
+	return ERR_None;
+}
+
+/** Private function: mark the labels of .global as global
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error markGlobals(ModuleBuilder *builder, const char *p, unsigned int lineNr,
+	const char *line)
+{
+	unsigned int	symbol = 0;
+	size_t		length = 0;
+	Error		rval = ERR_None;
+
+	do
+	{
+		while(*p == ' ' || *p == '\t')
+		{
+			p++;
+		}
+
+		length = identLength(p);
+		if(length == 0)
+		{
+			lineError(builder, "Invalid directive", lineNr, line);
+			return ERR_None;
+		}
+
+		rval = findSymbol(builder, p, length, &symbol);
+		if(rval != ERR_None)
+		{
+			return rval;
+		}
+		builder->module->symbols[symbol].flags |= OBJ_SYM_GLOBAL;
+
+		p += length;
+		while(*p == ' ' || *p == '\t')
+		{
+			p++;
+		}
+	} while(*p++ == ',');
+
+	if(p[-1] != '\0' && p[-1] != ';')
+	{
+		lineError(builder, "Invalid directive", lineNr, line);
+	}
+
+	return ERR_None;
+}
+
+/** Private function: display an error of a line, like compile does */
+static void lineError(ModuleBuilder *builder, const char *message, unsigned int lineNr,
+	const char *line)
+{
+	char	buff[MODULE_MAXLEN + 128];
+	size_t	length = strcspn(line, ";");
+
+	sprintf(buff, "  ERROR: %s at line %u: %.*s\n", message, lineNr, (int)length, line);
+	builder->output(buff);
+	builder->numErrors++;
+}
+
+/** Private function: is the word at p, of a length, the name of a
+ *  directive? Directives are not case sensitive. */
+static int isDirective(const char *p, size_t length, const char *name)
+{
+	size_t i = 0;
+
+	if(strlen(name) != length)
+	{
+		return 0;
+	}
+
+	while(i < length && tolower((unsigned char)p[i]) == name[i])
+	{
+		i++;
+	}
+
+	return i == length;
+}
+
+/** Private function: length of the label name at p, 0 if there is none */
+static size_t identLength(const char *p)
+{
+	size_t length = 0;
+
+	if(!isalpha((unsigned char)p[0]) && p[0] != '_')
+	{
+		return 0;
+	}
+
+	while(isalnum((unsigned char)p[length]) || p[length] == '_')
+	{
+		length++;
+	}
+
+	return length;
+}
+
+/** Private function: read a decimal number between min and max, whitespace
+ *  before and after it is skipped
+ *
+ * @return FALSE if there is no valid number
+ */
+static int readValue(const char **p, long long min, long long max, long long *value)
+{
+	const char	*s = *p;
+	char		*end = NULL;
+
+	while(*s == ' ' || *s == '\t')
+	{
+		s++;
+	}
+
+	if(!isdigit((unsigned char)*s) && !((*s == '-' || *s == '+')
+		&& isdigit((unsigned char)s[1])))
+	{
+		return 0;
+	}
+
+	errno = 0;
+	*value = strtoll(s, &end, 10);
+	if(errno == ERANGE || *value < min || *value > max)
+	{
+		return 0;
+	}
+
+	while(*end == ' ' || *end == '\t')
+	{
+		end++;
+	}
+
+	*p = end;
+	return 1;
+}
+
+/** Private function: add cells at the end of the module
+ *
+ * @param [out] cells		The new cells
+ * @retval ERR_OutOfMemory	Malloc failed, or too many cells
+ */
+static Error addCells(ModuleBuilder *builder, unsigned int count, unsigned char flags,
+	MemCell **cells)
+{
+	ObjModule	*module = builder->module;
+	unsigned int	size = builder->cellsSize;
+	MemCell		*bigger = NULL;
+	unsigned char	*biggerFlags = NULL;
+
+	if(count > UINT_MAX / 2 - module->numCells)
+	{
+		return ERR_OutOfMemory;
+	}
+
+	bigger = (MemCell*) growArray(module->cells, &size, module->numCells + count,
+		sizeof(MemCell));
+	if(bigger == NULL)
+	{
+		return ERR_OutOfMemory;
+	}
+	module->cells = bigger;
+
+	size = builder->cellsSize;
+	biggerFlags = (unsigned char*) growArray(module->cellFlags, &size,
+		module->numCells + count, 1);
+	if(biggerFlags == NULL)
+	{
+		return ERR_OutOfMemory;
+	}
+	module->cellFlags = biggerFlags;
+	builder->cellsSize = size;
+
+	memset(module->cellFlags + module->numCells, flags, count);
+	*cells = module->cells + module->numCells;
+	module->numCells += count;
+
+	return ERR_None;
+}
+
+/** Private function: find the symbol with a name, it is added when the
+ *  module does not have it yet
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error findSymbol(ModuleBuilder *builder, const char *name, size_t length,
+	unsigned int *symbol)
+{
+	ObjModule		*module = builder->module;
+	ObjSymbol		*symbols = NULL;
+	char			*names = NULL;
+	unsigned long long	hash = hashSource(name, length);
+	unsigned int		slot = 0;
+	Error			rval = ERR_None;
+
+	if(2 * (module->numSymbols + 1) > builder->indexSize)
+	{
+		rval = growIndex(builder);
+		if(rval != ERR_None)
+		{
+			return rval;
+		}
+	}
+
+	for(slot = (unsigned int)hash & (builder->indexSize - 1); builder->index[slot] != 0;
+		slot = (slot + 1) & (builder->indexSize - 1))
+	{
+		const char *other = module->names + module->symbols[builder->index[slot] - 1].name;
+
+		if(strncmp(other, name, length) == 0 && other[length] == '\0')
+		{
+			*symbol = builder->index[slot] - 1;
+			return ERR_None;
+		}
+	}
+
+	symbols = (ObjSymbol*) growArray(module->symbols, &builder->symbolsSize,
+		module->numSymbols + 1, sizeof(ObjSymbol));
+	if(symbols == NULL)
+	{
+		return ERR_OutOfMemory;
+	}
+	module->symbols = symbols;
+
+	names = (char*) growArray(module->names, &builder->namesAlloc,
+		module->namesSize + (unsigned int)length + 1, 1);
+	if(names == NULL)
+	{
+		return ERR_OutOfMemory;
+	}
+	module->names = names;
+
+	memcpy(names + module->namesSize, name, length);
+	names[module->namesSize + length] = '\0';
+
+	*symbol = module->numSymbols++;
+	symbols[*symbol].name = module->namesSize;
+	symbols[*symbol].value = 0;
+	symbols[*symbol].flags = 0;
+	module->namesSize += (unsigned int)length + 1;
+	builder->index[slot] = *symbol + 1;
+
+	return ERR_None;
+}
+
+/** Private function: double the size of the name index
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error growIndex(ModuleBuilder *builder)
+{
+	ObjModule	*module = builder->module;
+	unsigned int	size = builder->indexSize ? builder->indexSize * 2 : 64,
+			*index = NULL,
+			i = 0,
+			slot = 0;
+
+	index = (unsigned int*) calloc(size, sizeof(unsigned int));
+	if(index == NULL)
+	{
+		return ERR_OutOfMemory;
+	}
+
+	for(i = 0; i < module->numSymbols; i++)
+	{
+		const char *name = module->names + module->symbols[i].name;
+
+		slot = (unsigned int)hashSource(name, strlen(name)) & (size - 1);
+		while(index[slot] != 0)
+		{
+			slot = (slot + 1) & (size - 1);
+		}
+		index[slot] = i + 1;
+	}
+
+	free(builder->index);
+	builder->index = index;
+	builder->indexSize = size;
+
+	return ERR_None;
+}
+
+/** Private function: the cell at an offset holds the address of a symbol
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error addReloc(ModuleBuilder *builder, unsigned int offset, unsigned int symbol,
+	unsigned int kind)
+{
+	ObjModule	*module = builder->module;
+	ObjReloc	*relocs = NULL;
+
+	relocs = (ObjReloc*) growArray(module->relocs, &builder->relocsSize,
+		module->numRelocs + 1, sizeof(ObjReloc));
+	if(relocs == NULL)
+	{
+		return ERR_OutOfMemory;
+	}
+	module->relocs = relocs;
+
+	relocs[module->numRelocs].offset = offset;
+	relocs[module->numRelocs].symbol = symbol;
+	relocs[module->numRelocs].kind = kind;
+	module->numRelocs++;
+
+	return ERR_None;
+}
+
+/** Private function: make room for at least 'needed' items, the size is
+ *  doubled. Returns NULL when realloc failed, the array is kept. */
+static void *growArray(void *array, unsigned int *size, unsigned int needed, size_t itemSize)
+{
+	unsigned int newSize = *size;
+
+	if(needed <= *size)
+	{
+		return array;
+	}
+
+	while(newSize < needed)
+	{
+		newSize = newSize ? newSize * 2 : 256;
+	}
+
+	array = realloc(array, (size_t)newSize * itemSize);
+	if(array != NULL)
+	{
+		*size = newSize;
+	}
+
+	return array;
+}
+
+/** Private function: size rounded up to a multiple of 4 bytes */
+static size_t padded(size_t size)
+{
+	return (size + 3) & ~(size_t)3;
+}
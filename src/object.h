@@ -0,0 +1,68 @@
+#ifndef _PSEUDOASM_INC_OBJECT_H_
+#define _PSEUDOASM_INC_OBJECT_H_
+
+#include "errors.h"
+#include "hardware.h"
+
+#define OBJECT_VERSION	1
+
+/* Flags of a symbol */
+#define OBJ_SYM_DEFINED	0x1	// Label of this module, value is its offset
+#define OBJ_SYM_GLOBAL	0x2	// Other modules can use it (.global)
+
+/* What a relocation changes */
+#define OBJ_RELOC_OPERAND	0x0	// The operand of an instruction
+#define OBJ_RELOC_WORD		0x1	// The whole cell (.word)
+
+/** A label of a module, or a name it uses that another module defines */
+typedef struct ObjSymbol
+{
+	/** Offset of the name in ObjModule.names */
+	unsigned int name;
+	unsigned int value;
+	unsigned int flags;
+} ObjSymbol;
+
+/** A cell that holds the address of a symbol after linking */
+typedef struct ObjReloc
+{
+	unsigned int offset;
+	unsigned int symbol;
+	unsigned int kind;
+} ObjReloc;
+
+/** A relocatable module: cells starting at offset 0, with the symbols it
+ *  defines and uses */
+typedef struct ObjModule
+{
+	/** Hash of the source text the module was assembled from */
+	unsigned long long sourceHash;
+	unsigned int numCells;
+	MemCell *cells;
+	/** IMAGE_SEG_CODE or IMAGE_SEG_DATA for every cell */
+	unsigned char *cellFlags;
+	unsigned int numSymbols;
+	ObjSymbol *symbols;
+	unsigned int numRelocs;
+	ObjReloc *relocs;
+	/** Names of the symbols, each terminated by '\0' */
+	unsigned int namesSize;
+	char *names;
+} ObjModule;
+
+/* Assemble the source text of a module */
+Error assembleModule(const char *text, size_t size, ObjModule *module, OutputFunc output);
+
+/* Write a module to an object file */
+Error writeObject(const char *filename, ObjModule *module);
+
+/* Read an object file */
+Error readObject(const char *filename, ObjModule *module);
+
+/* Hash of a source text, see ObjModule.sourceHash */
+unsigned long long hashSource(const char *text, size_t size);
+
+/* Free a module */
+void freeObject(ObjModule *module);
+
+#endif // _PSEUDOASM_INC_OBJECT_H_
@@ -0,0 +1,973 @@
+/**
+ * Peephole optimizer for assembled images.
+ *
+ * First the instructions that can be executed are found, by following the
+ * program from its entry point: falling through, jumping, and returning to
+ * the address after a JSB. Then every cell that the program can write, or
+ * read as data, is marked. The cell an indirect load or store uses is known
+ * when its pointer is never written. When the program can write one of its
+ * instructions, or an indirect load or store uses a pointer that changes,
+ * nothing is optimized.
+ *
+ * Otherwise the code is rewritten in place, no instruction is moved:
+ *  - a load of a value the register already holds becomes a NOP, e.g. the
+ *    LDA x in STA x, LDA x, or a second LDB #1,
+ *  - a load of a cell that is never written becomes an immediate load, and
+ *    an indirect load through a constant pointer a direct load,
+ *  - a run of NOPs starts with a jump over the run,
+ *  - a jump to a JMP or a NOP jumps directly to the final target.
+ * The registers are only followed in straight line code, nothing is known
+ * about them at a jump target. Cells that are read as data are never
+ * rewritten.
+ *
+ * Before that, data flow analysis over the control flow graph (see
+ * dataflow.c) finds the values that are constant across jumps:
+ *  - arithmetic on constant registers becomes an immediate load, e.g.
+ *    LDA #2, LDB #3, ADD becomes LDA #2, LDB #3, LDA #5,
+ *  - a load of a cell that holds a known value becomes an immediate load,
+ *  - a load, direct store or arithmetic whose result is never used becomes
+ *    a NOP, e.g. the first STA x in STA x, STA x. This removes the LDA #2
+ *    and LDB #3 above, when nothing else uses them.
+ *
+ * The stack is assumed not to grow into the program, and RTS to return to
+ * the address pushed by its JSB.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "hardware.h"
+#include "image.h"
+#include "cfg.h"
+#include "dataflow.h"
+#include "optimizer.h"
+
+#define MARK_EXEC	0x01	// Can be executed
+#define MARK_TARGET	0x02	// Can be jumped or returned to
+#define MARK_WRITTEN	0x04	// Can be written by the program
+#define MARK_READ	0x08	// Can be read as data
+
+/** Largest operand of an instruction */
+#define OPERAND_MAX	0xFFFFFF
+
+/** Instructions looked at to find out if the flags are still used */
+#define FLAGS_MAX_SCAN	64
+/** Jumps and NOPs followed to find the final target of a jump */
+#define JUMP_MAX_CHAIN	256
+
+/** All cells of the program, sorted on address */
+typedef struct Program
+{
+	ImageCell	*cells;
+	size_t		count;
+} Program;
+
+/** What is known about a register in straight line code */
+typedef struct RegState
+{
+	int		hasValue;
+	int		value;
+	int		hasCell;	// Register equals the cell at address 'cell'
+	unsigned int	cell;
+} RegState;
+
+static ImageCell *findCell(Program *prog, unsigned int address);
+static Error markExecutable(Program *prog, unsigned int entry);
+static void visitCell(Program *prog, unsigned int address, int isTarget,
+	size_t *stack, size_t *top);
+static const char *markAccess(Program *prog);
+static Error optimizeFlow(Program *prog, unsigned int entry, OptReport *report);
+static int fetchCell(void *context, unsigned int address, MemCell *cell);
+static void foldConstants(Program *prog, DataFlow *flow, OptReport *report);
+static int foldMath(Instruction instr, DfValue *state, int *result);
+static void removeUnused(Program *prog, DataFlow *flow, OptReport *report);
+static void optimizeLoads(Program *prog, OptReport *report);
+static void optimizeLoad(Program *prog, size_t index, RegState *reg, int *flagsFromA,
+	OptReport *report);
+static void trackStore(Program *prog, Instruction instr, RegState *reg, RegState *other);
+static int flagsUnused(Program *prog, size_t index);
+static void skipNops(Program *prog, OptReport *report);
+static void threadJumps(Program *prog, OptReport *report);
+static Error saveChanges(Program *prog, OptReport *report);
+
+/** Rewrite the code of an assembled image into cheaper code that behaves
+ *  the same. Only the cells of the image are changed, and every change is
+ *  listed in the report. When the image can not be optimized safely, it is
+ *  not changed and report->skipReason says why.
+ *
+ * @param [in,out] image	Assembled image, not one loaded with mapImage
+ * @param [out] report		Free with freeOptReport
+ * @retval ERR_InvalidState	The image was loaded with mapImage
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error optimizeImage(Image *image, OptReport *report)
+{
+	Program	prog = {NULL, 0};
+	Error	rval = ERR_None;
+
+	assert(image != NULL && report != NULL);
+
+	report->removed = 0;
+	report->skipped = 0;
+	report->simplified = 0;
+	report->threaded = 0;
+	report->folded = 0;
+	report->dead = 0;
+	report->numChanges = 0;
+	report->changes = NULL;
+	report->skipReason = NULL;
+
+	if(image->cells == NULL && image->numSegments > 0)
+	{
+		return ERR_InvalidState;
+	}
+
+	rval = flattenImage(image, &prog.cells, &prog.count);
+	if(rval == ERR_None)
+	{
+		rval = markExecutable(&prog, image->entry);
+	}
+
+	if(rval == ERR_None)
+	{
+		report->skipReason = markAccess(&prog);
+	}
+
+	if(rval == ERR_None && report->skipReason == NULL)
+	{
+		rval = optimizeFlow(&prog, image->entry, report);
+	}
+
+	if(rval == ERR_None && report->skipReason == NULL)
+	{
+		optimizeLoads(&prog, report);
+		skipNops(&prog, report);
+		threadJumps(&prog, report);
+		rval = saveChanges(&prog, report);
+	}
+
+	free(prog.cells);
+
+	return rval;
+}
+
+/** Free the changes of a report */
+void freeOptReport(OptReport *report)
+{
+	assert(report != NULL);
+
+	free(report->changes);
+	report->changes = NULL;
+	report->numChanges = 0;
+}
+
+/** Private function: find the cell of an address, NULL if it is not in the image */
+static ImageCell *findCell(Program *prog, unsigned int address)
+{
+	return findImageCell(prog->cells, prog->count, address);
+}
+
+/** Private function: mark every cell that can be executed, starting at the
+ *  entry point. Executing a cell outside the image fails, so only cells of
+ *  the image are followed.
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error markExecutable(Program *prog, unsigned int entry)
+{
+	size_t	*stack = NULL,
+		top = 0;
+
+	// Every cell is pushed at most once
+	stack = (size_t*) malloc(prog->count * sizeof(size_t) + 1);
+	if(stack == NULL)
+	{
+		return ERR_OutOfMemory;
+	}
+
+	visitCell(prog, entry, 1, stack, &top);
+
+	while(top > 0)
+	{
+		ImageCell	*cell = &prog->cells[stack[--top]];
+		Instruction	instr = cell->value.instructie;
+		unsigned int	next = cell->address + 1;
+
+		switch(instr.operator)
+		{
+		case A_NOP:
+		case A_INP:
+		case A_OUT:
+		case A_ADD:
+		case A_SUB:
+		case A_MUL:
+		case A_DIV:
+			visitCell(prog, next, 0, stack, &top);
+			break;
+		case A_LDA:
+		case A_LDB:
+			if(instr.adressering != GEINDEXEERD)
+			{
+				visitCell(prog, next, 0, stack, &top);
+			}
+			break;
+		case A_STA:
+		case A_STB:
+			if(instr.adressering == DIRECT || instr.adressering == INDIRECT)
+			{
+				visitCell(prog, next, 0, stack, &top);
+			}
+			break;
+		case A_JMP:
+			visitCell(prog, instr.operand, 1, stack, &top);
+			break;
+		case A_JSP:
+		case A_JSN:
+		case A_JIZ:
+		case A_JOF:
+			visitCell(prog, instr.operand, 1, stack, &top);
+			visitCell(prog, next, 0, stack, &top);
+			break;
+		case A_JSB:
+			// RTS returns to the next instruction
+			visitCell(prog, instr.operand, 1, stack, &top);
+			visitCell(prog, next, 1, stack, &top);
+			break;
+		default:
+			// RTS, HLT and invalid instructions
+			break;
+		}
+	}
+
+	free(stack);
+
+	return ERR_None;
+}
+
+/** Private function: mark a cell as executable, and push it when it was not yet */
+static void visitCell(Program *prog, unsigned int address, int isTarget,
+	size_t *stack, size_t *top)
+{
+	ImageCell *cell = findCell(prog, address);
+
+	if(cell == NULL)
+	{
+		return;
+	}
+
+	if(isTarget)
+	{
+		cell->marks |= MARK_TARGET;
+	}
+
+	if(!(cell->marks & MARK_EXEC))
+	{
+		cell->marks |= MARK_EXEC;
+		stack[(*top)++] = (size_t)(cell - prog->cells);
+	}
+}
+
+/** Private function: mark the cells that the executable instructions can
+ *  write or read as data. Returns why the program can not be optimized, or
+ *  NULL if it can. */
+static const char *markAccess(Program *prog)
+{
+	ImageCell	*cell = NULL,
+			*pointer = NULL;
+	size_t		i = 0;
+	int		changed = 1;
+
+	// Direct loads and stores, and the pointers of indirect ones
+	for(i = 0; i < prog->count; i++)
+	{
+		Instruction instr = prog->cells[i].value.instructie;
+
+		if(!(prog->cells[i].marks & MARK_EXEC) || (instr.adressering != DIRECT
+			&& instr.adressering != INDIRECT))
+		{
+			continue;
+		}
+
+		cell = findCell(prog, instr.operand);
+		if(cell == NULL)
+		{
+			continue;
+		}
+
+		if((instr.operator == A_STA || instr.operator == A_STB)
+			&& instr.adressering == DIRECT)
+		{
+			cell->marks |= MARK_WRITTEN;
+		}
+		else if(instr.operator == A_LDA || instr.operator == A_LDB
+			|| instr.operator == A_STA || instr.operator == A_STB)
+		{
+			cell->marks |= MARK_READ;
+		}
+	}
+
+	// An indirect store writes the cell its pointer points to, as long as the
+	// pointer is never written. Marking that cell can change another pointer.
+	while(changed)
+	{
+		changed = 0;
+		for(i = 0; i < prog->count; i++)
+		{
+			Instruction instr = prog->cells[i].value.instructie;
+
+			if(!(prog->cells[i].marks & MARK_EXEC) || instr.adressering != INDIRECT
+				|| (instr.operator != A_STA && instr.operator != A_STB))
+			{
+				continue;
+			}
+
+			pointer = findCell(prog, instr.operand);
+			if(pointer == NULL || (pointer->marks & MARK_WRITTEN))
+			{
+				return "an indirect store uses a pointer that changes";
+			}
+
+			cell = findCell(prog, (unsigned int)pointer->value.getal);
+			if(cell != NULL && !(cell->marks & MARK_WRITTEN))
+			{
+				cell->marks |= MARK_WRITTEN;
+				changed = 1;
+			}
+		}
+	}
+
+	for(i = 0; i < prog->count; i++)
+	{
+		Instruction instr = prog->cells[i].value.instructie;
+
+		if(!(prog->cells[i].marks & MARK_EXEC) || instr.adressering != INDIRECT
+			|| (instr.operator != A_LDA && instr.operator != A_LDB))
+		{
+			continue;
+		}
+
+		pointer = findCell(prog, instr.operand);
+		if(pointer == NULL || (pointer->marks & MARK_WRITTEN))
+		{
+			return "an indirect load uses a pointer that changes";
+		}
+
+		cell = findCell(prog, (unsigned int)pointer->value.getal);
+		if(cell != NULL)
+		{
+			cell->marks |= MARK_READ;
+		}
+	}
+
+	for(i = 0; i < prog->count; i++)
+	{
+		if((prog->cells[i].marks & MARK_EXEC) && (prog->cells[i].marks & MARK_WRITTEN))
+		{
+			return "the program writes to its own code";
+		}
+	}
+
+	return NULL;
+}
+
+/** Private function: fold constants and remove unused instructions with
+ *  data flow analysis. A program that is too large to analyze is left as
+ *  it is.
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error optimizeFlow(Program *prog, unsigned int entry, OptReport *report)
+{
+	Cfg		cfg;
+	DataFlow	flow;
+	Error		rval = ERR_None;
+	int		pass = 0;
+
+	// The second pass sees the loads that folding left unused
+	for(pass = 0; pass < 2 && rval == ERR_None; pass++)
+	{
+		rval = buildCfg(fetchCell, prog, entry, &cfg);
+		if(rval != ERR_None)
+		{
+			break;
+		}
+
+		rval = dfAnalyze(&cfg, fetchCell, prog, &flow);
+		if(rval == ERR_None)
+		{
+			if(pass == 0)
+			{
+				foldConstants(prog, &flow, report);
+			}
+			else
+			{
+				removeUnused(prog, &flow, report);
+			}
+			dfFree(&flow);
+		}
+		freeCfg(&cfg);
+	}
+
+	return rval == ERR_MemoryLimit ? ERR_None : rval;
+}
+
+/** Private function: read a cell of the program for the control flow graph */
+static int fetchCell(void *context, unsigned int address, MemCell *cell)
+{
+	ImageCell *found = findCell((Program*) context, address);
+
+	if(found == NULL)
+	{
+		return 0;
+	}
+
+	*cell = found->value;
+	return 1;
+}
+
+/** Private function: rewrite arithmetic on constants, and loads of constant
+ *  cells, into immediate loads */
+static void foldConstants(Program *prog, DataFlow *flow, OptReport *report)
+{
+	Cfg		*cfg = flow->cfg;
+	DfValue		*state = NULL;
+	unsigned int	b = 0,
+			j = 0;
+	int		result = 0;
+
+	state = (DfValue*) malloc(flow->numVars * sizeof(DfValue));
+	if(state == NULL)
+	{
+		// Only an optimization
+		return;
+	}
+
+	for(b = 0; b < cfg->numBlocks; b++)
+	{
+		CfgBlock *block = &cfg->blocks[b];
+
+		memcpy(state, &flow->constIn[(size_t)b * flow->numVars], flow->numVars * sizeof(DfValue));
+		if(state[DF_REGA].state == DF_UNDEF)
+		{
+			// Never reached
+			continue;
+		}
+
+		for(j = 0; j < block->length; j++)
+		{
+			ImageCell	*cell = findCell(prog, block->start + j);
+			Instruction	instr = cell->value.instructie;
+			DfValue		value = {DF_VARYING, 0};
+
+			if(instr.operator == A_LDA || instr.operator == A_LDB)
+			{
+				if(instr.adressering == DIRECT)
+				{
+					value = state[dfVariable(flow, instr.operand)];
+				}
+			}
+			else if(foldMath(instr, state, &result))
+			{
+				value.state = DF_CONST;
+				value.value = result;
+				instr.operator = A_LDA;
+			}
+
+			if(value.state == DF_CONST && !(cell->marks & MARK_READ)
+				&& value.value >= -0x800000 && value.value <= 0x7FFFFF)
+			{
+				if(instr.operator == A_LDA && cell->value.instructie.operator != A_LDA)
+				{
+					report->folded++;
+				}
+				else
+				{
+					report->simplified++;
+				}
+				cell->value.getal = 0;
+				cell->value.instructie.operator = instr.operator;
+				cell->value.instructie.adressering = ONMIDDELIJK;
+				cell->value.instructie.operand = (unsigned int)value.value & OPERAND_MAX;
+			}
+
+			dfStep(flow, cell->value.instructie, state);
+		}
+	}
+
+	free(state);
+}
+
+/** Private function: compute arithmetic on constant registers. Returns
+ *  FALSE when a register is not constant, or when the flags would differ
+ *  from those of LDA: the overflow flag is set when the result is not
+ *  exact. */
+static int foldMath(Instruction instr, DfValue *state, int *result)
+{
+	DfValue	regA = state[DF_REGA],
+		regB = state[DF_REGB];
+	double	exact = 0;
+
+	if(regA.state != DF_CONST || regB.state != DF_CONST)
+	{
+		return 0;
+	}
+
+	switch(instr.operator)
+	{
+	case A_ADD:
+		exact = (double)regA.value + regB.value;
+		break;
+	case A_SUB:
+		exact = (double)regA.value - regB.value;
+		break;
+	case A_MUL:
+		exact = (double)regA.value * regB.value;
+		break;
+	case A_DIV:
+		if(regB.value == 0)
+		{
+			return 0;
+		}
+		exact = (double)regA.value / regB.value;
+		break;
+	default:
+		return 0;
+	}
+
+	if(exact < -0x800000 || exact > 0x7FFFFF || exact != (double)(int)exact)
+	{
+		return 0;
+	}
+
+	*result = (int)exact;
+	return 1;
+}
+
+/** Private function: replace loads, direct stores and arithmetic that
+ *  nothing ever uses by a NOP. DIV is kept, it can stop the program, and
+ *  INP, it reads the input. */
+static void removeUnused(Program *prog, DataFlow *flow, OptReport *report)
+{
+	Cfg		*cfg = flow->cfg;
+	unsigned int	b = 0,
+			j = 0;
+
+	for(b = 0; b < cfg->numBlocks; b++)
+	{
+		CfgBlock *block = &cfg->blocks[b];
+
+		for(j = 0; j < block->length; j++)
+		{
+			ImageCell	*cell = findCell(prog, block->start + j);
+			Instruction	instr = cell->value.instructie;
+
+			if(!flow->unused[block->first + j] || (cell->marks & MARK_READ))
+			{
+				continue;
+			}
+
+			switch(instr.operator)
+			{
+			case A_LDA:
+			case A_LDB:
+			case A_STA:
+			case A_STB:
+			case A_ADD:
+			case A_SUB:
+			case A_MUL:
+				cell->value.getal = 0;
+				cell->value.instructie.operator = A_NOP;
+				report->dead++;
+				break;
+			default:
+				break;
+			}
+		}
+	}
+}
+
+/** Private function: remove and simplify loads, following what the
+ *  registers hold through straight line code */
+static void optimizeLoads(Program *prog, OptReport *report)
+{
+	RegState	regA = {0, 0, 0, 0},
+			regB = {0, 0, 0, 0},
+			unknown = {0, 0, 0, 0};
+	int		flagsFromA = 0,
+			fallsThrough = 0;
+	size_t		i = 0;
+
+	for(i = 0; i < prog->count; i++)
+	{
+		ImageCell	*cell = &prog->cells[i];
+		Instruction	instr = cell->value.instructie;
+
+		if(!(cell->marks & MARK_EXEC))
+		{
+			fallsThrough = 0;
+			continue;
+		}
+
+		// Nothing is known at the start of straight line code
+		if(!fallsThrough || (cell->marks & MARK_TARGET)
+			|| cell->address != prog->cells[i - 1].address + 1)
+		{
+			regA = unknown;
+			regB = unknown;
+			flagsFromA = 0;
+		}
+		fallsThrough = 1;
+
+		switch(instr.operator)
+		{
+		case A_NOP:
+		case A_OUT:
+		case A_JSP:
+		case A_JSN:
+		case A_JIZ:
+		case A_JOF:
+			break;
+		case A_LDA:
+		case A_LDB:
+			if(instr.adressering == GEINDEXEERD)
+			{
+				fallsThrough = 0;
+			}
+			else if(instr.operator == A_LDA)
+			{
+				optimizeLoad(prog, i, &regA, &flagsFromA, report);
+			}
+			else
+			{
+				optimizeLoad(prog, i, &regB, NULL, report);
+			}
+			break;
+		case A_STA:
+		case A_STB:
+			if(instr.adressering != DIRECT && instr.adressering != INDIRECT)
+			{
+				fallsThrough = 0;
+			}
+			else if(instr.operator == A_STA)
+			{
+				trackStore(prog, instr, &regA, &regB);
+			}
+			else
+			{
+				trackStore(prog, instr, &regB, &regA);
+			}
+			break;
+		case A_INP:
+			// Sets the flags like LDA
+			regA = unknown;
+			flagsFromA = 1;
+			break;
+		case A_ADD:
+		case A_SUB:
+		case A_MUL:
+		case A_DIV:
+			// The overflow flag can be set
+			regA = unknown;
+			flagsFromA = 0;
+			break;
+		default:
+			// JMP, JSB, RTS, HLT and invalid instructions
+			fallsThrough = 0;
+			break;
+		}
+	}
+}
+
+/** Private function: remove a load when the register already holds its
+ *  value, or else load a constant immediately. FlagsFromA is NULL for a
+ *  load in register B, otherwise it tells if the flags were set by loading
+ *  the current value of A, like LDA does. */
+static void optimizeLoad(Program *prog, size_t index, RegState *reg, int *flagsFromA,
+	OptReport *report)
+{
+	ImageCell	*cell = &prog->cells[index],
+			*source = NULL;
+	Instruction	instr = cell->value.instructie;
+	RegState	load = {0, 0, 0, 0};
+	int		isKnown = 0;
+
+	switch(instr.adressering)
+	{
+	case ONMIDDELIJK:
+		load.hasValue = 1;
+		load.value = (int)(instr.operand & 0x800000 ? instr.operand | 0xFF000000 : instr.operand);
+		break;
+	case DIRECT:
+		load.hasCell = 1;
+		load.cell = instr.operand;
+		break;
+	case INDIRECT:
+		// markAccess checked that the pointer is in the image and constant
+		load.hasCell = 1;
+		load.cell = (unsigned int)findCell(prog, instr.operand)->value.getal;
+		break;
+	}
+
+	if(load.hasCell)
+	{
+		source = findCell(prog, load.cell);
+		if(source != NULL && !(source->marks & MARK_WRITTEN))
+		{
+			load.hasValue = 1;
+			load.value = source->value.getal;
+		}
+	}
+
+	isKnown = (reg->hasValue && load.hasValue && reg->value == load.value)
+		|| (reg->hasCell && load.hasCell && reg->cell == load.cell);
+
+	if(!(cell->marks & MARK_READ))
+	{
+		if(isKnown && (flagsFromA == NULL || *flagsFromA || flagsUnused(prog, index)))
+		{
+			// The flags stay as they were
+			cell->value.getal = 0;
+			cell->value.instructie.operator = A_NOP;
+			report->removed++;
+			*reg = load;
+			return;
+		}
+		else if(load.hasValue && instr.adressering != ONMIDDELIJK
+			&& load.value >= -0x800000 && load.value <= 0x7FFFFF)
+		{
+			cell->value.instructie.adressering = ONMIDDELIJK;
+			cell->value.instructie.operand = (unsigned int)load.value & OPERAND_MAX;
+			report->simplified++;
+		}
+		else if(instr.adressering == INDIRECT && load.cell <= OPERAND_MAX)
+		{
+			cell->value.instructie.adressering = DIRECT;
+			cell->value.instructie.operand = load.cell;
+			report->simplified++;
+		}
+	}
+
+	// A removed load did not change the register, so this still holds
+	*reg = load;
+	if(flagsFromA != NULL)
+	{
+		*flagsFromA = 1;
+	}
+}
+
+/** Private function: after storing reg, it equals the stored cell, and other
+ *  no longer does if it was the same cell */
+static void trackStore(Program *prog, Instruction instr, RegState *reg, RegState *other)
+{
+	unsigned int address = instr.operand;
+
+	if(instr.adressering == INDIRECT)
+	{
+		address = (unsigned int)findCell(prog, instr.operand)->value.getal;
+	}
+
+	if(other->hasCell && other->cell == address)
+	{
+		other->hasCell = 0;
+	}
+
+	reg->hasCell = 1;
+	reg->cell = address;
+}
+
+/** Private function: are the flags set again before anything can look at
+ *  them, when execution continues after the instruction at index? */
+static int flagsUnused(Program *prog, size_t index)
+{
+	size_t i = 0;
+
+	for(i = index + 1; i < prog->count && i <= index + FLAGS_MAX_SCAN; i++)
+	{
+		Instruction instr = prog->cells[i].value.instructie;
+
+		if(!(prog->cells[i].marks & MARK_EXEC)
+			|| prog->cells[i].address != prog->cells[i - 1].address + 1)
+		{
+			return 0;
+		}
+
+		switch(instr.operator)
+		{
+		case A_LDA:
+			return instr.adressering != GEINDEXEERD;
+		case A_INP:
+		case A_ADD:
+		case A_SUB:
+		case A_MUL:
+			return 1;
+		case A_NOP:
+		case A_OUT:
+			break;
+		case A_LDB:
+			if(instr.adressering == GEINDEXEERD)
+			{
+				return 0;
+			}
+			break;
+		case A_STA:
+		case A_STB:
+			if(instr.adressering != DIRECT && instr.adressering != INDIRECT)
+			{
+				return 0;
+			}
+			break;
+		default:
+			// Jumps look at the flags or leave straight line code, DIV can
+			// stop the program
+			return 0;
+		}
+	}
+
+	return 0;
+}
+
+/** Private function: start every run of NOPs with a jump over the run. A
+ *  jump target in the run gets a jump too, when it skips at least one NOP. */
+static void skipNops(Program *prog, OptReport *report)
+{
+	size_t		i = 0,
+			last = 0,
+			j = 0;
+	unsigned int	end = 0;
+
+	while(i < prog->count)
+	{
+		if(!(prog->cells[i].marks & MARK_EXEC)
+			|| prog->cells[i].value.instructie.operator != A_NOP)
+		{
+			i++;
+			continue;
+		}
+
+		for(last = i; last + 1 < prog->count; last++)
+		{
+			ImageCell *next = &prog->cells[last + 1];
+
+			if(!(next->marks & MARK_EXEC) || next->value.instructie.operator != A_NOP
+				|| next->address != prog->cells[last].address + 1)
+			{
+				break;
+			}
+		}
+
+		end = prog->cells[last].address + 1;
+		for(j = i; j <= last && end <= OPERAND_MAX; j++)
+		{
+			ImageCell *cell = &prog->cells[j];
+
+			if((j == i || (cell->marks & MARK_TARGET)) && !(cell->marks & MARK_READ)
+				&& end - cell->address >= 2)
+			{
+				if(j == i)
+				{
+					report->skipped += end - cell->address - 1;
+				}
+				cell->value.getal = 0;
+				cell->value.instructie.operator = A_JMP;
+				cell->value.instructie.adressering = DIRECT;
+				cell->value.instructie.operand = end;
+			}
+		}
+
+		i = last + 1;
+	}
+}
+
+/** Private function: let jumps to a JMP or NOP jump to where that leads.
+ *  The chain is only followed JUMP_MAX_CHAIN steps, every address on it
+ *  behaves the same, even when it is an endless loop. */
+static void threadJumps(Program *prog, OptReport *report)
+{
+	size_t i = 0;
+
+	for(i = 0; i < prog->count; i++)
+	{
+		ImageCell	*cell = &prog->cells[i];
+		Instruction	instr = cell->value.instructie;
+		unsigned int	target = instr.operand;
+		int		steps = 0;
+
+		if(!(cell->marks & MARK_EXEC) || (cell->marks & MARK_READ)
+			|| (instr.operator != A_JMP && instr.operator != A_JSP
+			&& instr.operator != A_JSN && instr.operator != A_JIZ
+			&& instr.operator != A_JOF && instr.operator != A_JSB))
+		{
+			continue;
+		}
+
+		for(steps = 0; steps < JUMP_MAX_CHAIN; steps++)
+		{
+			ImageCell *next = findCell(prog, target);
+
+			if(next == NULL || !(next->marks & MARK_EXEC))
+			{
+				break;
+			}
+			else if(next->value.instructie.operator == A_JMP
+				&& next->value.instructie.operand != target)
+			{
+				target = next->value.instructie.operand;
+			}
+			else if(next->value.instructie.operator == A_NOP && target < OPERAND_MAX)
+			{
+				target++;
+			}
+			else
+			{
+				break;
+			}
+		}
+
+		if(target != instr.operand)
+		{
+			cell->value.instructie.operand = target;
+			report->threaded++;
+		}
+	}
+}
+
+/** Private function: write the rewritten cells to the image and list them
+ *  in the report
+ *
+ * @retval ERR_OutOfMemory	Malloc failed, the image was not changed
+ */
+static Error saveChanges(Program *prog, OptReport *report)
+{
+	size_t	i = 0;
+
+	for(i = 0; i < prog->count; i++)
+	{
+		if(prog->cells[i].value.getal != prog->cells[i].cell->getal)
+		{
+			report->numChanges++;
+		}
+	}
+
+	report->changes = (OptChange*) malloc(report->numChanges * sizeof(OptChange) + 1);
+	if(report->changes == NULL)
+	{
+		report->numChanges = 0;
+		return ERR_OutOfMemory;
+	}
+
+	report->numChanges = 0;
+	for(i = 0; i < prog->count; i++)
+	{
+		ImageCell *cell = &prog->cells[i];
+
+		if(cell->value.getal != cell->cell->getal)
+		{
+			report->changes[report->numChanges].address = cell->address;
+			report->changes[report->numChanges].before = *cell->cell;
+			report->changes[report->numChanges].after = cell->value;
+			report->numChanges++;
+			*cell->cell = cell->value;
+		}
+	}
+
+	return ERR_None;
+}
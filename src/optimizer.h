@@ -0,0 +1,44 @@
+#ifndef _PSEUDOASM_INC_OPTIMIZER_H_
+#define _PSEUDOASM_INC_OPTIMIZER_H_
+
+#include "errors.h"
+#include "hardware.h"
+#include "image.h"
+
+/** A cell that was rewritten by the optimizer */
+typedef struct OptChange
+{
+	unsigned int address;
+	MemCell before;
+	MemCell after;
+} OptChange;
+
+/** What the optimizer did with an image */
+typedef struct OptReport
+{
+	/** Redundant loads that became a NOP */
+	unsigned int removed;
+	/** NOPs that are jumped over */
+	unsigned int skipped;
+	/** Loads of constant cells that became immediate, or direct */
+	unsigned int simplified;
+	/** Jumps to a jump or NOP that now jump to the final target */
+	unsigned int threaded;
+	/** Arithmetic on constant registers that became an immediate load */
+	unsigned int folded;
+	/** Loads, stores and arithmetic whose result is never used that
+	 *  became a NOP */
+	unsigned int dead;
+	unsigned int numChanges;
+	OptChange *changes;
+	/** Why the image was not optimized, NULL if it was */
+	const char *skipReason;
+} OptReport;
+
+/* Rewrite the code of an assembled image into cheaper equivalent code */
+Error optimizeImage(Image *image, OptReport *report);
+
+/* Free the changes of a report */
+void freeOptReport(OptReport *report);
+
+#endif // _PSEUDOASM_INC_OPTIMIZER_H_
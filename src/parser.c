@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include "util.h"
 #include "parser.h"
 #include "errors.h"
@@ -14,7 +15,13 @@ typedef enum AddrFlags
 	FLAG_NoArgs		= 0x10
 } AddrFlags;
 
-static Error parseInstr(char *instr, AsmInstr asmInstr, AddrFlags addrFlags, MemCell *cell);
+static Error parseInstr(const char *args, int stopAtComment, AsmInstr asmInstr,
+	AddrFlags addrFlags, MemCell *cell);
+static Error lexInstr(const char *instr, int stopAtComment, MemCell *cell);
+static const char *skipSpace(const char *p, int stopAtComment);
+static int lexNumber(const char **p, int stopAtComment, long long *value);
+static int lexEnd(const char *p, int stopAtComment);
+static int lexMinus(const char *p, int stopAtComment);
 
 /** Used to create a parse table */
 typedef struct ParseInfo
@@ -53,85 +60,246 @@ ParseInfo parseTable[] =
 	//{"sst", FLAG_Onmiddelijk, A_SST}
 };
 
-/** Parses an instruction (string) to it's binary representation (MemCell).
- *  This function is internal and is designed to be used with the parse table.
+/** Perfect hash of the (lowercase) mnemonics in the parse table */
+#define MNEMONIC_HASH(a, b, c)	((((a) << 1) ^ ((b) << 3) ^ (c)) & 63)
+
+/** Index in parseTable for every value of MNEMONIC_HASH, -1 if no mnemonic
+ *  has this hash. Must be updated when the parse table changes. */
+static const signed char mnemonicIndex[64] =
+{
+	-1, -1, 11, -1, 12, -1,  4, -1, -1, -1, 18, -1, 14, -1, -1, -1,
+	-1, -1, 10, -1,  9, -1, -1, -1, -1,  0,  1, -1, -1, -1,  6, -1,
+	-1, -1, 16, -1,  3, -1, 17,  2, -1, -1, -1, -1,  5, -1, 13, -1,
+	-1, -1, -1, -1, -1, -1,  7,  8, -1, -1, -1, -1, 15, -1, -1, -1
+};
+
+/** Index in parseTable for every opcode, -1 for an unknown opcode. Must be
+ *  updated when the parse table changes. */
+static const signed char opcodeIndex[64] =
+{
+	 9, -1, -1, -1,  0,  1, -1, -1,  2,  3, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, 10, -1, -1, -1, 11, -1, -1, -1,
+	 4, -1, -1, -1,  5, -1, -1, -1,  6, -1, -1, -1,  7, -1, -1, -1,
+	14, -1, 15, -1, 16, -1, 17, -1, 18, -1, -1, -1, 13,  8, -1, 12
+};
+
+/** True for the characters that sscanf treats as whitespace */
+#define ISSPACE(c)	((c) == ' ' || ((c) >= '\t' && (c) <= '\r'))
+
+/** Parses the arguments of an instruction (the text after the mnemonic)
+ *  to its binary representation (MemCell). This function is internal and
+ *  is designed to be used with the parse table.
+ *
+ *  Accepted syntax, whitespace is allowed where a space is shown:
+ *    immediate		 #n	(n can be negative)
+ *    direct		 n
+ *    indirect		 ( n)
+ *    no arguments	nothing
+ *  The instruction must end after this, apart from whitespace.
  *
  * @retval ERR_InvalidInstr		Invalid instruction detected
  */
-static Error parseInstr(char *instr, AsmInstr asmInstr, AddrFlags addrFlags, MemCell *cell)
+static Error parseInstr(const char *args, int stopAtComment, AsmInstr asmInstr,
+	AddrFlags addrFlags, MemCell *cell)
 {
-	char end[2];
-	int arg;
+	const char	*p = args;
+	long long	arg = 0;
 
-	cell->instructie.operator = asmInstr;	
+	cell->instructie.operator = asmInstr;
 
-	// Note 0: The line should include NO COMMENTS. Remove them before calling
-	// this function.
-	// Note 1: the return value of sscanf, "%1s" and the end[2] array are used to
-	// check that the instruction ends there and does not include any garbage
-	// after the actual instruction.
-	// Note 2: "%*3s" is used because ALL the instruction have length 3 :)
-	// Note 3: strchr(instr, '-') == NULL is used to check that the number
-	// is posotive.
+	p = skipSpace(p, stopAtComment);
 
-	if((addrFlags & FLAG_Onmiddelijk) == FLAG_Onmiddelijk
-		&& sscanf(instr, "%*3s #%d %1s", &arg, end) == 1)
+	if(*p == '#')
+	{
+		p++;
+		if((addrFlags & FLAG_Onmiddelijk) == FLAG_Onmiddelijk
+			&& lexNumber(&p, stopAtComment, &arg) && lexEnd(p, stopAtComment))
+		{
+			cell->instructie.adressering = ONMIDDELIJK;
+			cell->instructie.operand = (unsigned int)arg;
+			return ERR_None;
+		}
+	}
+	else if(*p == '(')
+	{
+		// The number must be positive. Only when it is followed by ')'
+		// the rest of the instruction is checked: a missing ')' has always
+		// been accepted, as long as there is no '-' in the instruction.
+		p = skipSpace(p + 1, stopAtComment);
+		if((addrFlags & FLAG_Indirect) == FLAG_Indirect
+			&& *p != '-' && lexNumber(&p, stopAtComment, &arg)
+			&& (*p == ')' ? lexEnd(p + 1, stopAtComment) : !lexMinus(p, stopAtComment)))
+		{
+			cell->instructie.adressering = INDIRECT;
+			cell->instructie.operand = (unsigned int)arg;
+			return ERR_None;
+		}
+	}
+	else if(lexEnd(p, stopAtComment))
 	{
-		cell->instructie.adressering = ONMIDDELIJK;
-		cell->instructie.operand = arg;
+		if(addrFlags == FLAG_NoArgs)
+		{
+			cell->instructie.adressering = 0;
+			cell->instructie.operand = /*(unsigned int)*/-1;
+			return ERR_None;
+		}
 	}
 	else if((addrFlags & FLAG_Direct) == FLAG_Direct
-		&& sscanf(instr, "%*3s %d %1s", &arg, end) == 1
-		&& strchr(instr, '-') == NULL)
+		&& *p != '-' && lexNumber(&p, stopAtComment, &arg) && lexEnd(p, stopAtComment))
 	{
 		cell->instructie.adressering = DIRECT;
-		cell->instructie.operand = arg;
+		cell->instructie.operand = (unsigned int)arg;
+		return ERR_None;
 	}
-	else if((addrFlags & FLAG_Indirect) == FLAG_Indirect
-		&& sscanf(instr, "%*3s (%d) %1s", &arg, end) == 1
-		&& strchr(instr, '-') == NULL)
+
+	return ERR_InvalidInstr;
+}
+
+/** Private function: skip whitespace. In a line, the newline is the end. */
+static const char *skipSpace(const char *p, int stopAtComment)
+{
+	while(ISSPACE(*p) && !(*p == '\n' && stopAtComment))
 	{
-		cell->instructie.adressering = INDIRECT;
-		cell->instructie.operand = arg;
+		p++;
 	}
-	else if(addrFlags == FLAG_NoArgs
-		&& sscanf(instr, "%*3s %1s", end) == EOF)
+
+	return p;
+}
+
+/** Private function: read a decimal number with an optional sign, after
+ *  optional whitespace. Like sscanf's %d numbers that do not fit are
+ *  saturated to 64 bit.
+ *
+ * @return FALSE if there is no number
+ */
+static int lexNumber(const char **p, int stopAtComment, long long *value)
+{
+	const char		*s = skipSpace(*p, stopAtComment);
+	unsigned long long	magnitude = 0;
+	int			negative = 0,
+				overflow = 0;
+
+	if(*s == '-' || *s == '+')
+	{
+		negative = *s == '-';
+		s++;
+	}
+
+	if(*s < '0' || *s > '9')
+	{
+		return 0;
+	}
+
+	for(; *s >= '0' && *s <= '9'; s++)
 	{
-		cell->instructie.adressering = 0;
-		cell->instructie.operand = /*(unsigned int)*/-1;
+		if(magnitude > (0x8000000000000000ULL - (*s - '0')) / 10)
+		{
+			overflow = 1;
+		}
+		else
+		{
+			magnitude = magnitude * 10 + (*s - '0');
+		}
+	}
+
+	if(negative)
+	{
+		*value = overflow || magnitude == 0x8000000000000000ULL
+			? (-0x7FFFFFFFFFFFFFFFLL - 1) : -(long long)magnitude;
 	}
 	else
 	{
-		return ERR_InvalidInstr;
+		*value = overflow || magnitude > 0x7FFFFFFFFFFFFFFFULL
+			? 0x7FFFFFFFFFFFFFFFLL : (long long)magnitude;
+	}
+
+	*p = s;
+	return 1;
+}
+
+/** Private function: is there only whitespace (and optionally a comment)
+ *  left? */
+static int lexEnd(const char *p, int stopAtComment)
+{
+	p = skipSpace(p, stopAtComment);
+
+	return *p == '\0' || (stopAtComment && (*p == ';' || *p == '\n'));
+}
+
+/** Private function: is there a '-' in the rest of the instruction? */
+static int lexMinus(const char *p, int stopAtComment)
+{
+	for(; *p != '\0'; p++)
+	{
+		if(*p == '-')
+		{
+			return 1;
+		}
+		if(stopAtComment && (*p == ';' || *p == '\n'))
+		{
+			return 0;
+		}
 	}
 
-	return ERR_None;
+	return 0;
 }
 
-/** Parse an assembly instruction.
+/** Private function: parse an instruction in a single pass over the string,
+ *  without modifying or copying it.
  *
  * @retval ERR_InvalidInstr	Invalid instruction (incorrect arguments?)
  * @retval ERR_UnknownInstr	Unknown instruction
  */
-Error parseAsmInstr(char *instr, MemCell *cell)
+static Error lexInstr(const char *instr, int stopAtComment, MemCell *cell)
 {
-	int i;
+	int		c0, c1, c2,
+			i;
+	ParseInfo	*info = NULL;
 
-	strtolower(instr);
+	if(instr[0] == '\0' || instr[1] == '\0' || instr[2] == '\0')
+	{
+		return ERR_UnknownInstr;
+	}
 
-	// See if instruction is in the table. If it is, call his parse function
-	// and return the result. Return ERR_UnknownInstr if instruction is not
-	// found in the table.
+	c0 = tolower((unsigned char)instr[0]);
+	c1 = tolower((unsigned char)instr[1]);
+	c2 = tolower((unsigned char)instr[2]);
 
-	for(i = 0; i < sizeof(parseTable) / sizeof(ParseInfo); i++)
+	i = mnemonicIndex[MNEMONIC_HASH(c0, c1, c2)];
+	if(i < 0)
 	{
-		if(!strncmp(instr, parseTable[i].instruction, 3))
-		{
-			return parseInstr(instr, parseTable[i].asmInstr, parseTable[i].addrFlags, cell);
-		}
+		return ERR_UnknownInstr;
 	}
 
-	return ERR_UnknownInstr;
+	info = &parseTable[i];
+	if(info->instruction[0] != c0 || info->instruction[1] != c1
+		|| info->instruction[2] != c2)
+	{
+		return ERR_UnknownInstr;
+	}
+
+	return parseInstr(instr + 3, stopAtComment, info->asmInstr, info->addrFlags, cell);
+}
+
+/** Parse an assembly instruction. The mnemonic is not case sensitive.
+ *
+ * @retval ERR_InvalidInstr	Invalid instruction (incorrect arguments?)
+ * @retval ERR_UnknownInstr	Unknown instruction
+ */
+Error parseAsmInstr(char *instr, MemCell *cell)
+{
+	return lexInstr(instr, 0, cell);
+}
+
+/** Parse a line of a source file: the same as parseAsmInstr, but the line
+ *  ends at a newline or at the start of a comment (';').
+ *
+ * @retval ERR_InvalidInstr	Invalid instruction (incorrect arguments?)
+ * @retval ERR_UnknownInstr	Unknown instruction
+ */
+Error parseAsmLine(const char *line, MemCell *cell)
+{
+	return lexInstr(line, 1, cell);
 }
 
 /** Converts an opcode to its mnemonic
@@ -141,47 +309,103 @@ Error parseAsmInstr(char *instr, MemCell *cell)
  */
 Error instToStr(Instruction instr, char *string)
 {
-	int i = 0;
+	if(opcodeIndex[instr.operator] < 0)
+	{
+		return ERR_UnknownInstr;
+	}
 
-	for(i = 0; i < sizeof(parseTable) / sizeof(ParseInfo); i++)
+	return appendInstr(string, instr) != NULL ? ERR_None : ERR_InvalidInstr;
+}
+
+/** Write the mnemonic of an instruction, like instToStr, at the end of a
+ *  listing. The string is terminated, and needs room for MAXINSTRLEN
+ *  characters.
+ *
+ * @return The end of the string, NULL when the instruction is unknown or
+ *         its addressing method is not allowed
+ */
+char *appendInstr(char *string, Instruction instr)
+{
+	const ParseInfo	*info = NULL;
+	int		i = opcodeIndex[instr.operator];
+
+	if(i < 0)
+	{
+		return NULL;
+	}
+
+	info = &parseTable[i];
+	string[0] = info->instruction[0];
+	string[1] = info->instruction[1];
+	string[2] = info->instruction[2];
+	string += 3;
+
+	// Addressing method and operand are ignored without arguments
+	if(info->addrFlags == FLAG_NoArgs)
 	{
-		if(instr.operator == (unsigned int)parseTable[i].asmInstr)
+		*string = '\0';
+		return string;
+	}
+
+	switch(instr.adressering)
+	{
+	case ONMIDDELIJK:
+		if(!(info->addrFlags & FLAG_Onmiddelijk))
+		{
+			return NULL;
+		}
+		string[0] = ' ';
+		string[1] = '#';
+		return formatUnsigned(string + 2, instr.operand);
+	case DIRECT:
+		if(!(info->addrFlags & FLAG_Direct))
 		{
-			ParseInfo info = parseTable[i];
-
-			// Check the arguments of the instruction (so the addressing method)
-			// and return the string representation of the instruction.
-
-			if(info.addrFlags == FLAG_NoArgs)
-			{
-				// Addressing method and operand are ignored.
-				strcpy(string, parseTable[i].instruction);
-				return ERR_None;
-			}
-			else if(instr.adressering == ONMIDDELIJK
-				&& (info.addrFlags & FLAG_Onmiddelijk) == FLAG_Onmiddelijk)
-			{
-				sprintf(string, "%s #%d", info.instruction, instr.operand);
-				return ERR_None;
-			}
-			else if(instr.adressering == DIRECT
-				&& (info.addrFlags & FLAG_Direct) == FLAG_Direct)
-			{
-				sprintf(string, "%s %d", info.instruction, instr.operand);
-				return ERR_None;
-			}
-			else if(instr.adressering == INDIRECT
-				&& (info.addrFlags & FLAG_Indirect) == FLAG_Indirect)
-			{
-				sprintf(string, "%s (%d)", info.instruction, instr.operand);
-				return ERR_None;
-			}
-			
-			// If we got here, the arguments or addressing method of the instruction
-			// is invalid!
-			return ERR_InvalidInstr;
+			return NULL;
 		}
+		string[0] = ' ';
+		return formatUnsigned(string + 1, instr.operand);
+	case INDIRECT:
+		if(!(info->addrFlags & FLAG_Indirect))
+		{
+			return NULL;
+		}
+		string[0] = ' ';
+		string[1] = '(';
+		string = formatUnsigned(string + 2, instr.operand);
+		string[0] = ')';
+		string[1] = '\0';
+		return string + 1;
+	default:
+		return NULL;
 	}
+}
 
-	return ERR_UnknownInstr;
+/** Is the cell exactly what assembling its mnemonic gives? Instructions
+ *  without arguments are assembled with operand -1 and addressing 0, data
+ *  that decodes to such an instruction is not. */
+int isCanonicalInstr(MemCell cell)
+{
+	int i = opcodeIndex[cell.instructie.operator];
+
+	if(i < 0)
+	{
+		return 0;
+	}
+
+	if(parseTable[i].addrFlags == FLAG_NoArgs)
+	{
+		return cell.instructie.adressering == 0 && cell.instructie.operand == 0xFFFFFF;
+	}
+
+	switch(cell.instructie.adressering)
+	{
+	case ONMIDDELIJK:
+		return (parseTable[i].addrFlags & FLAG_Onmiddelijk) != 0;
+	case DIRECT:
+		return (parseTable[i].addrFlags & FLAG_Direct) != 0;
+	case INDIRECT:
+		return (parseTable[i].addrFlags & FLAG_Indirect) != 0;
+	default:
+		return 0;
+	}
 }
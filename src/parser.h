@@ -7,7 +7,19 @@
 /* Convert an instruction to its binary representation */
 Error parseAsmInstr(char *instr, MemCell *cell);
 
+/* Same as parseAsmInstr, but stops at a newline or comment */
+Error parseAsmLine(const char *line, MemCell *cell);
+
+/** Longest string instToStr writes, without the terminating 0 */
+#define MAXINSTRLEN	14
+
 /* Convert the binary representation of an instruction to its 'string' form */
 Error instToStr(Instruction instr, char *string);
 
+/* Same as instToStr, returns the end of the string or NULL */
+char *appendInstr(char *string, Instruction instr);
+
+/* Does assembling the mnemonic of the cell give the same cell? */
+int isCanonicalInstr(MemCell cell);
+
 #endif // _PSEUDOASM_INC_COMPILE_H_
@@ -1,10 +1,18 @@
 /* Note: If not initialized, it will try to execute uninitialized memory */
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include <assert.h>
+#include "util.h"
 #include "numberlist.h"
 #include "hardware.h"
 #include "memory.h"
 #include "errors.h"
+#include "memo.h"
+#include "fastforward.h"
+#include "profile.h"
+#include "coverage.h"
+#include "alu.h"
 #include "processor.h"
 
 #define TRUE 1
@@ -16,7 +24,7 @@ static int regB;
 static unsigned int progCounter;
 
 // Stack pointer
-static unsigned int stackPointer = 900000;
+static unsigned int stackPointer = STACK_START;
 static int shouldTraceStack = 0;
 
 // Flags
@@ -36,7 +44,118 @@ static FuncNumOut numberout = NULL;
 // List of breakpoints
 NumberList *breakpoints = NULL;
 
+/** Breakpoints are also kept in a small open addressing hash set, so the run
+ *  loop can check the program counter in O(1). The sorted list above is only
+ *  used to display them. Slots hold address + 1, zero means empty. The last
+ *  address has no slot value of its own, so it is kept in a flag. */
+static unsigned int *bpTable = NULL;
+static unsigned int bpTableMask = 0;
+static unsigned int numBreakpoints = 0;
+static int bpAtLastAddress = FALSE;
+
+/** Resource limits of a run. The instruction counter is compared with
+ *  limitCheckpoint at the end of every basic block, only then the limits
+ *  and the clock are checked. */
+#define TIMECHECK_INTERVAL 65536
+static RunLimits limits = {0, 0, 0};
+static RunUsage usage = {0, 0, 0};
+static unsigned long limitCheckpoint = ULONG_MAX;
+static double runStartTime = 0;
+
+/** Counters of the work the processor did, see getProcStats. Executed
+ *  instructions are counted by opcode and addressing method, the totals
+ *  are only added up when they are asked for. */
+static unsigned long instrCount[64][4];
+static unsigned long skippedCount = 0;
+static unsigned long bpCheckCount = 0;
+static unsigned long lastRunInstr = 0;
+static double lastRunSeconds = 0;
+
+/** Infinite loop detection. The hash of the complete machine state is
+ *  sampled at every backward jump, call and return. A state that repeats
+ *  without I/O in between means the program will never stop. Samples are
+ *  saved in a small direct mapped table (finds short cycles fast) and as
+ *  one Brent style anchor, which finds every cycle within twice its length
+ *  even if table entries of the cycle overwrite each other. */
+#define LOOPTABLE_SIZE 256
+static int shouldDetectLoops = 0;
+static unsigned long long loopTable[LOOPTABLE_SIZE];
+static unsigned int loopTableEpoch[LOOPTABLE_SIZE];
+static unsigned int loopEpoch = 0;
+static unsigned long long loopAnchor = 0;
+static unsigned long loopAnchorPower = 0;
+static unsigned long loopAnchorLength = 0;
+
+/** Memoization of subroutine calls, see memo.c. Memory accesses are only
+ *  recorded while memoActive is set, that is during runProgram. */
+static int shouldMemoize = 0;
+static int memoActive = 0;
+
+/** Counted loop fast-forwarding, see fastforward.c. The analysis of every
+ *  loop is cached by the address of its backward jump. The cache is flushed
+ *  (by increasing ffEpoch) when a cell between ffLow and ffHigh, the range
+ *  of all cached loops, is written. */
+#define FFCACHE_SIZE 64
+typedef struct FFCacheEntry
+{
+	unsigned int jumpAddr;
+	unsigned int epoch;
+	int ok;
+	FFLoop loop;
+} FFCacheEntry;
+
+static int shouldFastForward = 1;
+static FFCacheEntry ffCache[FFCACHE_SIZE];
+static unsigned int ffEpoch = 1;
+static unsigned int ffLow = UINT_MAX;
+static unsigned int ffHigh = 0;
+
+/** Profile of the executed instructions, see profile.c. Every instruction
+ *  is counted, so loops are not fast-forwarded and calls not replayed. */
+static int shouldProfile = 0;
+
+/** Coverage bitmap of the executed addresses, see coverage.c. NULL when
+ *  coverage is not recorded. */
+static uint32_t *coverBits = NULL;
+
+/** Instrumentation hooks, see addHook. Memory accesses only test memWatched,
+ *  that is set while calls are memoized or memory hooks are added. An error
+ *  of a memory hook is kept in hookError until the instruction is done. */
+#define MAX_HOOKS 8
+typedef struct Hook
+{
+	HookFunc func;
+	void *context;
+} Hook;
+
+static Hook hooks[HOOK_COUNT][MAX_HOOKS];
+static unsigned int hookCount[HOOK_COUNT];
+static unsigned int numHooks = 0;
+static int memWatched = 0;
+static Error hookError = ERR_None;
+
 typedef Error (*funcHandleInstr)(Instruction inst);
+typedef Error (*funcRunLoop)(void);
+
+static Error runFast(void);
+static Error runDebug(void);
+static void selectRunLoop(void);
+static void setLimitCheckpoint(void);
+static Error checkLimits(void);
+static void resetLoopDetection(void);
+static Error sampleState(void);
+static void getMemoState(MemoState *state);
+static void setMemoState(MemoState *state);
+static Error fastForward(unsigned int jumpAddr);
+static void flushFastForward(void);
+static void profileControl(Instruction instr);
+static void markCovered(unsigned int address);
+static void updateWatch(void);
+static void callHooks(HookEvent event, unsigned int pc, unsigned int address, int value);
+static Error hookControl(Instruction instr, unsigned int pc, Error rval);
+
+/** Run loop that is currently used, see selectRunLoop */
+static funcRunLoop runLoop = runFast;
 
 typedef struct InstrInfo
 {
@@ -44,6 +163,65 @@ typedef struct InstrInfo
 	funcHandleInstr handler;
 } InstrInfo;
 
+/** Private function: read a memory cell for the running program */
+static MemCell loadCell(unsigned int address)
+{
+	MemCell cell = readMemCell(&memory, address);
+
+	if(memWatched)
+	{
+		if(memoActive)
+		{
+			memoRead(address, cell.getal);
+		}
+		if(hookCount[HOOK_Read] > 0)
+		{
+			callHooks(HOOK_Read, progCounter, address, cell.getal);
+		}
+	}
+
+	return cell;
+}
+
+/** Private function: fetch an instruction, the memo depends on it like on
+ *  any read but it is not a read for the hooks */
+static MemCell fetchCell(unsigned int address)
+{
+	MemCell cell = readMemCell(&memory, address);
+
+	if(memoActive)
+	{
+		memoRead(address, cell.getal);
+	}
+
+	return cell;
+}
+
+/** Private function: write a memory cell for the running program */
+static Error storeCell(unsigned int address, MemCell cell, int isStack)
+{
+	Error rval = writeMemCell(&memory, address, cell);
+
+	if(memWatched && rval == ERR_None)
+	{
+		if(memoActive)
+		{
+			memoWrite(address, cell.getal, isStack);
+		}
+		if(hookCount[HOOK_Write] > 0)
+		{
+			callHooks(HOOK_Write, progCounter, address, cell.getal);
+		}
+	}
+
+	if(address >= ffLow && address <= ffHigh)
+	{
+		flushFastForward();
+	}
+
+	return rval;
+}
+
 /*
  * Begin of private functions: Used to handle certain assembly instructions
  */
@@ -67,22 +245,14 @@ static Error instrLoad(Instruction instr)
 	switch(instr.adressering)
 	{
 	case ONMIDDELIJK:
-		// Copy unsigned 24 bit value to signed 32 bit variable.
-		// => No conversion will be done.
-		value = instr.operand;
-
-		// If H.O. bit of the 24 bit number was set, sign extend value
-		if(instr.operand & 0x800000)
-		{
-			value |= 0xFF000000;
-		}
+		value = immediateValue(instr);
 		break;
 	case DIRECT:
-		value = readMemCell(&memory, instr.operand).getal;
+		value = loadCell(instr.operand).getal;
 		break;
 	case INDIRECT:
-		pointer = readMemCell(&memory, instr.operand).getal;
-		value = readMemCell(&memory, pointer).getal;
+		pointer = loadCell(instr.operand).getal;
+		value = loadCell(pointer).getal;
 		break;
 	default:
 		return ERR_InvalidInstr;
@@ -96,9 +266,7 @@ static Error instrLoad(Instruction instr)
 	{
 	case A_LDA:
 		regA = value;
-		flagN = regA < 0;
-		flagZ = regA == 0;
-		flagO = 0;
+		setLoadFlags(regA, &flagN, &flagZ, &flagO);
 		break;
 	case A_LDB:
 		regB = value;
@@ -128,7 +296,7 @@ static Error instrStore(Instruction instr)
 		addr = instr.operand;
 		break;
 	case INDIRECT:
-		addr = readMemCell(&memory, instr.operand).getal;
+		addr = loadCell(instr.operand).getal;
 		break;
 	default:
 		return ERR_InvalidInstr;
@@ -150,7 +318,7 @@ static Error instrStore(Instruction instr)
 	}
 
 	// Store the value!
-	rval = writeMemCell(&memory, addr, memCell);
+	rval = storeCell(addr, memCell, FALSE);
 	if(rval != ERR_None)
 	{
 		return rval;
@@ -165,41 +333,13 @@ static Error instrStore(Instruction instr)
  */
 static Error instrMath(Instruction instr)
 {
-	double	dvalA = regA,
-			dvalB = regB;
+	Error rval = computeMath(instr, &regA, regB, &flagN, &flagZ, &flagO);
 
-	switch(instr.operator)
+	if(rval != ERR_None)
 	{
-	case A_ADD:
-		regA += regB;
-		dvalA += dvalB;
-		break;
-	case A_SUB:
-		regA -= regB;
-		dvalA -= dvalB;
-		break;
-	case A_MUL:
-		regA *= regB;
-		dvalA *= dvalB;
-		break;
-	case A_DIV:
-		if(regB == 0)
-		{
-			return ERR_DivideZero;
-		}
-		regA /= regB;
-		dvalA /= dvalB;
-		break;
-	default:
-		assert(0); // Mistake in parse table
-		return ERR_InvalidInstr;
-		break;
+		return rval;
 	}
 
-	flagN = regA < 0;
-	flagZ = regA == 0;
-	flagO = dvalA != (double)regA;
-
 	progCounter++;
 	return ERR_None;
 }
@@ -210,10 +350,7 @@ static Error instrInput(Instruction instr)
 	assert(numberinp != NULL);
 
 	regA = numberinp();
-
-	flagN = regA < 0;
-	flagZ = regA == 0;
-	flagO = 0;
+	setLoadFlags(regA, &flagN, &flagZ, &flagO);
 
 	progCounter++;
 	return ERR_None;
@@ -232,32 +369,7 @@ static Error instrOutput(Instruction instr)
 
 static Error instrJump(Instruction instr)
 {
-	int shouldJump = 0;
-	
-	switch(instr.operator)
-	{
-	case A_JMP:
-		shouldJump = 1;
-		break;
-	case A_JSP:
-		shouldJump = !flagZ && !flagN;
-		break;
-	case A_JSN:
-		shouldJump = flagN;
-		break;
-	case A_JIZ:
-		shouldJump = flagZ;
-		break;
-	case A_JOF:
-		shouldJump = flagO;
-		break;
-	default:
-		assert(0); // Mistake in parse table
-		return ERR_InvalidInstr;
-		break;
-	}
-
-	if(shouldJump)
+	if(isJumpTaken(instr, flagN, flagZ, flagO))
 	{
 		progCounter = instr.operand;
 	}
@@ -269,19 +381,29 @@ static Error instrJump(Instruction instr)
 	return ERR_None;
 }
 
+/**
+ * @retval ERR_MemoryLimit	The stack needs a new cell above the quota
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
 static Error instrCall(Instruction instr)
 {
 	MemCell memCell;
+	Error	rval = ERR_None;
 
 	assert(instr.operator == A_JSB);
 
-	// Push program counter on the stack
+	// Push program counter on the stack, PC and SP stay when it fails
 	if(!shouldTraceStack)
 	{
 		ignoreNextWriteInTrace();
 	}
 	memCell.getal = progCounter + 1;
-	writeMemCell(&memory, --stackPointer, memCell);
+	rval = storeCell(stackPointer - 1, memCell, TRUE);
+	if(rval != ERR_None)
+	{
+		return rval;
+	}
+	stackPointer--;
 
 	// Jump to subroutine
 	progCounter = instr.operand;
@@ -296,7 +418,7 @@ static Error instrReturn(Instruction instr)
 	assert(instr.operator == A_RTS);
 
 	// Pop old program counter
-	memCell = readMemCell(&memory, stackPointer++);
+	memCell = loadCell(stackPointer++);
 
 	// Set program counter back
 	progCounter = memCell.getal;
@@ -325,7 +447,10 @@ static Error instrHalt(Instruction instr)
 
 /**
  * Instruction table: Connection between the assembly instruction and the
- * private function that handles this instruction
+ * private function that handles this instruction. The prologue (step in
+ * prologue.c) executes the same instructions on an image; the register
+ * semantics are shared in alu.h, but a change to the memory accesses, the
+ * stack or the program counter must be made there too.
  */
 static InstrInfo instrTable[] = 
 {
@@ -351,6 +476,109 @@ static InstrInfo instrTable[] =
 	//{A_SST, instrSetStack}
 };
 
+/** Handlers indexed by opcode, filled from instrTable by InitProcessor.
+ *  Unknown opcodes have a NULL handler. */
+static funcHandleInstr handlerTable[64];
+
+/** Private function: build the opcode indexed handler table */
+static void buildHandlerTable(void)
+{
+	int i = 0;
+
+	for(i = 0; i < 64; i++)
+	{
+		handlerTable[i] = NULL;
+	}
+
+	for(i = 0; i < sizeof(instrTable) / sizeof(InstrInfo); i++)
+	{
+		handlerTable[instrTable[i].instr] = instrTable[i].handler;
+	}
+}
+
+/** Private function: hash an address into the breakpoint table */
+static unsigned int bpHash(unsigned int address)
+{
+	return (address * 2654435761u) & bpTableMask;
+}
+
+/** Private function: is there a breakpoint at the given address? */
+static int isBreakpoint(unsigned int address)
+{
+	unsigned int i;
+
+	bpCheckCount++;
+
+	if(numBreakpoints == 0)
+	{
+		return FALSE;
+	}
+
+	if(address == UINT_MAX)
+	{
+		return bpAtLastAddress;
+	}
+
+	for(i = bpHash(address); bpTable[i] != 0; i = (i + 1) & bpTableMask)
+	{
+		if(bpTable[i] == address + 1)
+		{
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/** Private function: rebuild the breakpoint hash set from the breakpoint list.
+ *  The set is kept at most half full.
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error rebuildBpTable(void)
+{
+	NumberList	*l = NULL;
+	unsigned int	size = 16,
+			count = 0,
+			i = 0;
+
+	for(l = breakpoints; l != NULL; l = l->next)
+	{
+		count++;
+	}
+
+	while(size < 2 * count)
+	{
+		size *= 2;
+	}
+
+	free(bpTable);
+	bpAtLastAddress = FALSE;
+	bpTable = (unsigned int*) calloc(size, sizeof(unsigned int));
+	if(bpTable == NULL)
+	{
+		bpTableMask = 0;
+		numBreakpoints = 0;
+		return ERR_OutOfMemory;
+	}
+	bpTableMask = size - 1;
+
+	for(l = breakpoints; l != NULL; l = l->next)
+	{
+		if(l->number == UINT_MAX)
+		{
+			bpAtLastAddress = TRUE;
+			continue;
+		}
+		for(i = bpHash(l->number); bpTable[i] != 0; i = (i + 1) & bpTableMask)
+			;
+		bpTable[i] = l->number + 1;
+	}
+	numBreakpoints = count;
+
+	return ERR_None;
+}
+
 /** Public function: Initialize processor.
  *
  * @param meminit	Load programming and set memory
@@ -365,13 +593,17 @@ Error InitProcessor(Memory *meminit, FuncNumInp inp, FuncNumOut out)
 	numberout = out;
 
 	breakpoints = NULL;
+	numBreakpoints = 0;
+	buildHandlerTable();
+	selectRunLoop();
+	flushFastForward();
 
 	// Reset processor registers and falgs
 	regA = 0;
 	regB = 0;
 	progCounter = 0;
 
-	stackPointer = 900000;
+	stackPointer = STACK_START;
 	shouldTraceStack = 0;
 
 	flagZ = 0;
@@ -381,6 +613,13 @@ Error InitProcessor(Memory *meminit, FuncNumInp inp, FuncNumOut out)
 	// Reset last written address (written by compiler)
 	getLastWrittenAddr(); // this will reset it :)
 
+	resetProcStats();
+	if(shouldProfile && profileReset(progCounter) != ERR_None)
+	{
+		shouldProfile = 0;
+		selectRunLoop();
+	}
+
 	return ERR_None;
 }
 
@@ -390,6 +629,11 @@ void DeInitProcessor(void)
 	freeMemList(memory);
 	memory = NULL;
 	freeNumberList(&breakpoints);
+	memoFree();
+	profileFree();
+	free(bpTable);
+	bpTable = NULL;
+	numBreakpoints = 0;
 
 	numberout = NULL;
 	numberinp = NULL;
@@ -408,24 +652,22 @@ void DeInitProcessor(void)
  */
 Error executeInstr(Instruction instr, int saveProgCount)
 {
-	int	i = 0,
-		oldProgCounter = progCounter;
+	int	oldProgCounter = progCounter;
 	Error	rval = ERR_None;
+	funcHandleInstr handler = handlerTable[instr.operator];
 
-	for(i = 0; i < sizeof(instrTable) / sizeof(InstrInfo); i++)
+	if(handler == NULL)
 	{
-		if((unsigned int)instrTable[i].instr == instr.operator)
-		{
-			rval = instrTable[i].handler(instr);
-			if(saveProgCount)
-			{
-				progCounter = oldProgCounter;
-			}
-			return rval;
-		}
+		return ERR_UnknownInstr;
 	}
 
-	return ERR_UnknownInstr;
+	instrCount[instr.operator][instr.adressering]++;
+	rval = handler(instr);
+	if(saveProgCount)
+	{
+		progCounter = oldProgCounter;
+	}
+	return rval;
 }
 
 /** Let the processor execute the next insruction
@@ -436,11 +678,33 @@ Error executeInstr(Instruction instr, int saveProgCount)
  */
 Error executeNextInstr(void)
 {
-	Error rval = ERR_None;
-	MemCell instr = readMemCell(&memory, progCounter);
+	Error		rval = ERR_None;
+	MemCell		instr = readMemCell(&memory, progCounter);
+	unsigned int	oldProgCounter = progCounter;
 
+	if(shouldProfile)
+	{
+		profileInstr(progCounter);
+	}
+	if(coverBits != NULL)
+	{
+		markCovered(progCounter);
+	}
+	if(numHooks > 0)
+	{
+		hookError = ERR_None;
+		callHooks(HOOK_Instr, oldProgCounter, oldProgCounter, instr.getal);
+	}
 	rval = executeInstr(instr.instructie, FALSE);
-	if(rval == ERR_None && hasNumber(breakpoints, progCounter))
+	if(rval == ERR_None && shouldProfile)
+	{
+		profileControl(instr.instructie);
+	}
+	if(numHooks > 0)
+	{
+		rval = hookControl(instr.instructie, oldProgCounter, rval);
+	}
+	if(rval == ERR_None && isBreakpoint(progCounter))
 	{
 		return ERR_Breakpoint;
 	}
@@ -450,6 +714,700 @@ Error executeNextInstr(void)
 	}
 }
 
+/** Run the program until an error, HLT, a breakpoint or a resource limit
+ *  is hit.
+ *
+ * See executeNextInstr for return values. Uses the fast run loop when no
+ * breakpoints are set.
+ * @retval ERR_InstrLimit	Instruction budget used up
+ * @retval ERR_TimeLimit	Wall clock limit reached
+ * @retval ERR_MemoryLimit	Memory cell quota reached
+ */
+Error runProgram(void)
+{
+	Error rval = ERR_None;
+
+	usage.instructions = 0;
+	runStartTime = getWallTime();
+	setLimitCheckpoint();
+	setMemCellQuota(limits.maxCells);
+	if(shouldDetectLoops)
+	{
+		enableMemHash(memory);
+		resetLoopDetection();
+	}
+	memoClearCalls();
+	memoActive = shouldMemoize && !shouldProfile && coverBits == NULL
+		&& numHooks == 0;
+	updateWatch();
+	hookError = ERR_None;
+
+	rval = runLoop();
+
+	memoActive = 0;
+	updateWatch();
+	disableMemHash();
+	setMemCellQuota(0);
+	lastRunInstr = usage.instructions;
+	lastRunSeconds = getWallTime() - runStartTime;
+	usage.millis = (unsigned long)(lastRunSeconds * 1000);
+	usage.cells = getMemCellCount();
+
+	return rval;
+}
+
+/** Private function: instruction count at which checkLimits must be called */
+static void setLimitCheckpoint(void)
+{
+	limitCheckpoint = ULONG_MAX;
+
+	if(limits.maxInstr != 0)
+	{
+		limitCheckpoint = limits.maxInstr;
+	}
+
+	if(limits.maxMillis != 0
+		&& usage.instructions + TIMECHECK_INTERVAL < limitCheckpoint)
+	{
+		limitCheckpoint = usage.instructions + TIMECHECK_INTERVAL;
+	}
+}
+
+/** Private function: check the instruction budget and wall clock limit */
+static Error checkLimits(void)
+{
+	if(limits.maxInstr != 0 && usage.instructions >= limits.maxInstr)
+	{
+		return ERR_InstrLimit;
+	}
+
+	if(limits.maxMillis != 0
+		&& (getWallTime() - runStartTime) * 1000 >= limits.maxMillis)
+	{
+		return ERR_TimeLimit;
+	}
+
+	setLimitCheckpoint();
+	return ERR_None;
+}
+
+/** Private function: run loop without any instrumentation */
+static Error runFast(void)
+{
+	Error		rval = ERR_None;
+	funcHandleInstr	handler = NULL;
+	MemCell		instr;
+	unsigned int	oldProgCounter;
+
+	do
+	{
+		oldProgCounter = progCounter;
+		instr = readMemCell(&memory, progCounter);
+		handler = handlerTable[instr.instructie.operator];
+		if(handler == NULL)
+		{
+			return ERR_UnknownInstr;
+		}
+		instrCount[instr.instructie.operator][instr.instructie.adressering]++;
+		if(coverBits != NULL)
+		{
+			markCovered(oldProgCounter);
+		}
+		rval = handler(instr.instructie);
+		usage.instructions++;
+
+		// All jumps have an opcode of at least A_JMP: end of a basic block
+		if(instr.instructie.operator >= A_JMP && rval == ERR_None)
+		{
+			if(usage.instructions >= limitCheckpoint)
+			{
+				rval = checkLimits();
+			}
+
+			if(shouldFastForward && instr.instructie.operator <= A_JIZ
+				&& progCounter <= oldProgCounter && rval == ERR_None)
+			{
+				rval = fastForward(oldProgCounter);
+			}
+		}
+	} while(rval == ERR_None);
+
+	return rval;
+}
+
+/** Private function: run loop that checks for breakpoints and loops, that
+ *  memoizes subroutine calls, that profiles the instructions and that calls
+ *  the hooks */
+static Error runDebug(void)
+{
+	Error		rval = ERR_None;
+	Instruction	instr;
+	unsigned int	oldProgCounter;
+	MemoState	state;
+
+	do
+	{
+		oldProgCounter = progCounter;
+		instr = fetchCell(progCounter).instructie;
+
+		if(memoActive && instr.operator == A_JSB)
+		{
+			unsigned long	saved = 0,
+					maxSaved = ULONG_MAX;
+			int		hit = 0;
+
+			// Like fastForward, a replayed call must stay below the
+			// instruction budget, else the call is executed
+			if(limits.maxInstr != 0)
+			{
+				maxSaved = usage.instructions < limits.maxInstr
+					? limits.maxInstr - usage.instructions - 1 : 0;
+			}
+
+			// Replaying skips breakpoints in the subroutine
+			getMemoState(&state);
+			if(numBreakpoints == 0)
+			{
+				rval = memoReplay(&memory, instr.operand, &state,
+					shouldTraceStack, maxSaved, &saved, &hit);
+				if(rval != ERR_None)
+				{
+					break;
+				}
+			}
+
+			if(hit)
+			{
+				// The replayed writes may have changed loops
+				flushFastForward();
+				setMemoState(&state);
+				usage.instructions += saved;
+				skippedCount += saved;
+				if(usage.instructions >= limitCheckpoint)
+				{
+					rval = checkLimits();
+				}
+				continue;
+			}
+			memoBegin(instr.operand, &state, usage.instructions);
+		}
+
+		if(shouldProfile)
+		{
+			profileInstr(oldProgCounter);
+		}
+		if(coverBits != NULL)
+		{
+			markCovered(oldProgCounter);
+		}
+		if(hookCount[HOOK_Instr] > 0)
+		{
+			MemCell cell;
+
+			cell.instructie = instr;
+			callHooks(HOOK_Instr, oldProgCounter, oldProgCounter, cell.getal);
+		}
+		rval = executeInstr(instr, FALSE);
+		if(rval == ERR_None && shouldProfile)
+		{
+			profileControl(instr);
+		}
+		if(numHooks > 0)
+		{
+			rval = hookControl(instr, oldProgCounter, rval);
+		}
+		if(rval == ERR_None && isBreakpoint(progCounter))
+		{
+			rval = ERR_Breakpoint;
+		}
+		usage.instructions++;
+
+		if(memoActive && rval == ERR_None)
+		{
+			if(instr.operator == A_RTS)
+			{
+				getMemoState(&state);
+				memoReturn(&state, usage.instructions);
+			}
+			else if(instr.operator == A_INP || instr.operator == A_OUT)
+			{
+				memoImpure();
+			}
+		}
+
+		if(instr.operator >= A_JMP && rval == ERR_None)
+		{
+			if(usage.instructions >= limitCheckpoint)
+			{
+				rval = checkLimits();
+			}
+
+			if(shouldDetectLoops && progCounter <= oldProgCounter && rval == ERR_None)
+			{
+				rval = sampleState();
+			}
+
+			if(shouldFastForward && !shouldProfile && numHooks == 0
+				&& instr.operator <= A_JIZ
+				&& progCounter <= oldProgCounter && rval == ERR_None)
+			{
+				rval = fastForward(oldProgCounter);
+			}
+		}
+		else if(shouldDetectLoops
+			&& (instr.operator == A_INP || instr.operator == A_OUT))
+		{
+			resetLoopDetection();
+		}
+	} while(rval == ERR_None);
+
+	return rval;
+}
+
+/** Private function: forget all sampled states */
+static void resetLoopDetection(void)
+{
+	loopEpoch++;
+	loopAnchorPower = 0;
+	loopAnchorLength = 0;
+}
+
+/** Private function: hash the machine state and compare it with the states
+ *  seen before.
+ *
+ * @retval ERR_NonTerminating	The state was seen before
+ */
+static Error sampleState(void)
+{
+	unsigned long long	hash = getMemHash();
+	unsigned int		slot;
+
+	// Memory is hashed incrementally by writeMemCell. Only a handful of
+	// registers are left, so they are simply mixed in now.
+	hash ^= hashValue(1, regA);
+	hash ^= hashValue(2, regB);
+	hash ^= hashValue(3, flagZ | flagO << 1 | flagN << 2);
+	hash ^= hashValue(4, progCounter);
+	hash ^= hashValue(5, stackPointer);
+
+	slot = (unsigned int)hash & (LOOPTABLE_SIZE - 1);
+	if(loopTableEpoch[slot] == loopEpoch && loopTable[slot] == hash)
+	{
+		return ERR_NonTerminating;
+	}
+	loopTable[slot] = hash;
+	loopTableEpoch[slot] = loopEpoch;
+
+	if(loopAnchorPower != 0 && loopAnchor == hash)
+	{
+		return ERR_NonTerminating;
+	}
+	if(++loopAnchorLength >= loopAnchorPower)
+	{
+		loopAnchor = hash;
+		loopAnchorPower = loopAnchorPower ? loopAnchorPower * 2 : 1;
+		loopAnchorLength = 0;
+	}
+
+	return ERR_None;
+}
+
+/** Private function: state used as key of a memoized call */
+static void getMemoState(MemoState *state)
+{
+	state->regA = regA;
+	state->regB = regB;
+	state->flags = flagZ | flagO << 1 | flagN << 2;
+	state->progCounter = progCounter;
+	state->stackPointer = stackPointer;
+}
+
+/** Private function: restore the state after a replayed call */
+static void setMemoState(MemoState *state)
+{
+	regA = state->regA;
+	regB = state->regB;
+	flagZ = state->flags & 1;
+	flagO = (state->flags >> 1) & 1;
+	flagN = (state->flags >> 2) & 1;
+	progCounter = state->progCounter;
+	stackPointer = state->stackPointer;
+}
+
+/** Private function: called after the backward jump at jumpAddr was taken.
+ *  If the loop is a counted loop, skip to the start of its last iteration.
+ *  Loops with a breakpoint in them are not skipped. */
+static Error fastForward(unsigned int jumpAddr)
+{
+	FFCacheEntry	*entry = &ffCache[jumpAddr & (FFCACHE_SIZE - 1)];
+	long long	values[FF_NUMVARS];
+	unsigned long	maxIter = ULONG_MAX,
+			iterations = 0;
+	unsigned int	addr;
+	int		i = 0;
+	Error		rval = ERR_None;
+
+	if(entry->epoch != ffEpoch || entry->jumpAddr != jumpAddr)
+	{
+		entry->jumpAddr = jumpAddr;
+		entry->epoch = ffEpoch;
+		entry->ok = ffAnalyze(&memory, jumpAddr, &entry->loop);
+
+		ffLow = progCounter < ffLow ? progCounter : ffLow;
+		ffHigh = jumpAddr > ffHigh ? jumpAddr : ffHigh;
+	}
+
+	if(!entry->ok || entry->loop.target != progCounter)
+	{
+		return ERR_None;
+	}
+
+	// The body may end at the last address, so stop on jumpAddr itself
+	// instead of letting addr wrap past it
+	for(addr = progCounter; numBreakpoints > 0; addr++)
+	{
+		if(isBreakpoint(addr))
+		{
+			return ERR_None;
+		}
+		if(addr == jumpAddr)
+		{
+			break;
+		}
+	}
+
+	// Skipped iterations must stay below the instruction budget, so the run
+	// stops at exactly the same instruction as without fast-forwarding
+	if(limits.maxInstr != 0)
+	{
+		if(usage.instructions >= limits.maxInstr)
+		{
+			return ERR_None;
+		}
+		maxIter = (limits.maxInstr - usage.instructions - 1) / entry->loop.length;
+	}
+
+	values[FF_REGA] = regA;
+	values[FF_REGB] = regB;
+	for(i = 0; i < entry->loop.numCells; i++)
+	{
+		values[2 + i] = loadCell(entry->loop.cells[i]).getal;
+	}
+
+	if(!ffSolve(&entry->loop, values, maxIter, &iterations))
+	{
+		return ERR_None;
+	}
+
+	// Only write the cells the loop changes
+	for(i = 0; i < entry->loop.numCells; i++)
+	{
+		if(entry->loop.update[2 + i].var != 2 + i || entry->loop.update[2 + i].c != 0)
+		{
+			MemCell cell;
+
+			cell.getal = (int)values[2 + i];
+			rval = storeCell(entry->loop.cells[i], cell, FALSE);
+			if(rval != ERR_None)
+			{
+				return rval;
+			}
+		}
+	}
+
+	regA = (int)values[FF_REGA];
+	regB = (int)values[FF_REGB];
+	usage.instructions += iterations * entry->loop.length;
+	skippedCount += iterations * entry->loop.length;
+
+	return ERR_None;
+}
+
+/** Private function: forget all analyzed loops */
+static void flushFastForward(void)
+{
+	ffEpoch++;
+	ffLow = UINT_MAX;
+	ffHigh = 0;
+}
+
+/** Enable or disable fast-forwarding of counted loops */
+void fastForwardLoops(int enable)
+{
+	shouldFastForward = enable;
+}
+
+/** Enable or disable memoization of subroutine calls. Calls that are
+ *  replayed are not executed, so breakpoints in them are not hit. */
+void memoizeCalls(int enable)
+{
+	shouldMemoize = enable;
+	selectRunLoop();
+}
+
+/** Enable or disable the profile of the executed instructions. Enabling
+ *  it forgets the previous profile, see profile.h for the results.
+ *
+ * @retval ERR_OutOfMemory	Malloc failed, profiling stays disabled
+ */
+Error profileInstructions(int enable)
+{
+	Error rval = ERR_None;
+
+	shouldProfile = 0;
+	if(enable)
+	{
+		rval = profileReset(progCounter);
+		shouldProfile = rval == ERR_None;
+	}
+	selectRunLoop();
+
+	return rval;
+}
+
+/** Record the executed addresses in a coverage bitmap, or stop recording
+ *  them when coverage is NULL. The bitmap keeps the addresses of all runs
+ *  until it is cleared. Calls are not replayed while it is recorded, their
+ *  instructions could have been executed before the bitmap was cleared. */
+void coverInstructions(Coverage *coverage)
+{
+	coverBits = coverage != NULL ? coverage->bits : NULL;
+}
+
+/**
+ * Call a function for every event of a kind, with the context as its first
+ * argument. The hooks stay added when the processor is initialised again.
+ * While any hook is added the run loop that checks for breakpoints is used,
+ * and loops are not fast-forwarded and calls not replayed, so no event is
+ * left out. Without hooks the run loops do not test for them.
+ *
+ * @retval ERR_InvalidState	Unknown event or no function
+ * @retval ERR_OutOfMemory	The event has MAX_HOOKS hooks already
+ */
+Error addHook(HookEvent event, HookFunc func, void *context)
+{
+	if((unsigned int) event >= HOOK_COUNT || func == NULL)
+	{
+		return ERR_InvalidState;
+	}
+	if(hookCount[event] == MAX_HOOKS)
+	{
+		return ERR_OutOfMemory;
+	}
+
+	hooks[event][hookCount[event]].func = func;
+	hooks[event][hookCount[event]].context = context;
+	hookCount[event]++;
+	numHooks++;
+	updateWatch();
+	selectRunLoop();
+
+	return ERR_None;
+}
+
+/** Remove a hook added with the same event, function and context
+ *
+ * @retval ERR_NotFound		No such hook was added
+ */
+Error removeHook(HookEvent event, HookFunc func, void *context)
+{
+	unsigned int i = 0;
+
+	if((unsigned int) event >= HOOK_COUNT)
+	{
+		return ERR_NotFound;
+	}
+
+	for(i = 0; i < hookCount[event]; i++)
+	{
+		if(hooks[event][i].func == func && hooks[event][i].context == context)
+		{
+			// Keep the order in which the hooks are called
+			memmove(&hooks[event][i], &hooks[event][i + 1],
+				(hookCount[event] - i - 1) * sizeof(Hook));
+			hookCount[event]--;
+			numHooks--;
+			updateWatch();
+			selectRunLoop();
+			return ERR_None;
+		}
+	}
+
+	return ERR_NotFound;
+}
+
+/** Enable or disable infinite loop detection. A program is stopped with
+ *  ERR_NonTerminating as soon as its complete state (registers, flags,
+ *  program counter, stack pointer and memory) repeats without I/O. */
+void detectLoops(int enable)
+{
+	shouldDetectLoops = enable;
+	selectRunLoop();
+}
+
+void setRunLimits(RunLimits newLimits)
+{
+	limits = newLimits;
+}
+
+RunLimits getRunLimits(void)
+{
+	return limits;
+}
+
+RunUsage getRunUsage(void)
+{
+	return usage;
+}
+
+/** Get the counters of the work the processor did since InitProcessor or
+ *  resetProcStats, and the wall time of the last runProgram */
+void getProcStats(ProcStats *stats)
+{
+	MemStats	mem = getMemStats();
+	int		op = 0,
+			mode = 0;
+
+	assert(stats != NULL);
+
+	memcpy(stats->byInstr, instrCount, sizeof(instrCount));
+	stats->executed = 0;
+	for(op = 0; op < 64; op++)
+	{
+		for(mode = 0; mode < 4; mode++)
+		{
+			stats->executed += instrCount[op][mode];
+		}
+	}
+	stats->inputs = instrCount[A_INP][0] + instrCount[A_INP][1]
+		+ instrCount[A_INP][2] + instrCount[A_INP][3];
+	stats->outputs = instrCount[A_OUT][0] + instrCount[A_OUT][1]
+		+ instrCount[A_OUT][2] + instrCount[A_OUT][3];
+	stats->skipped = skippedCount;
+	stats->reads = mem.reads;
+	stats->writes = mem.writes;
+	stats->cells = getMemCellCount();
+	stats->longestWalk = mem.longestWalk;
+	stats->bpChecks = bpCheckCount;
+	stats->lastInstructions = lastRunInstr;
+	stats->lastSeconds = lastRunSeconds;
+}
+
+/** Reset the counters of getProcStats, and the memory counters */
+void resetProcStats(void)
+{
+	memset(instrCount, 0, sizeof(instrCount));
+	skippedCount = 0;
+	bpCheckCount = 0;
+	lastRunInstr = 0;
+	lastRunSeconds = 0;
+	resetMemStats();
+}
+
+/** Private function: pick the run loop. The instrumented loop is only used
+ *  when something has to be checked after every instruction. Call this
+ *  whenever breakpoints are added or removed. */
+static void selectRunLoop(void)
+{
+	if(numBreakpoints > 0 || shouldDetectLoops || shouldMemoize || shouldProfile
+		|| numHooks > 0)
+	{
+		runLoop = runDebug;
+	}
+	else
+	{
+		runLoop = runFast;
+	}
+}
+
+/** Private function: set the bit of an executed address in the coverage
+ *  bitmap, addresses the bitmap has no bit for are left out */
+static void markCovered(unsigned int address)
+{
+	if(address < COVERAGE_ADDRESSES)
+	{
+		coverBits[address >> 5] |= 1u << (address & 31);
+	}
+}
+
+/** Private function: memory accesses have to be handled when calls are
+ *  memoized or memory hooks are added */
+static void updateWatch(void)
+{
+	memWatched = memoActive || hookCount[HOOK_Read] > 0
+		|| hookCount[HOOK_Write] > 0;
+}
+
+/** Private function: call the hooks of an event, in the order they were
+ *  added. The first error is kept in hookError. */
+static void callHooks(HookEvent event, unsigned int pc, unsigned int address, int value)
+{
+	HookInfo	info;
+	unsigned int	i = 0;
+	Error		rval = ERR_None;
+
+	info.event = event;
+	info.progCounter = pc;
+	info.address = address;
+	info.value = value;
+
+	for(i = 0; i < hookCount[event]; i++)
+	{
+		rval = hooks[event][i].func(hooks[event][i].context, &info);
+		if(rval != ERR_None && hookError == ERR_None)
+		{
+			hookError = rval;
+		}
+	}
+}
+
+/** Private function: call the hooks of an executed JSB, RTS, INP or OUT,
+ *  and return the error of the instruction or else that of a hook */
+static Error hookControl(Instruction instr, unsigned int pc, Error rval)
+{
+	Error error = ERR_None;
+
+	if(rval == ERR_None)
+	{
+		switch(instr.operator)
+		{
+		case A_JSB:
+			callHooks(HOOK_Call, pc, progCounter, 0);
+			break;
+		case A_RTS:
+			callHooks(HOOK_Return, pc, progCounter, 0);
+			break;
+		case A_INP:
+			callHooks(HOOK_Input, pc, pc, regA);
+			break;
+		case A_OUT:
+			callHooks(HOOK_Output, pc, pc, regA);
+			break;
+		default:
+			break;
+		}
+	}
+
+	error = hookError;
+	hookError = ERR_None;
+
+	return rval != ERR_None ? rval : error;
+}
+
+/** Private function: follow an executed JSB or RTS on the shadow call
+ *  stack of the profile */
+static void profileControl(Instruction instr)
+{
+	if(instr.operator == A_JSB)
+	{
+		profileCall(instr.operand);
+	}
+	else if(instr.operator == A_RTS)
+	{
+		profileReturn();
+	}
+}
+
 /** Get the next instruction that will be executed */
 Instruction getNextInstr(void)
 {
@@ -499,11 +1457,36 @@ MemCell readMemory(unsigned int address)
 	return readMemCell(&memory, address);
 }
 
+/** The memory list, to read many cells in the order of their address. It
+ *  is only valid until the next write. */
+Memory *getMemoryList(void)
+{
+	return memory;
+}
+
+/** Decode the lazy cells in a range of memory, so the memory list has all
+ *  cells of the range, see loadLazyCells
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error loadMemoryRange(unsigned int from, unsigned int to)
+{
+	return loadLazyCells(&memory, from, to);
+}
+
 Error writeMemory(unsigned int address, MemCell data)
 {
+	flushFastForward();
 	return writeMemCell(&memory, address, data);
 }
 
+/** Remove a memory cell, it becomes uninitialized memory */
+void clearMemory(unsigned int address)
+{
+	flushFastForward();
+	clearMemCell(&memory, address);
+}
+
 /** Return the address and value of the last memory change after the previous
  *  call of this fucntion. So after calling this function, the 'last written address'
  *  is reset!
@@ -528,13 +1511,29 @@ Error memoryChanged(unsigned int *address, MemCell *value)
 /* Set a breakpoint somewhere */
 Error setBreakpoint(unsigned int address)
 {
-	return addNumber(&breakpoints, address);
+	Error rval = addNumber(&breakpoints, address);
+
+	if(rval == ERR_None)
+	{
+		rval = rebuildBpTable();
+	}
+	selectRunLoop();
+
+	return rval;
 }
 
 /* Remove a breakpoint */
 Error delBreakpoint(unsigned int address)
 {
-	return delNumber(&breakpoints, address);
+	Error rval = delNumber(&breakpoints, address);
+
+	if(rval == ERR_None)
+	{
+		rval = rebuildBpTable();
+	}
+	selectRunLoop();
+
+	return rval;
 }
 
 NumberList *getBreakpoints(void)
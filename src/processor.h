@@ -2,6 +2,7 @@
 #define _PSEUDOASM_INC_PROCESSOR_H_
 
 #include "memory.h"
+#include "coverage.h"
 #include "error.h"
 
 typedef struct ProcInfo
@@ -14,6 +15,80 @@ typedef struct ProcInfo
 	int progCounter;
 } ProcInfo;
 
+/** Resource limits of a single run, 0 means no limit */
+typedef struct RunLimits
+{
+	unsigned long maxInstr;
+	unsigned long maxMillis;
+	unsigned int maxCells;
+} RunLimits;
+
+/** Resources used by the last run */
+typedef struct RunUsage
+{
+	unsigned long instructions;
+	unsigned long millis;
+	unsigned int cells;
+} RunUsage;
+
+/** Work done by the processor since InitProcessor or resetProcStats */
+typedef struct ProcStats
+{
+	/** Executed instructions by opcode and addressing method */
+	unsigned long byInstr[64][4];
+	unsigned long executed;
+	/** Instructions skipped by fast-forwarding loops and replaying calls */
+	unsigned long skipped;
+	unsigned long inputs;
+	unsigned long outputs;
+	/** Memory accesses, instruction fetches included */
+	unsigned long reads;
+	unsigned long writes;
+	/** Memory cells in use */
+	unsigned int cells;
+	/** Most memory cells walked over to find one cell */
+	unsigned int longestWalk;
+	unsigned long bpChecks;
+	/** Instructions and wall time of the last runProgram */
+	unsigned long lastInstructions;
+	double lastSeconds;
+} ProcStats;
+
+/** Events an instrumentation hook can be called for */
+typedef enum HookEvent
+{
+	/** Before an instruction is executed, value is the instruction cell */
+	HOOK_Instr,
+	/** Memory cell read by an instruction */
+	HOOK_Read,
+	/** Memory cell written by an instruction, the stack included */
+	HOOK_Write,
+	/** JSB executed, address is the subroutine */
+	HOOK_Call,
+	/** RTS executed, address is the return address */
+	HOOK_Return,
+	/** INP executed, value is the number read */
+	HOOK_Input,
+	/** OUT executed, value is the number written */
+	HOOK_Output,
+	HOOK_COUNT
+} HookEvent;
+
+/** What a hook is called for */
+typedef struct HookInfo
+{
+	HookEvent event;
+	/** Address of the instruction that caused the event */
+	unsigned int progCounter;
+	/** Memory cell, subroutine or return address, or progCounter */
+	unsigned int address;
+	int value;
+} HookInfo;
+
+/** Instrumentation hook. An error other than ERR_None stops runProgram with
+ *  that error after the current instruction. */
+typedef Error (*HookFunc)(void *context, const HookInfo *info);
+
 /* Initialise processor */
 Error InitProcessor(Memory *meminit, FuncNumInp inp, FuncNumOut out);
 
@@ -30,6 +105,45 @@ Error executeInstr(Instruction instr, int saveProgCount);
 /* Execute the next instruction */
 Error executeNextInstr(void);
 
+/* Run until HLT, an error, a breakpoint or a resource limit */
+Error runProgram(void);
+
+/* Set the resource limits used by runProgram */
+void setRunLimits(RunLimits newLimits);
+
+/* Get the current resource limits */
+RunLimits getRunLimits(void);
+
+/* Get the resources used by the last call to runProgram */
+RunUsage getRunUsage(void);
+
+/* Get the counters of the work the processor did */
+void getProcStats(ProcStats *stats);
+
+/* Reset the counters of getProcStats */
+void resetProcStats(void);
+
+/* Stop runProgram when the machine state repeats without I/O */
+void detectLoops(int enable);
+
+/* Replay subroutine calls that were already executed with the same input */
+void memoizeCalls(int enable);
+
+/* Skip iterations of counted loops, enabled by default */
+void fastForwardLoops(int enable);
+
+/* Count the executions of every address and subroutine, see profile.h */
+Error profileInstructions(int enable);
+
+/* Record the executed addresses in a bitmap, NULL to stop recording */
+void coverInstructions(Coverage *coverage);
+
+/* Call a function for every event of a kind, until it is removed */
+Error addHook(HookEvent event, HookFunc func, void *context);
+
+/* Remove a function added with addHook */
+Error removeHook(HookEvent event, HookFunc func, void *context);
+
 /* Get the next instruction that will be executed */
 Instruction getNextInstr(void);
 
@@ -55,9 +169,18 @@ Error memoryChanged(unsigned int *address, MemCell *value);
 /* Read a memory cell */
 MemCell readMemory(unsigned int address);
 
+/* Get the memory list, valid until the next write */
+Memory *getMemoryList(void);
+
+/* Decode the lazy cells in a range, so the memory list has all of them */
+Error loadMemoryRange(unsigned int from, unsigned int to);
+
 /* Write to a memory cell */
 Error writeMemory(unsigned int address, MemCell data);
 
+/* Remove a memory cell, so it is uninitialized */
+void clearMemory(unsigned int address);
+
 
 /* Get the stack pointer */
 int getStackPointer(void);
@@ -0,0 +1,490 @@
+/**
+ * Profile of the executed instructions.
+ *
+ * Executions are counted per address in a flat array indexed by the
+ * address, which grows up to the highest address that is executed.
+ *
+ * A shadow call stack follows JSB and RTS. It is kept as a trie of call
+ * stacks: every node is a subroutine reached by one chain of calls from the
+ * start of the program, and counts the instructions executed while it is on
+ * top of the stack. The current node is the top of the shadow stack and its
+ * parent is the caller, so a call or return only moves to another node.
+ * The counts per subroutine and the folded stacks are derived from the trie
+ * when they are asked for.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "errors.h"
+#include "profile.h"
+
+/** Addresses from here on are not counted, operands have 24 bits */
+#define PROF_MAX_ADDRESS	0x1000000
+#define PROF_MIN_COUNTERS	1024
+#define PROF_MIN_NODES		64
+
+/** A subroutine reached by one chain of calls. Node 0 is the start of the
+ *  program, so 0 is used as "no node" for the children and siblings. */
+typedef struct ProfNode
+{
+	unsigned int	entry;
+	unsigned int	parent;
+	unsigned int	child;
+	unsigned int	sibling;
+	unsigned long	self;
+	unsigned long	calls;
+} ProfNode;
+
+static unsigned long *counters = NULL;
+static unsigned int numCounters = 0;
+
+static ProfNode *nodes = NULL;
+static unsigned int numNodes = 0;
+static unsigned int sizeNodes = 0;
+static unsigned int current = 0;
+
+/** Calls for which no node could be made, the returns of those calls
+ *  must not leave the current node */
+static unsigned long lostCalls = 0;
+static unsigned long total = 0;
+
+static Error growCounters(unsigned int address);
+static unsigned int addNode(unsigned int entry);
+static int compareEntry(const void *a, const void *b);
+static int compareInclusive(const void *a, const void *b);
+
+/** Forget the profile. The start address is the entry of the code that
+ *  is not in a subroutine.
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error profileReset(unsigned int start)
+{
+	if(counters != NULL)
+	{
+		memset(counters, 0, numCounters * sizeof(unsigned long));
+	}
+
+	if(nodes == NULL)
+	{
+		nodes = (ProfNode*) malloc(PROF_MIN_NODES * sizeof(ProfNode));
+		if(nodes == NULL)
+		{
+			return ERR_OutOfMemory;
+		}
+		sizeNodes = PROF_MIN_NODES;
+	}
+
+	memset(&nodes[0], 0, sizeof(ProfNode));
+	nodes[0].entry = start;
+	numNodes = 1;
+	current = 0;
+	lostCalls = 0;
+	total = 0;
+
+	return ERR_None;
+}
+
+/** Count the execution of the instruction at an address, for the address
+ *  and for the subroutine on top of the shadow stack */
+void profileInstr(unsigned int address)
+{
+	if(address < numCounters || growCounters(address) == ERR_None)
+	{
+		counters[address]++;
+	}
+	nodes[current].self++;
+	total++;
+}
+
+/** A JSB to the entry address was executed: push the subroutine on the
+ *  shadow stack */
+void profileCall(unsigned int entry)
+{
+	unsigned int child = 0;
+
+	for(child = nodes[current].child; child != 0; child = nodes[child].sibling)
+	{
+		if(nodes[child].entry == entry)
+		{
+			break;
+		}
+	}
+
+	if(child == 0)
+	{
+		child = addNode(entry);
+		if(child == 0)
+		{
+			lostCalls++;
+			return;
+		}
+	}
+
+	nodes[child].calls++;
+	current = child;
+}
+
+/** An RTS was executed: pop the shadow stack. A return without a call is
+ *  ignored, the code outside subroutines stays at the bottom. */
+void profileReturn(void)
+{
+	if(lostCalls > 0)
+	{
+		lostCalls--;
+	}
+	else if(current != 0)
+	{
+		current = nodes[current].parent;
+	}
+}
+
+/** Total of the instructions counted since profileReset */
+unsigned long profileTotal(void)
+{
+	return total;
+}
+
+/** Number of addresses executed since profileReset, the most that
+ *  profileHottest can find */
+unsigned int profileAddresses(void)
+{
+	unsigned int	address = 0,
+			found = 0;
+
+	for(address = 0; address < numCounters; address++)
+	{
+		found += counters[address] != 0;
+	}
+
+	return found;
+}
+
+/** Get the most executed addresses.
+ *
+ * @param [out] hottest		At least max addresses, most executed first
+ * @param [in] max		Addresses to find
+ * @return Number of addresses found, addresses never executed are left out
+ */
+unsigned int profileHottest(ProfAddress *hottest, unsigned int max)
+{
+	unsigned int	found = 0,
+			address = 0,
+			i = 0;
+
+	for(address = 0; address < numCounters && max > 0; address++)
+	{
+		unsigned long count = counters[address];
+
+		if(count == 0 || (found == max && count <= hottest[max - 1].count))
+		{
+			continue;
+		}
+
+		// Insert it in the sorted list, dropping the last one when full
+		i = found < max ? found++ : max - 1;
+		for(; i > 0 && hottest[i - 1].count < count; i--)
+		{
+			hottest[i] = hottest[i - 1];
+		}
+		hottest[i].address = address;
+		hottest[i].count = count;
+	}
+
+	return found;
+}
+
+/** Get the instructions per subroutine, summed over all the chains of calls
+ *  it was reached by. The inclusive count of a recursive subroutine only
+ *  counts the outermost call. Sorted by inclusive count, highest first.
+ *
+ * @param [out] routines	Free with free
+ * @param [out] count		Number of subroutines
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error profileRoutines(ProfRoutine **routines, unsigned int *count)
+{
+	unsigned long	*inclusive = NULL;
+	unsigned int	*routineOf = NULL,
+			*onPath = NULL,
+			*entries = NULL,
+			numRoutines = 0,
+			node = 0,
+			r = 0,
+			i = 0;
+	ProfRoutine	*list = NULL;
+	Error		rval = ERR_None;
+
+	*routines = NULL;
+	*count = 0;
+	if(numNodes == 0)
+	{
+		return ERR_None;
+	}
+
+	inclusive = (unsigned long*) malloc(numNodes * sizeof(unsigned long));
+	routineOf = (unsigned int*) malloc(numNodes * sizeof(unsigned int));
+	onPath = (unsigned int*) calloc(numNodes, sizeof(unsigned int));
+	entries = (unsigned int*) malloc(numNodes * sizeof(unsigned int));
+	list = (ProfRoutine*) calloc(numNodes, sizeof(ProfRoutine));
+	if(inclusive == NULL || routineOf == NULL || onPath == NULL
+		|| entries == NULL || list == NULL)
+	{
+		rval = ERR_OutOfMemory;
+		goto cleanup;
+	}
+
+	// Children are added after their parent, so one pass from the end
+	// adds every subtree to its parent
+	for(i = 0; i < numNodes; i++)
+	{
+		inclusive[i] = nodes[i].self;
+		entries[i] = nodes[i].entry;
+	}
+	for(i = numNodes - 1; i > 0; i--)
+	{
+		inclusive[nodes[i].parent] += inclusive[i];
+	}
+
+	// One routine per distinct entry address
+	qsort(entries, numNodes, sizeof(unsigned int), compareEntry);
+	for(i = 0; i < numNodes; i++)
+	{
+		if(i == 0 || entries[i] != entries[i - 1])
+		{
+			entries[numRoutines] = entries[i];
+			list[numRoutines].entry = entries[i];
+			numRoutines++;
+		}
+	}
+	for(i = 0; i < numNodes; i++)
+	{
+		unsigned int *found = (unsigned int*) bsearch(&nodes[i].entry, entries,
+			numRoutines, sizeof(unsigned int), compareEntry);
+
+		routineOf[i] = (unsigned int)(found - entries);
+	}
+
+	// Walk the trie depth first. A node adds its subtree to the inclusive
+	// count only when its subroutine is not already on the path to it.
+	node = 0;
+	for(;;)
+	{
+		r = routineOf[node];
+		list[r].exclusive += nodes[node].self;
+		list[r].calls += nodes[node].calls;
+		if(onPath[r]++ == 0)
+		{
+			list[r].inclusive += inclusive[node];
+		}
+
+		if(nodes[node].child != 0)
+		{
+			node = nodes[node].child;
+			continue;
+		}
+
+		// Leave the nodes that have no next sibling
+		while(node != 0 && nodes[node].sibling == 0)
+		{
+			onPath[routineOf[node]]--;
+			node = nodes[node].parent;
+		}
+		if(node == 0)
+		{
+			break;
+		}
+		onPath[routineOf[node]]--;
+		node = nodes[node].sibling;
+	}
+
+	qsort(list, numRoutines, sizeof(ProfRoutine), compareInclusive);
+	*routines = list;
+	*count = numRoutines;
+	list = NULL;
+
+cleanup:
+	free(inclusive);
+	free(routineOf);
+	free(onPath);
+	free(entries);
+	free(list);
+
+	return rval;
+}
+
+/**
+ * Write the call stacks in the folded format of flame graph tools: one
+ * line per chain of calls, with the frames from the start of the program
+ * separated by semicolons and the instructions executed on top of it.
+ * The code outside subroutines is called "program", a subroutine is
+ * called "sub_" followed by its entry address.
+ *
+ * @param [in] fp		File to write to
+ * @retval ERR_OutOfMemory	Malloc failed
+ * @retval ERR_WritingFile	The file could not be written
+ */
+Error profileWriteFolded(FILE *fp)
+{
+	unsigned int	*depth = NULL,
+			*path = NULL,
+			maxDepth = 0,
+			i = 0,
+			d = 0,
+			node = 0;
+	Error		rval = ERR_None;
+
+	if(numNodes == 0)
+	{
+		return ERR_None;
+	}
+
+	depth = (unsigned int*) malloc(numNodes * sizeof(unsigned int));
+	if(depth == NULL)
+	{
+		return ERR_OutOfMemory;
+	}
+
+	depth[0] = 0;
+	for(i = 1; i < numNodes; i++)
+	{
+		depth[i] = depth[nodes[i].parent] + 1;
+		if(depth[i] > maxDepth)
+		{
+			maxDepth = depth[i];
+		}
+	}
+
+	path = (unsigned int*) malloc((maxDepth + 1) * sizeof(unsigned int));
+	if(path == NULL)
+	{
+		free(depth);
+		return ERR_OutOfMemory;
+	}
+
+	for(i = 0; i < numNodes && rval == ERR_None; i++)
+	{
+		if(nodes[i].self == 0)
+		{
+			continue;
+		}
+
+		for(node = i, d = depth[i]; node != 0; node = nodes[node].parent)
+		{
+			path[d--] = node;
+		}
+
+		fputs("program", fp);
+		for(d = 1; d <= depth[i]; d++)
+		{
+			fprintf(fp, ";sub_%u", nodes[path[d]].entry);
+		}
+		if(fprintf(fp, " %lu\n", nodes[i].self) < 0)
+		{
+			rval = ERR_WritingFile;
+		}
+	}
+
+	free(path);
+	free(depth);
+
+	return rval;
+}
+
+/** Free the profile */
+void profileFree(void)
+{
+	free(counters);
+	counters = NULL;
+	numCounters = 0;
+	free(nodes);
+	nodes = NULL;
+	numNodes = 0;
+	sizeNodes = 0;
+	current = 0;
+	lostCalls = 0;
+	total = 0;
+}
+
+/** Private function: grow the counters so the address has one.
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ * @retval ERR_InvalidState	The address is too high to be counted
+ */
+static Error growCounters(unsigned int address)
+{
+	unsigned long	*bigger = NULL;
+	unsigned int	size = numCounters ? numCounters : PROF_MIN_COUNTERS;
+
+	if(address >= PROF_MAX_ADDRESS)
+	{
+		return ERR_InvalidState;
+	}
+
+	while(size <= address)
+	{
+		size *= 2;
+	}
+
+	bigger = (unsigned long*) realloc(counters, size * sizeof(unsigned long));
+	if(bigger == NULL)
+	{
+		return ERR_OutOfMemory;
+	}
+
+	memset(bigger + numCounters, 0, (size - numCounters) * sizeof(unsigned long));
+	counters = bigger;
+	numCounters = size;
+
+	return ERR_None;
+}
+
+/** Private function: add a child for the entry address to the current
+ *  node. Returns the new node, or 0 when out of memory. */
+static unsigned int addNode(unsigned int entry)
+{
+	ProfNode *node = NULL;
+
+	if(numNodes == sizeNodes)
+	{
+		ProfNode *bigger = (ProfNode*) realloc(nodes, 2 * sizeNodes * sizeof(ProfNode));
+
+		if(bigger == NULL)
+		{
+			return 0;
+		}
+		nodes = bigger;
+		sizeNodes *= 2;
+	}
+
+	node = &nodes[numNodes];
+	memset(node, 0, sizeof(ProfNode));
+	node->entry = entry;
+	node->parent = current;
+	node->sibling = nodes[current].child;
+	nodes[current].child = numNodes;
+
+	return numNodes++;
+}
+
+/** Private function: compare two entry addresses for qsort and bsearch */
+static int compareEntry(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int*) a,
+		     y = *(const unsigned int*) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/** Private function: order subroutines by inclusive count, highest first */
+static int compareInclusive(const void *a, const void *b)
+{
+	const ProfRoutine	*x = (const ProfRoutine*) a,
+				*y = (const ProfRoutine*) b;
+
+	if(x->inclusive != y->inclusive)
+	{
+		return x->inclusive < y->inclusive ? 1 : -1;
+	}
+	return x->entry < y->entry ? -1 : x->entry > y->entry;
+}
@@ -0,0 +1,56 @@
+#ifndef _PSEUDOASM_INC_PROFILE_H_
+#define _PSEUDOASM_INC_PROFILE_H_
+
+#include <stdio.h>
+#include "errors.h"
+
+/** Executions of one address */
+typedef struct ProfAddress
+{
+	unsigned int address;
+	unsigned long count;
+} ProfAddress;
+
+/** Instructions of a subroutine, summed over all the calls to it */
+typedef struct ProfRoutine
+{
+	/** Entry address, for the code outside subroutines where it started */
+	unsigned int entry;
+	unsigned long calls;
+	/** Instructions of the subroutine itself */
+	unsigned long exclusive;
+	/** Instructions of the subroutine and the subroutines it calls */
+	unsigned long inclusive;
+} ProfRoutine;
+
+/* Forget the profile, the program starts at the given address */
+Error profileReset(unsigned int start);
+
+/* Count the execution of the instruction at an address */
+void profileInstr(unsigned int address);
+
+/* A JSB to the entry address was executed */
+void profileCall(unsigned int entry);
+
+/* An RTS was executed */
+void profileReturn(void);
+
+/* Total of the counted instructions */
+unsigned long profileTotal(void);
+
+/* Number of addresses that were executed */
+unsigned int profileAddresses(void);
+
+/* Get the most executed addresses, most executed first */
+unsigned int profileHottest(ProfAddress *hottest, unsigned int max);
+
+/* Get the instructions per subroutine, free the array with free */
+Error profileRoutines(ProfRoutine **routines, unsigned int *count);
+
+/* Write the call stacks in the folded format of flame graph tools */
+Error profileWriteFolded(FILE *fp);
+
+/* Free the profile */
+void profileFree(void);
+
+#endif // _PSEUDOASM_INC_PROFILE_H_
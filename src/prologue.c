@@ -0,0 +1,563 @@
+/**
+ * Execution of the prologue of a program when it is assembled.
+ *
+ * Many programs start with straight line code that only fills memory and
+ * sets registers. Until the program reads input it does exactly the same at
+ * every run, so that part can be executed once, before the image is saved
+ * or loaded: the program runs from its entry point until the first INP,
+ * OUT or HLT, an instruction that would fail, or until the budget is used
+ * up. The cells, registers, flags, stack pointer and program counter at
+ * that moment replace the image. Without input the outcome of every branch
+ * is known, so no branch has to stop the execution.
+ *
+ * When the prologue writes a cell it executed, or executes a cell it wrote,
+ * the image is not changed. The saved state would be correct, but the code
+ * in memory would no longer be the code of the source, which a reload and
+ * the optimizer depend on.
+ *
+ * The same execution measures the stack of a program that reads no input:
+ * then the whole run is known, see measureStack.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include "hardware.h"
+#include "memory.h"
+#include "image.h"
+#include "alu.h"
+#include "prologue.h"
+
+#define MARK_EXECUTED	0x1
+#define MARK_WRITTEN	0x2
+
+/** Size of the table of cells outside the image, twice the maximum */
+#define EXTRA_SIZE	(2 * PROLOGUE_MAXCELLS)
+
+/** Result of executing one instruction */
+typedef enum StepResult
+{
+	STEP_Done,
+	STEP_Stop,
+	STEP_Changed
+} StepResult;
+
+/** State of the processor while the prologue runs */
+typedef struct Machine
+{
+	/** Cells of the image, sorted on address */
+	ImageCell	*cells;
+	size_t		count;
+	/** Cells outside the image that were written, open addressing. A
+	 *  slot holds address + 1, zero means empty. */
+	unsigned int	*extraAddr;
+	MemCell		*extraValue;
+	unsigned int	numExtra;
+	int		regA;
+	int		regB;
+	int		flagZ;
+	int		flagO;
+	int		flagN;
+	unsigned int	progCounter;
+	unsigned int	stackPointer;
+	/** Lowest stack pointer after a JSB */
+	unsigned int	lowestStack;
+	/** Execute OUT like NOP, the output does not change the state */
+	int		skipOutput;
+	/** Did the last STEP_Stop end the program, like in the processor? */
+	int		hasEnded;
+	const char	*reason;
+} Machine;
+
+static Error initMachine(Image *image, Machine *machine);
+static void freeMachine(Machine *machine);
+static ImageCell *findCell(Machine *machine, unsigned int address);
+static unsigned int *findExtra(Machine *machine, unsigned int address);
+static MemCell readCell(Machine *machine, unsigned int address);
+static StepResult writeCell(Machine *machine, unsigned int address, int value);
+static StepResult step(Machine *machine);
+static Error saveState(Machine *machine, Image *image);
+static int compareUnsigned(const void *a, const void *b);
+
+/** Execute the start of a program, until the first instruction that reads
+ *  input or writes output, and make the state at that moment the start of
+ *  the image. Cells the prologue wrote outside the image are added as data
+ *  segments. The image is not changed when the prologue changes its own
+ *  code (report->skipReason says so), or when no instruction can be
+ *  executed.
+ *
+ * @param [in,out] image	Assembled or mapped image
+ * @param [in] maxInstr		Instructions that are executed at most
+ * @param [out] report		What was executed
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error runPrologue(Image *image, unsigned long maxInstr, PrologueReport *report)
+{
+	Machine		machine;
+	StepResult	result = STEP_Done;
+	Error		rval = ERR_None;
+
+	assert(image != NULL && report != NULL);
+
+	report->executed = 0;
+	report->stopReason = "the budget was used up";
+	report->skipReason = NULL;
+
+	rval = initMachine(image, &machine);
+
+	while(rval == ERR_None && report->executed < maxInstr)
+	{
+		result = step(&machine);
+		if(result != STEP_Done)
+		{
+			break;
+		}
+		report->executed++;
+	}
+
+	if(rval == ERR_None && result == STEP_Changed)
+	{
+		report->skipReason = machine.reason;
+	}
+	else if(rval == ERR_None)
+	{
+		report->stopReason = result == STEP_Stop ? machine.reason : report->stopReason;
+		if(report->executed > 0)
+		{
+			rval = saveState(&machine, image);
+		}
+	}
+
+	freeMachine(&machine);
+
+	return rval;
+}
+
+/** Execute a whole program that reads no input, to find how many cells of
+ *  the stack it uses. Without input every run of the program is the same,
+ *  so when it stops within the budget the depth it reached is exact. The
+ *  output is ignored. The image is not changed.
+ *
+ * @param [in] image		Assembled or mapped image
+ * @param [in] maxInstr		Instructions that are executed at most
+ * @param [out] depth		Cells below the initial stack pointer that were
+ *				pushed, only set when the program stopped
+ * @param [out] isBounded	FALSE when the program did not stop: it read
+ *				input, changed its own code or used up the budget
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error measureStack(Image *image, unsigned long maxInstr, unsigned int *depth, int *isBounded)
+{
+	Machine		machine;
+	StepResult	result = STEP_Done;
+	unsigned long	executed = 0;
+	Error		rval = ERR_None;
+
+	assert(image != NULL && depth != NULL && isBounded != NULL);
+
+	*isBounded = 0;
+
+	rval = initMachine(image, &machine);
+	machine.skipOutput = 1;
+
+	while(rval == ERR_None && executed < maxInstr)
+	{
+		result = step(&machine);
+		if(result != STEP_Done)
+		{
+			break;
+		}
+		executed++;
+	}
+
+	if(rval == ERR_None && result == STEP_Stop && machine.hasEnded)
+	{
+		*depth = image->stackPointer - machine.lowestStack;
+		*isBounded = 1;
+	}
+
+	freeMachine(&machine);
+
+	return rval;
+}
+
+/** Private function: set the state of the machine to the start of an image
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error initMachine(Image *image, Machine *machine)
+{
+	memset(machine, 0, sizeof(Machine));
+	machine->regA = image->regA;
+	machine->regB = image->regB;
+	machine->flagZ = (image->flags & IMAGE_FLAG_Z) != 0;
+	machine->flagO = (image->flags & IMAGE_FLAG_O) != 0;
+	machine->flagN = (image->flags & IMAGE_FLAG_N) != 0;
+	machine->progCounter = image->entry;
+	machine->stackPointer = image->stackPointer;
+	machine->lowestStack = image->stackPointer;
+
+	machine->extraAddr = (unsigned int*) calloc(EXTRA_SIZE, sizeof(unsigned int));
+	machine->extraValue = (MemCell*) malloc(EXTRA_SIZE * sizeof(MemCell));
+
+	return machine->extraAddr == NULL || machine->extraValue == NULL
+		? ERR_OutOfMemory : flattenImage(image, &machine->cells, &machine->count);
+}
+
+/** Private function: free the cells of a machine */
+static void freeMachine(Machine *machine)
+{
+	free(machine->cells);
+	free(machine->extraAddr);
+	free(machine->extraValue);
+}
+
+/** Private function: find the cell of an address, NULL if it is not in the image */
+static ImageCell *findCell(Machine *machine, unsigned int address)
+{
+	return findImageCell(machine->cells, machine->count, address);
+}
+
+/** Private function: slot of an address outside the image. The slot is
+ *  empty (0) when the address was not written. */
+static unsigned int *findExtra(Machine *machine, unsigned int address)
+{
+	unsigned int i = (address * 2654435761u) & (EXTRA_SIZE - 1);
+
+	while(machine->extraAddr[i] != 0 && machine->extraAddr[i] != address + 1)
+	{
+		i = (i + 1) & (EXTRA_SIZE - 1);
+	}
+
+	return &machine->extraAddr[i];
+}
+
+/** Private function: read a cell as data, like readMemCell */
+static MemCell readCell(Machine *machine, unsigned int address)
+{
+	ImageCell	*cell = findCell(machine, address);
+	unsigned int	*slot = NULL;
+	MemCell		uninit = {UNINIT};
+
+	if(cell != NULL)
+	{
+		return cell->value;
+	}
+
+	slot = findExtra(machine, address);
+	return *slot != 0 ? machine->extraValue[slot - machine->extraAddr] : uninit;
+}
+
+/** Private function: write a cell. Nothing is written when the cell was
+ *  executed (STEP_Changed), or when the prologue wrote too many cells
+ *  outside the image (STEP_Stop). */
+static StepResult writeCell(Machine *machine, unsigned int address, int value)
+{
+	ImageCell	*cell = findCell(machine, address);
+	unsigned int	*slot = NULL;
+
+	if(cell != NULL)
+	{
+		if(cell->marks & MARK_EXECUTED)
+		{
+			machine->reason = "the prologue changes its own code";
+			return STEP_Changed;
+		}
+		cell->marks |= MARK_WRITTEN;
+		cell->value.getal = value;
+		return STEP_Done;
+	}
+
+	slot = findExtra(machine, address);
+	if(*slot == 0)
+	{
+		// The last address can not be saved in the table
+		if(machine->numExtra == PROLOGUE_MAXCELLS || address == UINT_MAX)
+		{
+			machine->hasEnded = 0;
+			machine->reason = "too many cells were written";
+			return STEP_Stop;
+		}
+		*slot = address + 1;
+		machine->numExtra++;
+	}
+	machine->extraValue[slot - machine->extraAddr].getal = value;
+
+	return STEP_Done;
+}
+
+/** Private function: execute one instruction exactly like the processor
+ *  does, see the instruction handlers in processor.c. The registers and
+ *  flags are changed by the same functions of alu.h. An instruction that
+ *  reads input, writes output, halts or would fail is not executed
+ *  (STEP_Stop). */
+static StepResult step(Machine *machine)
+{
+	ImageCell	*cell = findCell(machine, machine->progCounter);
+	Instruction	instr;
+	MemCell		value;
+	unsigned int	address = 0;
+	int		shouldJump = 0;
+	StepResult	result = STEP_Done;
+
+	machine->hasEnded = 1;
+
+	if(cell == NULL && *findExtra(machine, machine->progCounter) == 0)
+	{
+		machine->reason = "the program counter left the program";
+		return STEP_Stop;
+	}
+	if(cell == NULL || (cell->marks & MARK_WRITTEN))
+	{
+		machine->hasEnded = 0;
+		machine->reason = "the prologue changes its own code";
+		return STEP_Changed;
+	}
+
+	instr = cell->value.instructie;
+	machine->reason = "an instruction would fail";
+
+	switch(instr.operator)
+	{
+	case A_NOP:
+		break;
+	case A_LDA:
+	case A_LDB:
+		switch(instr.adressering)
+		{
+		case ONMIDDELIJK:
+			value.getal = immediateValue(instr);
+			break;
+		case DIRECT:
+			value = readCell(machine, instr.operand);
+			break;
+		case INDIRECT:
+			value = readCell(machine, (unsigned int)readCell(machine, instr.operand).getal);
+			break;
+		default:
+			return STEP_Stop;
+		}
+
+		if(instr.operator == A_LDA)
+		{
+			machine->regA = value.getal;
+			setLoadFlags(machine->regA, &machine->flagN, &machine->flagZ,
+				&machine->flagO);
+		}
+		else
+		{
+			machine->regB = value.getal;
+		}
+		break;
+	case A_STA:
+	case A_STB:
+		switch(instr.adressering)
+		{
+		case DIRECT:
+			address = instr.operand;
+			break;
+		case INDIRECT:
+			address = (unsigned int)readCell(machine, instr.operand).getal;
+			break;
+		default:
+			return STEP_Stop;
+		}
+
+		result = writeCell(machine, address,
+			instr.operator == A_STA ? machine->regA : machine->regB);
+		if(result != STEP_Done)
+		{
+			return result;
+		}
+		break;
+	case A_ADD:
+	case A_SUB:
+	case A_MUL:
+	case A_DIV:
+		if(computeMath(instr, &machine->regA, machine->regB, &machine->flagN,
+			&machine->flagZ, &machine->flagO) != ERR_None)
+		{
+			return STEP_Stop;
+		}
+		break;
+	case A_JMP:
+	case A_JSP:
+	case A_JSN:
+	case A_JIZ:
+	case A_JOF:
+		shouldJump = isJumpTaken(instr, machine->flagN, machine->flagZ,
+			machine->flagO);
+		break;
+	case A_JSB:
+		result = writeCell(machine, machine->stackPointer - 1, (int)(machine->progCounter + 1));
+		if(result != STEP_Done)
+		{
+			return result;
+		}
+		machine->stackPointer--;
+		if(machine->stackPointer < machine->lowestStack)
+		{
+			machine->lowestStack = machine->stackPointer;
+		}
+		shouldJump = 1;
+		break;
+	case A_RTS:
+		address = (unsigned int)readCell(machine, machine->stackPointer++).getal;
+		break;
+	case A_OUT:
+		if(machine->skipOutput)
+		{
+			break;
+		}
+		// Fall through
+	case A_INP:
+		machine->hasEnded = 0;
+		machine->reason = "the program reads input or writes output";
+		return STEP_Stop;
+	case A_HLT:
+		machine->reason = "the program halts";
+		return STEP_Stop;
+	default:
+		return STEP_Stop;
+	}
+
+	cell->marks |= MARK_EXECUTED;
+
+	if(instr.operator == A_RTS)
+	{
+		machine->progCounter = address;
+	}
+	else if(shouldJump)
+	{
+		machine->progCounter = instr.operand;
+	}
+	else
+	{
+		machine->progCounter++;
+	}
+
+	return STEP_Done;
+}
+
+/** Private function: replace the cells and the start of an image with the
+ *  state of the machine. Runs of consecutive cells with the same flags
+ *  become a segment, cells outside the old image are data.
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error saveState(Machine *machine, Image *image)
+{
+	unsigned int	*extra = NULL,
+			numExtra = 0,
+			numSegments = 0,
+			e = 0,
+			i = 0,
+			flags = 0,
+			address = 0,
+			lastAddress = 0,
+			lastFlags = 0;
+	size_t		c = 0,
+			total = machine->count + machine->numExtra;
+	MemCell		*cells = NULL,
+			value;
+	ImageSegment	*segments = NULL,
+			*segment = NULL;
+	int		pass = 0;
+
+	extra = (unsigned int*) malloc(machine->numExtra * sizeof(unsigned int) + 1);
+	cells = (MemCell*) malloc(total * sizeof(MemCell) + 1);
+	if(extra == NULL || cells == NULL)
+	{
+		free(extra);
+		free(cells);
+		return ERR_OutOfMemory;
+	}
+
+	for(i = 0; i < EXTRA_SIZE; i++)
+	{
+		if(machine->extraAddr[i] != 0)
+		{
+			extra[numExtra++] = machine->extraAddr[i] - 1;
+		}
+	}
+	qsort(extra, numExtra, sizeof(unsigned int), compareUnsigned);
+
+	// Merge the cells of the image and the others. The first pass counts
+	// the segments, the second fills them in.
+	for(pass = 0; pass < 2; pass++)
+	{
+		for(c = 0, e = 0, i = 0; c < machine->count || e < numExtra; i++)
+		{
+			if(e == numExtra || (c < machine->count && machine->cells[c].address < extra[e]))
+			{
+				address = machine->cells[c].address;
+				value = machine->cells[c].value;
+				flags = machine->cells[c++].flags;
+			}
+			else
+			{
+				address = extra[e++];
+				value = readCell(machine, address);
+				flags = IMAGE_SEG_DATA;
+			}
+
+			if(i == 0 || address != lastAddress + 1 || flags != lastFlags)
+			{
+				if(pass == 0)
+				{
+					numSegments++;
+				}
+				else
+				{
+					segment = segment == NULL ? segments : segment + 1;
+					segment->base = address;
+					segment->count = 0;
+					segment->flags = flags;
+					segment->cells = cells + i;
+				}
+			}
+			lastAddress = address;
+			lastFlags = flags;
+
+			if(pass == 1)
+			{
+				segment->count++;
+				cells[i] = value;
+			}
+		}
+
+		if(pass == 0)
+		{
+			segments = (ImageSegment*) malloc(numSegments * sizeof(ImageSegment) + 1);
+			if(segments == NULL)
+			{
+				free(extra);
+				free(cells);
+				return ERR_OutOfMemory;
+			}
+		}
+	}
+	free(extra);
+
+	freeImage(image);
+	image->segments = segments;
+	image->numSegments = numSegments;
+	image->cells = cells;
+	image->entry = machine->progCounter;
+	image->stackPointer = machine->stackPointer;
+	image->regA = machine->regA;
+	image->regB = machine->regB;
+	image->flags = (machine->flagZ ? IMAGE_FLAG_Z : 0) | (machine->flagO ? IMAGE_FLAG_O : 0)
+		| (machine->flagN ? IMAGE_FLAG_N : 0);
+
+	return ERR_None;
+}
+
+/** Private function: order unsigned numbers */
+static int compareUnsigned(const void *a, const void *b)
+{
+	unsigned int	ua = *(const unsigned int*) a,
+			ub = *(const unsigned int*) b;
+
+	return ua < ub ? -1 : ua > ub;
+}
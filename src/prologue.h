@@ -0,0 +1,31 @@
+#ifndef _PSEUDOASM_INC_PROLOGUE_H_
+#define _PSEUDOASM_INC_PROLOGUE_H_
+
+#include "errors.h"
+#include "hardware.h"
+#include "image.h"
+
+/** Instructions of the prologue that are executed at most */
+#define PROLOGUE_MAXINSTR	1000000
+/** Cells outside the image that the prologue may write at most */
+#define PROLOGUE_MAXCELLS	65536
+
+/** What the execution of the prologue did with an image */
+typedef struct PrologueReport
+{
+	/** Instructions that were executed */
+	unsigned long executed;
+	/** Why the execution stopped */
+	const char *stopReason;
+	/** Why the image was not changed, NULL if it was */
+	const char *skipReason;
+} PrologueReport;
+
+/* Execute the start of a program until its first I/O, and save the state */
+Error runPrologue(Image *image, unsigned long maxInstr, PrologueReport *report);
+
+/* Execute a program that reads no input until it stops, and find the depth
+   of its stack */
+Error measureStack(Image *image, unsigned long maxInstr, unsigned int *depth, int *isBounded);
+
+#endif // _PSEUDOASM_INC_PROLOGUE_H_
@@ -1,5 +1,7 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <assert.h>
 #include "hardware.h"
 #include "memory.h" // For trace functions
@@ -7,52 +9,171 @@
 #include "compiler.h"
 #include "processor.h"
 #include "parser.h"
+#include "memo.h"
+#include "image.h"
+#include "optimizer.h"
+#include "listing.h"
+#include "linker.h"
+#include "prologue.h"
+#include "stackdepth.h"
+#include "profile.h"
+#include "coverage.h"
+#include "exectrace.h"
 
 #define MAXOUTLEN 101
 // Debug (console) output function.
 OutputFunc consoleOut = NULL;
 
+// Source file of the program and the hash of its lines, used by rntReload.
+// The file name is empty when the program was loaded from an image.
+static char sourceFile[FILENAME_MAX] = "";
+static SourceHash sourceHash = {0, NULL};
+
+// Should programs be optimized when they are loaded or assembled? The cells
+// the optimizer changed are kept, so a reload can restore them.
+static int shouldOptimize = 0;
+static OptReport optReport = {0, 0, 0, 0, 0, 0, 0, NULL, NULL};
+
+// Should the prologue of programs be executed when they are loaded or
+// assembled? See runPrologue.
+static int shouldRunPrologue = 0;
+
+// Should source files be loaded without assembling them? The instructions
+// of a lazy program are assembled when they are used, see compileLazy.
+static int shouldLoadLazy = 0;
+static LazyCells lazyProgram = {NULL, NULL, NULL};
+
+// Executed addresses of the runs. The bitmap is kept when a program is
+// loaded again, so the runs of a program with different input add up.
+static Coverage coverage = {NULL};
+
 static void displayTrace(void);
 static void displayError(Error rval);
+static void displayUsage(void);
+static Error coverageLines(SourceHash *lines);
+static Error patchCell(unsigned int address, MemCell *cell);
+static Error optimizeProgram(Image *image, OptReport *report, OutputFunc output);
+static Error prologueProgram(Image *image, OutputFunc output);
+static Error placeStack(Image *image, OutputFunc output);
 
 #define FLAGTOCHAR(x) x == 1 ? 'X' : '_'
 
-/** Initialize the runtime with the program
+/** Initialize the runtime with the program. The file is either assembly
+ *  source or an image written by rntAssemble, which is loaded as is. The
+ *  stack of a source file is moved above the program when it would
+ *  overwrite it, see analyzeStack; an image was placed when it was written.
  *
  * @retval ERR_OpeningFile	Source file could not be opened
  * @retval ERR_ReadingFile	Error getting line from file
+ * @retval ERR_InvalidImage	Corrupt image or image of another version
  * @retval ERR_OutOfMemory	Malloc failed
  */
 Error rntInit(char filename[], FuncNumInp numInp, FuncNumOut numOut, OutputFunc output)
 {
-	Error	rval;
-	FILE	*source = NULL;
-	Memory	*mem = NULL;
+	Error		rval;
+	Memory		*mem = NULL;
+	Image		image;
+	ProcInfo	info;
 
 	// Set debug (console) output function
 	consoleOut = output;
+	setLazyCells(NULL);
+	freeLazy(&lazyProgram);
 
-	// Open file
-	source = fopen(filename, "r");
-	if(!source)
+	if(isImageFile(filename))
 	{
-		return ERR_OpeningFile;
-	}
+		// Load the compiled program
+		rval = mapImage(filename, &image);
+		if(rval != ERR_None)
+		{
+			return rval;
+		}
 
-	// Compile file
-	rval = compile(source, &mem, consoleOut);
-	fclose(source);
-	if(rval != ERR_None)
+		rval = loadImage(&mem, &image);
+		freeImage(&image);
+		if(rval != ERR_None)
+		{
+			freeMemList(mem);
+			return rval;
+		}
+
+		sourceFile[0] = '\0';
+	}
+	else
 	{
-		return rval;
+		SourceHash	hash = {0, NULL};
+		unsigned int	changed = 0;
+
+		image.entry = 0;
+		image.stackPointer = STACK_START;
+		image.regA = 0;
+		image.regB = 0;
+		image.flags = 0;
+
+		// Compile file. The optimizer and the prologue need the whole
+		// program, so then it is never loaded lazily. A lazy program keeps
+		// the default stack, sizing it would assemble all of the code.
+		if(shouldLoadLazy && !shouldOptimize && !shouldRunPrologue)
+		{
+			rval = compileLazy(filename, &mem, &lazyProgram, consoleOut);
+
+			// A file that was assembled completely after all
+			if(rval == ERR_None && lazyProgram.context == NULL)
+			{
+				rval = recompileFile(filename, &hash, NULL, consoleOut, &changed);
+			}
+		}
+		else
+		{
+			rval = compileFileImage(filename, &image, &hash, consoleOut);
+			if(rval == ERR_None)
+			{
+				freeOptReport(&optReport);
+				rval = shouldOptimize ? optimizeProgram(&image, &optReport, consoleOut) : rval;
+				rval = rval == ERR_None && shouldRunPrologue
+					? prologueProgram(&image, consoleOut) : rval;
+				rval = rval == ERR_None ? placeStack(&image, consoleOut) : rval;
+				rval = rval == ERR_None ? loadImage(&mem, &image) : rval;
+				freeImage(&image);
+			}
+		}
+		if(rval != ERR_None)
+		{
+			freeSourceHash(&hash);
+			freeMemList(mem);
+			return rval;
+		}
+
+		// Remember the lines, so a reload only assembles the changed ones.
+		// They were hashed by the compiler; a lazy program keeps its
+		// source, it is hashed at the reload.
+		strncpy(sourceFile, filename, FILENAME_MAX - 1);
+		sourceFile[FILENAME_MAX - 1] = '\0';
+		freeSourceHash(&sourceHash);
+		sourceHash = hash;
 	}
 
 	// Initialize processer with the compiled 'memory'
 	rval = InitProcessor(mem, numInp, numOut);
 	if(rval != ERR_None)
 	{
+		freeLazy(&lazyProgram);
 		return rval;
 	}
+	if(lazyProgram.context != NULL)
+	{
+		setLazyCells(&lazyProgram);
+	}
+
+	info = getStatus();
+	info.progCounter = image.entry;
+	info.regA = image.regA;
+	info.regB = image.regB;
+	info.flagZ = (image.flags & IMAGE_FLAG_Z) != 0;
+	info.flagO = (image.flags & IMAGE_FLAG_O) != 0;
+	info.flagN = (image.flags & IMAGE_FLAG_N) != 0;
+	setStatus(info);
+	setStackPointer(image.stackPointer);
 
 	consoleOut("Runtime initialized!\n");
 	rntDisplayStatus();
@@ -60,12 +181,164 @@ Error rntInit(char filename[], FuncNumInp numInp, FuncNumOut numOut, OutputFunc
 	return ERR_None;
 }
 
+/** Compile a source file and write the program to an image file, that can
+ *  be loaded by rntInit without compiling it again. The stack is placed
+ *  now, so loading the image does not analyze it again.
+ *
+ * @retval ERR_OpeningFile	A file could not be opened
+ * @retval ERR_ReadingFile	Error getting line from file
+ * @retval ERR_WritingFile	Error writing the image
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error rntAssemble(char source[], char target[], OutputFunc output)
+{
+	Error	rval;
+	Image	image;
+
+	rval = compileFileImage(source, &image, NULL, output);
+	if(rval != ERR_None)
+	{
+		return rval;
+	}
+
+	if(shouldOptimize)
+	{
+		OptReport report;
+
+		rval = optimizeProgram(&image, &report, output);
+		freeOptReport(&report);
+	}
+
+	rval = rval == ERR_None && shouldRunPrologue ? prologueProgram(&image, output) : rval;
+	rval = rval == ERR_None ? placeStack(&image, output) : rval;
+	rval = rval == ERR_None ? writeImage(target, &image) : rval;
+	freeImage(&image);
+
+	return rval;
+}
+
+/** Link modules with labels into an image file. Modules are only assembled
+ *  when their source changed since the last link, see linkModules. The
+ *  stack is placed like rntAssemble does.
+ *
+ * @retval ERR_OpeningFile	A file could not be opened
+ * @retval ERR_ReadingFile	Error reading a source file
+ * @retval ERR_WritingFile	Error writing the image
+ * @retval ERR_InvalidInstr	A module has an error
+ * @retval ERR_UndefinedSymbol	A label is not defined
+ * @retval ERR_DuplicateSymbol	Two modules define the same global label
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error rntLink(char *sources[], unsigned int count, char target[], OutputFunc output)
+{
+	Error	rval;
+	Image	image;
+
+	rval = linkModules(sources, count, &image, output);
+	if(rval != ERR_None)
+	{
+		return rval;
+	}
+
+	if(shouldOptimize)
+	{
+		OptReport report;
+
+		rval = optimizeProgram(&image, &report, output);
+		freeOptReport(&report);
+	}
+
+	rval = rval == ERR_None && shouldRunPrologue ? prologueProgram(&image, output) : rval;
+	rval = rval == ERR_None ? placeStack(&image, output) : rval;
+	rval = rval == ERR_None ? writeImage(target, &image) : rval;
+	freeImage(&image);
+
+	return rval;
+}
+
 void rntDeInit(void)
 {
+	if(isExecTracing())
+	{
+		rntTraceStop();
+	}
 	DeInitProcessor();
+	setLazyCells(NULL);
+	freeLazy(&lazyProgram);
+	freeSourceHash(&sourceHash);
+	freeOptReport(&optReport);
+	sourceFile[0] = '\0';
 	consoleOut = NULL;
 }
 
+/** Load the changes of the source file in the running program. Only lines
+ *  that changed since the last (re)load are assembled and written to the
+ *  memory, cells of removed lines are cleared. Registers, other memory and
+ *  breakpoints are kept. The optimizations of the program are undone first,
+ *  because the changed lines can make them invalid.
+ *
+ * @retval ERR_InvalidState	The program was not loaded from a source file
+ * @retval ERR_OpeningFile	Source file could not be opened
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error rntReload(void)
+{
+	Error		rval = ERR_None;
+	unsigned int	changed = 0,
+			i = 0;
+	char		buff[MAXOUTLEN];
+
+	if(sourceFile[0] == '\0')
+	{
+		consoleOut("Program was not loaded from a source file\n");
+		return ERR_InvalidState;
+	}
+
+	for(i = 0; i < optReport.numChanges && rval == ERR_None; i++)
+	{
+		OptChange *change = &optReport.changes[i];
+
+		// Unless it was changed after the program was loaded
+		if(readMemory(change->address).getal == change->after.getal)
+		{
+			rval = patchCell(change->address, &change->before);
+		}
+	}
+	freeOptReport(&optReport);
+
+	// The lines of a lazy program that were not used yet are assembled
+	// from the source it was loaded from, before the file is compared
+	if(rval == ERR_None && lazyProgram.context != NULL)
+	{
+		freeSourceHash(&sourceHash);
+		rval = loadMemoryRange(0, UINT_MAX);
+		rval = rval == ERR_None ? hashLazySource(&lazyProgram, &sourceHash) : rval;
+		if(rval == ERR_None)
+		{
+			setLazyCells(NULL);
+			freeLazy(&lazyProgram);
+		}
+	}
+
+	if(rval == ERR_None)
+	{
+		rval = recompileFile(sourceFile, &sourceHash, patchCell, consoleOut, &changed);
+	}
+	if(rval != ERR_None)
+	{
+		consoleOut("Error reloading the program\n");
+		return rval;
+	}
+
+	sprintf(buff, "Reloaded, %u lines changed\n", changed);
+	consoleOut(buff);
+
+	// Next instruction could have changed
+	rntDisplayStatus();
+
+	return ERR_None;
+}
+
 /** Display registers, flags and the next instruction in the console */
 void rntDisplayStatus(void)
 {
@@ -127,10 +400,7 @@ Error rntRun(void)
 
 	enableTrace();
 
-	do
-	{
-		rval = executeNextInstr();
-	} while(rval == ERR_None);
+	rval = runProgram();
 
 	// The only thing that can interrupt a running program is a breakpoint.
 	// Or the "error" ERR_EndOfProgram. Other values are REAL errors.
@@ -177,12 +447,73 @@ static void displayError(Error rval)
 	case ERR_OutOfMemory:
 		consoleOut("CRITICAL: PseudoAsm out of memory!\n");
 		break;
+	case ERR_InstrLimit:
+		consoleOut("==> Stopped: instruction limit reached.\n");
+		displayUsage();
+		break;
+	case ERR_TimeLimit:
+		consoleOut("==> Stopped: time limit reached.\n");
+		displayUsage();
+		break;
+	case ERR_MemoryLimit:
+		consoleOut("==> Stopped: memory limit reached.\n");
+		displayUsage();
+		break;
+	case ERR_NonTerminating:
+		consoleOut("==> Stopped: program state repeats, it will never terminate.\n");
+		displayUsage();
+		break;
 	default:
 		consoleOut("Unknown error\n");
 		break;
 	}
 }
 
+/** Display the resources used by the last run */
+static void displayUsage(void)
+{
+	char		buff[MAXOUTLEN];
+	RunUsage	used = getRunUsage();
+	ProcInfo	info = getStatus();
+
+	sprintf(buff, "  Usage: %lu instructions, %lu ms, %u memory cells, PC: %d\n",
+		used.instructions, used.millis, used.cells, info.progCounter);
+	consoleOut(buff);
+}
+
+/** Private function: the addresses of the lines of the source file. The
+ *  lines of a lazy program are hashed from the source it keeps.
+ *
+ * @param [out] lines		Free with freeSourceHash
+ * @retval ERR_InvalidState	The program was not assembled from a source file
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error coverageLines(SourceHash *lines)
+{
+	SourceLine *copy = NULL;
+
+	if(sourceFile[0] == '\0')
+	{
+		return ERR_InvalidState;
+	}
+
+	if(lazyProgram.context != NULL)
+	{
+		return hashLazySource(&lazyProgram, lines);
+	}
+
+	copy = (SourceLine*) malloc(sourceHash.count * sizeof(SourceLine) + 1);
+	if(copy == NULL)
+	{
+		return ERR_OutOfMemory;
+	}
+	memcpy(copy, sourceHash.lines, sourceHash.count * sizeof(SourceLine));
+	lines->count = sourceHash.count;
+	lines->lines = copy;
+
+	return ERR_None;
+}
+
 static void displayTrace(void)
 {
 	NumberList	**trace = NULL;
@@ -271,6 +602,64 @@ Error rntFlyAsm(unsigned int address, char *cmd)
 	return ERR_None;
 }
 
+/** Display the disassembly of the memory from one address up to and
+ *  including another
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error rntList(unsigned int from, unsigned int to)
+{
+	Listing	listing;
+	Error	rval;
+
+	rval = loadMemoryRange(from, to);
+	rval = rval == ERR_None ? listMemory(getMemoryList(), from, to, &listing) : rval;
+	if(rval != ERR_None)
+	{
+		displayError(rval);
+		return rval;
+	}
+
+	if(listing.length == 0)
+	{
+		consoleOut("  No memory in use in this range\n");
+	}
+	else
+	{
+		consoleOut(listing.text);
+	}
+	freeListing(&listing);
+
+	return ERR_None;
+}
+
+/** Write the memory from one address up to and including another as
+ *  source, that assembles to the same cells
+ *
+ * @retval ERR_OpeningFile	The file could not be created
+ * @retval ERR_WritingFile	The file could not be written
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error rntExport(char filename[], unsigned int from, unsigned int to)
+{
+	char	buff[MAXOUTLEN + FILENAME_MAX];
+	Error	rval;
+
+	rval = loadMemoryRange(from, to);
+	rval = rval == ERR_None ? exportMemory(getMemoryList(), from, to, filename) : rval;
+	if(rval == ERR_None)
+	{
+		sprintf(buff, "  Memory written to %s\n", filename);
+	}
+	else
+	{
+		sprintf(buff, "Error writing %s (%d)\n", filename, rval);
+	}
+	consoleOut(buff);
+
+	return rval;
+}
+
 //
 // BREAKPOINTS
 //
@@ -334,6 +723,496 @@ void rntDelBp(int address)
 	}
 }
 
+//
+// RESOURCE LIMITS
+//
+
+void rntSetLimits(unsigned long maxInstr, unsigned long maxMillis, unsigned int maxCells)
+{
+	RunLimits limits;
+
+	limits.maxInstr = maxInstr;
+	limits.maxMillis = maxMillis;
+	limits.maxCells = maxCells;
+
+	setRunLimits(limits);
+}
+
+void rntListLimits(void)
+{
+	char		buff[MAXOUTLEN];
+	RunLimits	limits = getRunLimits();
+
+	consoleOut("Limits (0 is unlimited):\n");
+	sprintf(buff, "  Instructions: %lu\n", limits.maxInstr);
+	consoleOut(buff);
+	sprintf(buff, "  Time (ms):    %lu\n", limits.maxMillis);
+	consoleOut(buff);
+	sprintf(buff, "  Memory cells: %u\n", limits.maxCells);
+	consoleOut(buff);
+}
+
+/** Execute the prologue of the programs that are loaded or assembled after
+ *  this call, until their first input or output, see runPrologue */
+void rntPrologue(int enable)
+{
+	shouldRunPrologue = enable;
+}
+
+/** Load the source files that are opened after this call lazily: the
+ *  instructions are assembled when the program uses them. This does not
+ *  apply when programs are optimized. */
+void rntLazy(int enable)
+{
+	shouldLoadLazy = enable;
+}
+
+/** Optimize the programs that are loaded or assembled after this call */
+void rntOptimize(int enable)
+{
+	shouldOptimize = enable;
+}
+
+void rntDetectLoops(int enable)
+{
+	detectLoops(enable);
+}
+
+void rntFastForward(int enable)
+{
+	fastForwardLoops(enable);
+}
+
+void rntMemoize(int enable)
+{
+	memoizeCalls(enable);
+}
+
+void rntMemoStats(void)
+{
+	char		buff[MAXOUTLEN];
+	MemoStats	stats = memoGetStats();
+
+	consoleOut("Subroutine memoization:\n");
+	sprintf(buff, "  Calls:              %lu\n", stats.calls);
+	consoleOut(buff);
+	sprintf(buff, "  Replayed:           %lu (%.1f%%)\n", stats.hits,
+		stats.calls ? 100.0 * stats.hits / stats.calls : 0.0);
+	consoleOut(buff);
+	sprintf(buff, "  Recorded:           %lu\n", stats.stored);
+	consoleOut(buff);
+	sprintf(buff, "  Instructions saved: %lu\n", stats.instrSaved);
+	consoleOut(buff);
+}
+
+/** Display the counters of the work the processor did, and the speed of
+ *  the last run */
+void rntStats(void)
+{
+	static const char *modes[4] = {"immediate", "direct", "indirect", "indexed"};
+	char		buff[MAXOUTLEN];
+	ProcStats	stats;
+	int		op = 0,
+			mode = 0;
+
+	getProcStats(&stats);
+
+	consoleOut("Statistics:\n");
+	sprintf(buff, "  Instructions:      %lu executed, %lu skipped\n",
+		stats.executed, stats.skipped);
+	consoleOut(buff);
+	sprintf(buff, "  Last run:          %lu instructions, %.3f s, %.2f MIPS\n",
+		stats.lastInstructions, stats.lastSeconds,
+		stats.lastSeconds > 0 ? stats.lastInstructions / stats.lastSeconds / 1e6 : 0.0);
+	consoleOut(buff);
+	sprintf(buff, "  Memory:            %lu reads, %lu writes, %u cells\n",
+		stats.reads, stats.writes, stats.cells);
+	consoleOut(buff);
+	sprintf(buff, "  Longest walk:      %u cells\n", stats.longestWalk);
+	consoleOut(buff);
+	sprintf(buff, "  Breakpoint checks: %lu\n", stats.bpChecks);
+	consoleOut(buff);
+	sprintf(buff, "  Input/output:      %lu/%lu\n", stats.inputs, stats.outputs);
+	consoleOut(buff);
+	consoleOut("  Executed by instruction:\n");
+
+	for(op = 0; op < 64; op++)
+	{
+		for(mode = 0; mode < 4; mode++)
+		{
+			Instruction	instr;
+			char		name[MAXINSTRLEN + 1],
+					*end = NULL;
+
+			if(stats.byInstr[op][mode] == 0)
+			{
+				continue;
+			}
+
+			instr.operator = op;
+			instr.adressering = mode;
+			instr.operand = 0;
+			end = appendInstr(name, instr);
+			if(end == NULL)
+			{
+				sprintf(buff, "    opcode %2d, %-9s %lu\n", op, modes[mode],
+					stats.byInstr[op][mode]);
+			}
+			else
+			{
+				// Only instructions with an operand have an addressing method
+				name[3] = '\0';
+				sprintf(buff, "    %s %-9s     %lu\n", name, end - name > 3 ? modes[mode] : "",
+					stats.byInstr[op][mode]);
+			}
+			consoleOut(buff);
+		}
+	}
+}
+
+/** Reset the counters of rntStats */
+void rntResetStats(void)
+{
+	resetProcStats();
+}
+
+/** Enable or disable the profile of the runs. Enabling it starts a new
+ *  profile, while it is enabled loops are not fast-forwarded and calls are
+ *  not replayed. */
+void rntProfile(int enable)
+{
+	if(profileInstructions(enable) != ERR_None)
+	{
+		consoleOut("Error: out of memory for the profile\n");
+	}
+}
+
+/** Display the most executed addresses with their instruction, and the
+ *  instructions per subroutine */
+void rntProfileReport(unsigned int count)
+{
+	char		buff[MAXOUTLEN],
+			instr[MAXINSTRLEN + 1];
+	ProfAddress	*hottest = NULL;
+	ProfRoutine	*routines = NULL;
+	unsigned long	total = profileTotal();
+	unsigned int	maxHottest = 0,
+			numHottest = 0,
+			numRoutines = 0,
+			i = 0;
+
+	if(total == 0)
+	{
+		consoleOut("  No instructions were profiled, enable it with profile on\n");
+		return;
+	}
+
+	// No more addresses can be found than were executed
+	maxHottest = profileAddresses();
+	maxHottest = count < maxHottest ? count : maxHottest;
+
+	hottest = (ProfAddress*) malloc(((size_t)maxHottest + 1) * sizeof(ProfAddress));
+	if(hottest == NULL || profileRoutines(&routines, &numRoutines) != ERR_None)
+	{
+		free(hottest);
+		consoleOut("Error: out of memory for the profile\n");
+		return;
+	}
+	numHottest = profileHottest(hottest, maxHottest);
+
+	sprintf(buff, "Profile of %lu instructions:\n", total);
+	consoleOut(buff);
+	consoleOut("     Address       Count      %  Instruction\n");
+	for(i = 0; i < numHottest; i++)
+	{
+		if(instToStr(readMemory(hottest[i].address).instructie, instr) != ERR_None)
+		{
+			strcpy(instr, "?");
+		}
+		sprintf(buff, "  %10u %11lu %5.1f%%  %s\n", hottest[i].address,
+			hottest[i].count, 100.0 * hottest[i].count / total, instr);
+		consoleOut(buff);
+	}
+
+	consoleOut("  Subroutine       Calls   Inclusive      %   Exclusive      %\n");
+	for(i = 0; i < numRoutines && i < count; i++)
+	{
+		char name[16];
+
+		// The code outside subroutines is never called
+		if(routines[i].calls == 0)
+		{
+			strcpy(name, "program");
+		}
+		else
+		{
+			sprintf(name, "%u", routines[i].entry);
+		}
+		sprintf(buff, "  %10s %11lu %11lu %5.1f%% %11lu %5.1f%%\n", name,
+			routines[i].calls, routines[i].inclusive,
+			100.0 * routines[i].inclusive / total, routines[i].exclusive,
+			100.0 * routines[i].exclusive / total);
+		consoleOut(buff);
+	}
+
+	free(hottest);
+	free(routines);
+}
+
+/** Record the addresses executed by the next runs, or stop recording them.
+ *  The executed addresses are kept until rntCoverageReset. */
+void rntCoverage(int enable)
+{
+	if(enable && coverage.bits == NULL && initCoverage(&coverage) != ERR_None)
+	{
+		consoleOut("Error: out of memory for the coverage\n");
+		return;
+	}
+
+	coverInstructions(enable ? &coverage : NULL);
+}
+
+/** Forget the executed addresses */
+void rntCoverageReset(void)
+{
+	if(coverage.bits != NULL)
+	{
+		clearCoverage(&coverage);
+	}
+}
+
+/** Display how many instruction lines of the source were executed */
+void rntCoverageReport(void)
+{
+	char		buff[MAXOUTLEN];
+	SourceHash	lines = {0, NULL};
+	LineCoverage	result;
+	Error		rval = ERR_None;
+
+	if(coverage.bits == NULL)
+	{
+		consoleOut("  No coverage was recorded, enable it with coverage on\n");
+		return;
+	}
+
+	rval = coverageLines(&lines);
+	rval = rval == ERR_None ? writeLcov(NULL, sourceFile, &lines, &coverage, &result) : rval;
+	freeSourceHash(&lines);
+	if(rval != ERR_None)
+	{
+		consoleOut("Error: the source of the program can not be read\n");
+		return;
+	}
+
+	sprintf(buff, "Coverage: %u of %u instruction lines executed (%.1f%%)\n",
+		result.hit, result.found, result.found ? 100.0 * result.hit / result.found : 0.0);
+	consoleOut(buff);
+}
+
+/** Write the executed addresses to a file, that can be merged in later
+ *
+ * @retval ERR_InvalidState	No coverage was recorded
+ * @retval ERR_OpeningFile	The file could not be created
+ * @retval ERR_WritingFile	The file could not be written
+ */
+Error rntCoverageSave(char filename[])
+{
+	char	buff[MAXOUTLEN + FILENAME_MAX];
+	Error	rval = ERR_InvalidState;
+
+	if(coverage.bits != NULL)
+	{
+		rval = writeCoverage(filename, &coverage);
+	}
+
+	if(rval == ERR_None)
+	{
+		sprintf(buff, "  Coverage written to %s\n", filename);
+	}
+	else
+	{
+		sprintf(buff, "Error writing %s (%d)\n", filename, rval);
+	}
+	consoleOut(buff);
+
+	return rval;
+}
+
+/** Add the executed addresses saved in a file by rntCoverageSave
+ *
+ * @retval ERR_OpeningFile	The file could not be opened
+ * @retval ERR_ReadingFile	The file could not be read
+ * @retval ERR_InvalidImage	The file is not a coverage file
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error rntCoverageMerge(char filename[])
+{
+	char	buff[MAXOUTLEN + FILENAME_MAX];
+	Error	rval = ERR_None;
+
+	if(coverage.bits == NULL)
+	{
+		rval = initCoverage(&coverage);
+	}
+	rval = rval == ERR_None ? mergeCoverageFile(filename, &coverage) : rval;
+
+	if(rval == ERR_None)
+	{
+		sprintf(buff, "  Coverage of %s merged\n", filename);
+	}
+	else
+	{
+		sprintf(buff, "Error reading %s (%d)\n", filename, rval);
+	}
+	consoleOut(buff);
+
+	return rval;
+}
+
+/** Write the coverage of the lines of the source file in the lcov format
+ *
+ * @retval ERR_InvalidState	No coverage was recorded, or no source file
+ * @retval ERR_OpeningFile	A file could not be opened
+ * @retval ERR_WritingFile	The file could not be written
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error rntCoverageLcov(char filename[])
+{
+	char		buff[MAXOUTLEN + FILENAME_MAX];
+	SourceHash	lines = {0, NULL};
+	LineCoverage	result;
+	FILE		*fp = NULL;
+	Error		rval = ERR_InvalidState;
+
+	if(coverage.bits != NULL)
+	{
+		rval = coverageLines(&lines);
+	}
+
+	if(rval == ERR_None)
+	{
+		fp = fopen(filename, "w");
+		rval = fp == NULL ? ERR_OpeningFile : writeLcov(fp, sourceFile, &lines, &coverage, &result);
+		if(fp != NULL && fclose(fp) != 0 && rval == ERR_None)
+		{
+			rval = ERR_WritingFile;
+		}
+	}
+	freeSourceHash(&lines);
+
+	if(rval == ERR_None)
+	{
+		sprintf(buff, "  Coverage of %u of %u lines written to %s\n",
+			result.hit, result.found, filename);
+	}
+	else
+	{
+		sprintf(buff, "Error writing %s (%d)\n", filename, rval);
+	}
+	consoleOut(buff);
+
+	return rval;
+}
+
+/** Write the call stacks of the profile to a file, in the folded format of
+ *  flame graph tools
+ *
+ * @retval ERR_OpeningFile	The file could not be created
+ * @retval ERR_WritingFile	The file could not be written
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error rntProfileSave(char filename[])
+{
+	char	buff[MAXOUTLEN + FILENAME_MAX];
+	FILE	*fp = NULL;
+	Error	rval = ERR_None;
+
+	fp = fopen(filename, "w");
+	if(fp == NULL)
+	{
+		rval = ERR_OpeningFile;
+	}
+	else
+	{
+		rval = profileWriteFolded(fp);
+		if(fclose(fp) != 0 && rval == ERR_None)
+		{
+			rval = ERR_WritingFile;
+		}
+	}
+
+	if(rval == ERR_None)
+	{
+		sprintf(buff, "  Folded stacks written to %s\n", filename);
+	}
+	else
+	{
+		sprintf(buff, "Error writing %s (%d)\n", filename, rval);
+	}
+	consoleOut(buff);
+
+	return rval;
+}
+
+/** Write every instruction the next runs and steps execute to a trace
+ *  file, until rntTraceStop. See exectrace.c for the format.
+ *
+ * @retval ERR_InvalidState	A trace is being written already
+ * @retval ERR_OpeningFile	The file could not be created
+ * @retval ERR_WritingFile	The file could not be written
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error rntTrace(char filename[])
+{
+	char	buff[MAXOUTLEN + FILENAME_MAX];
+	Error	rval = startExecTrace(filename);
+
+	if(rval == ERR_None)
+	{
+		sprintf(buff, "  Tracing to %s\n", filename);
+	}
+	else if(rval == ERR_InvalidState)
+	{
+		sprintf(buff, "Error: a trace is being written already\n");
+	}
+	else
+	{
+		sprintf(buff, "Error writing %s (%d)\n", filename, rval);
+	}
+	consoleOut(buff);
+
+	return rval;
+}
+
+/** Close the trace file of rntTrace
+ *
+ * @retval ERR_InvalidState	No trace is being written
+ * @retval ERR_WritingFile	The file could not be written
+ */
+Error rntTraceStop(void)
+{
+	char		buff[MAXOUTLEN];
+	TraceStats	stats;
+	Error		rval = stopExecTrace(&stats);
+
+	if(rval == ERR_None)
+	{
+		sprintf(buff, "  Traced %lu instructions in %lu bytes\n",
+			stats.records, stats.bytes);
+	}
+	else if(rval == ERR_InvalidState)
+	{
+		sprintf(buff, "  No trace is being written\n");
+	}
+	else
+	{
+		sprintf(buff, "Error writing the trace (%d), it is incomplete\n", rval);
+	}
+	consoleOut(buff);
+
+	return rval;
+}
+
 void rntSetStack(int pointer)
 {
 	setStackPointer(pointer);
@@ -349,3 +1228,127 @@ void rntStackTrace(int shouldTrace)
 	traceStack(shouldTrace);
 }
 
+/** Private function: write the new cell of a changed line, or clear the
+ *  cell of a removed line */
+static Error patchCell(unsigned int address, MemCell *cell)
+{
+	if(cell == NULL)
+	{
+		clearMemory(address);
+		return ERR_None;
+	}
+
+	return writeMemory(address, *cell);
+}
+
+/** Private function: optimize an assembled program and display what changed */
+static Error optimizeProgram(Image *image, OptReport *report, OutputFunc output)
+{
+	Error		rval = ERR_None;
+	unsigned int	i = 0;
+	char		buff[2 * MAXOUTLEN],
+			before[21],
+			after[21];
+
+	rval = optimizeImage(image, report);
+	if(rval != ERR_None)
+	{
+		return rval;
+	}
+
+	if(report->skipReason != NULL)
+	{
+		sprintf(buff, "  Not optimized: %s.\n", report->skipReason);
+		output(buff);
+		return ERR_None;
+	}
+
+	sprintf(buff, "  Optimized: %u loads removed, %u loads simplified, %u constants folded,"
+		" %u unused instructions removed, %u NOPs skipped, %u jumps threaded\n",
+		report->removed, report->simplified, report->folded, report->dead,
+		report->skipped, report->threaded);
+	output(buff);
+
+	for(i = 0; i < report->numChanges; i++)
+	{
+		OptChange *change = &report->changes[i];
+
+		if(instToStr(change->before.instructie, before) != ERR_None)
+		{
+			strcpy(before, "???");
+		}
+		if(instToStr(change->after.instructie, after) != ERR_None)
+		{
+			strcpy(after, "???");
+		}
+
+		sprintf(buff, "    %6u: %-16s => %s\n", change->address, before, after);
+		output(buff);
+	}
+
+	return ERR_None;
+}
+
+/** Private function: execute the prologue of an assembled program and
+ *  display where the program starts now */
+static Error prologueProgram(Image *image, OutputFunc output)
+{
+	PrologueReport	report;
+	Error		rval = ERR_None;
+	char		buff[2 * MAXOUTLEN];
+
+	rval = runPrologue(image, PROLOGUE_MAXINSTR, &report);
+	if(rval != ERR_None)
+	{
+		return rval;
+	}
+
+	if(report.skipReason != NULL)
+	{
+		sprintf(buff, "  Prologue not executed: %s.\n", report.skipReason);
+	}
+	else
+	{
+		sprintf(buff, "  Prologue: %lu instructions executed, the program starts at %u"
+			" (%s).\n", report.executed, image->entry, report.stopReason);
+	}
+	output(buff);
+
+	return ERR_None;
+}
+
+/** Private function: find how deep the stack of a program gets, and move
+ *  the stack above the program when it would overwrite it. A stack that
+ *  already holds return addresses, because the prologue stopped in a
+ *  subroutine, is not moved.
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error placeStack(Image *image, OutputFunc output)
+{
+	StackReport	report;
+	Error		rval = ERR_None;
+	char		buff[2 * MAXOUTLEN];
+
+	rval = analyzeStack(image, &report);
+	if(rval != ERR_None)
+	{
+		return rval;
+	}
+
+	if(!report.isBounded)
+	{
+		sprintf(buff, "  WARNING: no bound on the depth of the stack was found (%s),"
+			" it may overwrite the program.\n", report.reason);
+		output(buff);
+	}
+	else if(report.stackPointer != image->stackPointer && image->stackPointer == STACK_START)
+	{
+		sprintf(buff, "  Stack moved to %u: it holds %u cells at most, and the program"
+			" uses cells up to %u.\n", report.stackPointer, report.depth, report.highestUsed);
+		output(buff);
+		image->stackPointer = report.stackPointer;
+	}
+
+	return ERR_None;
+}
@@ -7,6 +7,15 @@
 /* Initialise the runtime */
 Error rntInit(char filename[], FuncNumInp numInp, FuncNumOut numOut, OutputFunc output);
 
+/* Compile a source file to an image that rntInit loads without compiling */
+Error rntAssemble(char source[], char target[], OutputFunc output);
+
+/* Link modules with labels into an image, assembling only changed modules */
+Error rntLink(char *sources[], unsigned int count, char target[], OutputFunc output);
+
+/* Assemble the changed lines of the source file into the running program */
+Error rntReload(void);
+
 /* Deinit */
 void rntDeInit(void);
 
@@ -35,6 +44,83 @@ void rntDelBp(int address);
 /* Parse an instruction and save it to memory */
 Error rntFlyAsm(unsigned int address, char *cmd);
 
+/* Display the disassembly of a range of memory */
+Error rntList(unsigned int from, unsigned int to);
+
+/* Write a range of memory as source to a file */
+Error rntExport(char filename[], unsigned int from, unsigned int to);
+
+
+/* Set the resource limits of a run, 0 means no limit */
+void rntSetLimits(unsigned long maxInstr, unsigned long maxMillis, unsigned int maxCells);
+
+/* List the current resource limits */
+void rntListLimits(void);
+
+/* Optimize the programs that are loaded or assembled after this call */
+void rntOptimize(int enable);
+
+/* Execute the prologue of the programs that are loaded or assembled */
+void rntPrologue(int enable);
+
+/* Assemble the instructions of the programs that are opened when they are used */
+void rntLazy(int enable);
+
+/* Stop a run when the program is in an infinite loop */
+void rntDetectLoops(int enable);
+
+/* Skip the iterations of counted loops */
+void rntFastForward(int enable);
+
+/* Replay subroutine calls instead of executing them again */
+void rntMemoize(int enable);
+
+/* Display hit rate and saved instructions of the memoization */
+void rntMemoStats(void);
+
+
+/* Display the counters of the work done by the processor */
+void rntStats(void);
+
+/* Reset the counters of rntStats */
+void rntResetStats(void);
+
+
+/* Count the executions of every address and subroutine in the next runs */
+void rntProfile(int enable);
+
+/* Display the most executed addresses and the instructions per subroutine */
+void rntProfileReport(unsigned int count);
+
+/* Write the call stacks of the profile for flame graph tools */
+Error rntProfileSave(char filename[]);
+
+
+/* Record the addresses executed by the next runs */
+void rntCoverage(int enable);
+
+/* Forget the executed addresses */
+void rntCoverageReset(void);
+
+/* Display how many instruction lines of the source were executed */
+void rntCoverageReport(void);
+
+/* Write the executed addresses to a file */
+Error rntCoverageSave(char filename[]);
+
+/* Add the executed addresses saved in a file */
+Error rntCoverageMerge(char filename[]);
+
+/* Write the coverage of the source lines in the lcov format */
+Error rntCoverageLcov(char filename[]);
+
+
+/* Write every executed instruction to a trace file */
+Error rntTrace(char filename[]);
+
+/* Close the trace file */
+Error rntTraceStop(void);
+
 
 /* Set the stack pointer */
 void rntSetStack(int pointer);
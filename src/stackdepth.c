@@ -0,0 +1,525 @@
+/**
+ * Static analysis of the depth of the stack.
+ *
+ * Only JSB pushes a cell on the stack, and only RTS pops one. The control
+ * flow graph (see cfg.c) is split in subroutines: the entry point and every
+ * block that is called by a JSB start one, and a subroutine holds the blocks
+ * it reaches without following a JSB or RTS. After a JSB it continues at the
+ * block after the JSB. The calls between the subroutines are the call graph,
+ * and the longest path through it from the entry point is the depth of the
+ * stack.
+ *
+ * A subroutine that calls itself, directly or through others, can only be
+ * bounded when the program reads no input: then every run is the same, and
+ * the program is executed once to measure the depth (see measureStack). A
+ * program with a JSB that stores into its own code can call code the graph
+ * does not know, so it gets no bound. Indirect stores are not followed.
+ *
+ * The stack grows down from the stack pointer. When a cell of the image, or
+ * a cell the code addresses directly, lies where the stack grows, the stack
+ * is moved above the highest of those cells.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include "hardware.h"
+#include "image.h"
+#include "cfg.h"
+#include "prologue.h"
+#include "stackdepth.h"
+
+/** All cells of the program, sorted on address */
+typedef struct Program
+{
+	ImageCell	*cells;
+	size_t		count;
+} Program;
+
+/** Addresses the code uses as data, sorted */
+typedef struct UsedCells
+{
+	unsigned int	*addresses;
+	size_t		count;
+} UsedCells;
+
+/** A JSB from one subroutine to another, to is CFG_NONE when the called
+ *  address is not part of the program */
+typedef struct Call
+{
+	unsigned int	from;
+	unsigned int	to;
+} Call;
+
+static ImageCell *findCell(Program *prog, unsigned int address);
+static int fetchCell(void *context, unsigned int address, MemCell *cell);
+static Error findUsed(Program *prog, Cfg *cfg, UsedCells *used, StackReport *report,
+	int *changesCode);
+static Error findDepth(Cfg *cfg, StackReport *report, int *isRecursive);
+static Error findCalls(Cfg *cfg, unsigned int *routineOf, unsigned int *routines,
+	unsigned int numRoutines, Call **calls, unsigned int *firstCall);
+static unsigned int returnBlock(Cfg *cfg, CfgBlock *block);
+static int readsInput(Cfg *cfg);
+static int hasCall(Cfg *cfg);
+static int collides(Program *prog, UsedCells *used, unsigned int low, unsigned int high);
+static int compareUnsigned(const void *a, const void *b);
+
+/** Find the number of cells a program pushes on the stack at most, and
+ *  where the stack has to start so it does not overwrite the program. The
+ *  image is not changed.
+ *
+ * @param [in] image		Assembled or mapped image
+ * @param [out] report		Depth and place of the stack. When no bound
+ *				was found, the stack pointer of the image is
+ *				kept and report->reason says why.
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+Error analyzeStack(Image *image, StackReport *report)
+{
+	Program		prog = {NULL, 0};
+	UsedCells	used = {NULL, 0};
+	Cfg		cfg;
+	int		changesCode = 0,
+			isRecursive = 0;
+	unsigned int	pointer = image->stackPointer;
+	Error		rval = ERR_None;
+
+	assert(image != NULL && report != NULL);
+
+	report->isBounded = 1;
+	report->depth = 0;
+	report->numRoutines = 0;
+	report->highestUsed = 0;
+	report->stackPointer = pointer;
+	report->reason = NULL;
+
+	memset(&cfg, 0, sizeof(Cfg));
+	rval = flattenImage(image, &prog.cells, &prog.count);
+	if(rval == ERR_None)
+	{
+		rval = buildCfg(fetchCell, &prog, image->entry, &cfg);
+		if(rval != ERR_None)
+		{
+			free(prog.cells);
+			return rval;
+		}
+
+		rval = findUsed(&prog, &cfg, &used, report, &changesCode);
+	}
+
+	// Code that changes itself only matters when it can change a call
+	if(rval == ERR_None && changesCode && hasCall(&cfg))
+	{
+		report->isBounded = 0;
+		report->reason = "the program changes its own code";
+	}
+	else if(rval == ERR_None && cfg.numBlocks > 0)
+	{
+		rval = findDepth(&cfg, report, &isRecursive);
+	}
+
+	if(rval == ERR_None && isRecursive)
+	{
+		report->isBounded = 0;
+		if(readsInput(&cfg))
+		{
+			report->reason = "a subroutine calls itself, and the program reads input";
+		}
+		else
+		{
+			rval = measureStack(image, PROLOGUE_MAXINSTR, &report->depth,
+				&report->isBounded);
+			report->reason = report->isBounded ? NULL
+				: "a subroutine calls itself, and the program does not stop";
+		}
+	}
+
+	// Move the stack above the program when they would overlap
+	if(rval == ERR_None && report->isBounded && report->depth > 0
+		&& collides(&prog, &used, pointer > report->depth ? pointer - report->depth : 0,
+			pointer - 1)
+		&& report->highestUsed < UINT_MAX - report->depth)
+	{
+		report->stackPointer = report->highestUsed + 1 + report->depth;
+	}
+
+	free(prog.cells);
+	free(used.addresses);
+	freeCfg(&cfg);
+
+	return rval;
+}
+
+/** Private function: find the cell of an address, NULL if it is not in the image */
+static ImageCell *findCell(Program *prog, unsigned int address)
+{
+	return findImageCell(prog->cells, prog->count, address);
+}
+
+/** Private function: read a cell of the program for the control flow graph */
+static int fetchCell(void *context, unsigned int address, MemCell *cell)
+{
+	ImageCell *found = findCell((Program*) context, address);
+
+	if(found == NULL)
+	{
+		return 0;
+	}
+
+	*cell = found->value;
+	return 1;
+}
+
+/** Private function: list the cells the code loads or stores directly, or
+ *  uses as pointer, and find the highest address the program uses. Sets
+ *  changesCode when the code stores into an instruction.
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error findUsed(Program *prog, Cfg *cfg, UsedCells *used, StackReport *report,
+	int *changesCode)
+{
+	unsigned int	b = 0,
+			j = 0;
+
+	used->addresses = (unsigned int*) malloc(cfg->numCode * sizeof(unsigned int) + 1);
+	if(used->addresses == NULL)
+	{
+		return ERR_OutOfMemory;
+	}
+
+	report->highestUsed = prog->count > 0 ? prog->cells[prog->count - 1].address : 0;
+
+	for(b = 0; b < cfg->numBlocks; b++)
+	{
+		CfgBlock *block = &cfg->blocks[b];
+
+		for(j = 0; j < block->length; j++)
+		{
+			Instruction instr = cfg->code[block->first + j].instructie;
+
+			switch(instr.operator)
+			{
+			case A_STA:
+			case A_STB:
+				if(instr.adressering == DIRECT
+					&& cfgFindBlock(cfg, instr.operand) != CFG_NONE)
+				{
+					*changesCode = 1;
+				}
+				// Fall through
+			case A_LDA:
+			case A_LDB:
+				if(instr.adressering == DIRECT || instr.adressering == INDIRECT)
+				{
+					used->addresses[used->count++] = instr.operand;
+					if(instr.operand > report->highestUsed)
+					{
+						report->highestUsed = instr.operand;
+					}
+				}
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+	qsort(used->addresses, used->count, sizeof(unsigned int), compareUnsigned);
+
+	return ERR_None;
+}
+
+/** Private function: split the graph in subroutines, and find the longest
+ *  path of calls from the entry point. Sets isRecursive when a subroutine
+ *  on that path calls itself, then the depth is not known.
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error findDepth(Cfg *cfg, StackReport *report, int *isRecursive)
+{
+	unsigned int	*routineOf = NULL,
+			*routines = NULL,
+			*firstCall = NULL,
+			*depth = NULL,
+			*nextCall = NULL,
+			*stack = NULL,
+			numRoutines = 0,
+			top = 0,
+			b = 0;
+	unsigned char	*state = NULL;
+	Call		*calls = NULL;
+	Error		rval = ERR_None;
+
+	routineOf = (unsigned int*) malloc(cfg->numBlocks * sizeof(unsigned int));
+	routines = (unsigned int*) malloc(cfg->numBlocks * sizeof(unsigned int));
+	if(routineOf == NULL || routines == NULL)
+	{
+		free(routineOf);
+		free(routines);
+		return ERR_OutOfMemory;
+	}
+
+	// The entry point is the first subroutine, then every called block
+	for(b = 0; b < cfg->numBlocks; b++)
+	{
+		routineOf[b] = CFG_NONE;
+	}
+	routineOf[cfg->entry] = numRoutines;
+	routines[numRoutines++] = cfg->entry;
+
+	for(b = 0; b < cfg->numBlocks; b++)
+	{
+		unsigned int callee = cfg->blocks[b].callee;
+
+		if(callee != CFG_NONE && routineOf[callee] == CFG_NONE)
+		{
+			routineOf[callee] = numRoutines;
+			routines[numRoutines++] = callee;
+		}
+	}
+	report->numRoutines = numRoutines;
+
+	firstCall = (unsigned int*) malloc((numRoutines + 1) * sizeof(unsigned int));
+	depth = (unsigned int*) calloc(numRoutines, sizeof(unsigned int));
+	nextCall = (unsigned int*) malloc(numRoutines * sizeof(unsigned int));
+	stack = (unsigned int*) malloc(numRoutines * sizeof(unsigned int));
+	state = (unsigned char*) calloc(numRoutines, 1);
+	rval = firstCall == NULL || depth == NULL || nextCall == NULL || stack == NULL
+		|| state == NULL ? ERR_OutOfMemory
+		: findCalls(cfg, routineOf, routines, numRoutines, &calls, firstCall);
+
+	// Depth first through the call graph. State 1 is on the stack, 2 done.
+	if(rval == ERR_None)
+	{
+		memcpy(nextCall, firstCall, numRoutines * sizeof(unsigned int));
+		stack[top++] = 0;
+		state[0] = 1;
+	}
+
+	while(rval == ERR_None && top > 0)
+	{
+		unsigned int r = stack[top - 1];
+
+		if(nextCall[r] < firstCall[r + 1])
+		{
+			unsigned int to = calls[nextCall[r]++].to;
+
+			if(to == CFG_NONE)
+			{
+				// Pushes the return address, then fails
+				depth[r] = depth[r] > 1 ? depth[r] : 1;
+			}
+			else if(state[to] == 0)
+			{
+				state[to] = 1;
+				stack[top++] = to;
+			}
+			else if(state[to] == 1)
+			{
+				*isRecursive = 1;
+			}
+			else if(depth[to] + 1 > depth[r])
+			{
+				depth[r] = depth[to] + 1;
+			}
+			continue;
+		}
+
+		state[r] = 2;
+		top--;
+		if(top > 0 && depth[r] + 1 > depth[stack[top - 1]])
+		{
+			depth[stack[top - 1]] = depth[r] + 1;
+		}
+	}
+
+	if(rval == ERR_None)
+	{
+		report->depth = depth[0];
+	}
+
+	free(routineOf);
+	free(routines);
+	free(firstCall);
+	free(depth);
+	free(nextCall);
+	free(stack);
+	free(state);
+	free(calls);
+
+	return rval;
+}
+
+/** Private function: find the JSBs of every subroutine. The calls of
+ *  subroutine r are calls[firstCall[r]] up to calls[firstCall[r + 1]].
+ *
+ * @retval ERR_OutOfMemory	Malloc failed
+ */
+static Error findCalls(Cfg *cfg, unsigned int *routineOf, unsigned int *routines,
+	unsigned int numRoutines, Call **calls, unsigned int *firstCall)
+{
+	unsigned int	*seen = NULL,
+			*todo = NULL,
+			numCalls = 0,
+			size = 0,
+			top = 0,
+			r = 0,
+			b = 0,
+			k = 0;
+
+	seen = (unsigned int*) malloc(cfg->numBlocks * sizeof(unsigned int));
+	todo = (unsigned int*) malloc(cfg->numBlocks * sizeof(unsigned int));
+	if(seen == NULL || todo == NULL)
+	{
+		free(seen);
+		free(todo);
+		return ERR_OutOfMemory;
+	}
+
+	for(b = 0; b < cfg->numBlocks; b++)
+	{
+		seen[b] = CFG_NONE;
+	}
+
+	*calls = NULL;
+	for(r = 0; r < numRoutines; r++)
+	{
+		firstCall[r] = numCalls;
+		seen[routines[r]] = r;
+		todo[top++] = routines[r];
+
+		while(top > 0)
+		{
+			CfgBlock	*block = &cfg->blocks[todo[--top]];
+			unsigned int	next[1],
+					*succ = &cfg->succ[block->firstSucc],
+					numSucc = block->numSucc;
+
+			if(block->end == CFG_CALL)
+			{
+				if(numCalls == size)
+				{
+					Call *bigger = NULL;
+
+					size = size ? 2 * size : 64;
+					bigger = (Call*) realloc(*calls, size * sizeof(Call));
+					if(bigger == NULL)
+					{
+						free(seen);
+						free(todo);
+						return ERR_OutOfMemory;
+					}
+					*calls = bigger;
+				}
+
+				(*calls)[numCalls].from = r;
+				(*calls)[numCalls].to = block->callee == CFG_NONE
+					? CFG_NONE : routineOf[block->callee];
+				numCalls++;
+
+				// The subroutine continues after the JSB
+				next[0] = returnBlock(cfg, block);
+				succ = next;
+				numSucc = next[0] != CFG_NONE;
+			}
+			else if(block->end == CFG_RETURN)
+			{
+				numSucc = 0;
+			}
+
+			for(k = 0; k < numSucc; k++)
+			{
+				if(seen[succ[k]] != r)
+				{
+					seen[succ[k]] = r;
+					todo[top++] = succ[k];
+				}
+			}
+		}
+	}
+	firstCall[numRoutines] = numCalls;
+
+	free(seen);
+	free(todo);
+
+	return ERR_None;
+}
+
+/** Private function: the block an RTS returns to after a JSB block,
+ *  CFG_NONE if the address after the JSB is not part of the program */
+static unsigned int returnBlock(Cfg *cfg, CfgBlock *block)
+{
+	unsigned int	address = block->start + block->length,
+			index = cfgFindBlock(cfg, address);
+
+	return index != CFG_NONE && cfg->blocks[index].start == address ? index : CFG_NONE;
+}
+
+/** Private function: can the program execute an INP? */
+static int readsInput(Cfg *cfg)
+{
+	unsigned int i = 0;
+
+	for(i = 0; i < cfg->numCode; i++)
+	{
+		if(cfg->code[i].instructie.operator == A_INP)
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/** Private function: does the program have a JSB? */
+static int hasCall(Cfg *cfg)
+{
+	unsigned int b = 0;
+
+	for(b = 0; b < cfg->numBlocks; b++)
+	{
+		if(cfg->blocks[b].end == CFG_CALL)
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/** Private function: is a cell from low up to and including high part of the
+ *  image, or used by the code? */
+static int collides(Program *prog, UsedCells *used, unsigned int low, unsigned int high)
+{
+	size_t	lowCell = firstImageCell(prog->cells, prog->count, low),
+		lowUsed = 0,
+		highUsed = used->count,
+		mid = 0;
+
+	// First used address from low
+	while(lowUsed < highUsed)
+	{
+		mid = (lowUsed + highUsed) / 2;
+		if(used->addresses[mid] < low)
+		{
+			lowUsed = mid + 1;
+		}
+		else
+		{
+			highUsed = mid;
+		}
+	}
+
+	return (lowCell < prog->count && prog->cells[lowCell].address <= high)
+		|| (lowUsed < used->count && used->addresses[lowUsed] <= high);
+}
+
+/** Private function: order addresses */
+static int compareUnsigned(const void *a, const void *b)
+{
+	unsigned int	x = *(const unsigned int*) a,
+			y = *(const unsigned int*) b;
+
+	return x < y ? -1 : x > y;
+}
@@ -0,0 +1,28 @@
+#ifndef _PSEUDOASM_INC_STACKDEPTH_H_
+#define _PSEUDOASM_INC_STACKDEPTH_H_
+
+#include "errors.h"
+#include "hardware.h"
+#include "image.h"
+
+/** How deep the stack of a program gets, and where it can start */
+typedef struct StackReport
+{
+	/** Was a bound on the depth found? If not, reason says why */
+	int isBounded;
+	/** Cells the stack holds at most */
+	unsigned int depth;
+	/** Subroutines the program calls */
+	unsigned int numRoutines;
+	/** Highest address of the image, or of a cell the code addresses */
+	unsigned int highestUsed;
+	/** Stack pointer at the start, moved when the stack would overwrite
+	 *  a cell the program uses */
+	unsigned int stackPointer;
+	const char *reason;
+} StackReport;
+
+/* Find the depth of the stack of a program, and a place for the stack */
+Error analyzeStack(Image *image, StackReport *report);
+
+#endif // _PSEUDOASM_INC_STACKDEPTH_H_
@@ -1,5 +1,7 @@
+#define _POSIX_C_SOURCE 199309L
 #include "util.h"
 #include <ctype.h>
+#include <time.h>
 
 /** Convert a string to lowercase */
 char * strtolower(char input[])
@@ -13,3 +15,52 @@ char * strtolower(char input[])
 
 	return input;
 }
+
+/** Monotonic wall clock time in seconds */
+double getWallTime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/** Write a number in decimal, like sprintf's %u. The string is terminated.
+ *
+ * @return The end of the string, where the terminating 0 is
+ */
+char *formatUnsigned(char *string, unsigned int value)
+{
+	char	digits[10];
+	int	count = 0;
+
+	do
+	{
+		digits[count++] = (char)('0' + value % 10);
+		value /= 10;
+	} while(value > 0);
+
+	while(count > 0)
+	{
+		*string++ = digits[--count];
+	}
+	*string = '\0';
+
+	return string;
+}
+
+/** Write a signed number in decimal, like sprintf's %d
+ *
+ * @return The end of the string, where the terminating 0 is
+ */
+char *formatInt(char *string, int value)
+{
+	if(value < 0)
+	{
+		*string++ = '-';
+		return formatUnsigned(string, 0u - (unsigned int)value);
+	}
+
+	return formatUnsigned(string, (unsigned int)value);
+}
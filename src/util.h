@@ -11,4 +11,13 @@
 /* Convert a string to lowercase */
 char * strtolower(char input[]);
 
+/* Wall clock time in seconds, only useful to measure intervals */
+double getWallTime(void);
+
+/* Write a number in decimal, returns the end of the string */
+char *formatUnsigned(char *string, unsigned int value);
+
+/* Write a signed number in decimal, returns the end of the string */
+char *formatInt(char *string, int value);
+
 #endif // _PSEUDOASM_INC_UTIL_H_
@@ -0,0 +1,211 @@
+/**
+ * Decode a trace file written by the trace command of the console, or by
+ * the --trace option of pseudoasm-workload, see src/exectrace.c.
+ *
+ * Build it from the root of the repository with "make pseudoasm-tracedump".
+ * It uses all sources except the console interface, so it needs no GTK.
+ *
+ * Usage: pseudoasm-tracedump [options] file
+ * Every executed instruction is written as a line with its number in the
+ * trace, its address, the instruction, the memory cell it wrote or read
+ * last, and the registers and flags it changed. The options select the
+ * instructions that are written:
+ *   --from address	instructions at this address or above
+ *   --to address	instructions at this address or below
+ *   --op mnemonic	instructions with this mnemonic, like LDA or JSB
+ *   --addr address	instructions that wrote or read this memory cell
+ *   --writes		instructions that wrote to memory
+ *   --limit n		at most n instructions
+ *   --count		only the number of selected instructions
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include "hardware.h"
+#include "errors.h"
+#include "parser.h"
+#include "exectrace.h"
+
+/** Instructions that are written */
+typedef struct Filter
+{
+	unsigned int	from;
+	unsigned int	to;
+	const char	*mnemonic;
+	int		hasAddress;
+	unsigned int	address;
+	int		onlyWrites;
+	unsigned long	limit;
+} Filter;
+
+static int isSelected(Filter *filter, TraceRecord *record, const char *instr);
+static void printRecord(unsigned long index, TraceRecord *record, const char *instr);
+static void usage(void);
+
+int main(int argc, char *argv[])
+{
+	Filter		filter = {0, UINT_MAX, NULL, 0, 0, 0, ULONG_MAX};
+	TraceReader	*reader = NULL;
+	TraceRecord	record;
+	const char	*filename = NULL;
+	char		instr[MAXINSTRLEN + 1];
+	unsigned long	index = 0,
+			selected = 0;
+	int		onlyCount = 0,
+			i = 0;
+	Error		rval = ERR_None;
+
+	for(i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "--from") == 0 && i + 1 < argc)
+		{
+			filter.from = strtoul(argv[++i], NULL, 0);
+		}
+		else if(strcmp(argv[i], "--to") == 0 && i + 1 < argc)
+		{
+			filter.to = strtoul(argv[++i], NULL, 0);
+		}
+		else if(strcmp(argv[i], "--op") == 0 && i + 1 < argc)
+		{
+			filter.mnemonic = argv[++i];
+		}
+		else if(strcmp(argv[i], "--addr") == 0 && i + 1 < argc)
+		{
+			filter.hasAddress = 1;
+			filter.address = strtoul(argv[++i], NULL, 0);
+		}
+		else if(strcmp(argv[i], "--writes") == 0)
+		{
+			filter.onlyWrites = 1;
+		}
+		else if(strcmp(argv[i], "--limit") == 0 && i + 1 < argc)
+		{
+			filter.limit = strtoul(argv[++i], NULL, 0);
+		}
+		else if(strcmp(argv[i], "--count") == 0)
+		{
+			onlyCount = 1;
+		}
+		else if(strncmp(argv[i], "--", 2) == 0 || filename != NULL)
+		{
+			usage();
+			return 2;
+		}
+		else
+		{
+			filename = argv[i];
+		}
+	}
+
+	if(filename == NULL)
+	{
+		usage();
+		return 2;
+	}
+
+	rval = openTraceReader(filename, &reader);
+	if(rval != ERR_None)
+	{
+		fprintf(stderr, "Cannot read trace %s (%d)\n", filename, rval);
+		return 1;
+	}
+
+	while(selected < filter.limit
+		&& (rval = readTraceRecord(reader, &record)) == ERR_None)
+	{
+		if(instToStr(record.instr, instr) != ERR_None)
+		{
+			strcpy(instr, "???");
+		}
+
+		if(isSelected(&filter, &record, instr))
+		{
+			selected++;
+			if(!onlyCount)
+			{
+				printRecord(index, &record, instr);
+			}
+		}
+		index++;
+	}
+	closeTraceReader(reader);
+
+	if(onlyCount)
+	{
+		printf("%lu\n", selected);
+	}
+
+	if(rval != ERR_None && rval != ERR_EndOfProgram)
+	{
+		fprintf(stderr, "Trace %s is corrupt or cut off after %lu instructions (%d)\n",
+			filename, index, rval);
+		return 1;
+	}
+
+	return 0;
+}
+
+/** Should the instruction be written? */
+static int isSelected(Filter *filter, TraceRecord *record, const char *instr)
+{
+	size_t length = 0;
+
+	if(record->progCounter < filter->from || record->progCounter > filter->to)
+	{
+		return 0;
+	}
+
+	if(filter->mnemonic != NULL)
+	{
+		length = strlen(filter->mnemonic);
+		if(strncasecmp(instr, filter->mnemonic, length) != 0
+			|| (instr[length] != '\0' && instr[length] != ' '))
+		{
+			return 0;
+		}
+	}
+
+	if(filter->hasAddress && (!record->hasAddress || record->address != filter->address))
+	{
+		return 0;
+	}
+
+	return !filter->onlyWrites || record->hasWrite;
+}
+
+/** Write an instruction of the trace as a line */
+static void printRecord(unsigned long index, TraceRecord *record, const char *instr)
+{
+	printf("%10lu  %08u  %-14s", index, record->progCounter, instr);
+
+	if(record->hasWrite)
+	{
+		printf("  [%u] = %d", record->address, record->value);
+	}
+	else if(record->hasAddress)
+	{
+		printf("  [%u]", record->address);
+	}
+
+	if(record->changed & TRACE_RegA)
+	{
+		printf("  A=%d", record->regA);
+	}
+	if(record->changed & TRACE_RegB)
+	{
+		printf("  B=%d", record->regB);
+	}
+	if(record->changed & TRACE_Flags)
+	{
+		printf("  Z=%d O=%d N=%d", record->flagZ, record->flagO, record->flagN);
+	}
+	printf("\n");
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: pseudoasm-tracedump [--from address] [--to address] [--op mnemonic]\n"
+		"         [--addr address] [--writes] [--limit n] [--count] file\n");
+}